@@ -26,148 +26,450 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <stdio.h>
-#include <xf86drm.h>
-#include <xcb/dri2.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
 
 
 #include "nv50/nv50_context.h"
 
+#include "drm_open.h"
+
 #undef NDEBUG
 #include <assert.h>
 
-/* From pipe_loader_drm.c in mesa */
-static void
-pipe_loader_drm_x_auth(int fd)
-{
-   /* Try authenticate with the X server to give us access to devices that X
-    * is running on. */
-   xcb_connection_t *xcb_conn;
-   const xcb_setup_t *xcb_setup;
-   xcb_screen_iterator_t s;
-   xcb_dri2_connect_cookie_t connect_cookie;
-   xcb_dri2_connect_reply_t *connect;
-   drm_magic_t magic;
-   xcb_dri2_authenticate_cookie_t authenticate_cookie;
-   xcb_dri2_authenticate_reply_t *authenticate;
-
-   xcb_conn = xcb_connect(NULL,  NULL);
-
-   if(!xcb_conn)
-      return;
-
-   xcb_setup = xcb_get_setup(xcb_conn);
-
-  if (!xcb_setup)
-    goto disconnect;
-
-   s = xcb_setup_roots_iterator(xcb_setup);
-   connect_cookie = xcb_dri2_connect_unchecked(xcb_conn, s.data->root,
-                                               XCB_DRI2_DRIVER_TYPE_DRI);
-   connect = xcb_dri2_connect_reply(xcb_conn, connect_cookie, NULL);
-
-   if (!connect || connect->driver_name_length
-                   + connect->device_name_length == 0) {
+static uint64_t
+now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 
-      goto disconnect;
-   }
+/* What the benchmarks need from a device. The stand-in device (-n)
+ * interprets the same method stream on the CPU, with a model of the
+ * semaphore methods only, so that the harness can be checked without a
+ * card. */
+enum { SUBC_BSP = 1, SUBC_VP = 2, SUBC_M2MF = 4 };
+
+struct bench_dev {
+  void (*begin)(struct bench_dev *dev, int subc, int mthd, int size);
+  void (*data)(struct bench_dev *dev, uint32_t data);
+  void (*kick)(struct bench_dev *dev);
+  void (*wait)(struct bench_dev *dev); /* until everything kicked is done */
+
+  uint32_t handle[8]; /* object for each subchannel */
+  uint32_t vram, gart, sync;
+  uint64_t sem_offset;
+  volatile uint32_t *sem;
+};
+
+struct nouveau_bench_dev {
+  struct bench_dev base;
+  struct nouveau_client *client;
+  struct nouveau_pushbuf *push;
+  struct nouveau_bo *sem;
+};
 
-   if (drmGetMagic(fd, &magic))
-      goto disconnect;
+static void
+nv_begin(struct bench_dev *dev, int subc, int mthd, int size) {
+  BEGIN_NV04(((struct nouveau_bench_dev *)dev)->push, subc, mthd, size);
+}
 
-   authenticate_cookie = xcb_dri2_authenticate_unchecked(xcb_conn,
-                                                         s.data->root,
-                                                         magic);
-   authenticate = xcb_dri2_authenticate_reply(xcb_conn,
-                                              authenticate_cookie,
-                                              NULL);
-   FREE(authenticate);
+static void
+nv_data(struct bench_dev *dev, uint32_t data) {
+  PUSH_DATA(((struct nouveau_bench_dev *)dev)->push, data);
+}
 
-disconnect:
-   xcb_disconnect(xcb_conn);
+static void
+nv_kick(struct bench_dev *dev) {
+  PUSH_KICK(((struct nouveau_bench_dev *)dev)->push);
 }
 
+static void
+nv_wait(struct bench_dev *dev) {
+  struct nouveau_bench_dev *nv = (struct nouveau_bench_dev *)dev;
+  assert(!nouveau_bo_wait(nv->sem, NOUVEAU_BO_RDWR, nv->client));
+}
 
-int main() {
+static struct bench_dev *
+nouveau_bench_dev_new(uint32_t pushbuf_size) {
+  struct nouveau_bench_dev *nv = calloc(1, sizeof(*nv));
   struct nouveau_device *dev;
-  struct nouveau_client *client;
-  struct nouveau_object *channel;
-  struct nouveau_object *bsp;
-  struct nouveau_pushbuf *push;
-  struct nouveau_bo *sem = NULL;
+  struct nouveau_object *channel, *bsp, *vp, *m2mf, *sync;
+  struct nouveau_bufctx *bufctx;
   struct nv04_fifo nv04_data = { .vram = 0xbeef0201, .gart = 0xbeef0202 };
+  struct drm_open_info drm;
+  uint64_t start, channel_ns;
+  int fd;
 
-  int fd, i;
-
-  fd = open("/dev/dri/card0", O_RDWR);
-  assert(fd);
-  pipe_loader_drm_x_auth(fd);
+  fd = drm_open_nouveau(&drm);
+  assert(fd >= 0);
 
+  start = now_ns();
   assert(!nouveau_device_wrap(fd, 0, &dev));
-  assert(!nouveau_client_new(dev, &client));
+  assert(!nouveau_client_new(dev, &nv->client));
   assert(!nouveau_object_new(&dev->object, 0, NOUVEAU_FIFO_CHANNEL_CLASS,
                              &nv04_data, sizeof(nv04_data), &channel));
-  assert(!nouveau_pushbuf_new(client, channel, 2, 4096, 1, &push));
+  assert(!nouveau_pushbuf_new(nv->client, channel, 2, pushbuf_size, 1, &nv->push));
+  channel_ns = now_ns() - start;
+  start = now_ns();
   assert(!nouveau_object_new(channel, 0xbeef74b0, 0x74b0, NULL, 0, &bsp));
-  assert(!nouveau_bo_new(dev, NOUVEAU_BO_VRAM, 0, 0x1000, NULL, &sem));
+  assert(!nouveau_object_new(channel, 0xbeef7476, 0x7476, NULL, 0, &vp));
+  assert(!nouveau_object_new(channel, 0xbeef5039, 0x5039, NULL, 0, &m2mf));
+  assert(!nouveau_object_new(channel, 0xbeef0301, NOUVEAU_NOTIFIER_CLASS,
+                             &(struct nv04_notify){ .length = 32 },
+                             sizeof(struct nv04_notify), &sync));
+
+  assert(!nouveau_bo_new(dev, NOUVEAU_BO_VRAM, 0, 0x1000, NULL, &nv->sem));
+  assert(!nouveau_bo_map(nv->sem, NOUVEAU_BO_RD | NOUVEAU_BO_WR, nv->client));
+
+  /* So that nouveau_bo_wait on it waits for the last kick */
+  assert(!nouveau_bufctx_new(nv->client, 1, &bufctx));
+  nouveau_pushbuf_bufctx(nv->push, bufctx);
+  nouveau_bufctx_refn(bufctx, 0, nv->sem, NOUVEAU_BO_VRAM | NOUVEAU_BO_RDWR);
+
+  printf("%s (%s): open %.2f ms, auth %.2f ms, channel %.2f ms, objects %.2f ms\n",
+         drm.path, drm.render_node ? "render node" :
+         drm.authenticated == 1 ? "master" : drm.authenticated ? "X auth" : "unauthenticated",
+         drm.open_ns / 1e6, drm.auth_ns / 1e6, channel_ns / 1e6,
+         (now_ns() - start) / 1e6);
+  printf("bo offset: %llx\n", nv->sem->offset);
+  printf("bo handle: %x\n", nv->sem->handle);
+  printf("bo map: %p\n", nv->sem->map);
+
+  nv->base.begin = nv_begin;
+  nv->base.data = nv_data;
+  nv->base.kick = nv_kick;
+  nv->base.wait = nv_wait;
+  nv->base.handle[SUBC_BSP] = bsp->handle;
+  nv->base.handle[SUBC_VP] = vp->handle;
+  nv->base.handle[SUBC_M2MF] = m2mf->handle;
+  nv->base.vram = nv04_data.vram;
+  nv->base.gart = nv04_data.gart;
+  nv->base.sync = sync->handle;
+  nv->base.sem_offset = nv->sem->offset;
+  nv->base.sem = nv->sem->map;
+  return &nv->base;
+}
+
+/* Queues methods like a pushbuf (flushing when full) and runs them on
+ * kick. Only binds and the semaphore methods do anything; an acquire
+ * that the real thing would block on is an assertion failure. */
+struct null_bench_dev {
+  struct bench_dev base;
+  uint32_t *buf;
+  unsigned size, count;
+  uint32_t sem_mem[0x1000 / 4];
+  uint32_t bound[8];
+  uint64_t sem_addr[8];
+  uint32_t sem_value[8];
+};
+
+#define NULL_SEM_OFFSET 0x20000000ULL
+
+static volatile uint32_t *
+null_sem(struct null_bench_dev *null, uint64_t addr) {
+  assert(addr >= NULL_SEM_OFFSET &&
+         addr + 4 <= NULL_SEM_OFFSET + sizeof(null->sem_mem));
+  return &null->sem_mem[(addr - NULL_SEM_OFFSET) / 4];
+}
+
+static void
+null_method(struct null_bench_dev *null, int subc, int mthd, uint32_t data) {
+  /* Methods from 0x100 up go to the object bound to subc */
+  assert(mthd < 0x100 || null->bound[subc]);
+  switch (mthd) {
+  case 0x0000:
+    null->bound[subc] = data;
+    break;
+  case 0x0010: /* channel semaphore */
+  case 0x0610: /* engine semaphore */
+    null->sem_addr[subc] = (null->sem_addr[subc] & 0xffffffff) | (uint64_t)data << 32;
+    break;
+  case 0x0014:
+  case 0x0614:
+    null->sem_addr[subc] = (null->sem_addr[subc] & ~0xffffffffULL) | data;
+    break;
+  case 0x0018:
+  case 0x0618:
+    null->sem_value[subc] = data;
+    break;
+  case 0x001c:
+    if (data == 1)
+      assert(*null_sem(null, null->sem_addr[subc]) == null->sem_value[subc]);
+    else if (data == 2)
+      *null_sem(null, null->sem_addr[subc]) = null->sem_value[subc];
+    else
+      assert(0);
+    break;
+  case 0x0304:
+    assert(subc == SUBC_BSP || subc == SUBC_VP);
+    assert(null->bound[subc]);
+    *null_sem(null, null->sem_addr[subc]) = null->sem_value[subc];
+    break;
+  }
+}
+
+static void
+null_kick(struct bench_dev *dev) {
+  struct null_bench_dev *null = (struct null_bench_dev *)dev;
+  unsigned i = 0, j;
+
+  while (i < null->count) {
+    uint32_t hdr = null->buf[i++];
+    int mthd = hdr & 0x1ffc, subc = (hdr >> 13) & 7, size = (hdr >> 18) & 0x7ff;
+
+    assert(i + size <= null->count);
+    for (j = 0; j < size; j++)
+      null_method(null, subc, mthd + 4 * j, null->buf[i++]);
+  }
+  null->count = 0;
+}
+
+static void
+null_begin(struct bench_dev *dev, int subc, int mthd, int size) {
+  struct null_bench_dev *null = (struct null_bench_dev *)dev;
+
+  assert(size + 1 <= null->size);
+  if (null->count + size + 1 > null->size)
+    null_kick(dev);
+  null->buf[null->count++] = size << 18 | subc << 13 | mthd;
+}
 
-  printf("bo offset: %lx\n", sem->offset);
-  printf("bo handle: %x\n", sem->handle);
+static void
+null_data(struct bench_dev *dev, uint32_t data) {
+  struct null_bench_dev *null = (struct null_bench_dev *)dev;
+  null->buf[null->count++] = data;
+}
 
-  assert(!nouveau_bo_map(sem, NOUVEAU_BO_RD | NOUVEAU_BO_WR, client));
+static void
+null_wait(struct bench_dev *dev) {
+}
 
-  /*
-  struct nouveau_pushbuf_refn refs[] = {
-    { sem, NOUVEAU_BO_RDWR }
-  };
-  assert(!nouveau_pushbuf_refn(push, refs, 1));
-  */
+static struct bench_dev *
+null_bench_dev_new(uint32_t pushbuf_size) {
+  struct null_bench_dev *null = calloc(1, sizeof(*null));
+
+  null->size = pushbuf_size / 4;
+  null->buf = calloc(null->size, 4);
+  null->base.begin = null_begin;
+  null->base.data = null_data;
+  null->base.kick = null_kick;
+  null->base.wait = null_wait;
+  null->base.handle[SUBC_BSP] = 0xbeef74b0;
+  null->base.handle[SUBC_VP] = 0xbeef7476;
+  null->base.handle[SUBC_M2MF] = 0xbeef5039;
+  null->base.vram = 0xbeef0201;
+  null->base.gart = 0xbeef0202;
+  null->base.sync = 0xbeef0301;
+  null->base.sem_offset = NULL_SEM_OFFSET;
+  null->base.sem = null->sem_mem;
+  return &null->base;
+}
 
-  printf("bo map: %p\n", sem->map);
+static void
+bind(struct bench_dev *dev, int subc) {
+  dev->begin(dev, subc, 0, 1);
+  dev->data(dev, dev->handle[subc]);
+}
 
-  uint32_t *map = sem->map;
-  *map = 0xdeadbeef;
+static void
+setup(struct bench_dev *dev) {
+  int i;
 
-  BEGIN_NV04(push, 0, 0x60, 1);
-  PUSH_DATA (push, nv04_data.vram);
+  dev->begin(dev, 0, 0x60, 1);
+  dev->data(dev, dev->vram);
 
-  /* Bind the BSP to the fifo */
-  BEGIN_NV04(push, 1, 0, 1);
-  PUSH_DATA (push, bsp->handle);
+  bind(dev, SUBC_BSP);
+  bind(dev, SUBC_VP);
+  bind(dev, SUBC_M2MF);
 
   /* Set the DMA channels */
-  BEGIN_NV04(push, 1, 0x180, 11);
+  dev->begin(dev, SUBC_BSP, 0x180, 11);
   for (i = 0; i < 11; i++)
-    PUSH_DATA(push, nv04_data.vram);
+    dev->data(dev, dev->vram);
+  dev->begin(dev, SUBC_BSP, 0x1b8, 1);
+  dev->data(dev, dev->vram);
 
-  BEGIN_NV04(push, 1, 0x1b8, 1);
-  PUSH_DATA (push, nv04_data.vram);
+  dev->begin(dev, SUBC_VP, 0x180, 11);
+  for (i = 0; i < 11; i++)
+    dev->data(dev, dev->vram);
+  dev->begin(dev, SUBC_VP, 0x1b8, 1);
+  dev->data(dev, dev->vram);
+
+  dev->begin(dev, SUBC_M2MF, 0x180, 3);
+  dev->data(dev, dev->sync);
+  for (i = 0; i < 2; i++)
+    dev->data(dev, dev->gart);
 
-  /* Set the semaphore */
-  BEGIN_NV04(push, 1, 0x610, 3);
-  PUSH_DATAh(push, sem->offset);
-  PUSH_DATA (push, sem->offset);
-  PUSH_DATA (push, 0xabce);
+  dev->kick(dev);
+}
 
-  /* Write abce to the semaphore location */
-  BEGIN_NV04(push, 1, 0x304, 1);
-  PUSH_DATA (push, 0x101);
+/* BSP and VP write semaphores with their own methods, M2MF goes through
+ * the channel's. */
+static void
+release(struct bench_dev *dev, int subc, uint32_t value) {
+  if (subc == SUBC_M2MF) {
+    dev->begin(dev, subc, 0x10, 4);
+    dev->data(dev, dev->sem_offset >> 32);
+    dev->data(dev, dev->sem_offset);
+    dev->data(dev, value);
+    dev->data(dev, 2); /* write long */
+    return;
+  }
+
+  dev->begin(dev, subc, 0x610, 3);
+  dev->data(dev, dev->sem_offset >> 32);
+  dev->data(dev, dev->sem_offset);
+  dev->data(dev, value);
+  dev->begin(dev, subc, 0x304, 1);
+  dev->data(dev, 0x101);
+}
 
-  BEGIN_NV04(push, 1, 0x80, 1);
-  PUSH_DATA (push, 0);
-  PUSH_KICK (push);
+static void
+acquire(struct bench_dev *dev, int subc, uint32_t value) {
+  dev->begin(dev, subc, 0x10, 4);
+  dev->data(dev, dev->sem_offset >> 32);
+  dev->data(dev, dev->sem_offset);
+  dev->data(dev, value);
+  dev->data(dev, 1); /* wait for equal */
+}
 
-  /* Wait for abce to come out */
-  BEGIN_NV04(push, 4, 0x10, 4);
-  PUSH_DATAh(push, sem->offset);
-  PUSH_DATA (push, sem->offset);
-  PUSH_DATA (push, 0xabce);
-  PUSH_DATA (push, 1); /* Wait for equal */
-  PUSH_KICK (push);
+/* The CPU side of a round trip: spin on the mapping */
+static void
+spin_for(struct bench_dev *dev, uint32_t value) {
+  uint64_t start = now_ns();
 
-  nouveau_bo_wait(sem, NOUVEAU_BO_RDWR, client);
+  while (*dev->sem != value)
+    assert(now_ns() - start < 1000000000ULL);
+}
+
+static int
+cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void
+report(const char *name, uint64_t *samples, unsigned n) {
+  qsort(samples, n, sizeof(*samples), cmp_u64);
+  printf("%-14s %7u  min %9.2f  median %9.2f  p99 %9.2f us\n", name, n,
+         samples[0] / 1000.0, samples[n / 2] / 1000.0,
+         samples[(uint64_t)n * 99 / 100] / 1000.0);
+}
+
+static const char *subc_name[8] = {
+  [SUBC_BSP] = "bsp", [SUBC_VP] = "vp", [SUBC_M2MF] = "m2mf",
+};
+
+static void
+bench_bind(struct bench_dev *dev, int subc, uint64_t *samples, unsigned n) {
+  char name[32];
+  unsigned i;
+
+  for (i = 0; i < n; i++) {
+    uint64_t start = now_ns();
+    bind(dev, subc);
+    dev->kick(dev);
+    dev->wait(dev);
+    samples[i] = now_ns() - start;
+  }
+  snprintf(name, sizeof(name), "bind %s", subc_name[subc]);
+  report(name, samples, n);
+}
+
+/* Release on the engine, have the channel acquire it back, and see the
+ * value on the CPU */
+static void
+bench_semaphore(struct bench_dev *dev, int subc, uint64_t *samples, unsigned n) {
+  static uint32_t seq = 0x1000;
+  char name[32];
+  unsigned i;
+
+  for (i = 0; i < n; i++) {
+    uint32_t value = ++seq;
+    uint64_t start = now_ns();
+    release(dev, subc, value);
+    acquire(dev, subc, value);
+    dev->kick(dev);
+    spin_for(dev, value);
+    samples[i] = now_ns() - start;
+  }
+  dev->wait(dev);
+  snprintf(name, sizeof(name), "semaphore %s", subc_name[subc]);
+  report(name, samples, n);
+}
+
+static void
+bench_kick(struct bench_dev *dev, uint64_t *samples, unsigned n) {
+  unsigned i;
+
+  for (i = 0; i < n; i++) {
+    uint64_t start = now_ns();
+    /* Handled by the FIFO itself, nothing reaches an engine */
+    dev->begin(dev, SUBC_BSP, 0x80, 1);
+    dev->data(dev, 0);
+    dev->kick(dev);
+    dev->wait(dev);
+    samples[i] = now_ns() - start;
+  }
+  report("empty kick", samples, n);
+}
 
-  printf("%x\n", *map);
+int main(int argc, char **argv) {
+  static const int subcs[] = { SUBC_BSP, SUBC_VP, SUBC_M2MF };
+  struct bench_dev *dev;
+  uint32_t pushbuf_size = 4096;
+  unsigned iterations = 10000, i;
+  uint64_t *samples;
+  int stand_in = 0, opt;
+
+  while ((opt = getopt(argc, argv, "ni:p:")) != -1) {
+    switch (opt) {
+    case 'n':
+      stand_in = 1;
+      break;
+    case 'i':
+      iterations = strtoul(optarg, NULL, 0);
+      break;
+    case 'p':
+      pushbuf_size = strtoul(optarg, NULL, 0);
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-n] [-i iterations] [-p pushbuf bytes]\n", argv[0]);
+      return 1;
+    }
+  }
+  assert(iterations > 0);
+  assert(pushbuf_size >= 64 && pushbuf_size % 4 == 0);
+
+  dev = stand_in ? null_bench_dev_new(pushbuf_size) : nouveau_bench_dev_new(pushbuf_size);
+  setup(dev);
+
+  /* Make sure the BSP is there at all: write abce to the semaphore
+   * location, and wait for it to come out */
+  *dev->sem = 0xdeadbeef;
+  release(dev, SUBC_BSP, 0xabce);
+  dev->begin(dev, SUBC_BSP, 0x80, 1);
+  dev->data(dev, 0);
+  dev->kick(dev);
+  acquire(dev, SUBC_M2MF, 0xabce);
+  dev->kick(dev);
+  dev->wait(dev);
+
+  printf("%x\n", *dev->sem);
   usleep(10000);
-  printf("%x\n", *map);
+  printf("%x\n", *dev->sem);
+  assert(*dev->sem == 0xabce);
+
+  assert((samples = malloc(iterations * sizeof(*samples))));
+  printf("%u iterations, %u byte pushbuf\n", iterations, pushbuf_size);
+  for (i = 0; i < 3; i++)
+    bench_bind(dev, subcs[i], samples, iterations);
+  for (i = 0; i < 3; i++)
+    bench_semaphore(dev, subcs[i], samples, iterations);
+  bench_kick(dev, samples, iterations);
+
+  free(samples);
   return 0;
 }
@@ -0,0 +1,1410 @@
+/*
+ * Copyright (C) 2013 Ilia Mirkin <imirkin@alum.mit.edu>
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/* The VP2 decoder, see decoder.h. Split out of decode_frame so that vp2d
+ * can drive the same setup and submission. */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#include "nv50/nv50_context.h"
+
+#include "decoder.h"
+#include "drm_open.h"
+#include "h264_parse.h"
+#include "nal_pack.h"
+#include "readback.h"
+
+#undef NDEBUG
+#include <assert.h>
+
+static struct nouveau_bufctx *bufctx;
+
+/* Every submission goes through push_kick, so they can be counted */
+static unsigned long kicks;
+
+static void
+push_kick(struct nouveau_pushbuf *push) {
+  kicks++;
+  PUSH_KICK(push);
+}
+
+static struct nouveau_bo *
+new_bo_and_map(struct nouveau_device *dev,
+               struct nouveau_client *client, long size) {
+  struct nouveau_bo *ret;
+  assert(!nouveau_bo_new(dev, NOUVEAU_BO_VRAM, 0x1000, size, NULL, &ret));
+  if (client)
+    assert(!nouveau_bo_map(ret, NOUVEAU_BO_RDWR, client));
+  fprintf(stderr, "returning map: %llx\n", ret->offset);
+  nouveau_bufctx_refn(bufctx, 0, ret, NOUVEAU_BO_VRAM | NOUVEAU_BO_RDWR);
+  return ret;
+}
+
+static struct nouveau_bo *
+new_bo_and_map_tile(struct nouveau_device *dev,
+               struct nouveau_client *client, long size) {
+  struct nouveau_bo *ret;
+  union nouveau_bo_config cfg;
+
+  cfg.nv50.tile_mode = 0x20;
+  cfg.nv50.memtype = 0x70;
+  assert(!nouveau_bo_new(dev, NOUVEAU_BO_VRAM, 0x1000, size, &cfg, &ret));
+  if (client)
+    assert(!nouveau_bo_map(ret, NOUVEAU_BO_RDWR, client));
+  fprintf(stderr, "returning map: %llx\n", ret->offset);
+  nouveau_bufctx_refn(bufctx, 0, ret, NOUVEAU_BO_VRAM | NOUVEAU_BO_RDWR);
+  return ret;
+}
+
+static struct nouveau_bo *
+new_bo_and_map_gart(struct nouveau_device *dev,
+                    struct nouveau_client *client, long size) {
+  struct nouveau_bo *ret;
+  assert(!nouveau_bo_new(dev, NOUVEAU_BO_GART, 0x1000, size, NULL, &ret));
+  if (client)
+    assert(!nouveau_bo_map(ret, NOUVEAU_BO_RDWR, client));
+  fprintf(stderr, "returning gart map: %llx\n", ret->offset);
+  nouveau_bufctx_refn(bufctx, 0, ret, NOUVEAU_BO_GART | NOUVEAU_BO_RDWR);
+  return ret;
+}
+
+static void
+load_bsp_fw(struct nouveau_bo *fw) {
+  int fd = open("/lib/firmware/nouveau/nv84_bsp-h264", O_RDONLY);
+  struct stat statbuf;
+  void *addr;
+  assert(fd);
+  assert(fstat(fd, &statbuf) == 0);
+  addr = mmap(NULL, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  assert(addr);
+
+  memcpy(fw->map, addr, statbuf.st_size);
+  memset(fw->map + statbuf.st_size, 0, fw->size - statbuf.st_size);
+
+  munmap(addr, statbuf.st_size);
+  close(fd);
+}
+
+/* Sizes and offsets of everything that depends on the stream. The
+ * constants below were measured on a 1280x544 (2720 MB) level 4.0 stream
+ * and scaled per macroblock; that stream comes out at exactly what the
+ * blob allocates. */
+#define ALIGN(x, a) (((x) + (a) - 1) & ~((uint64_t)(a) - 1))
+
+/* The BSP is only told about 0xff800 bytes per picture */
+#define BITSTREAM_MAX 0xff800
+/* MaxRawMbBits / 8 for 8-bit 4:2:0 */
+#define MB_RAW_BYTES 400
+/* Bound on slice header + start code overhead */
+#define SLICE_OVERHEAD 0x100
+
+
+/* Table A-1 MaxCPB, in 1000 bits */
+static uint32_t
+level_max_cpb(int level_idc) {
+  switch (level_idc) {
+  case 9: return 350;
+  case 10: return 175;
+  case 11: return 500;
+  case 12: return 1000;
+  case 13: case 20: return 2000;
+  case 21: case 22: return 4000;
+  case 30: return 10000;
+  case 31: return 14000;
+  case 32: return 20000;
+  case 40: return 25000;
+  case 41: case 42: return 62500;
+  case 50: return 135000;
+  case 51: case 52: return 240000;
+  default: return 0;
+  }
+}
+
+void
+decoder_layout_compute(struct decoder_layout *l, const struct h264_sps *sps,
+                       unsigned max_slices) {
+  uint32_t w_mbs = sps->pic_width_in_mbs_minus1 + 1;
+  uint32_t h_mbs = (sps->pic_height_in_map_units_minus1 + 1) *
+    (2 - sps->frame_mbs_only_flag);
+  uint32_t mbs, cpb;
+  uint64_t bs;
+
+  memset(l, 0, sizeof(*l));
+  l->width = w_mbs * 16;
+  l->height = h_mbs * 16;
+  l->pitch = ALIGN(l->width, 64);
+  l->mb_count = w_mbs * h_mbs;
+  /* Keeps everything below 0x100 aligned */
+  mbs = ALIGN(l->mb_count, 4);
+
+  l->luma_field = l->pitch * ALIGN(l->height / 2, 16);
+  l->chroma = 2 * l->luma_field;
+  l->chroma_field = l->pitch * ALIGN(l->height / 4, 16);
+  l->frame_size = ALIGN(l->chroma + 2 * l->chroma_field, 0x1000);
+
+  bs = (uint64_t)l->mb_count * MB_RAW_BYTES + max_slices * SLICE_OVERHEAD;
+  cpb = level_max_cpb(sps->level_idc);
+  if (cpb && bs > (uint64_t)cpb * 1000 / 8)
+    bs = (uint64_t)cpb * 1000 / 8;
+  if (bs > BITSTREAM_MAX)
+    bs = BITSTREAM_MAX;
+  l->bitstream_max = ALIGN(bs, 0x100);
+  /* Parameters up to 0x700, then the data */
+  l->bitstream_size = 0xe00 + 2 * l->bitstream_max;
+
+  l->mb_data = mbs * 0x100;
+  l->mb_clear = mbs * 0x1c0;
+  l->mbring_size = l->mb_data + l->mb_clear + 0x2000;
+
+  l->vp_data = 4 * l->bitstream_max;
+  l->vp_b = l->vp_data;
+  l->vp_b_size = ALIGN((uint64_t)0xd8300 * mbs / 2720, 0x100);
+  l->vp_c = l->vp_b + l->vp_b_size;
+  l->vp_c_size = ALIGN(mbs * 48, 0x100);
+  l->vp_sem = l->vp_c + l->vp_c_size;
+  l->vpring_half = l->vp_sem + 0x1000;
+  l->vpring_size = 2 * l->vpring_half;
+}
+
+void
+decoder_layout_report(const struct decoder_layout *l) {
+  uint64_t total = l->bitstream_size + l->mbring_size + l->vpring_size +
+    2 * l->frame_size;
+
+  fprintf(stderr, "%ux%u, %u MBs, %u bytes of bitstream per picture\n",
+          l->width, l->height, l->mb_count, l->bitstream_max);
+  fprintf(stderr, "  bitstream %8x\n  mbring    %8x\n  vpring    %8x\n"
+          "  frames  2*%8x\n  total %llu KiB of VRAM\n",
+          l->bitstream_size, l->mbring_size, l->vpring_size, l->frame_size,
+          (unsigned long long)total >> 10);
+}
+
+static void
+clear_3d(struct nouveau_pushbuf *push, uint64_t offset,
+         uint16_t w, uint16_t h, int scale, int tile_mode, uint32_t color) {
+  int i;
+
+  BEGIN_NV04(push, 3, 0x200, 4);
+  PUSH_DATAh(push, offset);
+  PUSH_DATA (push, offset);
+  PUSH_DATA (push, 0xd5); /* RGBA8_UNORM - some of the 0's use BGRA8, but whatever, it's all 0's... */
+  PUSH_DATA (push, tile_mode); /* tile mode */
+  BEGIN_NV04(push, 3, 0xff4, 2);
+  PUSH_DATA (push, (uint32_t)w << 16);
+  PUSH_DATA (push, (uint32_t)h << 16);
+  BEGIN_NV04(push, 3, 0x1240, 2);
+  PUSH_DATA (push, (scale == 1 ? 0 : 0x80000000) | scale * w);
+  PUSH_DATA (push, h);
+  BEGIN_NV04(push, 3, 0x143c, 1);
+  PUSH_DATA (push, 0);
+  BEGIN_NV04(push, 3, 0xd80, 4);
+  for (i = 0; i < 4; i++)
+    PUSH_DATA(push, color);
+  BEGIN_NV04(push, 3, 0x19d0, 1);
+  PUSH_DATA (push, 0x3c);
+}
+
+static void
+copy_to_linear(struct nouveau_pushbuf *push, uint64_t from, uint64_t to,
+               int width, int height, int lines, int dest_pitch) {
+  BEGIN_NV04(push, 4, 0x200, 4);
+  PUSH_DATA (push, 0);
+  PUSH_DATA (push, 0x20 /* tiling mode */);
+  PUSH_DATA (push, width);
+  PUSH_DATA (push, height);
+
+  BEGIN_NV04(push, 4, 0x218, 2);
+  PUSH_DATA (push, 0 << 16); /* y offset */
+  PUSH_DATA (push, 1);
+
+  BEGIN_NV04(push, 4, 0x238, 2);
+  PUSH_DATAh(push, from);
+  PUSH_DATAh(push, to);
+
+  BEGIN_NV04(push, 4, 0x30c, 8);
+  PUSH_DATA (push, from);
+  PUSH_DATA (push, to);
+  PUSH_DATA (push, 0);
+  PUSH_DATA (push, dest_pitch);
+  PUSH_DATA (push, width);
+  PUSH_DATA (push, lines);
+  PUSH_DATA (push, 0x101);
+  PUSH_DATA (push, 0);
+}
+
+static void
+copy_buffer(struct nouveau_pushbuf *push, const struct decoder_layout *l,
+            struct nouveau_bo *from, struct nouveau_bo *to) {
+  /*
+  copy_to_linear(push, from->offset, to->offset + 0 * 0x7d00, 1280, 272, 25, 0);
+  copy_to_linear(push, from->offset, to->offset + 1 * 0x7d00, 1280, 272, 25, 25);
+  copy_to_linear(push, from->offset, to->offset + 2 * 0x7d00, 1280, 272, 25, 50);
+  copy_to_linear(push, from->offset, to->offset + 3 * 0x7d00, 1280, 272, 25, 75);
+  copy_to_linear(push, from->offset, to->offset + 4 * 0x7d00, 1280, 272, 25, 100);
+  copy_to_linear(push, from->offset, to->offset + 5 * 0x7d00, 1280, 272, 25, 125);
+  copy_to_linear(push, from->offset, to->offset + 6 * 0x7d00, 1280, 272, 25, 150);
+  copy_to_linear(push, from->offset, to->offset + 7 * 0x7d00, 1280, 272, 25, 175);
+  copy_to_linear(push, from->offset, to->offset + 8 * 0x7d00, 1280, 272, 25, 200);
+  copy_to_linear(push, from->offset, to->offset + 9 * 0x7d00, 1280, 272, 25, 225);
+  copy_to_linear(push, from->offset, to->offset + 10 * 0x7d00, 1280, 272, 22, 250);
+  */
+  copy_to_linear(push, from->offset, to->offset,
+                 l->pitch, l->height / 2, l->height / 2, l->pitch * 2);
+
+  /*
+  copy_to_linear(push, from->offset + 0x55000, to->offset + 0x55000 + 0 * 0x7d00, 1280, 272, 25, 0);
+  copy_to_linear(push, from->offset + 0x55000, to->offset + 0x55000 + 1 * 0x7d00, 1280, 272, 25, 25);
+  copy_to_linear(push, from->offset + 0x55000, to->offset + 0x55000 + 2 * 0x7d00, 1280, 272, 25, 50);
+  copy_to_linear(push, from->offset + 0x55000, to->offset + 0x55000 + 3 * 0x7d00, 1280, 272, 25, 75);
+  copy_to_linear(push, from->offset + 0x55000, to->offset + 0x55000 + 4 * 0x7d00, 1280, 272, 25, 100);
+  copy_to_linear(push, from->offset + 0x55000, to->offset + 0x55000 + 5 * 0x7d00, 1280, 272, 25, 125);
+  copy_to_linear(push, from->offset + 0x55000, to->offset + 0x55000 + 6 * 0x7d00, 1280, 272, 25, 150);
+  copy_to_linear(push, from->offset + 0x55000, to->offset + 0x55000 + 7 * 0x7d00, 1280, 272, 25, 175);
+  copy_to_linear(push, from->offset + 0x55000, to->offset + 0x55000 + 8 * 0x7d00, 1280, 272, 25, 200);
+  copy_to_linear(push, from->offset + 0x55000, to->offset + 0x55000 + 9 * 0x7d00, 1280, 272, 25, 225);
+  copy_to_linear(push, from->offset + 0x55000, to->offset + 0x55000 + 10 * 0x7d00, 1280, 272, 22, 250);
+  */
+  copy_to_linear(push, from->offset + l->luma_field, to->offset + /*0x55000*/ l->pitch,
+                 l->pitch, l->height / 2, l->height / 2, l->pitch * 2);
+
+  /*
+  copy_to_linear(push, from->offset + 0xaa000, to->offset + 0xaa000 + 0 * 0x7d00,
+                 1280, 136, 25, 0);
+  copy_to_linear(push, from->offset + 0xaa000, to->offset + 0xaa000 + 1 * 0x7d00,
+                 1280, 136, 25, 25);
+  copy_to_linear(push, from->offset + 0xaa000, to->offset + 0xaa000 + 2 * 0x7d00,
+                 1280, 136, 25, 50);
+  copy_to_linear(push, from->offset + 0xaa000, to->offset + 0xaa000 + 3 * 0x7d00,
+                 1280, 136, 25, 75);
+  copy_to_linear(push, from->offset + 0xaa000, to->offset + 0xaa000 + 4 * 0x7d00,
+                 1280, 136, 25, 100);
+  copy_to_linear(push, from->offset + 0xaa000, to->offset + 0xaa000 + 5 * 0x7d00,
+                 1280, 136, 11, 125);
+  */
+  copy_to_linear(push, from->offset + l->chroma, to->offset + l->chroma,
+                 l->pitch, l->height / 4, l->height / 4, l->pitch * 2);
+
+  /* Round up number of lines to 16, so 2d000 offset on source. */
+  /*
+  copy_to_linear(push, from->offset + 0xaa000 + 0x2d000, to->offset + 0xaa000 + 0x2a800 + 0 * 0x7d00,
+                 1280, 136, 25, 0);
+  copy_to_linear(push, from->offset + 0xaa000 + 0x2d000, to->offset + 0xaa000 + 0x2a800 + 1 * 0x7d00,
+                 1280, 136, 25, 25);
+  copy_to_linear(push, from->offset + 0xaa000 + 0x2d000, to->offset + 0xaa000 + 0x2a800 + 2 * 0x7d00,
+                 1280, 136, 25, 50);
+  copy_to_linear(push, from->offset + 0xaa000 + 0x2d000, to->offset + 0xaa000 + 0x2a800 + 3 * 0x7d00,
+                 1280, 136, 25, 75);
+  copy_to_linear(push, from->offset + 0xaa000 + 0x2d000, to->offset + 0xaa000 + 0x2a800 + 4 * 0x7d00,
+                 1280, 136, 25, 100);
+  copy_to_linear(push, from->offset + 0xaa000 + 0x2d000, to->offset + 0xaa000 + 0x2a800 + 5 * 0x7d00,
+                 1280, 136, 11, 125);
+  */
+  copy_to_linear(push, from->offset + l->chroma + l->chroma_field,
+                 to->offset + l->chroma + /*0x2a800*/ + l->pitch,
+                 l->pitch, l->height / 4, l->height / 4, l->pitch * 2);
+}
+
+static void
+load_vp_fw(struct nouveau_bo *fw) {
+  int fd;
+  struct stat statbuf;
+  void *addr;
+
+  assert((fd = open("/lib/firmware/nouveau/nv84_vp-h264-1", O_RDONLY)));
+  assert(fstat(fd, &statbuf) == 0);
+  assert(statbuf.st_size < 0x1f400);
+  assert((addr = mmap(NULL, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0)));
+
+  memcpy(fw->map, addr, statbuf.st_size);
+
+  munmap(addr, statbuf.st_size);
+  close(fd);
+
+  assert((fd = open("/lib/firmware/nouveau/nv84_vp-h264-2", O_RDONLY)));
+  assert(fstat(fd, &statbuf) == 0);
+  assert((addr = mmap(NULL, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0)));
+
+  memcpy(fw->map + 0x1f400, addr, statbuf.st_size);
+
+  munmap(addr, statbuf.st_size);
+  close(fd);
+}
+
+/* One reference picture in the BSP picture parameters. */
+struct bsp_ref {
+  uint32_t u00;                /* 0x00 */
+  uint32_t field_is_ref;       /* 0x04, bit0: top, bit1: bottom */
+  uint8_t is_long_term;        /* 0x08 */
+  uint8_t non_existing;        /* 0x09 */
+  uint8_t pad0a[2];
+  uint32_t frame_idx;          /* 0x0c */
+  uint32_t field_order_cnt[2]; /* 0x10 */
+  uint32_t mvidx;              /* 0x18 */
+  uint8_t field_pic_flag;      /* 0x1c */
+  uint8_t pad1d[3];
+};
+
+/* The 0x530-byte BSP picture parameters at the start of the bitstream
+ * BO. The first 0x150 bytes come from the SPS, the rest from the PPS
+ * and the current picture. */
+struct bsp_picparm {
+  uint32_t chroma_format_idc;                      /* 0x000 */
+  uint32_t unk004[(0x128 - 0x4) / 4];
+  uint32_t log2_max_frame_num_minus4;              /* 0x128 */
+  uint32_t pic_order_cnt_type;                     /* 0x12c */
+  uint32_t log2_max_pic_order_cnt_lsb_minus4;      /* 0x130 */
+  uint32_t delta_pic_order_always_zero_flag;       /* 0x134 */
+  uint32_t num_ref_frames;                         /* 0x138 */
+  uint32_t pic_width_in_mbs_minus1;                /* 0x13c */
+  uint32_t pic_height_in_map_units_minus1;         /* 0x140 */
+  uint32_t frame_mbs_only_flag;                    /* 0x144 */
+  uint32_t mb_adaptive_frame_field_flag;           /* 0x148 */
+  uint32_t direct_8x8_inference_flag;              /* 0x14c */
+
+  uint32_t entropy_coding_mode_flag;               /* 0x150 */
+  uint32_t pic_order_present_flag;                 /* 0x154 */
+  uint32_t num_slice_groups_minus1;                /* 0x158 */
+  uint32_t slice_group_map_type;                   /* 0x15c */
+  uint32_t unk160[(0x1cc - 0x160) / 4];
+  uint32_t num_ref_idx_l0_active_minus1;           /* 0x1cc */
+  uint32_t num_ref_idx_l1_active_minus1;           /* 0x1d0 */
+  uint32_t weighted_pred_flag;                     /* 0x1d4 */
+  uint32_t weighted_bipred_idc;                    /* 0x1d8 */
+  int32_t pic_init_qp_minus26;                     /* 0x1dc */
+  int32_t chroma_qp_index_offset;                  /* 0x1e0 */
+  uint32_t deblocking_filter_control_present_flag; /* 0x1e4 */
+  uint32_t constrained_intra_pred_flag;            /* 0x1e8 */
+  uint32_t redundant_pic_cnt_present_flag;         /* 0x1ec */
+  uint32_t transform_8x8_mode_flag;                /* 0x1f0 */
+  uint32_t unk1f4[(0x318 - 0x1f4) / 4];
+  int32_t second_chroma_qp_index_offset;           /* 0x318 */
+  uint32_t unk31c;                                 /* 0x31c */
+  uint32_t curr_pic_order_cnt;                     /* 0x320 */
+  uint32_t field_order_cnt[2];                     /* 0x324 */
+  uint32_t curr_mvidx;                             /* 0x32c */
+  struct bsp_ref refs[16];                         /* 0x330 */
+};
+
+#define BSP_PICPARM_AT(field, offset) \
+  _Static_assert(offsetof(struct bsp_picparm, field) == offset, \
+                 "bsp_picparm." #field " is not at " #offset)
+
+BSP_PICPARM_AT(log2_max_frame_num_minus4, 0x128);
+BSP_PICPARM_AT(num_ref_frames, 0x138);
+BSP_PICPARM_AT(pic_height_in_map_units_minus1, 0x140);
+BSP_PICPARM_AT(direct_8x8_inference_flag, 0x14c);
+BSP_PICPARM_AT(entropy_coding_mode_flag, 0x150);
+BSP_PICPARM_AT(num_ref_idx_l0_active_minus1, 0x1cc);
+BSP_PICPARM_AT(deblocking_filter_control_present_flag, 0x1e4);
+BSP_PICPARM_AT(transform_8x8_mode_flag, 0x1f0);
+BSP_PICPARM_AT(second_chroma_qp_index_offset, 0x318);
+BSP_PICPARM_AT(curr_pic_order_cnt, 0x320);
+BSP_PICPARM_AT(refs, 0x330);
+_Static_assert(sizeof(struct bsp_ref) == 0x20, "bsp_ref size");
+_Static_assert(sizeof(struct bsp_picparm) == 0x530, "bsp_picparm size");
+
+/* At 0x600 in the bitstream BO */
+struct bsp_slice_params {
+  uint32_t unk00;
+  uint32_t bitstream_size; /* start code + NAL + end markers */
+  uint32_t unk08[15];
+};
+_Static_assert(sizeof(struct bsp_slice_params) == 0x44, "bsp_slice_params size");
+
+/* Keeps a copy of what's in the BO and which 64-byte lines of it were
+ * changed by the builder since the last flush, so that a new picture
+ * only costs the lines that actually differ. */
+#define BSP_LINE 64
+#define BSP_LINES ((sizeof(struct bsp_picparm) + BSP_LINE - 1) / BSP_LINE)
+
+struct bsp_params_state {
+  struct bsp_picparm p;
+  struct bsp_slice_params s;
+  uint32_t dirty;
+  int slice_dirty;
+  unsigned lines_written, lines_total;
+};
+_Static_assert(BSP_LINES <= 32, "bsp_params_state.dirty too small");
+
+static void
+bsp_params_init(struct bsp_params_state *b) {
+  memset(b, 0, sizeof(*b));
+  /* No idea what's in the BO yet */
+  b->dirty = (1u << BSP_LINES) - 1;
+  b->slice_dirty = 1;
+}
+
+static void
+bsp_dirty(struct bsp_params_state *b, const void *field, size_t size) {
+  size_t off = (const char *)field - (const char *)&b->p;
+  size_t line;
+
+  for (line = off / BSP_LINE; line <= (off + size - 1) / BSP_LINE; line++)
+    b->dirty |= 1u << line;
+}
+
+#define BSP_SET(b, field, val) do {                \
+    __typeof__((b)->p.field) v_ = (val);           \
+    if ((b)->p.field != v_) {                      \
+      (b)->p.field = v_;                           \
+      bsp_dirty((b), &(b)->p.field, sizeof(v_));   \
+    }                                              \
+  } while (0)
+
+static void
+bsp_params_build(struct bsp_params_state *b, const struct h264_sps *sps,
+                 const struct h264_pps *pps,
+                 const struct h264_slice_header *sh) {
+  uint32_t poc = 0x10000 + sh->pic_order_cnt_lsb;
+
+  BSP_SET(b, chroma_format_idc, sps->chroma_format_idc);
+  BSP_SET(b, log2_max_frame_num_minus4, sps->log2_max_frame_num_minus4);
+  BSP_SET(b, pic_order_cnt_type, sps->pic_order_cnt_type);
+  BSP_SET(b, log2_max_pic_order_cnt_lsb_minus4, sps->log2_max_pic_order_cnt_lsb_minus4);
+  BSP_SET(b, delta_pic_order_always_zero_flag, sps->delta_pic_order_always_zero_flag);
+  BSP_SET(b, num_ref_frames, sps->num_ref_frames);
+  BSP_SET(b, pic_width_in_mbs_minus1, sps->pic_width_in_mbs_minus1);
+  BSP_SET(b, pic_height_in_map_units_minus1, sps->pic_height_in_map_units_minus1);
+  BSP_SET(b, frame_mbs_only_flag, sps->frame_mbs_only_flag);
+  BSP_SET(b, mb_adaptive_frame_field_flag, sps->mb_adaptive_frame_field_flag);
+  BSP_SET(b, direct_8x8_inference_flag, sps->direct_8x8_inference_flag);
+
+  BSP_SET(b, entropy_coding_mode_flag, pps->entropy_coding_mode_flag);
+  BSP_SET(b, pic_order_present_flag, pps->pic_order_present_flag);
+  BSP_SET(b, num_slice_groups_minus1, pps->num_slice_groups_minus1);
+  BSP_SET(b, num_ref_idx_l0_active_minus1, pps->num_ref_idx_l0_default_active_minus1);
+  BSP_SET(b, num_ref_idx_l1_active_minus1, pps->num_ref_idx_l1_default_active_minus1);
+  BSP_SET(b, weighted_pred_flag, pps->weighted_pred_flag);
+  BSP_SET(b, weighted_bipred_idc, pps->weighted_bipred_idc);
+  BSP_SET(b, pic_init_qp_minus26, pps->pic_init_qp_minus26);
+  BSP_SET(b, chroma_qp_index_offset, pps->chroma_qp_index_offset);
+  BSP_SET(b, deblocking_filter_control_present_flag, pps->deblocking_filter_control_present_flag);
+  BSP_SET(b, constrained_intra_pred_flag, pps->constrained_intra_pred_flag);
+  BSP_SET(b, redundant_pic_cnt_present_flag, pps->redundant_pic_cnt_present_flag);
+  BSP_SET(b, transform_8x8_mode_flag, pps->transform_8x8_mode_flag);
+  BSP_SET(b, second_chroma_qp_index_offset, pps->second_chroma_qp_index_offset);
+
+  BSP_SET(b, curr_pic_order_cnt, poc);
+  BSP_SET(b, field_order_cnt[0], poc);
+  BSP_SET(b, field_order_cnt[1], poc);
+}
+
+static void
+bsp_params_flush(struct bsp_params_state *b, uint8_t *map) {
+  unsigned line;
+
+  for (line = 0; line < BSP_LINES; line++) {
+    size_t off = line * BSP_LINE;
+    size_t len = sizeof(b->p) - off < BSP_LINE ? sizeof(b->p) - off : BSP_LINE;
+
+    if (!(b->dirty & (1u << line)))
+      continue;
+    memcpy(map + off, (uint8_t *)&b->p + off, len);
+    b->lines_written++;
+  }
+  b->lines_total += BSP_LINES;
+  b->dirty = 0;
+
+  if (b->slice_dirty) {
+    memcpy(map + 0x600, &b->s, sizeof(b->s));
+    b->slice_dirty = 0;
+  }
+}
+
+static void
+load_bitstream(struct nouveau_bo *data, struct bsp_params_state *bsp,
+               const uint8_t *nal, size_t size) {
+  uint32_t end[2] = {0x0b010000, 0};
+  uint8_t *map = data->map;
+
+  if (bsp->s.bitstream_size != size + 3 + 16) {
+    bsp->s.bitstream_size = size + 3 + 16;
+    bsp->slice_dirty = 1;
+  }
+  bsp_params_flush(bsp, map);
+
+  map[0x700] = 0;
+  map[0x701] = 0;
+  map[0x702] = 1;
+  memcpy(map + 0x703, nal, size);
+  memcpy(map + 0x703 + size, end, sizeof(end));
+  memcpy(map + 0x703 + size + sizeof(end), end, sizeof(end));
+}
+
+/* A NAL pack payload already has the start code and end markers, and
+ * is padded to at least 256 bytes in the file, so it goes in as one
+ * copy of whole blocks. */
+static void
+load_bitstream_packed(struct nouveau_bo *data, struct bsp_params_state *bsp,
+                      const uint8_t *payload, size_t size) {
+  uint8_t *map = data->map;
+
+  if (bsp->s.bitstream_size != size) {
+    bsp->s.bitstream_size = size;
+    bsp->slice_dirty = 1;
+  }
+  bsp_params_flush(bsp, map);
+  memcpy(map + 0x700, payload, ALIGN(size, 256));
+}
+
+/* Layout of the VP parameter block, as far as it's understood. Only the
+ * first 0x438 bytes of the 0x2000 block are ever written. */
+struct vp_params {
+  uint32_t unk000[0xe0 / 4];  /* 0x10101010 */
+  uint32_t width;             /* 0x0e0 */
+  uint32_t height;            /* 0x0e4 */
+  uint64_t refs[16];          /* 0x0e8, frame addresses */
+  uint64_t refs2[16];         /* 0x168, more frame addresses ??? */
+  uint32_t unk1e8[2];         /* 0x1e8 */
+  uint32_t width2[3];         /* 0x1f0 */
+  uint32_t height2[3];        /* 0x1fc */
+  uint32_t unk208[2];         /* 0x208 */
+  uint32_t fourcc;            /* 0x210, "NV12" */
+  uint32_t unk214;            /* 0x214 */
+  uint32_t unk218[(0x400 - 0x218) / 4];
+  uint32_t width3;            /* 0x400 */
+  uint32_t height3;           /* 0x404 */
+  uint32_t mb_count;          /* 0x408 */
+  uint32_t width4[3];         /* 0x40c */
+  uint32_t height4[3];        /* 0x418 */
+  uint32_t unk424[4];         /* 0x424 */
+  uint32_t unk434;            /* 0x434, 1 */
+};
+
+#define VP_PARAMS_AT(field, offset) \
+  _Static_assert(offsetof(struct vp_params, field) == offset, \
+                 "vp_params." #field " is not at " #offset)
+
+VP_PARAMS_AT(width, 0xe0);
+VP_PARAMS_AT(height, 0xe4);
+VP_PARAMS_AT(refs, 0xe8);
+VP_PARAMS_AT(refs2, 0x168);
+VP_PARAMS_AT(unk1e8, 0x1e8);
+VP_PARAMS_AT(width2, 0x1f0);
+VP_PARAMS_AT(height2, 0x1fc);
+VP_PARAMS_AT(fourcc, 0x210);
+VP_PARAMS_AT(width3, 0x400);
+VP_PARAMS_AT(mb_count, 0x408);
+VP_PARAMS_AT(width4, 0x40c);
+VP_PARAMS_AT(height4, 0x418);
+VP_PARAMS_AT(unk434, 0x434);
+_Static_assert(sizeof(struct vp_params) == 0x438, "vp_params size");
+
+/* Everything in the block except the reference addresses only depends on
+ * the picture size, so it's built once per size and kept around. */
+struct vp_params_template {
+  uint32_t width, height;
+  struct vp_params params;
+};
+
+static struct vp_params_template vp_templates[4];
+static int vp_template_count;
+
+static const struct vp_params *
+vp_params_template(uint32_t width, uint32_t height) {
+  struct vp_params_template *t;
+  struct vp_params *p;
+  int i;
+
+  for (i = 0; i < vp_template_count; i++)
+    if (vp_templates[i].width == width && vp_templates[i].height == height)
+      return &vp_templates[i].params;
+
+  /* Oldest one goes once the cache is full. */
+  if (vp_template_count == 4) {
+    memmove(vp_templates, vp_templates + 1, 3 * sizeof(vp_templates[0]));
+    vp_template_count--;
+  }
+  t = &vp_templates[vp_template_count++];
+
+  memset(t, 0, sizeof(*t));
+  t->width = width;
+  t->height = height;
+  p = &t->params;
+  for (i = 0; i < 0xe0 / 4; i++)
+    p->unk000[i] = 0x10101010;
+  p->width = p->width3 = width;
+  p->height = p->height3 = height;
+  p->mb_count = ((width + 15) / 16) * ((height + 15) / 16);
+  for (i = 0; i < 3; i++) {
+    p->width2[i] = p->width4[i] = width;
+    p->height2[i] = p->height4[i] = height;
+  }
+  p->fourcc = 0x3231564e; /* ??? */
+  p->unk434 = 1;
+  return p;
+}
+
+/* What's currently in the VP params BO, so that only the parts that
+ * changed get written through the BAR. The template cache moves its
+ * entries around, so what's loaded goes by size, not by pointer. */
+struct vp_params_state {
+  struct nouveau_bo *bo;
+  uint32_t width, height; /* 0 until the first upload */
+  uint64_t refs[16], refs2[16];
+};
+
+static void
+vp_params_upload(struct vp_params_state *s, const struct vp_params *tmpl,
+                 uint64_t ref, uint64_t ref2) {
+  struct vp_params *map = s->bo->map;
+  int i;
+
+  if (s->width != tmpl->width || s->height != tmpl->height) {
+    memcpy(map, tmpl, sizeof(*tmpl));
+    memcpy(s->refs, tmpl->refs, sizeof(s->refs));
+    memcpy(s->refs2, tmpl->refs2, sizeof(s->refs2));
+    s->width = tmpl->width;
+    s->height = tmpl->height;
+  }
+
+  for (i = 0; i < 16; i++) {
+    if (s->refs[i] != ref)
+      map->refs[i] = s->refs[i] = ref;
+    if (s->refs2[i] != ref2)
+      map->refs2[i] = s->refs2[i] = ref2;
+  }
+}
+
+struct decoder {
+  struct nouveau_client *client;
+  struct nouveau_pushbuf *push;
+  struct nouveau_bo *bsp_sem, *bitstream, *mbring, *vpring;
+  struct nouveau_bo *vp_sem, *vp_params, *frames[2], *clear_sem;
+
+  /* Picture n is copied to outputs[n % ring_depth], after which the
+   * M2MF writes n + 1 to the 16-byte slot of the same index in out_sem.
+   * The CPU reads pictures back in order, up to ring_depth behind. */
+  struct nouveau_bo *outputs[OUTPUT_RING_MAX], *out_sem;
+  unsigned ring_depth, read;
+  int output_vram;
+  uint64_t occupancy_sum;
+  unsigned occupancy_max;
+  unsigned long sem_waits;
+  uint64_t sem_wait_ns;
+
+  struct vp_params_state vp;
+  struct bsp_params_state bsp;
+  unsigned frame;
+  unsigned long setup_kicks;
+  struct decoder_layout l;
+  uint8_t *staging; /* cached copy of output, all reads go through it */
+  uint64_t readback_ns, readback_bytes;
+  enum frame_clear clear;
+  uint64_t clear_ns, clear_bytes;
+  decoder_output_fn output;
+  void *output_arg;
+};
+
+static uint64_t
+now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Reads from output's mapping are uncached (GART) or write-combined
+ * (VRAM through the BAR), so it's copied to d->staging in one streaming
+ * pass instead of being read piecemeal. */
+static void
+readback(struct decoder *d, struct nouveau_bo *output) {
+  const struct decoder_layout *l = &d->l;
+  size_t len = l->chroma + l->pitch * (l->height / 2);
+  uint64_t start = now_ns();
+
+  readback_copy(d->staging, output->map, len);
+  d->readback_ns += now_ns() - start;
+  d->readback_bytes += len;
+}
+
+/* Spins until the GPU has written seq to the semaphore at offset */
+static void
+wait_sem(struct decoder *d, struct nouveau_bo *bo, uint32_t offset, uint32_t seq) {
+  volatile uint32_t *sem = (uint32_t *)((uint8_t *)bo->map + offset);
+  uint64_t start;
+
+  if (*sem == seq)
+    return;
+  start = now_ns();
+  while (*sem != seq)
+    sched_yield();
+  d->sem_wait_ns += now_ns() - start;
+  d->sem_waits++;
+}
+
+/* Reads back the oldest picture in the output ring and hands it to the
+ * output function */
+static void
+finish_output(struct decoder *d) {
+  unsigned frame = d->read++, slot = frame % d->ring_depth;
+
+  wait_sem(d, d->out_sem, slot * 16, frame + 1);
+  readback(d, d->outputs[slot]);
+  d->output(d->output_arg, frame, d->staging, &d->l);
+}
+
+/* Everything decoder_picture pushes, with room to spare */
+#define PICTURE_PUSH_WORDS 768
+
+/* Clears both frames as RGBA8 surfaces, each field of each plane on its
+ * own like the VP lays them out, then has the 3D write seq to clear_sem
+ * and the channel wait for it. */
+static void
+clear_frames_3d(struct decoder *d, uint32_t seq) {
+  struct nouveau_pushbuf *push = d->push;
+  const struct decoder_layout *l = &d->l;
+  uint16_t w = l->pitch / 4;
+  uint16_t luma_h = l->luma_field / l->pitch;
+  uint16_t chroma_h = l->chroma_field / l->pitch;
+  int i;
+
+  for (i = 0; i < 2; i++) {
+    uint64_t offset = d->frames[i]->offset;
+
+    clear_3d(push, offset, w, luma_h, 1, 0x20, ~0);
+    clear_3d(push, offset + l->luma_field, w, luma_h, 1, 0x20, ~0);
+    clear_3d(push, offset + l->chroma, w, chroma_h, 1, 0x20, ~0);
+    clear_3d(push, offset + l->chroma + l->chroma_field,
+             w, chroma_h, 1, 0x20, ~0);
+  }
+
+  BEGIN_NV04(push, 3, 0x1b00, 4);
+  PUSH_DATAh(push, d->clear_sem->offset);
+  PUSH_DATA (push, d->clear_sem->offset);
+  PUSH_DATA (push, seq);
+  PUSH_DATA (push, 0xf010); /* write + ? */
+
+  BEGIN_NV04(push, 2, 0x10, 4);
+  PUSH_DATAh(push, d->clear_sem->offset);
+  PUSH_DATA (push, d->clear_sem->offset);
+  PUSH_DATA (push, seq);
+  PUSH_DATA (push, 1); /* wait for sem == seq */
+}
+
+/* The semaphores count pictures: bsp_sem and vp_sem hold the number of
+ * pictures the BSP and VP are done with, and each out_sem slot the
+ * number of the last picture copied into it. Nothing needs resetting
+ * between pictures, so picture n + 1 can be set up and submitted while
+ * picture n is still being copied out and n - 1 read back. */
+void
+decoder_picture(struct decoder *d, const struct h264_sps *sps,
+                const struct h264_pps *pps, const struct h264_slice_header *sh,
+                const struct h264_nal *nal, const uint8_t *packed) {
+  struct nouveau_pushbuf *push = d->push;
+  struct nouveau_bo *bsp_sem = d->bsp_sem, *bitstream = d->bitstream;
+  struct nouveau_bo *mbring = d->mbring, *vpring = d->vpring;
+  struct nouveau_bo *vp_sem = d->vp_sem, *vp_params = d->vp_params;
+  struct nouveau_bo **frames = d->frames;
+  const struct decoder_layout *l = &d->l;
+  unsigned frame = d->frame++, slot = frame % d->ring_depth;
+  uint32_t seq = frame + 1;
+
+  /* The ring slot is free again once the picture that used it last has
+   * been read back. Nothing gets submitted until the end, so this has
+   * to be settled before the picture is built. */
+  while (d->frame - d->read > d->ring_depth)
+    finish_output(d);
+
+  /* The bitstream, parameters and rings are single buffered: the VP has
+   * to be done with the previous picture before they're rewritten. */
+  wait_sem(d, vp_sem, 0, seq - 1);
+
+  bsp_params_build(&d->bsp, sps, pps, sh);
+  assert(decoder_bitstream_fits(d, nal->size));
+  if (packed) {
+    assert(ALIGN(nal->size + 3 + NAL_PACK_END_MARKERS, 256) <= l->bitstream_max);
+    load_bitstream_packed(bitstream, &d->bsp, packed, nal->size + 3 + NAL_PACK_END_MARKERS);
+  } else {
+    load_bitstream(bitstream, &d->bsp, nal->data, nal->size);
+  }
+  vp_params_upload(&d->vp, vp_params_template(l->width, l->height),
+                   frames[0]->offset, frames[1]->offset);
+
+  /* Only safe with the GPU idle, which it is when the ring has a single
+   * buffer: the previous picture has been read back by now. */
+  if (d->clear == CLEAR_CPU) {
+    uint64_t start = now_ns();
+
+    memset(frames[0]->map, 0xff, frames[0]->size);
+    memset(frames[1]->map, 0xff, frames[1]->size);
+    d->clear_ns += now_ns() - start;
+    d->clear_bytes += frames[0]->size + frames[1]->size;
+  }
+
+  /* The whole picture goes in one submission. The engines run on
+   * their own, so the kicks never ordered anything: the semaphore
+   * acquires and releases below do. */
+  PUSH_SPACE(push, PICTURE_PUSH_WORDS);
+
+  /* Wait for the previous BSP run, or the mbring/vpring clearing */
+  BEGIN_NV04(push, 1, 0x10, 4);
+  PUSH_DATAh(push, bsp_sem->offset);
+  PUSH_DATA (push, bsp_sem->offset);
+  PUSH_DATA (push, seq - 1);
+  PUSH_DATA (push, 1); /* wait for sem == seq - 1 */
+
+  /* Kick off the BSP */
+  BEGIN_NV04(push, 1, 0x400, 20);
+  PUSH_DATA (push, bitstream->offset >> 8);
+  PUSH_DATA (push, (bitstream->offset >> 8) + 7);
+  PUSH_DATA (push, l->bitstream_max);
+  PUSH_DATA (push, (bitstream->offset >> 8) + 6);
+  PUSH_DATA (push, 1);
+  PUSH_DATA (push, mbring->offset >> 8);
+  PUSH_DATA (push, l->mb_data);
+  PUSH_DATA (push, (mbring->offset + l->mb_data) >> 8);
+  PUSH_DATA (push, vpring->offset >> 8);
+  PUSH_DATA (push, l->vpring_half);
+  PUSH_DATA (push, l->vp_data);
+  PUSH_DATA (push, l->vp_b_size);
+  PUSH_DATA (push, 0x0);
+  PUSH_DATA (push, l->vp_b);
+  PUSH_DATA (push, l->vp_c);
+  PUSH_DATA (push, l->vp_c_size);
+  PUSH_DATA (push, (vpring->offset + l->vp_sem) >> 8);
+  PUSH_DATA (push, 0x654321);
+  PUSH_DATA (push, 0);
+  PUSH_DATA (push, 0x100008);
+
+  BEGIN_NV04(push, 1, 0x620, 2);
+  PUSH_DATA (push, 0);
+  PUSH_DATA (push, 0);
+
+  BEGIN_NV04(push, 1, 0x300, 1);
+  PUSH_DATA (push, 0);
+
+  /* Set the semaphore */
+  BEGIN_NV04(push, 1, 0x610, 3);
+  PUSH_DATAh(push, bsp_sem->offset);
+  PUSH_DATA (push, bsp_sem->offset);
+  PUSH_DATA (push, seq);
+
+  /* Write seq to the semaphore location */
+  BEGIN_NV04(push, 1, 0x304, 1);
+  PUSH_DATA (push, 0x101);
+
+  /* Wait for the semaphore to get written */
+  BEGIN_NV04(push, 2, 0x10, 4);
+  PUSH_DATAh(push, bsp_sem->offset);
+  PUSH_DATA (push, bsp_sem->offset);
+  PUSH_DATA (push, seq);
+  PUSH_DATA (push, 1); /* wait for sem == seq */
+
+  /* frames[0] is also the copy source, wait for the previous picture to
+   * be out of it */
+  if (frame) {
+    BEGIN_NV04(push, 2, 0x10, 4);
+    PUSH_DATAh(push, d->out_sem->offset + (frame - 1) % d->ring_depth * 16);
+    PUSH_DATA (push, d->out_sem->offset + (frame - 1) % d->ring_depth * 16);
+    PUSH_DATA (push, seq - 1);
+    PUSH_DATA (push, 1); /* wait for sem == seq - 1 */
+  }
+
+  /* With the previous picture out of the frames, and before the VP
+   * writes them */
+  if (d->clear == CLEAR_GPU) {
+    uint64_t start = now_ns();
+
+    clear_frames_3d(d, seq);
+    d->clear_ns += now_ns() - start;
+    d->clear_bytes += 2 * (2 * l->luma_field + 2 * l->chroma_field);
+  }
+
+  /* VP step 1 */
+  BEGIN_NV04(push, 2, 0x400, 15);
+  PUSH_DATA (push, 1);
+  PUSH_DATA (push, l->mb_data >> 8);
+  PUSH_DATA (push, 0x3987654);
+  PUSH_DATA (push, l->luma_field | 1); /* was 0x55001 at 1280x544 */
+  PUSH_DATA (push, vp_params->offset >> 8);
+  PUSH_DATA (push, (vpring->offset + l->vp_b) >> 8);
+  PUSH_DATA (push, l->vp_b_size);
+  PUSH_DATA (push, vpring->offset >> 8);
+  PUSH_DATA (push, l->bitstream_max);
+  PUSH_DATA (push, (mbring->offset + l->mb_data + l->mb_clear) >> 8);
+  PUSH_DATA (push, (vpring->offset + l->vp_sem) >> 8);
+  PUSH_DATA (push, 0);
+  PUSH_DATA (push, 0x100008);
+  PUSH_DATA (push, frames[0]->offset >> 8);
+  PUSH_DATA (push, 0);
+
+  BEGIN_NV04(push, 2, 0x620, 2);
+  PUSH_DATA (push, 0);
+  PUSH_DATA (push, 0);
+
+  BEGIN_NV04(push, 2, 0x300, 1);
+  PUSH_DATA (push, 0);
+
+  /* VP step 2 */
+  BEGIN_NV04(push, 2, 0x400, 5);
+  PUSH_DATA (push, 0x54530201);
+  PUSH_DATA (push, (vp_params->offset >> 8) + 0x4);
+  PUSH_DATA (push, (vpring->offset + l->vp_c) >> 8);
+  PUSH_DATA (push, frames[0]->offset >> 8);
+  PUSH_DATA (push, frames[0]->offset >> 8);
+  BEGIN_NV04(push, 2, 0x414, 1);
+  PUSH_DATA (push, frames[1]->offset >> 8);
+
+  BEGIN_NV04(push, 2, 0x620, 2);
+  PUSH_DATA (push, 0);
+  PUSH_DATA (push, 0x1f400); /* offset for second firmware */
+
+  BEGIN_NV04(push, 2, 0x300, 1);
+  PUSH_DATA (push, 0);
+
+  /* Set the semaphore */
+  BEGIN_NV04(push, 2, 0x610, 3);
+  PUSH_DATAh(push, vp_sem->offset);
+  PUSH_DATA (push, vp_sem->offset);
+  PUSH_DATA (push, seq);
+
+  /* Write to the semaphore location, intr */
+  BEGIN_NV04(push, 2, 0x304, 1);
+  PUSH_DATA (push, 0x101);
+
+  /* Set the semaphore */
+  BEGIN_NV04(push, 2, 0x610, 3);
+  PUSH_DATAh(push, vp_sem->offset);
+  PUSH_DATA (push, vp_sem->offset);
+  PUSH_DATA (push, seq);
+
+  /* Write to the semaphore location */
+  BEGIN_NV04(push, 2, 0x304, 1);
+  PUSH_DATA (push, 1);
+
+  /* Wait for the semaphore to get written */
+  BEGIN_NV04(push, 4, 0x10, 4);
+  PUSH_DATAh(push, vp_sem->offset);
+  PUSH_DATA (push, vp_sem->offset);
+  PUSH_DATA (push, seq);
+  PUSH_DATA (push, 1); /* wait for sem == seq */
+
+  copy_buffer(push, l, frames[0], d->outputs[slot]);
+
+  /* Mark the slot as holding this picture */
+  BEGIN_NV04(push, 4, 0x10, 4);
+  PUSH_DATAh(push, d->out_sem->offset + slot * 16);
+  PUSH_DATA (push, d->out_sem->offset + slot * 16);
+  PUSH_DATA (push, seq);
+  PUSH_DATA (push, 2); /* write long */
+  push_kick(push);
+
+  d->occupancy_sum += d->frame - d->read;
+  if (d->frame - d->read > d->occupancy_max)
+    d->occupancy_max = d->frame - d->read;
+
+  /* Keep one slot for the next picture's copy, read back the rest */
+  while (d->frame - d->read >= d->ring_depth)
+    finish_output(d);
+}
+
+struct decoder *
+decoder_new(const struct h264_sps *sps, const struct decoder_config *cfg) {
+  struct nouveau_device *dev;
+  struct nouveau_client *client;
+  struct nouveau_object *channel;
+  struct nouveau_object *bsp, *vp, *threed, *m2mf, *sync;
+  struct nouveau_pushbuf *push;
+  struct nouveau_bo *bsp_sem, *bsp_fw, *bsp_scratch, *bitstream, *mbring, *vpring;
+  struct nouveau_bo *vp_sem, *vp_fw, *vp_scratch, *vp_params, *frames[2];
+  struct nouveau_bo *d3_fpvp, *d3_cb_def, *d3_tsc_tic;
+  struct nouveau_bo *outputs[OUTPUT_RING_MAX], *out_sem, *clear_sem;
+
+  struct nv04_fifo nv04_data = { .vram = 0xbeef0201, .gart = 0xbeef0202 };
+
+  struct decoder *d;
+  struct decoder_layout *l;
+  unsigned ring_depth = cfg->ring_depth;
+  struct drm_open_info drm;
+  uint64_t startup[5];
+  int fd, i;
+
+  assert(ring_depth >= 1 && ring_depth <= OUTPUT_RING_MAX);
+  assert(cfg->clear != CLEAR_CPU || ring_depth == 1);
+  assert(cfg->output);
+  assert((d = calloc(1, sizeof(*d))));
+  l = &d->l;
+  /* Each picture is a single slice */
+  decoder_layout_compute(l, sps, 1);
+  decoder_layout_report(l);
+
+  fd = drm_open_nouveau(&drm);
+  assert(fd >= 0);
+  startup[0] = now_ns();
+
+  assert(!nouveau_device_wrap(fd, 0, &dev));
+  assert(!nouveau_client_new(dev, &client));
+  assert(!nouveau_object_new(&dev->object, 0, NOUVEAU_FIFO_CHANNEL_CLASS,
+                             &nv04_data, sizeof(nv04_data), &channel));
+  assert(!nouveau_pushbuf_new(client, channel, 2, 0x2000, 1, &push));
+  startup[1] = now_ns();
+
+  assert(!nouveau_object_new(channel, 0xbeef74b0, 0x74b0, NULL, 0, &bsp));
+  assert(!nouveau_object_new(channel, 0xbeef7476, 0x7476, NULL, 0, &vp));
+  assert(!nouveau_object_new(channel, 0xbeef8297, 0x8297, NULL, 0, &threed));
+  assert(!nouveau_object_new(channel, 0xbeef5039, 0x5039, NULL, 0, &m2mf));
+
+  assert(!nouveau_object_new(channel, 0xbeef0301, NOUVEAU_NOTIFIER_CLASS,
+                             &(struct nv04_notify){ .length = 32 },
+                             sizeof(struct nv04_notify), &sync));
+
+  assert(!nouveau_bufctx_new(client, 1, &bufctx));
+  nouveau_pushbuf_bufctx(push, bufctx);
+
+
+  bsp_sem = new_bo_and_map(dev, client, 0x1000);
+  bsp_fw = new_bo_and_map(dev, client, 0xd9d0);
+  bsp_scratch = new_bo_and_map(dev, client, 0x40000);
+  bitstream = new_bo_and_map(dev, client, l->bitstream_size);
+  mbring = new_bo_and_map(dev, NULL, l->mbring_size);
+  vpring = new_bo_and_map(dev, NULL, l->vpring_size);
+
+  vp_sem = new_bo_and_map(dev, client, 0x1000);
+  vp_fw = new_bo_and_map(dev, client, 0x3b3fc);
+  vp_scratch = new_bo_and_map(dev, client, 0x40000);
+  vp_params = new_bo_and_map(dev, client, 0x2000);
+
+  d3_fpvp = new_bo_and_map(dev, NULL, 0x8f00);
+  d3_cb_def = new_bo_and_map(dev, NULL, 0x1000);
+  d3_tsc_tic = new_bo_and_map(dev, NULL, 0x2000);
+
+  for (i = 0; i < 2; i++) {
+    frames[i] = new_bo_and_map_tile(dev, client, l->frame_size);
+  }
+
+  /* The M2MF copy doesn't care: its source is tiled VRAM already,
+   * through the same DMA objects */
+  for (i = 0; i < ring_depth; i++) {
+    if (cfg->output_vram)
+      outputs[i] = new_bo_and_map(dev, client, l->frame_size);
+    else
+      outputs[i] = new_bo_and_map_gart(dev, client, l->frame_size);
+  }
+  out_sem = new_bo_and_map(dev, client, 0x1000);
+  clear_sem = new_bo_and_map(dev, client, 0x1000);
+
+  *(uint64_t *)bsp_sem->map = ~0;
+  *(uint64_t *)vp_sem->map = 0;
+  memset(out_sem->map, 0, out_sem->size);
+  *(uint64_t *)clear_sem->map = 0;
+  startup[2] = now_ns();
+
+  /* Setup DMA for the SEMAPHORE logic */
+  BEGIN_NV04(push, 0, 0x60, 1);
+  PUSH_DATA (push, nv04_data.vram);
+
+  /* Bind the BSP to the fifo */
+  BEGIN_NV04(push, 1, 0, 1);
+  PUSH_DATA (push, bsp->handle);
+
+  /* Bind the VP to the fifo */
+  BEGIN_NV04(push, 2, 0, 1);
+  PUSH_DATA (push, vp->handle);
+
+  /* Bind the 3D to the fifo */
+  BEGIN_NV04(push, 3, 0, 1);
+  PUSH_DATA (push, threed->handle);
+
+  /* Bind the M2MF to the fifo */
+  BEGIN_NV04(push, 4, 0, 1);
+  PUSH_DATA (push, m2mf->handle);
+
+  /* Set the DMA channels */
+  BEGIN_NV04(push, 1, 0x180, 11);
+  for (i = 0; i < 11; i++)
+    PUSH_DATA(push, nv04_data.vram);
+
+  BEGIN_NV04(push, 1, 0x1b8, 1);
+  PUSH_DATA (push, nv04_data.vram);
+
+  BEGIN_NV04(push, 2, 0x180, 11);
+  for (i = 0; i < 11; i++)
+    PUSH_DATA(push, nv04_data.vram);
+
+  BEGIN_NV04(push, 2, 0x1b8, 1);
+  PUSH_DATA (push, nv04_data.vram);
+
+  BEGIN_NV04(push, 3, 0x180, 1);
+  PUSH_DATA (push, sync->handle);
+  BEGIN_NV04(push, 3, 0x188, 2);
+  for (i = 0; i < 2; i++)
+    PUSH_DATA (push, nv04_data.vram);
+  BEGIN_NV04(push, 3, 0x198, 6);
+  for (i = 0; i < 6; i++)
+    PUSH_DATA (push, nv04_data.vram);
+
+  BEGIN_NV04(push, 3, 0x1c0, 8);
+  for (i = 0; i < 8; i++)
+    PUSH_DATA (push, nv04_data.vram);
+
+  BEGIN_NV04(push, 4, 0x180, 3);
+  PUSH_DATA (push, sync->handle);
+  for (i = 0; i < 2; i++)
+    PUSH_DATA (push, nv04_data.gart);
+
+  /* Initialize 3D FP/VP/whatever */
+  BEGIN_NV04(push, 3, 0xfa4, 2);
+  PUSH_DATAh(push, d3_fpvp->offset);
+  PUSH_DATA (push, d3_fpvp->offset);
+
+  BEGIN_NV04(push, 3, 0xf7c, 2);
+  PUSH_DATAh(push, d3_fpvp->offset);
+  PUSH_DATA (push, d3_fpvp->offset);
+
+  BEGIN_NV04(push, 3, 0x1290, 1);
+  PUSH_DATA (push, 0xfff);
+  BEGIN_NV04(push, 3, 0x1988, 1);
+  PUSH_DATA (push, 0x240424);
+  BEGIN_NV04(push, 3, 0x1298, 1);
+  PUSH_DATA (push, 0x4);
+  BEGIN_NV04(push, 3, 0x140c, 1);
+  PUSH_DATA (push, 0x0);
+  BEGIN_NV04(push, 3, 0x16ac, 2);
+  PUSH_DATA (push, 0x24);
+  PUSH_DATA (push, 0x0);
+  BEGIN_NV04(push, 3, 0x129c, 1);
+  PUSH_DATA (push, 0x20);
+  BEGIN_NV04(push, 3, 0x1650, 2);
+  PUSH_DATA (push, ~0);
+  PUSH_DATA (push, ~0);
+  BEGIN_NV04(push, 3, 0x16b0, 1);
+  PUSH_DATA (push, 0x24);
+  BEGIN_NV04(push, 3, 0x16bc, 1);
+  PUSH_DATA (push, 0x03020100);
+  BEGIN_NV04(push, 3, 0x1540, 2);
+  PUSH_DATA (push, ~0);
+  PUSH_DATA (push, ~0);
+  BEGIN_NV04(push, 3, 0x1280, 3);
+  PUSH_DATAh(push, d3_cb_def->offset);
+  PUSH_DATA (push, d3_cb_def->offset);
+  PUSH_DATA (push, 0x100);
+  BEGIN_NV04(push, 3, 0x1694, 1);
+  PUSH_DATA (push, 0x131);
+  BEGIN_NV04(push, 3, 0x1280, 3);
+  PUSH_DATAh(push, d3_cb_def->offset + 0x400);
+  PUSH_DATA (push, d3_cb_def->offset + 0x400);
+  PUSH_DATA (push, 0x100);
+  BEGIN_NV04(push, 3, 0x1694, 1);
+  PUSH_DATA (push, 0x1031);
+  BEGIN_NV04(push, 3, 0xa00, 6);
+  for (i = 0; i < 3; i++)
+    PUSH_DATA(push, 0x3f800000);
+  for (i = 0; i < 3; i++)
+    PUSH_DATA(push, 0);
+  BEGIN_NV04(push, 3, 0xc00, 4);
+  PUSH_DATA (push, 0x20000000);
+  PUSH_DATA (push, 0x20000000);
+  PUSH_DATA (push, 0);
+  PUSH_DATA (push, 0x3f800000);
+  BEGIN_NV04(push, 3, 0xdac, 3);
+  PUSH_DATA(push, 0x1b02);
+  PUSH_DATA(push, 0x1b02);
+  PUSH_DATA(push, 0);
+  BEGIN_NV04(push, 3, 0xdc0, 3);
+  PUSH_DATA(push, 0);
+  PUSH_DATA(push, 0);
+  PUSH_DATA(push, 0);
+  BEGIN_NV04(push, 3, 0xdf8, 2);
+  PUSH_DATA(push, 0);
+  PUSH_DATA(push, 0);
+  BEGIN_NV04(push, 3, 0xe00, 1);
+  PUSH_DATA(push, 0);
+  BEGIN_NV04(push, 3, 0x1234, 1);
+  PUSH_DATA(push, 1);
+  BEGIN_NV04(push, 3, 0x12cc, 3);
+  PUSH_DATA(push, 0);
+  PUSH_DATA(push, 3);
+  PUSH_DATA(push, 2);
+  BEGIN_NV04(push, 3, 0x12e8, 2);
+  PUSH_DATA(push, 0);
+  PUSH_DATA(push, 0);
+  BEGIN_NV04(push, 3, 0x1308, 1);
+  PUSH_DATA(push, 1);
+  BEGIN_NV04(push, 3, 0x133c, 1);
+  PUSH_DATA(push, 1);
+  BEGIN_NV04(push, 3, 0x13bc, 1);
+  PUSH_DATA(push, 0x44);
+  /*
+  BEGIN_NV04(push, 3, 0x1528, 1);
+  PUSH_DATA(push, 0);
+  */
+  BEGIN_NV04(push, 3, 0x1534, 1);
+  PUSH_DATA(push, 0);
+  BEGIN_NV04(push, 3, 0x155c, 3);
+  PUSH_DATAh(push, d3_tsc_tic->offset + 0x1000);
+  PUSH_DATA (push, d3_tsc_tic->offset + 0x1000);
+  PUSH_DATA (push, 0x80);
+  BEGIN_NV04(push, 3, 0x1574, 3);
+  PUSH_DATAh(push, d3_tsc_tic->offset);
+  PUSH_DATA (push, d3_tsc_tic->offset);
+  PUSH_DATA (push, 0x80);
+  BEGIN_NV04(push, 3, 0x15b4, 2);
+  PUSH_DATA(push, 0);
+  PUSH_DATA(push, 0);
+  BEGIN_NV04(push, 3, 0x168c, 1);
+  PUSH_DATA(push, 0);
+  BEGIN_NV04(push, 3, 0x1924, 1);
+  PUSH_DATA(push, 0);
+  BEGIN_NV04(push, 3, 0x192c, 1);
+  PUSH_DATA(push, 0);
+  BEGIN_NV04(push, 3, 0x194c, 1);
+  PUSH_DATA(push, 0);
+  BEGIN_NV04(push, 3, 0x1a00, 1);
+  PUSH_DATA(push, 0x1111);
+  BEGIN_NV04(push, 3, 0x121c, 1);
+  PUSH_DATA(push, 1);
+  BEGIN_NV04(push, 3, 0x1538, 1);
+  PUSH_DATA(push, 0);
+
+  /* Clear stuff on mbring/vpring */
+  clear_3d(push, mbring->offset + l->mb_data,
+           64, l->mb_clear / 0x100, 4, 0, 0);
+  clear_3d(push, vpring->offset + l->vp_sem,
+           1024, 1, 4, 0, 0);
+  clear_3d(push, vpring->offset + l->vpring_half + l->vp_sem,
+           1024, 1, 4, 0, 0);
+
+  /* Write semaphore */
+  BEGIN_NV04(push, 3, 0x1b00, 4);
+  PUSH_DATAh(push, bsp_sem->offset);
+  PUSH_DATA (push, bsp_sem->offset);
+  PUSH_DATA (push, 0);
+  PUSH_DATA (push, 0xf010); /* write + ? */
+  startup[3] = now_ns();
+
+  /* Load BSP firmware/scratch buf */
+  load_bsp_fw(bsp_fw);
+  BEGIN_NV04(push, 1, 0x600, 3);
+  PUSH_DATAh(push, bsp_fw->offset);
+  PUSH_DATA (push, bsp_fw->offset);
+  PUSH_DATA (push, bsp_fw->size);
+
+  BEGIN_NV04(push, 1, 0x628, 2);
+  PUSH_DATA (push, bsp_scratch->offset >> 8);
+  PUSH_DATA (push, bsp_scratch->size);
+  push_kick(push);
+
+  /* Load VP firmware/scratch buf */
+
+  load_vp_fw(vp_fw);
+  BEGIN_NV04(push, 2, 0x600, 3);
+  PUSH_DATAh(push, vp_fw->offset);
+  PUSH_DATA (push, vp_fw->offset);
+  PUSH_DATA (push, vp_fw->size);
+
+  BEGIN_NV04(push, 2, 0x628, 2);
+  PUSH_DATA (push, vp_scratch->offset >> 8);
+  PUSH_DATA (push, vp_scratch->size);
+  push_kick(push);
+
+  startup[4] = now_ns();
+  fprintf(stderr, "Startup: %s (%s), open %.2f ms, auth %.2f ms, channel %.2f ms, "
+          "objects %.2f ms, state %.2f ms, firmware %.2f ms\n",
+          drm.path, drm.render_node ? "render node" :
+          drm.authenticated == 1 ? "master" : drm.authenticated ? "X auth" : "unauthenticated",
+          drm.open_ns / 1e6, drm.auth_ns / 1e6, (startup[1] - startup[0]) / 1e6,
+          (startup[2] - startup[1]) / 1e6, (startup[3] - startup[2]) / 1e6,
+          (startup[4] - startup[3]) / 1e6);
+
+  d->client = client;
+  d->push = push;
+  d->bsp_sem = bsp_sem;
+  d->bitstream = bitstream;
+  d->mbring = mbring;
+  d->vpring = vpring;
+  d->vp_sem = vp_sem;
+  d->vp_params = vp_params;
+  d->frames[0] = frames[0];
+  d->frames[1] = frames[1];
+  d->clear_sem = clear_sem;
+  memcpy(d->outputs, outputs, sizeof(outputs));
+  d->out_sem = out_sem;
+  d->ring_depth = ring_depth;
+  d->output_vram = cfg->output_vram;
+  d->clear = cfg->clear;
+  d->vp.bo = vp_params;
+  bsp_params_init(&d->bsp);
+  d->setup_kicks = kicks;
+  assert((d->staging = malloc(l->frame_size)));
+  d->output = cfg->output;
+  d->output_arg = cfg->output_arg;
+  return d;
+}
+
+/* Start code, NAL and the two end markers, within what the BSP is told
+ * it has. The BO holds two of those after the parameters. */
+int
+decoder_bitstream_fits(const struct decoder *d, size_t nal_size) {
+  return nal_size + 3 + NAL_PACK_END_MARKERS <= d->l.bitstream_max;
+}
+
+int
+decoder_fits(const struct decoder *d, const struct h264_sps *sps) {
+  struct decoder_layout l;
+
+  decoder_layout_compute(&l, sps, 1);
+  return l.width == d->l.width && l.height == d->l.height;
+}
+
+void
+decoder_finish(struct decoder *d) {
+  while (d->read < d->frame)
+    finish_output(d);
+}
+
+void
+decoder_report(const struct decoder *d) {
+  fprintf(stderr, "BSP params: %u of %u cache lines written\n",
+          d->bsp.lines_written, d->bsp.lines_total);
+  if (d->readback_ns)
+    fprintf(stderr, "Readback from %s: %.1f MB in %.2f ms, %.2f GB/s (%s)\n",
+            d->output_vram ? "VRAM" : "GART", d->readback_bytes / 1e6,
+            d->readback_ns / 1e6, (double)d->readback_bytes / d->readback_ns,
+            readback_streaming() ? "movntdqa" : "memcpy");
+  if (d->frame)
+    fprintf(stderr, "Kicks: %lu for setup, %lu for %u pictures (%.2f per picture)\n",
+            d->setup_kicks, kicks - d->setup_kicks, d->frame,
+            (double)(kicks - d->setup_kicks) / d->frame);
+  if (d->frame && d->clear != CLEAR_NONE)
+    fprintf(stderr, "Frame clears (%s): %.1f MB, %.2f ms of CPU time, "
+            "%.1f us per picture\n",
+            d->clear == CLEAR_CPU ? "CPU memset" : "3D engine",
+            d->clear_bytes / 1e6, d->clear_ns / 1e6,
+            d->clear_ns / 1e3 / d->frame);
+  if (d->frame)
+    fprintf(stderr, "Output ring: depth %u, avg occupancy %.2f, max %u, "
+            "%lu semaphore waits, %.2f ms waiting\n",
+            d->ring_depth, (double)d->occupancy_sum / d->frame, d->occupancy_max,
+            d->sem_waits, d->sem_wait_ns / 1e6);
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2013 Ilia Mirkin <imirkin@alum.mit.edu>
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef DECODER_H
+#define DECODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "h264_parse.h"
+
+/* The VP2 decoder: a nouveau channel with the BSP, VP, 3D and M2MF
+ * bound, the buffers for one stream layout, and the firmware loaded.
+ * Pictures are submitted one slice at a time; each is copied out to a
+ * linear output ring and read back in order, up to ring_depth behind. */
+
+/* Sizes and offsets of everything that depends on the stream */
+struct decoder_layout {
+  uint32_t width, height, pitch;
+  uint32_t mb_count;
+
+  /* Frames are stored as two fields, luma then chroma, each field's
+   * height aligned to 16 lines. */
+  uint32_t luma_field, chroma_field; /* offsets of the second fields */
+  uint32_t chroma, frame_size;
+
+  uint32_t bitstream_max, bitstream_size;
+
+  uint32_t mb_data;     /* mbring: 0x100 bytes per MB */
+  uint32_t mb_clear;    /* then 0x1c0 more per MB, cleared at init */
+  uint32_t mbring_size; /* plus 0x2000 at the end */
+
+  uint32_t vp_data;     /* vpring: 4 pictures of bitstream */
+  uint32_t vp_b, vp_b_size;
+  uint32_t vp_c, vp_c_size;
+  uint32_t vp_sem;      /* 0x1000 at the end of each half */
+  uint32_t vpring_half, vpring_size;
+};
+
+void decoder_layout_compute(struct decoder_layout *l, const struct h264_sps *sps,
+                            unsigned max_slices);
+void decoder_layout_report(const struct decoder_layout *l);
+
+#define OUTPUT_RING_MAX 8
+
+/* How frames[] get initialized before each picture. The VP writes every
+ * macroblock of a picture, so the clear only matters for telling apart
+ * what it didn't decode. */
+enum frame_clear {
+  CLEAR_NONE,
+  CLEAR_CPU, /* memset through the BAR, needs the GPU idle */
+  CLEAR_GPU, /* 3D engine, ordered before the VP by clear_sem */
+};
+
+/* Gets each picture as it's read back, in order: the luma plane, then
+ * the interleaved UV plane at l->chroma, both l->pitch wide. */
+typedef void (*decoder_output_fn)(void *arg, unsigned frame, const uint8_t *pic,
+                                  const struct decoder_layout *l);
+
+struct decoder_config {
+  unsigned ring_depth; /* 1 to OUTPUT_RING_MAX */
+  int output_vram;     /* output ring in VRAM rather than GART */
+  enum frame_clear clear;
+  decoder_output_fn output;
+  void *output_arg;
+};
+
+struct decoder;
+
+/* Opens the card and sets it up for pictures of sps's layout. Asserts
+ * on failure, like everything here. */
+struct decoder *decoder_new(const struct h264_sps *sps, const struct decoder_config *cfg);
+
+/* Whether pictures of sps fit the buffers allocated at decoder_new(),
+ * which aren't reallocated. Everything but the bitstream buffer follows
+ * from the picture size; that one depends on the level too, and is up
+ * to decoder_bitstream_fits() for each NAL. */
+int decoder_fits(const struct decoder *d, const struct h264_sps *sps);
+
+/* Whether a slice NAL of nal_size bytes fits the bitstream buffer,
+ * which is sized from the SPS's level */
+int decoder_bitstream_fits(const struct decoder *d, size_t nal_size);
+
+/* Submits one single-slice picture. nal is still escaped; packed, if
+ * not NULL, is the same NAL already in the BSP's format (nal_pack). May
+ * hand earlier pictures to the output function. */
+void decoder_picture(struct decoder *d, const struct h264_sps *sps,
+                     const struct h264_pps *pps, const struct h264_slice_header *sh,
+                     const struct h264_nal *nal, const uint8_t *packed);
+
+/* Reads back everything submitted so far */
+void decoder_finish(struct decoder *d);
+
+/* Readback, kick, clear and output ring statistics, to stderr */
+void decoder_report(const struct decoder *d);
+
+#endif
@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2013 Ilia Mirkin <imirkin@alum.mit.edu>
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <xf86drm.h>
+#include <xcb/dri2.h>
+
+#include "drm_open.h"
+
+static uint64_t
+now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* From pipe_loader_drm.c in mesa. Returns 0 if the X server
+ * authenticated us. */
+static int
+pipe_loader_drm_x_auth(int fd)
+{
+   /* Try authenticate with the X server to give us access to devices that X
+    * is running on. */
+   xcb_connection_t *xcb_conn;
+   const xcb_setup_t *xcb_setup;
+   xcb_screen_iterator_t s;
+   xcb_dri2_connect_cookie_t connect_cookie;
+   xcb_dri2_connect_reply_t *connect;
+   drm_magic_t magic;
+   xcb_dri2_authenticate_cookie_t authenticate_cookie;
+   xcb_dri2_authenticate_reply_t *authenticate;
+   int ret = -1;
+
+   xcb_conn = xcb_connect(NULL,  NULL);
+
+   if(!xcb_conn)
+      return -1;
+
+   xcb_setup = xcb_get_setup(xcb_conn);
+
+  if (!xcb_setup)
+    goto disconnect;
+
+   s = xcb_setup_roots_iterator(xcb_setup);
+   connect_cookie = xcb_dri2_connect_unchecked(xcb_conn, s.data->root,
+                                               XCB_DRI2_DRIVER_TYPE_DRI);
+   connect = xcb_dri2_connect_reply(xcb_conn, connect_cookie, NULL);
+
+   if (!connect || connect->driver_name_length
+                   + connect->device_name_length == 0) {
+
+      free(connect);
+      goto disconnect;
+   }
+   free(connect);
+
+   if (drmGetMagic(fd, &magic))
+      goto disconnect;
+
+   authenticate_cookie = xcb_dri2_authenticate_unchecked(xcb_conn,
+                                                         s.data->root,
+                                                         magic);
+   authenticate = xcb_dri2_authenticate_reply(xcb_conn,
+                                              authenticate_cookie,
+                                              NULL);
+   if (authenticate && authenticate->authenticated)
+      ret = 0;
+   free(authenticate);
+
+disconnect:
+   xcb_disconnect(xcb_conn);
+   return ret;
+}
+
+static int
+open_nouveau(const char *path) {
+  drmVersionPtr version;
+  int fd = open(path, O_RDWR | O_CLOEXEC);
+
+  if (fd < 0)
+    return -1;
+  version = drmGetVersion(fd);
+  if (!version || strcmp(version->name, "nouveau")) {
+    drmFreeVersion(version);
+    close(fd);
+    return -1;
+  }
+  drmFreeVersion(version);
+  return fd;
+}
+
+int drm_open_nouveau(struct drm_open_info *info) {
+  const char *env = getenv("VP2_DRM_DEVICE");
+  uint64_t start = now_ns();
+  drm_magic_t magic;
+  int fd = -1, i;
+
+  memset(info, 0, sizeof(*info));
+  if (env) {
+    snprintf(info->path, sizeof(info->path), "%s", env);
+    fd = open_nouveau(info->path);
+  }
+  for (i = 0; !env && fd < 0 && i < 64; i++) {
+    snprintf(info->path, sizeof(info->path), DRM_RENDER_DEV_NAME, DRM_DIR_NAME,
+             DRM_RENDER_MINOR_BASE + i);
+    fd = open_nouveau(info->path);
+  }
+  for (i = 0; !env && fd < 0 && i < 16; i++) {
+    snprintf(info->path, sizeof(info->path), DRM_DEV_NAME, DRM_DIR_NAME, i);
+    fd = open_nouveau(info->path);
+  }
+  info->open_ns = now_ns() - start;
+  if (fd < 0)
+    return -1;
+
+  info->render_node = drmGetNodeTypeFromFd(fd) == DRM_NODE_RENDER;
+  if (info->render_node)
+    return fd;
+
+  /* Whoever opens a primary node first is master and can authenticate
+   * itself; X is only asked when it holds the device. */
+  start = now_ns();
+  if (!drmGetMagic(fd, &magic) && !drmAuthMagic(fd, magic))
+    info->authenticated = 1;
+  else if (!pipe_loader_drm_x_auth(fd))
+    info->authenticated = 2;
+  info->auth_ns = now_ns() - start;
+  return fd;
+}
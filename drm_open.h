@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2013 Ilia Mirkin <imirkin@alum.mit.edu>
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef DRM_OPEN_H
+#define DRM_OPEN_H
+
+#include <stdint.h>
+
+struct drm_open_info {
+  char path[32];
+  int render_node;
+  int authenticated; /* primary node: 0 none, 1 as master, 2 through X */
+  uint64_t open_ns;  /* finding and opening the node */
+  uint64_t auth_ns;
+};
+
+/* Opens the first nouveau device: a render node if there is one, which
+ * needs no authentication, otherwise a primary node, authenticated
+ * directly when nobody else is master and through the X server (DRI2)
+ * when somebody is. VP2_DRM_DEVICE picks a node by path instead.
+ * Returns the fd, or -1 if there is no nouveau device. */
+int drm_open_nouveau(struct drm_open_info *info);
+
+#endif
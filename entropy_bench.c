@@ -0,0 +1,471 @@
+/*
+ * Copyright (C) 2013 Ilia Mirkin <imirkin@alum.mit.edu>
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/* Round-trips synthetic slices through a CABAC encoder (9.3.4.2) and
+ * h264_cabac, checking every bin and timing the decoder per slice.
+ * Given NAL files, times slice_data() decoding of the real slices in
+ * them instead. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "h264_cabac.h"
+
+#undef NDEBUG
+#include <assert.h>
+
+#define NUM_CTX 32
+
+struct encoder {
+  uint8_t *buf;
+  size_t size, pos;
+  int bit;
+  uint32_t low, range;
+  int first, outstanding;
+};
+
+static void
+put(struct encoder *e, int b) {
+  if (e->bit == 0) {
+    assert(e->pos < e->size);
+    e->buf[e->pos] = 0;
+  }
+  e->buf[e->pos] |= b << (7 - e->bit);
+  if (++e->bit == 8) {
+    e->bit = 0;
+    e->pos++;
+  }
+}
+
+static void
+put_bit(struct encoder *e, int b) {
+  if (e->first)
+    e->first = 0;
+  else
+    put(e, b);
+  for (; e->outstanding > 0; e->outstanding--)
+    put(e, !b);
+}
+
+static void
+renorm_e(struct encoder *e) {
+  while (e->range < 256) {
+    if (e->low < 256) {
+      put_bit(e, 0);
+    } else if (e->low >= 512) {
+      e->low -= 512;
+      put_bit(e, 1);
+    } else {
+      e->low -= 256;
+      e->outstanding++;
+    }
+    e->range <<= 1;
+    e->low <<= 1;
+  }
+}
+
+static void
+encode_decision(struct encoder *e, uint8_t *ctx, int bin) {
+  int s = *ctx;
+  uint32_t lps_range = h264_cabac_lps_range[s >> 1][(e->range >> 6) & 3];
+  int lps = bin != (s & 1);
+
+  e->range -= lps_range;
+  if (lps) {
+    e->low += e->range;
+    e->range = lps_range;
+  }
+  *ctx = h264_cabac_next_state[lps][s];
+  renorm_e(e);
+}
+
+static void
+encode_bypass(struct encoder *e, int bin) {
+  e->low <<= 1;
+  if (bin)
+    e->low += e->range;
+  if (e->low >= 1024) {
+    put_bit(e, 1);
+    e->low -= 1024;
+  } else if (e->low < 512) {
+    put_bit(e, 0);
+  } else {
+    e->low -= 512;
+    e->outstanding++;
+  }
+}
+
+static void
+encode_terminate(struct encoder *e, int bin) {
+  e->range -= 2;
+  if (!bin) {
+    renorm_e(e);
+    return;
+  }
+  e->low += e->range;
+  e->range = 2;
+  renorm_e(e);
+  put_bit(e, (e->low >> 9) & 1);
+  put(e, (e->low >> 8) & 1);
+  put(e, 1);
+  /* rbsp_stop_one_bit is already there, pad the byte */
+  while (e->bit)
+    put(e, 0);
+}
+
+/* What each bin is, so that the decoder can follow along */
+enum { BIN_DECISION, BIN_BYPASS, BIN_TERMINATE };
+
+struct slice {
+  uint8_t *kind, *ctx, *value;
+  unsigned count;
+  uint8_t *data;
+  size_t size;
+};
+
+/* Macroblock-like runs: mostly context-coded bins with a per-context
+ * skew, a few bypass bins (signs, suffixes), and end_of_slice_flag. */
+static void
+make_slice(struct slice *s, unsigned bins, const double *p_one) {
+  unsigned i = 0;
+
+  while (i < bins - 1) {
+    unsigned run = 20 + rand() % 40, j;
+
+    for (j = 0; j < run && i < bins - 1; j++, i++) {
+      if (rand() % 8 == 0) {
+        s->kind[i] = BIN_BYPASS;
+        s->value[i] = rand() & 1;
+      } else {
+        s->kind[i] = BIN_DECISION;
+        s->ctx[i] = rand() % NUM_CTX;
+        s->value[i] = rand() < p_one[s->ctx[i]] * RAND_MAX;
+      }
+    }
+    if (i < bins - 1) {
+      s->kind[i] = BIN_TERMINATE;
+      s->value[i++] = 0;
+    }
+  }
+  s->kind[i] = BIN_TERMINATE;
+  s->value[i++] = 1;
+  s->count = i;
+}
+
+static void
+init_contexts(uint8_t *ctx, int qp) {
+  int i;
+
+  /* Some spread of initial states and MPS values */
+  for (i = 0; i < NUM_CTX; i++)
+    ctx[i] = h264_cabac_context((i * 7) % 40 - 20, (i * 13) % 127, qp);
+}
+
+static void
+encode_slice(struct slice *s, int qp) {
+  struct encoder e = {
+    .buf = s->data, .size = s->size,
+    .range = 510, .first = 1,
+  };
+  uint8_t ctx[NUM_CTX];
+  unsigned i;
+
+  init_contexts(ctx, qp);
+  for (i = 0; i < s->count; i++) {
+    switch (s->kind[i]) {
+    case BIN_DECISION:
+      encode_decision(&e, &ctx[s->ctx[i]], s->value[i]);
+      break;
+    case BIN_BYPASS:
+      encode_bypass(&e, s->value[i]);
+      break;
+    case BIN_TERMINATE:
+      encode_terminate(&e, s->value[i]);
+      break;
+    }
+  }
+  s->size = e.pos;
+}
+
+static unsigned
+decode_slice(const struct slice *s, int qp, uint8_t *out) {
+  struct h264_cabac c;
+  uint8_t ctx[NUM_CTX];
+  unsigned i;
+
+  init_contexts(ctx, qp);
+  h264_cabac_init(&c, s->data, s->size);
+  for (i = 0; i < s->count; i++) {
+    switch (s->kind[i]) {
+    case BIN_DECISION:
+      out[i] = h264_cabac_decision(&c, &ctx[s->ctx[i]]);
+      break;
+    case BIN_BYPASS:
+      out[i] = h264_cabac_bypass(&c);
+      break;
+    case BIN_TERMINATE:
+      out[i] = h264_cabac_terminate(&c);
+      break;
+    }
+  }
+  return i;
+}
+
+static uint64_t
+now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int
+cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+/* What h264_player's hardcoded picinfo assumes, until an SPS or PPS
+ * file comes along */
+static const struct h264_sps default_sps = {
+  .profile_idc = 77,
+  .level_idc = 40,
+  .chroma_format_idc = 1,
+  .log2_max_frame_num_minus4 = 5,
+  .log2_max_pic_order_cnt_lsb_minus4 = 6,
+  .num_ref_frames = 6,
+  .pic_width_in_mbs_minus1 = 1280 / 16 - 1,
+  .pic_height_in_map_units_minus1 = 544 / 16 - 1,
+  .frame_mbs_only_flag = 1,
+  .direct_8x8_inference_flag = 1,
+};
+
+static const struct h264_pps default_pps = {
+  .entropy_coding_mode_flag = 1,
+  .deblocking_filter_control_present_flag = 1,
+};
+
+struct slice_stats {
+  unsigned mbs, types[3]; /* I_NxN, I_16x16, I_PCM */
+  unsigned coded_blocks, coeffs;
+};
+
+static int
+decode_real_slice(struct h264_cabac_picture *pic, const struct h264_sps *sps,
+                  const struct h264_pps *pps, const struct h264_nal *nal,
+                  struct slice_stats *st) {
+  struct h264_cabac_slice s;
+  struct h264_mb mb;
+  int ret, i;
+
+  h264_cabac_picture_reset(pic);
+  if (h264_cabac_slice_start(&s, pic, sps, pps, nal))
+    return -1;
+  do {
+    ret = h264_cabac_slice_mb(&s, &mb);
+    if (ret < 0)
+      break;
+    if (!st)
+      continue;
+    st->mbs++;
+    st->types[mb.mb_type == H264_MB_I_NXN ? 0 : mb.mb_type == H264_MB_I_PCM ? 2 : 1]++;
+    if (mb.mb_type == H264_MB_I_PCM)
+      continue;
+    st->coded_blocks += __builtin_popcount(mb.coded);
+    for (i = 0; i < 16; i++)
+      st->coeffs += !!mb.luma_dc[i];
+    for (i = 0; i < 16 * 16; i++)
+      st->coeffs += !!mb.luma[i / 16][i % 16];
+    for (i = 0; i < 8; i++)
+      st->coeffs += !!mb.chroma_dc[i / 4][i % 4];
+    for (i = 0; i < 2 * 4 * 16; i++)
+      st->coeffs += !!mb.chroma_ac[i / 64][i / 16 % 4][i % 16];
+  } while (ret > 0);
+  h264_cabac_slice_end(&s);
+  return ret;
+}
+
+/* Each file holds a single NAL, as for decode_frame. SPS and PPS NALs
+ * apply to the slices after them. */
+static int
+bench_files(char **files, int count, unsigned runs) {
+  struct h264_sps sps = default_sps;
+  struct h264_pps pps = default_pps;
+  struct h264_cabac_picture pic = { 0 };
+  uint64_t *times = malloc(runs * sizeof(*times));
+  int i, ret = 0;
+
+  assert(times);
+  for (i = 0; i < count; i++) {
+    struct slice_stats st = { 0 };
+    struct h264_nal nal = { .offset = 0 };
+    struct stat statbuf;
+    uint8_t *data;
+    unsigned j;
+    FILE *f;
+
+    assert((f = fopen(files[i], "rb")));
+    assert(fstat(fileno(f), &statbuf) == 0 && statbuf.st_size > 0);
+    assert((data = malloc(statbuf.st_size)));
+    assert(fread(data, 1, statbuf.st_size, f) == (size_t)statbuf.st_size);
+    fclose(f);
+    nal.data = data;
+    nal.size = statbuf.st_size;
+    nal.type = data[0] & 0x1f;
+    nal.ref_idc = data[0] >> 5 & 3;
+
+    if (nal.type == 7) {
+      assert(!h264_parse_sps(&nal, &sps));
+      h264_cabac_picture_free(&pic);
+    } else if (nal.type == 8) {
+      assert(!h264_parse_pps(&nal, &pps));
+    } else if (h264_nal_is_slice(nal.type)) {
+      if (!pic.mbs && h264_cabac_picture_init(&pic, &sps)) {
+        fprintf(stderr, "%s: unsupported SPS\n", files[i]);
+        return 1;
+      }
+      if (decode_real_slice(&pic, &sps, &pps, &nal, &st)) {
+        fprintf(stderr, "%s: slice not decodable (I slices only), or broken\n",
+                files[i]);
+        ret = 1;
+      } else {
+        for (j = 0; j < runs; j++) {
+          uint64_t start = now_ns();
+          decode_real_slice(&pic, &sps, &pps, &nal, NULL);
+          times[j] = now_ns() - start;
+        }
+        qsort(times, runs, sizeof(*times), cmp_u64);
+        printf("%s: %u MBs (%u I_NxN, %u I_16x16, %u I_PCM), %u coded blocks, "
+               "%u nonzero levels, ends on rbsp_stop_one_bit\n",
+               files[i], st.mbs, st.types[0], st.types[1], st.types[2],
+               st.coded_blocks, st.coeffs);
+        printf("  %u runs: min %.1f  median %.1f  p99 %.1f us, "
+               "%.2f MMB/s, %.1f Mbit/s\n", runs,
+               times[0] / 1000.0, times[runs / 2] / 1000.0,
+               times[(uint64_t)runs * 99 / 100] / 1000.0,
+               st.mbs * 1000.0 / times[runs / 2],
+               nal.size * 8000.0 / times[runs / 2]);
+      }
+    }
+    free(data);
+  }
+  h264_cabac_picture_free(&pic);
+  free(times);
+  return ret;
+}
+
+int main(int argc, char **argv) {
+  unsigned slices = 200, bins = 100000, seed = 1, runs = 100, i, j;
+  uint64_t *times, total_ns = 0, total_bits = 0, total_bins = 0;
+  double p_one[NUM_CTX];
+  struct slice s;
+  uint8_t *out;
+  int qp = 26, opt;
+
+  while ((opt = getopt(argc, argv, "s:b:q:r:n:")) != -1) {
+    switch (opt) {
+    case 's':
+      slices = strtoul(optarg, NULL, 0);
+      break;
+    case 'b':
+      bins = strtoul(optarg, NULL, 0);
+      break;
+    case 'q':
+      qp = atoi(optarg);
+      break;
+    case 'r':
+      seed = strtoul(optarg, NULL, 0);
+      break;
+    case 'n':
+      runs = strtoul(optarg, NULL, 0);
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-s slices] [-b bins per slice] [-q qp] [-r seed]\n"
+              "       %s [-n runs] nal files...\n", argv[0], argv[0]);
+      return 1;
+    }
+  }
+  assert(slices > 0 && bins > 1 && runs > 0);
+
+  if (optind < argc)
+    return bench_files(argv + optind, argc - optind, runs);
+
+  srand(seed);
+  for (i = 0; i < NUM_CTX; i++)
+    p_one[i] = (double)rand() / RAND_MAX;
+
+  s.kind = malloc(bins);
+  s.ctx = malloc(bins);
+  s.value = malloc(bins);
+  out = malloc(bins);
+  times = malloc(slices * sizeof(*times));
+  assert(s.kind && s.ctx && s.value && out && times);
+
+  for (i = 0; i < slices; i++) {
+    uint64_t start;
+
+    /* A bin never takes more than ~7 bits, and the decoder reads ahead */
+    s.size = bins + 16;
+    s.data = malloc(s.size);
+    make_slice(&s, bins, p_one);
+    encode_slice(&s, qp);
+
+    start = now_ns();
+    decode_slice(&s, qp, out);
+    times[i] = now_ns() - start;
+
+    for (j = 0; j < s.count; j++) {
+      if (out[j] != s.value[j]) {
+        fprintf(stderr, "slice %u: bin %u decoded as %d, expected %d\n",
+                i, j, out[j], s.value[j]);
+        return 1;
+      }
+    }
+
+    total_ns += times[i];
+    total_bins += s.count;
+    total_bits += s.size * 8;
+    free(s.data);
+  }
+
+  qsort(times, slices, sizeof(*times), cmp_u64);
+  printf("%u slices of %u bins, %.3f bits/bin, all bins match\n",
+         slices, bins, (double)total_bits / total_bins);
+  printf("per slice: min %.1f  median %.1f  p99 %.1f us\n",
+         times[0] / 1000.0, times[slices / 2] / 1000.0,
+         times[(uint64_t)slices * 99 / 100] / 1000.0);
+  printf("%.1f Mbins/s, %.1f Mbit/s of slice data\n",
+         total_bins * 1000.0 / total_ns, total_bits * 1000.0 / total_ns);
+
+  free(times);
+  free(out);
+  free(s.kind);
+  free(s.ctx);
+  free(s.value);
+  return 0;
+}
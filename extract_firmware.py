@@ -20,8 +20,10 @@
 # ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
 # OTHER DEALINGS IN THE SOFTWARE.
 
-import itertools
+import hashlib
 import mmap
+import multiprocessing
+import optparse
 import os
 import re
 import struct
@@ -52,26 +54,35 @@ def product(a, b):
         for y in b:
             yield (x, y)
 
-cwd = os.getcwd()
-for (VERSION, ARCH) in product(VERSIONS, ARCHES):
-    if os.path.exists("NVIDIA-Linux-%s-%s" % (ARCH, VERSION)):
-        break
-else:
-    print """Please run this in a directory where NVIDIA-Linux-x86-%(version)s is a subdir.
+USAGE = """Please run this in a directory where NVIDIA-Linux-x86-%(version)s is a subdir.
 
 You can make this happen by running
 wget http://us.download.nvidia.com/XFree86/Linux-x86/%(version)s/NVIDIA-Linux-x86-%(version)s.run
 sh NVIDIA-Linux-x86-%(version)s.run --extract-only
 
 Note: You can use other versions/arches, see the source for what is acceptable.
+
+With --batch STORE, every such directory is processed and the results go
+to a content-addressed store instead of the current directory.
 """ % {"version": VERSIONS[-1]}
-    sys.exit(1)
 
-kernel_f = open("NVIDIA-Linux-%s-%s/kernel/nv-kernel.o" % (ARCH, VERSION), "r")
-kernel = mmap.mmap(kernel_f.fileno(), 0, access=mmap.ACCESS_READ)
+def tree_dir(version, arch):
+    return "NVIDIA-Linux-%s-%s" % (arch, version)
+
+def tree_inputs(version, arch):
+    return ("%s/kernel/nv-kernel.o" % tree_dir(version, arch),
+            "%s/libnvcuvid.so.%s" % (tree_dir(version, arch), version))
 
-user_f = open("NVIDIA-Linux-%s-%s/libnvcuvid.so.%s" % (ARCH, VERSION, VERSION), "r")
-user = mmap.mmap(user_f.fileno(), 0, access=mmap.ACCESS_READ)
+def open_images(version, arch):
+    kernel_path, user_path = tree_inputs(version, arch)
+    images = {}
+    for name, path in (("kernel", kernel_path), ("user", user_path)):
+        with open(path, "r") as f:
+            images[name] = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+    return images
+
+# The version being extracted, the preds below depend on it
+VERSION = None
 
 vp2_kernel_prefix = "\xcd\xab\x55\xee\x44"
 vp2_user_prefix = "\xce\xab\x55\xee\x20\x00\x00\xd0\x00\x00\x00\xd0"
@@ -104,13 +115,13 @@ def vp5_offset():
 BLOBS = {
     # VP2 kernel xuc
     "nv84_bsp": {
-        "data": kernel,
+        "data": "kernel",
         "start": vp2_kernel_prefix + "\x46",
         "length": 0x16f3c,
         "links": links(VP2_CHIPS, "xuc103"),
     },
     "nv84_vp": {
-        "data": kernel,
+        "data": "kernel",
         "start": vp2_kernel_prefix + "\x7c",
         "length": 0x1ae6c,
         "links": links(VP2_CHIPS, "xuc00f"),
@@ -118,21 +129,21 @@ BLOBS = {
 
     # VP3 kernel fuc
     "nv98_bsp": {
-        "data": kernel,
+        "data": "kernel",
         "start": "\xf1\x07\x00\x10\xf1\x03\x00\x00",
         "length": 0xac00,
         "pred": lambda data, i: data[i+vp3_offset()] == '\x8e',
         "links": links(VP3_CHIPS, "fuc084"),
     },
     "nv98_vp": {
-        "data": kernel,
+        "data": "kernel",
         "start": "\xf1\x07\x00\x10\xf1\x03\x00\x00",
         "length": 0xa500,
         "pred": lambda data, i: data[i+vp3_offset()] == '\x95',
         "links": links(VP3_CHIPS, "fuc085"),
     },
     "nv98_ppp": {
-        "data": kernel,
+        "data": "kernel",
         "start": "\xf1\x07\x00\x08\xf1\x03\x00\x00",
         "length": 0x3800,
         "pred": lambda data, i: data[i+vp3_offset()] == '\x30',
@@ -141,21 +152,21 @@ BLOBS = {
 
     # VP4.0 kernel fuc
     "nva3_bsp": {
-        "data": kernel,
+        "data": "kernel",
         "start": vp4_kernel_prefix,
         "length": 0x10200,
         "pred": lambda data, i: data[i+8*11+1] == '\xcf',
         "links": links(VP4_0_CHIPS, "fuc084"),
     },
     "nva3_vp": {
-        "data": kernel,
+        "data": "kernel",
         "start": vp4_kernel_prefix,
         "length": 0xc600,
         "pred": lambda data, i: data[i+8*11+1] == '\x9e',
         "links": links(VP4_0_CHIPS, "fuc085"),
     },
     "nva3_ppp": {
-        "data": kernel,
+        "data": "kernel",
         "start": vp4_kernel_prefix,
         "length": 0x3f00,
         "pred": lambda data, i: data[i+8*11+1] == '\x36',
@@ -164,21 +175,21 @@ BLOBS = {
 
     # VP4.2 kernel fuc
     "nvc0_bsp": {
-        "data": kernel,
+        "data": "kernel",
         "start": vp4_kernel_prefix,
         "length": 0x10d00,
         "pred": lambda data, i: data[i+0x59] == '\xd8',
         "links": links(VP4_2_CHIPS, "fuc084"),
     },
     "nvc0_vp": {
-        "data": kernel,
+        "data": "kernel",
         "start": vp4_kernel_prefix,
         "length": 0xd300,
         "pred": lambda data, i: data[i+0x59] == '\xa5',
         "links": links(VP4_2_CHIPS, "fuc085"),
     },
     "nvc0_ppp": {
-        "data": kernel,
+        "data": "kernel",
         "start": vp4_kernel_prefix,
         "length": 0x4100,
         "pred": lambda data, i: data[i+0x59] == '\x38',
@@ -187,14 +198,14 @@ BLOBS = {
 
     # VP5 kernel fuc
     "nve0_bsp": {
-        "data": kernel,
+        "data": "kernel",
         "start": vp4_kernel_prefix,
         "length": 0x11c00,
         "pred": lambda data, i: data[i+vp5_offset()] == '\x27',
         "links": links(VP5_CHIPS, "fuc084"),
     },
     "nve0_vp": {
-        "data": kernel,
+        "data": "kernel",
         "start": vp4_kernel_prefix,
         "length": 0xdd00,
         "pred": lambda data, i: data[i+vp5_offset()] == '\x0a',
@@ -203,68 +214,68 @@ BLOBS = {
 
     # VP2 user xuc
     "nv84_bsp-h264": {
-        "data": user,
+        "data": "user",
         "start": vp2_user_prefix + "\x88",
         "length": 0xd9d0,
     },
     "nv84_vp-h264-1": {
-        "data": user,
+        "data": "user",
         "start": vp2_user_prefix + "\x3c",
         "length": 0x1f334,
     },
     "nv84_vp-h264-2": {
-        "data": user,
+        "data": "user",
         "start": vp2_user_prefix + "\x04",
         "length": 0x1bffc,
     },
     "nv84_vp-mpeg12": {
-        "data": user,
+        "data": "user",
         "start": vp2_user_prefix + "\x4c",
         "length": 0x22084,
     },
     "nv84_vp-vc1-1": {
-        "data": user,
+        "data": "user",
         "start": vp2_user_prefix + "\x7c",
         "length": 0x2cd24,
     },
     "nv84_vp-vc1-2": {
-        "data": user,
+        "data": "user",
         "start": vp2_user_prefix + "\xa4",
         "length": 0x1535c,
     },
     "nv84_vp-vc1-3": {
-        "data": user,
+        "data": "user",
         "start": vp2_user_prefix + "\x34",
         "length": 0x133bc,
     },
 
     # VP3 user vuc
     "vuc-vp3-mpeg12-0": {
-        "data": user,
+        "data": "user",
         "start": vp3_user_prefix,
         "length": 0xb00,
         "pred": lambda data, i: data[i + 11 * 8] == '\x4a' and data[i + 228] == '\x43',
     },
     "vuc-vp3-h264-0": {
-        "data": user,
+        "data": "user",
         "start": vp3_user_prefix,
         "length": 0x1600,
         "pred": lambda data, i: data[i + 11 * 8 + 1] == '\xff' and data[i + 225] == '\x81',
     },
     "vuc-vp3-vc1-0": {
-        "data": user,
+        "data": "user",
         "start": vp3_vc1_prefix + vp3_user_prefix,
         "length": 0x1d00,
         "pred": lambda data, i: data[i + 11 * 8 + 1] == '\xf4',
     },
     "vuc-vp3-vc1-1": {
-        "data": user,
+        "data": "user",
         "start": vp3_vc1_prefix + vp3_user_prefix,
         "length": 0x2100,
         "pred": lambda data, i: data[i + 11 * 8 + 1] == '\x34',
     },
     "vuc-vp3-vc1-2": {
-        "data": user,
+        "data": "user",
         "start": vp3_vc1_prefix + vp3_user_prefix,
         "length": 0x2300,
         "pred": lambda data, i: data[i + 11 * 8 + 1] == '\x98',
@@ -272,49 +283,49 @@ BLOBS = {
 
     # VP4.x user vuc
     "vuc-vp4-mpeg12-0": {
-        "data": user,
+        "data": "user",
         "start": vp3_user_prefix,
         "length": 0xc00,
         "pred": lambda data, i: data[i + 11 * 8] == '\x4a' and data[i + 228] == '\x44',
         "links": ["vuc-mpeg12-0"],
     },
     "vuc-vp4-h264-0": {
-        "data": user,
+        "data": "user",
         "start": vp3_user_prefix,
         "length": 0x1900,
         "pred": lambda data, i: data[i + 11 * 8 + 1] == '\xff' and data[i + 225] == '\x8c',
         "links": ["vuc-h264-0"],
     },
     "vuc-vp4-mpeg4-0": {
-        "data": user,
+        "data": "user",
         "start": vp3_user_prefix,
         "length": 0x1d00,
         "pred": lambda data, i: data[i + 61] == '\x30' and data[i + 6923] == '\x00',
         "links": ["vuc-mpeg4-0"],
     },
     "vuc-vp4-mpeg4-1": {
-        "data": user,
+        "data": "user",
         "start": vp3_user_prefix,
         "length": 0x1d00,
         "pred": lambda data, i: data[i + 61] == '\x30' and data[i + 6923] == '\x20',
         "links": ["vuc-mpeg4-1"],
     },
     "vuc-vp4-vc1-0": {
-        "data": user,
+        "data": "user",
         "start": vp3_vc1_prefix + vp3_user_prefix,
         "length": 0x1d00,
         "pred": lambda data, i: data[i + 11 * 8 + 1] == '\xb4',
         "links": ["vuc-vc1-0"],
     },
     "vuc-vp4-vc1-1": {
-        "data": user,
+        "data": "user",
         "start": vp3_vc1_prefix + vp3_user_prefix,
         "length": 0x2100,
         "pred": lambda data, i: data[i + 11 * 8 + 1] == '\x08',
         "links": ["vuc-vc1-1"],
     },
     "vuc-vp4-vc1-2": {
-        "data": user,
+        "data": "user",
         "start": vp3_vc1_prefix + vp3_user_prefix,
         "length": 0x2100,
         "pred": lambda data, i: data[i + 11 * 8 + 1] == '\x6c',
@@ -322,39 +333,7 @@ BLOBS = {
     },
 }
 
-# Build a regex on the start data to speed things along.
-start_re = "|".join(set(re.escape(v["start"]) for v in BLOBS.itervalues()))
-files = set(v["data"] for v in BLOBS.itervalues())
-
-done = set()
-
-for data in files:
-    for match in re.finditer(start_re, data):
-        for name, v in BLOBS.iteritems():
-            if name in done or data != v["data"] or match.group(0) != v["start"]:
-                continue
-
-            i = match.start(0)
-            pred = v.get("pred")
-            if pred and not pred(data, i):
-                continue
-
-            length = v["length"]
-            links = v.get("links", [])
-
-            with open(os.path.join(cwd, name), "w") as f:
-                f.write(data[i:i+length])
-
-            done.add(name)
-            for link in links:
-                try:
-                    os.unlink(link)
-                except:
-                    pass
-                os.symlink(name, link)
-
-for name in set(BLOBS) - done:
-    print "Firmware %s not found, ignoring." % name
+GZIP_MAGIC = "\x1f\x8b\x08"
 
 ARCHIVE_FILES = {
     0: "fuc409d",
@@ -369,14 +348,140 @@ ARCHIVE_ORDERS = {
                "nv108"],
 }
 
-# Extract the gzipped archives found inside the kernel driver
-def decompress(prefix, start, s):
+class DirSink(object):
+    """Writes the firmware and its links into a directory, as-is."""
+
+    def __init__(self, path):
+        self.path = path
+
+    def blob(self, name, data, links=()):
+        with open(os.path.join(self.path, name), "wb") as f:
+            f.write(data)
+        for link in links:
+            link = os.path.join(self.path, link)
+            try:
+                os.unlink(link)
+            except:
+                pass
+            os.symlink(name, link)
+
+    def close(self):
+        pass
+
+class StoreSink(object):
+    """Writes each blob once, under its sha256, in STORE/objects. The
+    tree for one driver release gets STORE/<version>-<arch>/ with a
+    MANIFEST of "hash name links..." lines, and the usual names and chip
+    links as symlinks into the object store."""
+
+    def __init__(self, store, tag):
+        self.store = store
+        self.path = os.path.join(store, tag)
+        self.entries = []
+        for d in (os.path.join(store, "objects"), self.path):
+            if not os.path.isdir(d):
+                os.makedirs(d)
+        # Drop what a previous extraction of this tree left behind, the
+        # objects themselves are shared and stay.
+        for name in os.listdir(self.path):
+            if os.path.islink(os.path.join(self.path, name)):
+                os.unlink(os.path.join(self.path, name))
+        self.written = 0
+
+    def blob(self, name, data, links=()):
+        digest = hashlib.sha256(data).hexdigest()
+        obj = os.path.join(self.store, "objects", digest)
+        if not os.path.exists(obj):
+            tmp = obj + ".tmp"
+            with open(tmp, "wb") as f:
+                f.write(data)
+            os.rename(tmp, obj)
+            self.written += 1
+        self.entries.append((digest, name, list(links)))
+
+        for path, target in [(name, os.path.join("..", "objects", digest))] + \
+                [(link, name) for link in links]:
+            path = os.path.join(self.path, path)
+            if os.path.lexists(path):
+                os.unlink(path)
+            os.symlink(target, path)
+
+    def close(self):
+        with open(os.path.join(self.path, "MANIFEST"), "w") as f:
+            for digest, name, links in sorted(self.entries,
+                                              key=lambda e: e[1]):
+                f.write(" ".join([digest, name] + links) + "\n")
+        print "%s: %d blobs, %d new" % (self.path, len(self.entries),
+                                        self.written)
+
+def scan(data, prefixes):
+    """Yields (offset, prefix) for every place one of prefixes occurs in
+    data, in a single pass. The lookahead makes the match zero-width, so
+    candidates that overlap each other are all reported."""
+    alts = sorted(prefixes, key=len, reverse=True)
+    pattern = re.compile("(?=(%s))" % "|".join(re.escape(p) for p in alts))
+    for match in pattern.finditer(data):
+        yield match.start(0), match.group(1)
+
+def extract_blobs(images, sink):
+    """Returns the offsets of the gzip headers in the kernel image, if
+    there's an archive order for this version."""
+    # Group the blobs by image and then by start, so that each image is
+    # only walked once and a hit only has to look at the blobs sharing
+    # its prefix.
+    by_image = {}
+    for name, v in BLOBS.iteritems():
+        by_image.setdefault(v["data"], {}).setdefault(v["start"], []).append(name)
+
+    done = set()
+    gzip_starts = []
+
+    for image, by_start in by_image.iteritems():
+        data = images[image]
+        prefixes = list(by_start)
+        if image == "kernel" and VERSION in ARCHIVE_ORDERS:
+            prefixes.append(GZIP_MAGIC)
+
+        for i, prefix in scan(data, prefixes):
+            if prefix == GZIP_MAGIC:
+                gzip_starts.append(i)
+                continue
+
+            for name in by_start[prefix]:
+                if name in done:
+                    continue
+
+                v = BLOBS[name]
+                pred = v.get("pred")
+                if pred and not pred(data, i):
+                    continue
+
+                sink.blob(name, data[i:i+v["length"]], v.get("links", []))
+                done.add(name)
+
+    for name in set(BLOBS) - done:
+        print "Firmware %s not found, ignoring." % name
+
+    return gzip_starts
+
+# Extract the gzipped archives found inside the kernel driver. Each
+# archive runs up to the next gzip header; inflating them is independent
+# and the slow part, so it is spread over a process pool. Naming depends
+# on the order of the valid ones, so that is done afterwards.
+kernel = None
+
+def inflate(span):
+    start, end = span
     try:
         decomp = zlib.decompressobj(-zlib.MAX_WBITS)
-        data = decomp.decompress(s[10:])
+        return decomp.decompress(kernel[start+10:end])
     except Exception, e:
-        print prefix, repr(s[:16]), len(s)
+        print "0x%x" % start, repr(kernel[start:start+16]), end - start
         print e
+        return None
+
+def unpack(prefix, start, data, sink):
+    if data is None:
         return False
     magic, count = struct.unpack("<II", data[:8])
     if magic != 0:
@@ -396,24 +501,114 @@ def decompress(prefix, start, s):
     for entry in entries:
         if not entry[0] in ARCHIVE_FILES:
             continue
-        with open("%s_%s" % (prefix, ARCHIVE_FILES[entry[0]]), "wb") as f:
-            f.write(data[entry[2]:entry[2]+entry[1]])
-            if f.name.endswith("c"):
-                # round code up to the nearest 0x200
-                f.write("\0" * (0x200 - entry[1] % 0x200))
+        name = "%s_%s" % (prefix, ARCHIVE_FILES[entry[0]])
+        blob = data[entry[2]:entry[2]+entry[1]]
+        if name.endswith("c"):
+            # round code up to the nearest 0x200
+            blob += "\0" * (0x200 - entry[1] % 0x200)
+        sink.blob(name, blob)
 
     return True
 
-if VERSION in ARCHIVE_ORDERS:
-    gzip_starts = list(m.start(0) for m in re.finditer(
-        re.escape("\x1f\x8b\x08"), kernel))
+def extract_archives(images, gzip_starts, sink):
+    global kernel
+
+    if VERSION not in ARCHIVE_ORDERS:
+        print "Unknown PGRAPH archive order in this version."
+        return
+
+    # The pool's workers see the image through the fork
+    kernel = images["kernel"]
+    spans = zip(gzip_starts, gzip_starts[1:] + [len(kernel)])
+    pool = multiprocessing.Pool()
+    archives = pool.map(inflate, spans)
+    pool.close()
+
     idx = 0
     names = ARCHIVE_ORDERS[VERSION]
-    for start, end in itertools.izip(gzip_starts,
-                                     gzip_starts[1:] + [len(kernel)]):
-        if decompress(names[idx], start, kernel[start:end]):
+    for (start, end), data in zip(spans, archives):
+        if unpack(names[idx], start, data, sink):
             idx += 1
     if idx != len(names):
         print "Unexpected quantity of archives in blob, graph fw likely wrong."
-else:
-    print "Unknown PGRAPH archive order in this version."
+
+def extract(version, arch, sink):
+    global VERSION
+
+    VERSION = version
+    images = open_images(version, arch)
+    gzip_starts = extract_blobs(images, sink)
+    extract_archives(images, gzip_starts, sink)
+    sink.close()
+
+def input_stamp(version, arch):
+    return " ".join("%s:%d:%d" % (path, st.st_size, int(st.st_mtime))
+                    for path, st in ((p, os.stat(p))
+                                     for p in tree_inputs(version, arch)))
+
+def batch(store):
+    """Extracts every known driver tree in the current directory into
+    store. Trees whose inputs have the same size and mtime as on the
+    previous run are skipped."""
+    stamps_path = os.path.join(store, "INPUTS")
+    stamps = {}
+    if os.path.exists(stamps_path):
+        with open(stamps_path) as f:
+            for line in f:
+                tag, stamp = line.rstrip("\n").split(" ", 1)
+                stamps[tag] = stamp
+
+    trees = []
+    for d in sorted(os.listdir(".")):
+        m = re.match(r"^NVIDIA-Linux-(x86_64|x86)-([0-9.]+)$", d)
+        if not m or not os.path.isdir(d):
+            continue
+        arch, version = m.groups()
+        if version not in VERSIONS:
+            print "Skipping %s, untested version." % d
+            continue
+        trees.append((version, arch))
+    if not trees:
+        print USAGE
+        sys.exit(1)
+
+    for version, arch in trees:
+        tag = "%s-%s" % (version, arch)
+        stamp = input_stamp(version, arch)
+        if stamps.get(tag) == stamp and \
+                os.path.exists(os.path.join(store, tag, "MANIFEST")):
+            print "%s: unchanged, skipping" % tag
+            continue
+
+        print "%s:" % tag
+        extract(version, arch, StoreSink(store, tag))
+        stamps[tag] = stamp
+
+        # Written after each tree so that an interrupted run keeps what
+        # it finished.
+        with open(stamps_path + ".tmp", "w") as f:
+            for t in sorted(stamps):
+                f.write("%s %s\n" % (t, stamps[t]))
+        os.rename(stamps_path + ".tmp", stamps_path)
+
+def main():
+    parser = optparse.OptionParser(usage="%prog [--batch STORE]")
+    parser.add_option("--batch", metavar="STORE",
+                      help="extract all driver trees into STORE")
+    opts, args = parser.parse_args()
+
+    if opts.batch:
+        batch(opts.batch)
+        return
+
+    for (version, arch) in product(VERSIONS, ARCHES):
+        if os.path.exists(tree_dir(version, arch)):
+            break
+    else:
+        print USAGE
+        sys.exit(1)
+
+    extract(version, arch, DirSink(os.getcwd()))
+
+if __name__ == "__main__":
+    main()
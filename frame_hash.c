@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2013 Ilia Mirkin <imirkin@alum.mit.edu>
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <nmmintrin.h>
+
+#include "frame_hash.h"
+
+static uint32_t crc32c_table[256];
+static int have_sse42;
+
+__attribute__((constructor)) static void
+crc32c_init(void) {
+  uint32_t i, j;
+
+  for (i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (j = 0; j < 8; j++)
+      crc = (crc >> 1) ^ (0x82f63b78 & -(crc & 1));
+    crc32c_table[i] = crc;
+  }
+  have_sse42 = __builtin_cpu_supports("sse4.2");
+}
+
+__attribute__((target("sse4.2"))) static uint32_t
+crc32c_hw(uint32_t crc, const uint8_t *p, size_t len) {
+  uint64_t c = crc;
+
+  for (; len && ((uintptr_t)p & 7); len--)
+    c = _mm_crc32_u8(c, *p++);
+  for (; len >= 8; len -= 8, p += 8)
+    c = _mm_crc32_u64(c, *(const uint64_t *)p);
+  for (; len; len--)
+    c = _mm_crc32_u8(c, *p++);
+  return c;
+}
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len) {
+  const uint8_t *p = buf;
+
+  crc = ~crc;
+  if (have_sse42) {
+    crc = crc32c_hw(crc, p, len);
+  } else {
+    while (len--)
+      crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+struct plane_hash {
+  unsigned frame;
+  int plane;
+  uint32_t crc;
+};
+
+struct frame_check {
+  FILE *f;
+  int generate;
+  struct plane_hash *expected;
+  unsigned count, next;
+  unsigned checked, mismatches;
+  double seconds;
+};
+
+static const char *plane_names[] = { "Y", "UV", "U", "V" };
+
+static const char *
+plane_name(int plane) {
+  return plane >= 0 && plane < 4 ? plane_names[plane] : "?";
+}
+
+struct frame_check *frame_check_open(const char *path, int generate) {
+  struct frame_check *c = calloc(1, sizeof(*c));
+  unsigned alloced = 0;
+  struct plane_hash h;
+
+  assert(c);
+  c->generate = generate;
+  c->f = fopen(path, generate ? "w" : "r");
+  if (!c->f) {
+    perror(path);
+    free(c);
+    return NULL;
+  }
+  if (generate)
+    return c;
+
+  while (fscanf(c->f, "%u %d %" SCNx32, &h.frame, &h.plane, &h.crc) == 3) {
+    if (c->count == alloced) {
+      alloced = alloced ? alloced * 2 : 256;
+      c->expected = realloc(c->expected, alloced * sizeof(h));
+      assert(c->expected);
+    }
+    c->expected[c->count++] = h;
+  }
+  fclose(c->f);
+  c->f = NULL;
+  return c;
+}
+
+int frame_check_plane(struct frame_check *c, unsigned frame, int plane,
+                      const uint8_t *data, uint32_t width, uint32_t height,
+                      uint32_t pitch) {
+  struct timespec start, end;
+  uint32_t crc = 0, y;
+  const struct plane_hash *e;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (pitch == width) {
+    crc = crc32c(0, data, (size_t)width * height);
+  } else {
+    for (y = 0; y < height; y++)
+      crc = crc32c(crc, data + (size_t)y * pitch, width);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  c->seconds += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  c->checked++;
+
+  if (c->generate) {
+    fprintf(c->f, "%u %d %08" PRIx32 "\n", frame, plane, crc);
+    return 0;
+  }
+
+  e = c->next < c->count ? &c->expected[c->next] : NULL;
+  c->next++;
+  if (e && e->frame == frame && e->plane == plane && e->crc == crc)
+    return 0;
+
+  if (!c->mismatches++) {
+    if (!e || e->frame != frame || e->plane != plane)
+      fprintf(stderr, "First divergence: frame %u plane %s not in manifest\n",
+              frame, plane_name(plane));
+    else
+      fprintf(stderr, "First divergence: frame %u plane %s: "
+              "crc %08" PRIx32 ", expected %08" PRIx32 "\n",
+              frame, plane_name(plane), crc, e->crc);
+  }
+  return -1;
+}
+
+int frame_check_close(struct frame_check *c) {
+  int ret;
+
+  if (c->generate) {
+    if (fclose(c->f))
+      c->mismatches++;
+    fprintf(stderr, "Recorded %u plane hashes", c->checked);
+  } else {
+    if (c->next < c->count) {
+      if (!c->mismatches)
+        fprintf(stderr, "First divergence: frame %u plane %s missing from output\n",
+                c->expected[c->next].frame, plane_name(c->expected[c->next].plane));
+      c->mismatches += c->count - c->next;
+    }
+    fprintf(stderr, "Verified %u plane hashes, %u mismatches",
+            c->checked, c->mismatches);
+  }
+  fprintf(stderr, " (%.2f ms hashing)\n", c->seconds * 1000);
+
+  ret = c->mismatches;
+  free(c->expected);
+  free(c);
+  return ret;
+}
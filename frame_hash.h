@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2013 Ilia Mirkin <imirkin@alum.mit.edu>
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef FRAME_HASH_H
+#define FRAME_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* CRC32C (Castagnoli), using the SSE4.2 crc32 instruction when the CPU
+ * has it. */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+/* Per-plane hashes of every decoded frame, either written out to a
+ * manifest ("generate") or compared against one. The manifest is plain
+ * text, one "<frame> <plane> <crc32c>" line per plane. */
+struct frame_check;
+
+struct frame_check *frame_check_open(const char *path, int generate);
+
+/* Returns 0 if the plane matches (or is being recorded). Only the first
+ * mismatch is reported in detail. */
+int frame_check_plane(struct frame_check *c, unsigned frame, int plane,
+                      const uint8_t *data, uint32_t width, uint32_t height,
+                      uint32_t pitch);
+
+/* Prints a summary and returns the number of mismatching planes, also
+ * counting planes that were missing on either side. */
+int frame_check_close(struct frame_check *c);
+
+#endif
@@ -0,0 +1,590 @@
+/*
+ * Copyright (C) 2013 Ilia Mirkin <imirkin@alum.mit.edu>
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/* Stream statistics without decoding anything: NAL types, picture and
+ * slice types, GOP structure, reference usage and bitrate over time,
+ * from the NAL walker and slice header parser alone. Files are
+ * analyzed in parallel, and the results come out as text, CSV or
+ * JSON. */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "h264_parse.h"
+
+#undef NDEBUG
+#include <assert.h>
+
+/* The stream h264_player is hardcoded for, until an SPS comes along */
+#define LOG2_MAX_FRAME_NUM 9
+#define LOG2_MAX_POC_LSB 10
+
+/* Picture types, by the "largest" slice type in them */
+enum { PIC_I, PIC_P, PIC_B, PIC_TYPES };
+static const char pic_names[PIC_TYPES] = { 'I', 'P', 'B' };
+
+/* A GOP pattern is kept for the first GOP, up to this many pictures */
+#define PATTERN_MAX 64
+
+struct analysis {
+  const char *path;
+  int failed;
+
+  uint64_t bytes;
+  unsigned long nals[32];
+  uint64_t nal_bytes[32];
+  unsigned long slices[5];      /* by slice_type % 5 */
+  unsigned long pictures[PIC_TYPES], ref_pictures[PIC_TYPES];
+  unsigned long idr, recovery_points, fields;
+  unsigned long slices_max;     /* in one picture */
+  uint64_t picture_bytes_max[PIC_TYPES], picture_bytes[PIC_TYPES];
+  int width, height, profile_idc, level_idc, poc_type, entropy_coding;
+
+  /* GOPs run from IDR to IDR. The pattern is that of the first one
+   * that's complete: upper case for reference pictures. */
+  unsigned long gops, gop_min, gop_max, gop;
+  char pattern[PATTERN_MAX + 1];
+  int pattern_state; /* 0: no IDR yet, 1: recording, 2: done */
+
+  /* Bitrate counts every NAL, the ones between pictures (parameter
+   * sets, SEI, delimiters) with the picture after them. Time is kept
+   * in fields of -r frame rate. There are bytes per second, and the
+   * most bytes in any 1 s window of pictures. */
+  uint64_t stream_bytes, pending_bytes;
+  uint64_t *per_second;
+  unsigned seconds, seconds_alloced;
+  unsigned long ticks;
+  double time;
+  struct window_pic *window;
+  unsigned window_head, window_count, window_alloced;
+  uint64_t window_bytes, window_max;
+};
+
+struct window_pic {
+  unsigned long start; /* ticks */
+  uint64_t bytes;
+};
+
+static double fps = 24;
+static int annexb;
+
+struct picture {
+  int type;
+  int idr, ref;
+  unsigned slices;
+  uint64_t bytes;
+  int field;
+};
+
+static void
+gop_end(struct analysis *a) {
+  if (!a->gop)
+    return;
+  if (!a->gops || a->gop < a->gop_min)
+    a->gop_min = a->gop;
+  if (a->gop > a->gop_max)
+    a->gop_max = a->gop;
+  a->gops++;
+  a->gop = 0;
+}
+
+static void
+rate_add(struct analysis *a, uint64_t bytes) {
+  unsigned second = a->ticks / (2 * fps);
+
+  if (second >= a->seconds_alloced) {
+    unsigned n = a->seconds_alloced ? a->seconds_alloced : 64;
+    while (n <= second)
+      n *= 2;
+    a->per_second = realloc(a->per_second, n * sizeof(*a->per_second));
+    assert(a->per_second);
+    memset(a->per_second + a->seconds_alloced, 0,
+           (n - a->seconds_alloced) * sizeof(*a->per_second));
+    a->seconds_alloced = n;
+  }
+  a->per_second[second] += bytes;
+  a->seconds = second + 1;
+
+  if (a->window_head + a->window_count == a->window_alloced) {
+    if (a->window_head) {
+      memmove(a->window, a->window + a->window_head,
+              a->window_count * sizeof(*a->window));
+      a->window_head = 0;
+    } else {
+      a->window_alloced = a->window_alloced ? 2 * a->window_alloced : 64;
+      a->window = realloc(a->window, a->window_alloced * sizeof(*a->window));
+      assert(a->window);
+    }
+  }
+  a->window[a->window_head + a->window_count++] =
+    (struct window_pic){ a->ticks, bytes };
+  a->window_bytes += bytes;
+}
+
+/* The window ends at the current time. It only counts once it's a
+ * full second long. */
+static void
+window_update(struct analysis *a) {
+  double second_ticks = 2 * fps;
+
+  while (a->window_count &&
+         a->window[a->window_head].start + second_ticks < a->ticks) {
+    a->window_bytes -= a->window[a->window_head].bytes;
+    a->window_head++;
+    a->window_count--;
+  }
+  if (a->ticks >= second_ticks && a->window_bytes > a->window_max)
+    a->window_max = a->window_bytes;
+}
+
+static void
+picture_end(struct analysis *a, const struct picture *pic) {
+  size_t len;
+
+  a->pictures[pic->type]++;
+  a->ref_pictures[pic->type] += pic->ref;
+  a->picture_bytes[pic->type] += pic->bytes;
+  if (pic->bytes > a->picture_bytes_max[pic->type])
+    a->picture_bytes_max[pic->type] = pic->bytes;
+  if (pic->slices > a->slices_max)
+    a->slices_max = pic->slices;
+  a->fields += pic->field;
+
+  if (pic->idr) {
+    a->idr++;
+    gop_end(a);
+    if (a->pattern_state < 2)
+      a->pattern_state++;
+  }
+  a->gop++;
+  len = strlen(a->pattern);
+  if (a->pattern_state == 1 && len < PATTERN_MAX)
+    a->pattern[len] = pic_names[pic->type] + (pic->ref ? 0 : 'a' - 'A');
+
+  rate_add(a, pic->bytes + a->pending_bytes);
+  a->pending_bytes = 0;
+  /* Two fields make a frame */
+  a->ticks += pic->field ? 1 : 2;
+  a->time = a->ticks / (2 * fps);
+  window_update(a);
+}
+
+static void
+analyze(struct analysis *a) {
+  struct h264_sps sps = {
+    .log2_max_frame_num_minus4 = LOG2_MAX_FRAME_NUM - 4,
+    .log2_max_pic_order_cnt_lsb_minus4 = LOG2_MAX_POC_LSB - 4,
+    .frame_mbs_only_flag = 1,
+  };
+  struct h264_pps pps = { 0 };
+  struct h264_slice_params params;
+  h264_slice_header_fn parse_slice_header;
+  struct h264_nal nal, first_nal;
+  struct h264_slice_header sh, first;
+  struct picture pic = { 0 };
+  const uint8_t *addr;
+  struct stat st;
+  size_t pos = 0;
+  int fd, in_picture = 0;
+
+  fd = open(a->path, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) || st.st_size == 0) {
+    a->failed = 1;
+    if (fd >= 0)
+      close(fd);
+    return;
+  }
+  addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    a->failed = 1;
+    return;
+  }
+  /* One pass front to back; slice payloads are never touched */
+  madvise((void *)addr, st.st_size, MADV_SEQUENTIAL);
+  a->bytes = st.st_size;
+  a->width = a->height = -1;
+
+  h264_slice_params_init(&params, &sps, &pps);
+  parse_slice_header = h264_slice_header_parser(&params);
+
+  while (!(annexb ? h264_next_nal_annexb(addr, st.st_size, &pos, &nal)
+                  : h264_next_nal(addr, st.st_size, &pos, &nal))) {
+    a->nals[nal.type]++;
+    a->nal_bytes[nal.type] += nal.size;
+    a->stream_bytes += nal.size;
+
+    if (!h264_nal_is_slice(nal.type)) {
+      if (in_picture && h264_nal_starts_au(nal.type)) {
+        picture_end(a, &pic);
+        in_picture = 0;
+      }
+      /* NALs after the last picture go with it */
+      a->pending_bytes += nal.size;
+      if (nal.type == 7 || nal.type == 8) {
+        int err = nal.type == 7 ? h264_parse_sps(&nal, &sps) : h264_parse_pps(&nal, &pps);
+        if (!err) {
+          h264_slice_params_init(&params, &sps, &pps);
+          parse_slice_header = h264_slice_header_parser(&params);
+        }
+        if (nal.type == 7 && !err && a->width < 0) {
+          a->width = (sps.pic_width_in_mbs_minus1 + 1) * 16;
+          a->height = (sps.pic_height_in_map_units_minus1 + 1) * 16 *
+            (2 - sps.frame_mbs_only_flag);
+          a->profile_idc = sps.profile_idc;
+          a->level_idc = sps.level_idc;
+          a->poc_type = sps.pic_order_cnt_type;
+        }
+        if (nal.type == 8 && !err)
+          a->entropy_coding = pps.entropy_coding_mode_flag;
+      } else if (nal.type == 6 && h264_sei_recovery_point(&nal) >= 0) {
+        a->recovery_points++;
+      }
+      continue;
+    }
+
+    parse_slice_header(&nal, &params, &sh);
+    a->slices[sh.slice_type % 5]++;
+
+    if (in_picture && h264_new_picture(&first_nal, &first, &nal, &sh)) {
+      picture_end(a, &pic);
+      in_picture = 0;
+    }
+    if (!in_picture) {
+      in_picture = 1;
+      first_nal = nal;
+      first = sh;
+      pic = (struct picture){ .type = PIC_I, .idr = nal.type == 5,
+                              .ref = nal.ref_idc != 0,
+                              .field = sh.field_pic_flag };
+    }
+
+    pic.slices++;
+    pic.bytes += nal.size;
+    switch (sh.slice_type % 5) {
+    case 0:
+    case 3:
+      if (pic.type < PIC_P)
+        pic.type = PIC_P;
+      break;
+    case 1:
+      pic.type = PIC_B;
+      break;
+    }
+  }
+  if (in_picture)
+    picture_end(a, &pic);
+  gop_end(a);
+  if (a->seconds && a->pending_bytes) {
+    a->per_second[a->seconds - 1] += a->pending_bytes;
+    a->window_bytes += a->pending_bytes;
+    window_update(a);
+  }
+  free(a->window);
+
+  munmap((void *)addr, st.st_size);
+}
+
+static const char *nal_names[32] = {
+  [1] = "slice", [2] = "dpa", [3] = "dpb", [4] = "dpc", [5] = "idr",
+  [6] = "sei", [7] = "sps", [8] = "pps", [9] = "aud", [10] = "eoseq",
+  [11] = "eostream", [12] = "filler", [13] = "spsext", [19] = "aux",
+  [20] = "ext",
+};
+static const char *slice_names[5] = { "P", "B", "I", "SP", "SI" };
+
+static unsigned long
+pictures_total(const struct analysis *a) {
+  return a->pictures[PIC_I] + a->pictures[PIC_P] + a->pictures[PIC_B];
+}
+
+static double
+kbps(uint64_t bytes) {
+  return bytes * 8 / 1000.0;
+}
+
+static double
+duration(const struct analysis *a) {
+  return a->time > 0 ? a->time : 1 / fps;
+}
+
+static double
+kbps_average(const struct analysis *a) {
+  return kbps(a->stream_bytes) / duration(a);
+}
+
+/* A stream shorter than a second is one window, whose rate is the
+ * average */
+static double
+kbps_peak(const struct analysis *a) {
+  return a->time >= 1 ? kbps(a->window_max) : kbps_average(a);
+}
+
+/* The last second is usually cut short: its rate is over the part of
+ * it the stream covers */
+static double
+kbps_second(const struct analysis *a, unsigned i) {
+  double covered = a->time - i;
+
+  return kbps(a->per_second[i]) / (covered < 1 && covered > 0 ? covered : 1);
+}
+
+static void
+print_text(const struct analysis *a) {
+  unsigned long total = pictures_total(a);
+  int i;
+
+  printf("%s:\n", a->path);
+  if (a->width > 0)
+    printf("  %dx%d, profile %d, level %d.%d, POC type %d, %s\n",
+           a->width, a->height, a->profile_idc, a->level_idc / 10,
+           a->level_idc % 10, a->poc_type, a->entropy_coding ? "CABAC" : "CAVLC");
+  printf("  %lu pictures (%lu field), %.2f s at %g fps, %.1f kbit/s average, %.1f peak\n",
+         total, a->fields, a->time, fps, kbps_average(a), kbps_peak(a));
+  for (i = 0; i < PIC_TYPES; i++) {
+    if (!a->pictures[i])
+      continue;
+    printf("  %c: %lu pictures, %lu reference, %.0f bytes average, %llu max\n",
+           pic_names[i], a->pictures[i], a->ref_pictures[i],
+           (double)a->picture_bytes[i] / a->pictures[i],
+           (unsigned long long)a->picture_bytes_max[i]);
+  }
+  printf("  slices:");
+  for (i = 0; i < 5; i++)
+    if (a->slices[i])
+      printf(" %s %lu", slice_names[i], a->slices[i]);
+  printf(", up to %lu per picture\n", a->slices_max);
+  printf("  %lu IDR, %lu recovery point SEI", a->idr, a->recovery_points);
+  if (a->gops)
+    printf(", GOP %lu..%lu, %.1f average", a->gop_min, a->gop_max,
+           (double)total / a->gops);
+  printf("\n");
+  if (a->pattern[0])
+    printf("  first GOP: %s%s\n", a->pattern,
+           strlen(a->pattern) == PATTERN_MAX ? "..." : "");
+  printf("  NALs:");
+  for (i = 0; i < 32; i++)
+    if (a->nals[i])
+      printf(" %d%s%s%s %lu", i, nal_names[i] ? "(" : "",
+             nal_names[i] ? nal_names[i] : "", nal_names[i] ? ")" : "", a->nals[i]);
+  printf("\n");
+}
+
+static void
+print_csv_header(void) {
+  int i;
+
+  printf("file,bytes,width,height,profile,level,pictures,fields,seconds,"
+         "kbps_avg,kbps_peak,idr,recovery_points,gops,gop_min,gop_max");
+  for (i = 0; i < PIC_TYPES; i++)
+    printf(",%c_pictures,%c_ref,%c_bytes_avg,%c_bytes_max", pic_names[i],
+           pic_names[i], pic_names[i], pic_names[i]);
+  for (i = 0; i < 5; i++)
+    printf(",%s_slices", slice_names[i]);
+  printf(",slices_max");
+  for (i = 0; i < 32; i++)
+    printf(",nal%d", i);
+  printf(",pattern\n");
+}
+
+static void
+print_csv(const struct analysis *a) {
+  int i;
+
+  printf("%s,%llu,%d,%d,%d,%d,%lu,%lu,%.3f,%.1f,%.1f,%lu,%lu,%lu,%lu,%lu",
+         a->path, (unsigned long long)a->bytes, a->width, a->height,
+         a->profile_idc, a->level_idc, pictures_total(a), a->fields, a->time,
+         kbps_average(a), kbps_peak(a), a->idr,
+         a->recovery_points, a->gops, a->gop_min, a->gop_max);
+  for (i = 0; i < PIC_TYPES; i++)
+    printf(",%lu,%lu,%.0f,%llu", a->pictures[i], a->ref_pictures[i],
+           a->pictures[i] ? (double)a->picture_bytes[i] / a->pictures[i] : 0.0,
+           (unsigned long long)a->picture_bytes_max[i]);
+  for (i = 0; i < 5; i++)
+    printf(",%lu", a->slices[i]);
+  printf(",%lu", a->slices_max);
+  for (i = 0; i < 32; i++)
+    printf(",%lu", a->nals[i]);
+  printf(",%s\n", a->pattern);
+}
+
+/* Paths are the only strings that can need escaping */
+static void
+print_json_string(const char *s) {
+  putchar('"');
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\')
+      printf("\\%c", *s);
+    else if ((unsigned char)*s < 0x20)
+      printf("\\u%04x", *s);
+    else
+      putchar(*s);
+  }
+  putchar('"');
+}
+
+static void
+print_json(const struct analysis *a, int first) {
+  const char *sep = "";
+  unsigned i;
+
+  printf("%s  {\n    \"file\": ", first ? "" : ",\n");
+  print_json_string(a->path);
+  printf(",\n    \"bytes\": %llu, \"width\": %d, \"height\": %d, "
+         "\"profile\": %d, \"level\": %d,\n",
+         (unsigned long long)a->bytes, a->width, a->height, a->profile_idc, a->level_idc);
+  printf("    \"pictures\": %lu, \"fields\": %lu, \"seconds\": %.3f, "
+         "\"kbps_avg\": %.1f, \"kbps_peak\": %.1f,\n",
+         pictures_total(a), a->fields, a->time, kbps_average(a), kbps_peak(a));
+  printf("    \"idr\": %lu, \"recovery_points\": %lu, "
+         "\"gop\": { \"count\": %lu, \"min\": %lu, \"max\": %lu, \"pattern\": \"%s\" },\n",
+         a->idr, a->recovery_points, a->gops, a->gop_min, a->gop_max, a->pattern);
+  printf("    \"picture_types\": {");
+  for (i = 0; i < PIC_TYPES; i++) {
+    printf("%s \"%c\": { \"count\": %lu, \"ref\": %lu, \"bytes\": %llu, \"bytes_max\": %llu }",
+           i ? "," : "", pic_names[i], a->pictures[i], a->ref_pictures[i],
+           (unsigned long long)a->picture_bytes[i],
+           (unsigned long long)a->picture_bytes_max[i]);
+  }
+  printf(" },\n    \"slice_types\": {");
+  for (i = 0; i < 5; i++)
+    printf("%s \"%s\": %lu", i ? "," : "", slice_names[i], a->slices[i]);
+  printf(" }, \"slices_max\": %lu,\n    \"nal_types\": {", a->slices_max);
+  for (i = 0; i < 32; i++) {
+    if (!a->nals[i])
+      continue;
+    printf("%s \"%u\": { \"count\": %lu, \"bytes\": %llu }", sep, i,
+           a->nals[i], (unsigned long long)a->nal_bytes[i]);
+    sep = ",";
+  }
+  printf(" },\n    \"kbps_per_second\": [");
+  for (i = 0; i < a->seconds; i++)
+    printf("%s%.1f", i ? ", " : "", kbps_second(a, i));
+  printf("]\n  }");
+}
+
+static struct analysis *analyses;
+static unsigned analysis_count, analysis_next;
+static pthread_mutex_t next_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Workers take the next file until there are none left */
+static void *
+worker(void *arg) {
+  for (;;) {
+    unsigned i;
+
+    pthread_mutex_lock(&next_lock);
+    i = analysis_next++;
+    pthread_mutex_unlock(&next_lock);
+    if (i >= analysis_count)
+      return NULL;
+    analyze(&analyses[i]);
+  }
+}
+
+int main(int argc, char **argv) {
+  enum { TEXT, CSV, JSON } format = TEXT;
+  long threads = sysconf(_SC_NPROCESSORS_ONLN);
+  pthread_t *tids;
+  int opt, failed = 0, printed = 0;
+  unsigned i;
+
+  while ((opt = getopt(argc, argv, "f:j:r:a")) != -1) {
+    switch (opt) {
+    case 'f':
+      if (!strcmp(optarg, "csv"))
+        format = CSV;
+      else if (!strcmp(optarg, "json"))
+        format = JSON;
+      else
+        assert(!strcmp(optarg, "text"));
+      break;
+    case 'j':
+      threads = atoi(optarg);
+      break;
+    case 'r':
+      fps = atof(optarg);
+      assert(fps > 0);
+      break;
+    case 'a':
+      annexb = 1;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-f text|csv|json] [-j threads] [-r fps] [-a] files...\n", argv[0]);
+      return 1;
+    }
+  }
+  if (optind == argc) {
+    fprintf(stderr, "Usage: %s [-f text|csv|json] [-j threads] [-r fps] [-a] files...\n", argv[0]);
+    return 1;
+  }
+
+  analysis_count = argc - optind;
+  analyses = calloc(analysis_count, sizeof(*analyses));
+  assert(analyses);
+  for (i = 0; i < analysis_count; i++)
+    analyses[i].path = argv[optind + i];
+
+  if (threads < 1)
+    threads = 1;
+  if (threads > analysis_count)
+    threads = analysis_count;
+  tids = calloc(threads, sizeof(*tids));
+  assert(tids);
+  for (i = 0; i < threads; i++)
+    assert(!pthread_create(&tids[i], NULL, worker, NULL));
+  for (i = 0; i < threads; i++)
+    pthread_join(tids[i], NULL);
+
+  if (format == CSV)
+    print_csv_header();
+  if (format == JSON)
+    printf("[\n");
+  for (i = 0; i < analysis_count; i++) {
+    const struct analysis *a = &analyses[i];
+
+    if (a->failed) {
+      fprintf(stderr, "%s: can't read\n", a->path);
+      failed = 1;
+      continue;
+    }
+    if (format == TEXT)
+      print_text(a);
+    else if (format == CSV)
+      print_csv(a);
+    else
+      print_json(a, !printed);
+    printed++;
+  }
+  if (format == JSON)
+    printf("%s]\n", printed ? "\n" : "");
+  return failed;
+}
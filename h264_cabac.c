@@ -0,0 +1,735 @@
+/*
+ * Copyright (C) 2013 Ilia Mirkin <imirkin@alum.mit.edu>
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "h264_cabac.h"
+
+/* Table 9-44 */
+const uint8_t h264_cabac_lps_range[64][4] = {
+  { 128, 176, 208, 240 }, { 128, 167, 197, 227 }, { 128, 158, 187, 216 },
+  { 123, 150, 178, 205 }, { 116, 142, 169, 195 }, { 111, 135, 160, 185 },
+  { 105, 128, 152, 175 }, { 100, 122, 144, 166 }, {  95, 116, 137, 158 },
+  {  90, 110, 130, 150 }, {  85, 104, 123, 142 }, {  81,  99, 117, 135 },
+  {  77,  94, 111, 128 }, {  73,  89, 105, 122 }, {  69,  85, 100, 116 },
+  {  66,  80,  95, 110 }, {  62,  76,  90, 104 }, {  59,  72,  86,  99 },
+  {  56,  69,  81,  94 }, {  53,  65,  77,  89 }, {  51,  62,  73,  85 },
+  {  48,  59,  69,  80 }, {  46,  56,  66,  76 }, {  43,  53,  63,  72 },
+  {  41,  50,  59,  69 }, {  39,  48,  56,  65 }, {  37,  45,  54,  62 },
+  {  35,  43,  51,  59 }, {  33,  41,  48,  56 }, {  32,  39,  46,  53 },
+  {  30,  37,  43,  50 }, {  29,  35,  41,  48 }, {  27,  33,  39,  45 },
+  {  26,  31,  37,  43 }, {  24,  30,  35,  41 }, {  23,  28,  33,  39 },
+  {  22,  27,  32,  37 }, {  21,  26,  30,  35 }, {  20,  24,  29,  33 },
+  {  19,  23,  27,  31 }, {  18,  22,  26,  30 }, {  17,  21,  25,  28 },
+  {  16,  20,  23,  27 }, {  15,  19,  22,  25 }, {  14,  18,  21,  24 },
+  {  14,  17,  20,  23 }, {  13,  16,  19,  22 }, {  12,  15,  18,  21 },
+  {  12,  14,  17,  20 }, {  11,  14,  16,  19 }, {  11,  13,  15,  18 },
+  {  10,  12,  15,  17 }, {  10,  12,  14,  16 }, {   9,  11,  13,  15 },
+  {   9,  11,  12,  14 }, {   8,  10,  12,  14 }, {   8,   9,  11,  13 },
+  {   7,   9,  11,  12 }, {   7,   9,  10,  12 }, {   7,   8,  10,  11 },
+  {   6,   8,   9,  11 }, {   6,   7,   9,  10 }, {   6,   7,   8,   9 },
+  {   2,   2,   2,   2 },
+};
+
+/* Table 9-45 */
+static const uint8_t trans_idx_lps[64] = {
+   0,  0,  1,  2,  2,  4,  4,  5,  6,  7,  8,  9,  9, 11, 11, 12,
+  13, 13, 15, 15, 16, 16, 18, 18, 19, 19, 21, 21, 22, 22, 23, 24,
+  24, 25, 26, 26, 27, 27, 28, 29, 29, 30, 30, 30, 31, 32, 32, 33,
+  33, 33, 34, 34, 35, 35, 35, 36, 36, 36, 37, 37, 37, 38, 38, 63,
+};
+
+/* Filled in from Table 9-45 below, with valMPS folded in */
+uint8_t h264_cabac_next_state[2][128];
+
+__attribute__((constructor)) static void
+next_state_init(void) {
+  uint8_t (*next)[128] = h264_cabac_next_state;
+  int s, mps;
+
+  for (s = 0; s < 64; s++) {
+    for (mps = 0; mps < 2; mps++) {
+      int mps_state = s < 62 ? s + 1 : s;
+      int lps_mps = s == 0 ? !mps : mps;
+
+      next[0][s << 1 | mps] = mps_state << 1 | mps;
+      next[1][s << 1 | mps] = trans_idx_lps[s] << 1 | lps_mps;
+    }
+  }
+}
+
+void h264_cabac_init(struct h264_cabac *c, const uint8_t *data, size_t len) {
+  c->start = data;
+  c->p = data;
+  c->end = data + len;
+  c->cache = 0;
+  c->bits = 0;
+  h264_cabac_refill(c);
+  c->range = 510;
+  c->offset = h264_cabac_take(c, 9);
+}
+
+uint8_t h264_cabac_context(int m, int n, int slice_qp) {
+  int qp = slice_qp < 0 ? 0 : slice_qp > 51 ? 51 : slice_qp;
+  int pre = ((m * qp) >> 4) + n;
+
+  if (pre < 1)
+    pre = 1;
+  else if (pre > 126)
+    pre = 126;
+  if (pre <= 63)
+    return (63 - pre) << 1;
+  return (pre - 64) << 1 | 1;
+}
+
+/* (m, n) for I slices, Tables 9-12 to 9-25. 11..59 are P/B only,
+ * 277..398 field coding and 4:4:4. */
+static const int8_t init_i[H264_CABAC_CTX_I][2] = {
+  /* 0..10: mb_type SI prefix, mb_type I */
+  { 20, -15 }, { 2, 54 }, { 3, 74 }, { 20, -15 }, { 2, 54 }, { 3, 74 },
+  { -28, 127 }, { -23, 104 }, { -6, 53 }, { -1, 54 }, { 7, 51 },
+  /* 60..69: mb_qp_delta, intra_chroma_pred_mode, intra 4x4 modes */
+  [60] =
+  { 0, 41 }, { 0, 63 }, { 0, 63 }, { 0, 63 }, { -9, 83 }, { 4, 86 },
+  { 0, 97 }, { -7, 72 }, { 13, 41 }, { 3, 62 },
+  /* 70..72: mb_field_decoding_flag */
+  { 0, 11 }, { 1, 55 }, { 0, 69 },
+  /* 73..84: coded_block_pattern */
+  { -17, 127 }, { -13, 102 }, { 0, 82 }, { -7, 74 }, { -21, 107 },
+  { -27, 127 }, { -31, 127 }, { -24, 127 }, { -18, 95 }, { -27, 127 },
+  { -21, 114 }, { -30, 127 },
+  /* 85..104: coded_block_flag */
+  { -17, 123 }, { -12, 115 }, { -16, 122 }, { -11, 115 }, { -12, 63 },
+  { -2, 68 }, { -15, 84 }, { -13, 104 }, { -3, 70 }, { -8, 93 },
+  { -10, 90 }, { -30, 127 }, { -1, 74 }, { -6, 97 }, { -7, 91 },
+  { -20, 127 }, { -4, 56 }, { -5, 82 }, { -7, 76 }, { -22, 125 },
+  /* 105..165: significant_coeff_flag */
+  { -7, 93 }, { -11, 87 }, { -3, 77 }, { -5, 71 }, { -4, 63 },
+  { -4, 68 }, { -12, 84 }, { -7, 62 }, { -7, 65 }, { 8, 61 },
+  { 5, 56 }, { -2, 66 }, { 1, 64 }, { 0, 61 }, { -2, 78 },
+  { 1, 50 }, { 7, 52 }, { 10, 35 }, { 0, 44 }, { 11, 38 },
+  { 1, 45 }, { 0, 46 }, { 5, 44 }, { 31, 17 }, { 1, 51 },
+  { 7, 50 }, { 28, 19 }, { 16, 33 }, { 14, 62 }, { -13, 108 },
+  { -15, 100 }, { -13, 101 }, { -13, 91 }, { -12, 94 }, { -10, 88 },
+  { -16, 84 }, { -10, 86 }, { -7, 83 }, { -13, 87 }, { -19, 94 },
+  { 1, 70 }, { 0, 72 }, { -5, 74 }, { 18, 59 }, { -8, 102 },
+  { -15, 100 }, { 0, 95 }, { -4, 75 }, { 2, 72 }, { -11, 75 },
+  { -3, 71 }, { 15, 46 }, { -13, 69 }, { 0, 62 }, { 0, 65 },
+  { 21, 37 }, { -15, 72 }, { 9, 57 }, { 16, 54 }, { 0, 62 },
+  { 12, 72 },
+  /* 166..226: last_significant_coeff_flag */
+  { 24, 0 }, { 15, 9 }, { 8, 25 }, { 13, 18 }, { 15, 9 },
+  { 13, 19 }, { 10, 37 }, { 12, 18 }, { 6, 29 }, { 20, 33 },
+  { 15, 30 }, { 4, 45 }, { 1, 58 }, { 0, 62 }, { 7, 61 },
+  { 12, 38 }, { 11, 45 }, { 15, 39 }, { 11, 42 }, { 13, 44 },
+  { 16, 45 }, { 12, 41 }, { 10, 49 }, { 30, 34 }, { 18, 42 },
+  { 10, 55 }, { 17, 51 }, { 17, 46 }, { 0, 89 }, { 26, -19 },
+  { 22, -17 }, { 26, -17 }, { 30, -25 }, { 28, -20 }, { 33, -23 },
+  { 37, -27 }, { 33, -23 }, { 40, -28 }, { 38, -17 }, { 33, -11 },
+  { 40, -15 }, { 41, -6 }, { 38, 1 }, { 41, 17 }, { 30, -6 },
+  { 27, 3 }, { 26, 22 }, { 37, -16 }, { 35, -4 }, { 38, -8 },
+  { 38, -3 }, { 37, 3 }, { 38, 5 }, { 42, 0 }, { 35, 16 },
+  { 39, 22 }, { 14, 48 }, { 27, 37 }, { 21, 60 }, { 12, 68 },
+  { 2, 97 },
+  /* 227..275: coeff_abs_level_minus1 */
+  { -3, 71 }, { -6, 42 }, { -5, 50 }, { -3, 54 }, { -2, 62 },
+  { 0, 58 }, { 1, 63 }, { -2, 72 }, { -1, 74 }, { -9, 91 },
+  { -5, 67 }, { -5, 27 }, { -3, 39 }, { -2, 44 }, { 0, 46 },
+  { -16, 64 }, { -8, 68 }, { -10, 78 }, { -6, 77 }, { -10, 86 },
+  { -12, 92 }, { -15, 55 }, { -10, 60 }, { -6, 62 }, { -4, 65 },
+  { -12, 73 }, { -8, 76 }, { -7, 80 }, { -9, 88 }, { -17, 110 },
+  { -11, 97 }, { -20, 84 }, { -11, 79 }, { -6, 73 }, { -4, 74 },
+  { -13, 86 }, { -13, 96 }, { -11, 97 }, { -19, 117 }, { -8, 78 },
+  { -5, 33 }, { -4, 48 }, { -2, 53 }, { -3, 62 }, { -13, 71 },
+  { -10, 79 }, { -12, 86 }, { -13, 90 }, { -14, 97 },
+  /* 399..401: transform_size_8x8_flag */
+  [399] =
+  { 31, 21 }, { 31, 31 }, { 25, 50 },
+  /* 402..416: significant_coeff_flag, 8x8 frame blocks */
+  { -17, 120 }, { -20, 112 }, { -18, 114 }, { -11, 85 }, { -15, 92 },
+  { -14, 89 }, { -26, 71 }, { -15, 81 }, { -14, 80 }, { 0, 68 },
+  { -14, 70 }, { -24, 56 }, { -23, 68 }, { -24, 50 }, { -11, 74 },
+  /* 417..425: last_significant_coeff_flag, 8x8 frame blocks */
+  { 23, -13 }, { 26, -13 }, { 40, -15 }, { 49, -14 }, { 44, 3 },
+  { 45, 6 }, { 44, 34 }, { 33, 54 }, { 19, 82 },
+  /* 426..435: coeff_abs_level_minus1, 8x8 blocks */
+  { -3, 75 }, { -1, 23 }, { 1, 34 }, { 1, 43 }, { 0, 54 },
+  { -2, 55 }, { 0, 61 }, { 1, 64 }, { 0, 68 }, { -9, 92 },
+  /* 436..459: significant and last flags of 8x8 field blocks */
+  { -14, 106 }, { -13, 97 }, { -15, 90 }, { -12, 90 }, { -18, 88 },
+  { -10, 73 }, { -9, 79 }, { -14, 86 }, { -10, 73 }, { -10, 70 },
+  { -10, 69 }, { -5, 66 }, { -9, 64 }, { -5, 58 }, { 2, 59 },
+  { 21, -10 }, { 24, -11 }, { 28, -8 }, { 28, -1 }, { 29, 3 },
+  { 29, 9 }, { 35, 20 }, { 29, 36 }, { 14, 67 },
+};
+
+/* ctxIdxOffset, Table 9-34 */
+#define CTX_MB_TYPE_I      3
+#define CTX_QP_DELTA       60
+#define CTX_CHROMA_PRED    64
+#define CTX_PREV_INTRA4X4  68
+#define CTX_REM_INTRA4X4   69
+#define CTX_CBP_LUMA       73
+#define CTX_CBP_CHROMA     77
+#define CTX_CODED_BLOCK    85
+#define CTX_SIGNIFICANT    105
+#define CTX_LAST           166
+#define CTX_ABS_LEVEL      227
+#define CTX_TRANSFORM_8X8  399
+
+/* ctxBlockCat: luma DC, luma AC, luma 4x4, chroma DC, chroma AC, luma
+ * 8x8 */
+enum {
+  CAT_LUMA_DC, CAT_LUMA_AC, CAT_LUMA_4X4, CAT_CHROMA_DC, CAT_CHROMA_AC,
+  CAT_LUMA_8X8,
+};
+
+/* ctxBlockCatOffset, Table 9-40. Luma 8x8 blocks have ctxIdxOffsets of
+ * their own (402, 417 and 426), folded in here; their coded_block_flag
+ * is only there for 4:4:4. */
+static const uint8_t cat_offset_cbf[6] = { 0, 4, 8, 12, 16 };
+static const uint16_t cat_offset_sig[6] = { 0, 15, 29, 44, 47, 402 - CTX_SIGNIFICANT };
+static const uint16_t cat_offset_last[6] = { 0, 15, 29, 44, 47, 417 - CTX_LAST };
+static const uint16_t cat_offset_abs[6] = { 0, 10, 20, 30, 39, 426 - CTX_ABS_LEVEL };
+
+/* ctxIdxInc of significant_coeff_flag and last_significant_coeff_flag
+ * in 8x8 frame blocks, by levelListIdx (Table 9-43) */
+static const uint8_t sig_inc_8x8[63] = {
+   0,  1,  2,  3,  4,  5,  5,  4,  4,  3,  3,  4,  4,  4,  5,  5,
+   4,  4,  4,  4,  3,  3,  6,  7,  7,  7,  8,  9, 10,  9,  8,  7,
+   7,  6, 11, 12, 13, 11,  6,  7,  8,  9, 14, 10,  9,  8,  6, 11,
+  12, 13, 11,  6,  9, 14, 10,  9, 11, 12, 13, 11, 14, 10, 12,
+};
+
+static const uint8_t last_inc_8x8[63] = {
+  0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+  3, 3, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4,
+  5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7, 8, 8, 8,
+};
+
+/* Luma blkIdx to and from 4x4 block coordinates in the MB */
+static inline int blk_x(int blk) { return (blk & 1) | ((blk >> 1) & 2); }
+static inline int blk_y(int blk) { return ((blk >> 1) & 1) | ((blk >> 2) & 2); }
+static inline int blk_idx(int x, int y) {
+  return (x & 1) | (y & 1) << 1 | (x & 2) << 1 | (y & 2) << 2;
+}
+
+int h264_cabac_picture_init(struct h264_cabac_picture *pic,
+                            const struct h264_sps *sps) {
+  if (!sps->frame_mbs_only_flag || sps->chroma_format_idc != 1)
+    return -1;
+  pic->width_mbs = sps->pic_width_in_mbs_minus1 + 1;
+  pic->mb_count = pic->width_mbs * (sps->pic_height_in_map_units_minus1 + 1);
+  pic->mbs = calloc(pic->mb_count, sizeof(*pic->mbs));
+  pic->slices = 0;
+  return pic->mbs ? 0 : -1;
+}
+
+void h264_cabac_picture_reset(struct h264_cabac_picture *pic) {
+  memset(pic->mbs, 0, pic->mb_count * sizeof(*pic->mbs));
+  pic->slices = 0;
+}
+
+void h264_cabac_picture_free(struct h264_cabac_picture *pic) {
+  free(pic->mbs);
+  pic->mbs = NULL;
+}
+
+/* The rest of the slice header (7.3.3) of an I slice. Returns the bit
+ * offset of slice_data() in rbsp, -1 for anything else. */
+static int
+slice_header_i(const uint8_t *rbsp, size_t len, int nal_type, int ref_idc,
+               const struct h264_sps *sps, const struct h264_pps *pps,
+               unsigned *first_mb, int *slice_qp) {
+  int bit_offset = 0, slice_type;
+
+  *first_mb = ue(rbsp, &bit_offset);
+  slice_type = ue(rbsp, &bit_offset) % 5;
+  if (slice_type != 2)
+    return -1;
+  ue(rbsp, &bit_offset); /* pic_parameter_set_id */
+  read_bits(rbsp, &bit_offset, sps->log2_max_frame_num_minus4 + 4);
+  if (nal_type == 5)
+    ue(rbsp, &bit_offset); /* idr_pic_id */
+  if (sps->pic_order_cnt_type == 0) {
+    read_bits(rbsp, &bit_offset, sps->log2_max_pic_order_cnt_lsb_minus4 + 4);
+    if (pps->pic_order_present_flag)
+      se(rbsp, &bit_offset);
+  } else if (sps->pic_order_cnt_type == 1 &&
+             !sps->delta_pic_order_always_zero_flag) {
+    se(rbsp, &bit_offset);
+    if (pps->pic_order_present_flag)
+      se(rbsp, &bit_offset);
+  }
+  if (pps->redundant_pic_cnt_present_flag)
+    ue(rbsp, &bit_offset);
+
+  /* dec_ref_pic_marking() */
+  if (ref_idc) {
+    if (nal_type == 5) {
+      read_bits(rbsp, &bit_offset, 2);
+    } else if (read_bit(rbsp, &bit_offset)) {
+      int mmco;
+
+      while ((mmco = ue(rbsp, &bit_offset)) != 0) {
+        if (mmco == 1 || mmco == 3)
+          ue(rbsp, &bit_offset); /* difference_of_pic_nums_minus1 */
+        if (mmco == 2)
+          ue(rbsp, &bit_offset); /* long_term_pic_num */
+        if (mmco == 3 || mmco == 6)
+          ue(rbsp, &bit_offset); /* long_term_frame_idx */
+        if (mmco == 4)
+          ue(rbsp, &bit_offset); /* max_long_term_frame_idx_plus1 */
+        if (bit_offset > (int)len * 8)
+          return -1;
+      }
+    }
+  }
+
+  *slice_qp = 26 + pps->pic_init_qp_minus26 + se(rbsp, &bit_offset);
+  if (pps->deblocking_filter_control_present_flag &&
+      ue(rbsp, &bit_offset) != 1) {
+    se(rbsp, &bit_offset);
+    se(rbsp, &bit_offset);
+  }
+
+  /* cabac_alignment_one_bit */
+  bit_offset = (bit_offset + 7) & ~7;
+  if (bit_offset > (int)len * 8 || *slice_qp < 0 || *slice_qp > 51)
+    return -1;
+  return bit_offset;
+}
+
+int h264_cabac_slice_start(struct h264_cabac_slice *s,
+                           struct h264_cabac_picture *pic,
+                           const struct h264_sps *sps,
+                           const struct h264_pps *pps,
+                           const struct h264_nal *nal) {
+  int offset, qp, i;
+  unsigned first_mb;
+  size_t stop;
+
+  if (!pps->entropy_coding_mode_flag || nal->size < 2)
+    return -1;
+
+  /* The bit readers may look a few bytes past the end */
+  s->rbsp = calloc(nal->size + 8, 1);
+  if (!s->rbsp)
+    return -1;
+  s->len = h264_unescape(s->rbsp, nal->data + 1, nal->size - 1);
+
+  /* rbsp_stop_one_bit: the last 1, before any cabac_zero_words */
+  for (stop = s->len; stop > 0 && !s->rbsp[stop - 1]; stop--)
+    ;
+  offset = stop ? slice_header_i(s->rbsp, s->len, nal->type, nal->ref_idc,
+                                 sps, pps, &first_mb, &qp) : -1;
+  if (offset < 0 || first_mb >= pic->mb_count) {
+    free(s->rbsp);
+    s->rbsp = NULL;
+    return -1;
+  }
+  s->stop_bit = stop * 8 - 1 - __builtin_ctz(s->rbsp[stop - 1]);
+
+  for (i = 0; i < H264_CABAC_CTX_I; i++)
+    s->ctx[i] = h264_cabac_context(init_i[i][0], init_i[i][1], qp);
+  h264_cabac_init(&s->c, s->rbsp + offset / 8, s->len - offset / 8);
+  s->pic = pic;
+  s->slice = ++pic->slices;
+  s->addr = first_mb;
+  s->qp = qp;
+  s->last_qp_delta = 0;
+  s->transform_8x8_mode = pps->transform_8x8_mode_flag;
+  return 0;
+}
+
+void h264_cabac_slice_end(struct h264_cabac_slice *s) {
+  free(s->rbsp);
+  s->rbsp = NULL;
+}
+
+/* Left and top neighbours (6.4.9), NULL when in another slice or
+ * outside the picture */
+static inline const struct h264_cabac_mb_info *
+mb_left(const struct h264_cabac_slice *s) {
+  const struct h264_cabac_mb_info *n = &s->pic->mbs[s->addr - 1];
+  return s->addr % s->pic->width_mbs && n->slice == s->slice ? n : NULL;
+}
+
+static inline const struct h264_cabac_mb_info *
+mb_top(const struct h264_cabac_slice *s) {
+  const struct h264_cabac_mb_info *n;
+
+  if (s->addr < s->pic->width_mbs)
+    return NULL;
+  n = &s->pic->mbs[s->addr - s->pic->width_mbs];
+  return n->slice == s->slice ? n : NULL;
+}
+
+/* 9.3.3.1.1.3, for I slices */
+static int
+mb_type_i(struct h264_cabac_slice *s, const struct h264_cabac_mb_info *a,
+          const struct h264_cabac_mb_info *b) {
+  uint8_t *ctx = s->ctx + CTX_MB_TYPE_I;
+  int inc = (a && a->type != H264_MB_I_NXN) + (b && b->type != H264_MB_I_NXN);
+  int t;
+
+  if (!h264_cabac_decision(&s->c, &ctx[inc]))
+    return H264_MB_I_NXN;
+  if (h264_cabac_terminate(&s->c))
+    return H264_MB_I_PCM;
+  t = 1 + 12 * h264_cabac_decision(&s->c, &ctx[3]);
+  if (h264_cabac_decision(&s->c, &ctx[4]))
+    t += 4 + 4 * h264_cabac_decision(&s->c, &ctx[5]);
+  t += 2 * h264_cabac_decision(&s->c, &ctx[6]);
+  t += h264_cabac_decision(&s->c, &ctx[7]);
+  return t;
+}
+
+/* 9.3.3.1.1.8: TU with cMax 3 */
+static int
+chroma_pred_mode(struct h264_cabac_slice *s, const struct h264_cabac_mb_info *a,
+                 const struct h264_cabac_mb_info *b) {
+  uint8_t *ctx = s->ctx + CTX_CHROMA_PRED;
+  int inc = (a && a->chroma_pred_mode) + (b && b->chroma_pred_mode);
+  int mode = 0;
+
+  if (!h264_cabac_decision(&s->c, &ctx[inc]))
+    return 0;
+  while (++mode < 3 && h264_cabac_decision(&s->c, &ctx[3]))
+    ;
+  return mode;
+}
+
+/* 9.3.3.1.1.4: FL luma prefix, one bin per 8x8 quadrant, then TU chroma
+ * suffix. Unavailable neighbours count as luma coded and chroma not,
+ * I_PCM ones were stored as 0x2f. */
+static int
+coded_block_pattern(struct h264_cabac_slice *s,
+                    const struct h264_cabac_mb_info *a,
+                    const struct h264_cabac_mb_info *b) {
+  uint8_t *ctx = s->ctx + CTX_CBP_LUMA;
+  int cbp_a = a ? a->cbp : 0x0f, cbp_b = b ? b->cbp : 0x0f;
+  int luma = 0, chroma_a = cbp_a >> 4, chroma_b = cbp_b >> 4, inc;
+
+  luma |= h264_cabac_decision(&s->c, &ctx[!(cbp_a & 2) + 2 * !(cbp_b & 4)]);
+  luma |= h264_cabac_decision(&s->c, &ctx[!(luma & 1) + 2 * !(cbp_b & 8)]) << 1;
+  luma |= h264_cabac_decision(&s->c, &ctx[!(cbp_a & 8) + 2 * !(luma & 1)]) << 2;
+  luma |= h264_cabac_decision(&s->c, &ctx[!(luma & 4) + 2 * !(luma & 2)]) << 3;
+
+  ctx = s->ctx + CTX_CBP_CHROMA;
+  inc = (chroma_a != 0) + 2 * (chroma_b != 0);
+  if (!h264_cabac_decision(&s->c, &ctx[inc]))
+    return luma;
+  inc = 4 + (chroma_a == 2) + 2 * (chroma_b == 2);
+  return (1 + h264_cabac_decision(&s->c, &ctx[inc])) << 4 | luma;
+}
+
+/* 9.3.3.1.1.5: mapped to unsigned, unary */
+static int
+mb_qp_delta(struct h264_cabac_slice *s) {
+  uint8_t *ctx = s->ctx + CTX_QP_DELTA;
+  int k = 0;
+
+  if (!h264_cabac_decision(&s->c, &ctx[s->last_qp_delta != 0]))
+    return 0;
+  k = 1;
+  while (h264_cabac_decision(&s->c, &ctx[k == 1 ? 2 : 3])) {
+    /* 52 values, anything past that is garbage */
+    if (++k > 52)
+      return 0x7fff;
+  }
+  return k & 1 ? (k + 1) / 2 : -(k / 2);
+}
+
+/* coded_block_flag of a neighbouring block, for an intra MB: 1 if
+ * that MB isn't available or is I_PCM. */
+static inline int
+cbf_cond(const struct h264_cabac_mb_info *n, uint32_t bit) {
+  return !n || n->type == H264_MB_I_PCM || (n->coded & bit);
+}
+
+/* 9.3.3.1.1.10: whether the neighbours used the 8x8 transform */
+static int
+transform_size_8x8_flag(struct h264_cabac_slice *s,
+                        const struct h264_cabac_mb_info *a,
+                        const struct h264_cabac_mb_info *b) {
+  int inc = (a && a->transform_8x8) + (b && b->transform_8x8);
+
+  return h264_cabac_decision(&s->c, &s->ctx[CTX_TRANSFORM_8X8 + inc]);
+}
+
+/* residual_block_cabac(): coded_block_flag, significance map, then the
+ * levels in reverse. Returns coded_block_flag. */
+static int
+residual_block(struct h264_cabac_slice *s, int cat, int cbf_inc,
+               int16_t *coeff, int first, int max) {
+  struct h264_cabac *c = &s->c;
+  uint8_t *sig = s->ctx + CTX_SIGNIFICANT + cat_offset_sig[cat];
+  uint8_t *last = s->ctx + CTX_LAST + cat_offset_last[cat];
+  uint8_t *abs = s->ctx + CTX_ABS_LEVEL + cat_offset_abs[cat];
+  int gt1_max = cat == CAT_CHROMA_DC ? 3 : 4;
+  int pos[64], n = 0, i, gt1 = 0, eq1 = 0;
+
+  if (cat == CAT_LUMA_8X8) {
+    for (i = 0; i < 63; i++) {
+      if (h264_cabac_decision(c, &sig[sig_inc_8x8[i]])) {
+        pos[n++] = i;
+        if (h264_cabac_decision(c, &last[last_inc_8x8[i]]))
+          break;
+      }
+    }
+  } else {
+    if (!h264_cabac_decision(c, &s->ctx[CTX_CODED_BLOCK + cat_offset_cbf[cat] + cbf_inc]))
+      return 0;
+    /* For 4:2:0 chroma DC, Min(i / NumC8x8, 2) is just i */
+    for (i = 0; i < max - 1; i++) {
+      if (h264_cabac_decision(c, &sig[i])) {
+        pos[n++] = i;
+        if (h264_cabac_decision(c, &last[i]))
+          break;
+      }
+    }
+  }
+  if (i == max - 1)
+    pos[n++] = i;
+
+  while (n--) {
+    int level = 1;
+
+    if (h264_cabac_decision(c, &abs[gt1 ? 0 : eq1 < 3 ? 1 + eq1 : 4])) {
+      uint8_t *ctx = &abs[5 + (gt1 < gt1_max ? gt1 : gt1_max)];
+
+      /* TU prefix with cMax 14, then an Exp-Golomb k=0 suffix */
+      level = 2;
+      while (level < 15 && h264_cabac_decision(c, ctx))
+        level++;
+      if (level == 15) {
+        int k = 0, suffix = 0;
+
+        while (h264_cabac_bypass(c)) {
+          suffix += 1 << k;
+          if (++k > 24)
+            return -1;
+        }
+        while (k--)
+          suffix += h264_cabac_bypass(c) << k;
+        level += suffix;
+      }
+      gt1++;
+    } else {
+      eq1++;
+    }
+    coeff[first + pos[n]] = h264_cabac_bypass(c) ? -level : level;
+  }
+  return 1;
+}
+
+static int
+luma_blocks(struct h264_cabac_slice *s, struct h264_mb *mb,
+            const struct h264_cabac_mb_info *a,
+            const struct h264_cabac_mb_info *b, int i16x16) {
+  int cat = i16x16 ? CAT_LUMA_AC : CAT_LUMA_4X4, blk;
+
+  /* There's no coded_block_flag, every 8x8 block the cbp has is coded.
+   * Its four 4x4 blocks are marked as such for the neighbours' context
+   * selection (9.3.3.1.1.9). */
+  if (mb->transform_size_8x8_flag) {
+    for (blk = 0; blk < 16; blk += 4) {
+      if (!(mb->coded_block_pattern & (1 << (blk >> 2))))
+        continue;
+      if (residual_block(s, CAT_LUMA_8X8, 0, mb->luma[blk], 0, 64) < 0)
+        return -1;
+      mb->coded |= 0xfu * H264_CBF_LUMA(blk);
+    }
+    return 0;
+  }
+
+  if (i16x16) {
+    int inc = cbf_cond(a, H264_CBF_LUMA_DC) + 2 * cbf_cond(b, H264_CBF_LUMA_DC);
+    int ret = residual_block(s, CAT_LUMA_DC, inc, mb->luma_dc, 0, 16);
+
+    if (ret < 0)
+      return -1;
+    if (ret)
+      mb->coded |= H264_CBF_LUMA_DC;
+  }
+
+  for (blk = 0; blk < 16; blk++) {
+    int x = blk_x(blk), y = blk_y(blk), inc, ret;
+
+    if (!(mb->coded_block_pattern & (1 << (blk >> 2))))
+      continue;
+    /* Inside the MB, the neighbour is already decoded, and the cbp bit
+     * of its quadrant is in mb->coded as well */
+    inc = x ? !!(mb->coded & H264_CBF_LUMA(blk_idx(x - 1, y)))
+            : cbf_cond(a, H264_CBF_LUMA(blk_idx(3, y)));
+    inc += 2 * (y ? !!(mb->coded & H264_CBF_LUMA(blk_idx(x, y - 1)))
+                  : cbf_cond(b, H264_CBF_LUMA(blk_idx(x, 3))));
+    ret = residual_block(s, cat, inc, mb->luma[blk], i16x16, 16 - i16x16);
+    if (ret < 0)
+      return -1;
+    if (ret)
+      mb->coded |= H264_CBF_LUMA(blk);
+  }
+  return 0;
+}
+
+static int
+chroma_blocks(struct h264_cabac_slice *s, struct h264_mb *mb,
+              const struct h264_cabac_mb_info *a,
+              const struct h264_cabac_mb_info *b) {
+  int chroma = mb->coded_block_pattern >> 4, i, blk, inc, ret;
+
+  if (!chroma)
+    return 0;
+
+  for (i = 0; i < 2; i++) {
+    inc = cbf_cond(a, H264_CBF_CHROMA_DC(i)) + 2 * cbf_cond(b, H264_CBF_CHROMA_DC(i));
+    ret = residual_block(s, CAT_CHROMA_DC, inc, mb->chroma_dc[i], 0, 4);
+    if (ret < 0)
+      return -1;
+    if (ret)
+      mb->coded |= H264_CBF_CHROMA_DC(i);
+  }
+
+  if (chroma != 2)
+    return 0;
+
+  for (i = 0; i < 2; i++) {
+    for (blk = 0; blk < 4; blk++) {
+      int x = blk & 1, y = blk >> 1;
+
+      inc = x ? !!(mb->coded & H264_CBF_CHROMA_AC(i, blk - 1))
+              : cbf_cond(a, H264_CBF_CHROMA_AC(i, blk + 1));
+      inc += 2 * (y ? !!(mb->coded & H264_CBF_CHROMA_AC(i, blk - 2))
+                    : cbf_cond(b, H264_CBF_CHROMA_AC(i, blk + 2)));
+      ret = residual_block(s, CAT_CHROMA_AC, inc, mb->chroma_ac[i][blk], 1, 15);
+      if (ret < 0)
+        return -1;
+      if (ret)
+        mb->coded |= H264_CBF_CHROMA_AC(i, blk);
+    }
+  }
+  return 0;
+}
+
+/* I_PCM samples start at the byte after the flush of the mb_type
+ * terminate bin; the engine starts over after them (9.3.1.2). */
+static int
+pcm_samples(struct h264_cabac_slice *s, struct h264_mb *mb) {
+  const uint8_t *p = s->c.start + (h264_cabac_bits_read(&s->c) + 7) / 8;
+  const uint8_t *end = s->rbsp + s->len;
+
+  if (end - p < 384)
+    return -1;
+  memcpy(mb->pcm, p, 384);
+  h264_cabac_init(&s->c, p + 384, end - p - 384);
+  return 0;
+}
+
+int h264_cabac_slice_mb(struct h264_cabac_slice *s, struct h264_mb *mb) {
+  struct h264_cabac_mb_info *info = &s->pic->mbs[s->addr];
+  const struct h264_cabac_mb_info *a = mb_left(s), *b = mb_top(s);
+  int i16x16, i;
+
+  if (info->slice)
+    return -1;
+
+  memset(mb, 0, sizeof(*mb));
+  mb->addr = s->addr;
+  mb->mb_type = mb_type_i(s, a, b);
+  i16x16 = mb->mb_type != H264_MB_I_NXN && mb->mb_type != H264_MB_I_PCM;
+
+  if (mb->mb_type == H264_MB_I_PCM) {
+    if (pcm_samples(s, mb))
+      return -1;
+    mb->qp = s->qp;
+    mb->coded_block_pattern = 0x2f;
+    mb->coded = ~0u;
+    s->last_qp_delta = 0;
+  } else {
+    if (mb->mb_type == H264_MB_I_NXN) {
+      uint8_t *ctx = s->ctx;
+      int blocks = 16;
+
+      if (s->transform_8x8_mode) {
+        mb->transform_size_8x8_flag = transform_size_8x8_flag(s, a, b);
+        blocks = mb->transform_size_8x8_flag ? 4 : 16;
+      }
+      /* prev_intra8x8_pred_mode_flag and rem_intra8x8_pred_mode share
+       * the 4x4 ones' contexts */
+      for (i = 0; i < blocks; i++) {
+        if (h264_cabac_decision(&s->c, &ctx[CTX_PREV_INTRA4X4])) {
+          mb->rem_intra4x4_pred_mode[i] = -1;
+          continue;
+        }
+        /* FL, least significant bin first */
+        mb->rem_intra4x4_pred_mode[i] =
+          h264_cabac_decision(&s->c, &ctx[CTX_REM_INTRA4X4]) |
+          h264_cabac_decision(&s->c, &ctx[CTX_REM_INTRA4X4]) << 1 |
+          h264_cabac_decision(&s->c, &ctx[CTX_REM_INTRA4X4]) << 2;
+      }
+    }
+    mb->intra_chroma_pred_mode = chroma_pred_mode(s, a, b);
+
+    if (i16x16)
+      mb->coded_block_pattern = ((mb->mb_type - 1) / 4 % 3) << 4 |
+        (mb->mb_type >= 13 ? 15 : 0);
+    else
+      mb->coded_block_pattern = coded_block_pattern(s, a, b);
+
+    if (mb->coded_block_pattern || i16x16) {
+      mb->mb_qp_delta = mb_qp_delta(s);
+      if (mb->mb_qp_delta < -26 || mb->mb_qp_delta > 25)
+        return -1;
+      s->qp = (s->qp + mb->mb_qp_delta + 52) % 52;
+      if (luma_blocks(s, mb, a, b, i16x16) || chroma_blocks(s, mb, a, b))
+        return -1;
+    }
+    s->last_qp_delta = mb->mb_qp_delta;
+    mb->qp = s->qp;
+  }
+
+  info->slice = s->slice;
+  info->type = i16x16 ? 1 : mb->mb_type;
+  info->cbp = mb->coded_block_pattern;
+  info->chroma_pred_mode = mb->intra_chroma_pred_mode;
+  info->coded = mb->coded;
+  info->transform_8x8 = mb->transform_size_8x8_flag;
+
+  /* end_of_slice_flag */
+  if (h264_cabac_terminate(&s->c)) {
+    s->addr++;
+    /* The flush ends with rbsp_stop_one_bit */
+    return h264_cabac_bits_read(&s->c) + (s->c.start - s->rbsp) * 8 ==
+      s->stop_bit + 1 ? 0 : -1;
+  }
+  if (++s->addr >= s->pic->mb_count ||
+      s->c.p - s->c.start > (ptrdiff_t)(s->rbsp + s->len - s->c.start) + 8)
+    return -1;
+  return 1;
+}
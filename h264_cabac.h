@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) 2013 Ilia Mirkin <imirkin@alum.mit.edu>
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef H264_CABAC_H
+#define H264_CABAC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "h264_parse.h"
+
+/* The CABAC arithmetic decoding engine (9.3.3.2). Contexts are kept as
+ * a single byte, pStateIdx << 1 | valMPS, so that both the LPS range and
+ * the state transition are one table lookup each, and decoding a bin
+ * doesn't branch on whether it was the MPS. */
+extern const uint8_t h264_cabac_lps_range[64][4];
+extern uint8_t h264_cabac_next_state[2][128]; /* [was lps][ctx] */
+
+struct h264_cabac {
+  const uint8_t *start;
+  const uint8_t *p, *end; /* RBSP, emulation prevention already removed */
+  uint64_t cache;         /* next bits, msb first */
+  int bits;               /* valid bits in cache */
+  uint32_t range, offset;
+};
+
+/* data points at the first byte of slice data, after cabac_alignment. */
+void h264_cabac_init(struct h264_cabac *c, const uint8_t *data, size_t len);
+
+/* 9.3.1.1, from the (m, n) pair of the context's table entry */
+uint8_t h264_cabac_context(int m, int n, int slice_qp);
+
+/* Past the end of the data, zeros are read. p keeps counting, so that
+ * the position stays right. */
+static inline void h264_cabac_refill(struct h264_cabac *c) {
+  while (c->bits <= 56) {
+    uint64_t byte = c->p < c->end ? *c->p : 0;
+
+    c->p++;
+    c->cache |= byte << (56 - c->bits);
+    c->bits += 8;
+  }
+}
+
+static inline uint32_t h264_cabac_take(struct h264_cabac *c, int n) {
+  uint32_t ret = (c->cache >> 1) >> (63 - n);
+  c->cache <<= n;
+  c->bits -= n;
+  return ret;
+}
+
+static inline void h264_cabac_renorm(struct h264_cabac *c) {
+  int n = __builtin_clz(c->range) - 23;
+
+  if (c->bits < 8)
+    h264_cabac_refill(c);
+  c->range <<= n;
+  c->offset = (c->offset << n) | h264_cabac_take(c, n);
+}
+
+static inline int h264_cabac_decision(struct h264_cabac *c, uint8_t *ctx) {
+  uint32_t s = *ctx;
+  uint32_t lps_range = h264_cabac_lps_range[s >> 1][(c->range >> 6) & 3];
+  uint32_t mps_range = c->range - lps_range;
+  uint32_t lps = c->offset >= mps_range;
+  uint32_t mask = -lps;
+
+  c->offset -= mps_range & mask;
+  c->range = (lps_range & mask) | (mps_range & ~mask);
+  *ctx = h264_cabac_next_state[lps][s];
+  h264_cabac_renorm(c);
+  return (s & 1) ^ lps;
+}
+
+static inline int h264_cabac_bypass(struct h264_cabac *c) {
+  uint32_t bin, mask;
+
+  if (c->bits < 1)
+    h264_cabac_refill(c);
+  c->offset = (c->offset << 1) | h264_cabac_take(c, 1);
+  bin = c->offset >= c->range;
+  mask = -bin;
+  c->offset -= c->range & mask;
+  return bin;
+}
+
+/* end_of_slice_flag and the I_PCM mb_type bin */
+static inline int h264_cabac_terminate(struct h264_cabac *c) {
+  c->range -= 2;
+  if (c->offset >= c->range)
+    return 1;
+  h264_cabac_renorm(c);
+  return 0;
+}
+
+/* Bits taken out of the data so far, the 9 of initialization included.
+ * After a terminate bin of 1 that's up to and including the last bit
+ * of the encoder's flush. */
+static inline size_t h264_cabac_bits_read(const struct h264_cabac *c) {
+  return (c->p - c->start) * 8 - c->bits;
+}
+
+/* slice_data() of I slices (7.3.4, 7.3.5), CABAC coded, frame MBs,
+ * 4:2:0, 4x4 and 8x8 transforms: what Main and High profile have in an
+ * I slice. This is not a full entropy decoder: the context tables for
+ * P and B slices (and for field coding) aren't there, and neither is
+ * CAVLC. Those slices are refused. */
+#define H264_CABAC_CTX_I 460
+
+/* Table 7-11 numbering: I_NxN, the 24 I_16x16 types, I_PCM */
+#define H264_MB_I_NXN 0
+#define H264_MB_I_PCM 25
+
+/* Which blocks had coded_block_flag set, in h264_mb.coded */
+#define H264_CBF_LUMA(blk)          (1u << (blk))
+#define H264_CBF_LUMA_DC            (1u << 16)
+#define H264_CBF_CHROMA_DC(c)       (1u << (17 + (c)))
+#define H264_CBF_CHROMA_AC(c, blk)  (1u << (19 + 4 * (c) + (blk)))
+
+/* One macroblock's syntax elements. Levels are in zigzag scan order
+ * and not dequantized; the AC blocks start at index 1. Luma blocks are
+ * in blkIdx order (8x8 quadrants, then 4x4 within). With the 8x8
+ * transform, the four blocks of each quadrant hold its 64 levels (8x8
+ * zigzag), and the first 4 intra modes are the quadrants' 8x8 ones. */
+struct h264_mb {
+  unsigned addr;
+  int mb_type;
+  int transform_size_8x8_flag;
+  int8_t rem_intra4x4_pred_mode[16]; /* -1: prev_intra4x4_pred_mode_flag */
+  int intra_chroma_pred_mode;
+  int coded_block_pattern;           /* chroma << 4 | luma */
+  int mb_qp_delta;
+  int qp;                            /* QP_Y after mb_qp_delta */
+  uint32_t coded;
+  int16_t luma_dc[16];
+  int16_t luma[16][16];
+  int16_t chroma_dc[2][4];
+  int16_t chroma_ac[2][4][16];
+  uint8_t pcm[384];                  /* I_PCM: luma, then Cb, Cr */
+};
+
+/* What the context selection of later macroblocks needs */
+struct h264_cabac_mb_info {
+  unsigned slice; /* 0 if not decoded yet in this picture */
+  uint8_t type;   /* mb_type, I_16x16 ones all as 1 */
+  uint8_t cbp;
+  uint8_t chroma_pred_mode;
+  uint8_t transform_8x8;
+  uint32_t coded;
+};
+
+struct h264_cabac_picture {
+  struct h264_cabac_mb_info *mbs;
+  unsigned width_mbs, mb_count, slices;
+};
+
+struct h264_cabac_slice {
+  struct h264_cabac c;
+  uint8_t ctx[H264_CABAC_CTX_I];
+  struct h264_cabac_picture *pic;
+  unsigned slice, addr;
+  int qp, last_qp_delta;
+  int transform_8x8_mode; /* the PPS's transform_8x8_mode_flag */
+  uint8_t *rbsp;
+  size_t len, stop_bit; /* of the unescaped NAL payload */
+};
+
+/* Returns -1 and leaves pic untouched for streams it can't take */
+int h264_cabac_picture_init(struct h264_cabac_picture *pic,
+                            const struct h264_sps *sps);
+void h264_cabac_picture_reset(struct h264_cabac_picture *pic);
+void h264_cabac_picture_free(struct h264_cabac_picture *pic);
+
+/* Parses the slice header of nal up to slice_data() and sets up the
+ * contexts. -1 for slices that aren't supported (see above). */
+int h264_cabac_slice_start(struct h264_cabac_slice *s,
+                           struct h264_cabac_picture *pic,
+                           const struct h264_sps *sps,
+                           const struct h264_pps *pps,
+                           const struct h264_nal *nal);
+
+/* Decodes the next macroblock into mb. Returns 1 if more follow, 0
+ * after the last one, -1 if the data is broken: that includes the
+ * slice not ending exactly at its rbsp_stop_one_bit. */
+int h264_cabac_slice_mb(struct h264_cabac_slice *s, struct h264_mb *mb);
+
+void h264_cabac_slice_end(struct h264_cabac_slice *s);
+
+#endif
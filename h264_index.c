@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2013 Ilia Mirkin <imirkin@alum.mit.edu>
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "h264_index.h"
+#include "h264_parse.h"
+
+static const char magic[8] = "VP2IDX\0\1";
+
+struct index_header {
+  char magic[8];
+  uint64_t source_size;
+  int64_t source_mtime;
+  uint8_t log2_max_frame_num;
+  uint8_t log2_max_poc_lsb;
+  uint16_t pad;
+  uint32_t pictures;
+  uint32_t count;
+  uint32_t pad2;
+};
+
+static void
+add_entry(struct h264_index *idx, uint32_t *alloced,
+          const struct h264_index_entry *e) {
+  if (idx->count == *alloced) {
+    *alloced = *alloced ? *alloced * 2 : 64;
+    idx->entries = realloc(idx->entries, *alloced * sizeof(*e));
+    assert(idx->entries);
+  }
+  idx->entries[idx->count++] = *e;
+}
+
+void h264_index_build(const uint8_t *base, size_t len,
+                      int log2_max_frame_num, int log2_max_poc_lsb,
+                      struct h264_index *idx) {
+  struct h264_nal nal, prev_nal;
+  struct h264_slice_header sh, prev;
+  int have_prev = 0;
+  size_t pos = 0;
+  long au_start = -1;
+  int recovery = -1;
+  uint32_t alloced = 0;
+
+  memset(idx, 0, sizeof(*idx));
+  idx->source_size = len;
+  idx->log2_max_frame_num = log2_max_frame_num;
+  idx->log2_max_poc_lsb = log2_max_poc_lsb;
+
+  while (!h264_next_nal(base, len, &pos, &nal)) {
+    if (!h264_nal_is_slice(nal.type)) {
+      /* That's where decoding has to be restarted from. */
+      if (au_start < 0 && h264_nal_starts_au(nal.type))
+        au_start = nal.offset;
+      if (nal.type == 6) {
+        int cnt = h264_sei_recovery_point(&nal);
+        if (cnt >= 0)
+          recovery = cnt;
+      }
+      continue;
+    }
+
+    h264_parse_slice_header(&nal, log2_max_frame_num, log2_max_poc_lsb, &sh);
+    if (!have_prev || h264_new_picture(&prev_nal, &prev, &nal, &sh)) {
+      struct h264_index_entry e = {
+        .offset = au_start >= 0 ? au_start : nal.offset,
+        .picture = idx->pictures++,
+        .poc_lsb = sh.pic_order_cnt_lsb,
+        .frame_num = sh.frame_num,
+      };
+
+      if (nal.type == 5)
+        e.flags |= H264_INDEX_IDR;
+      if (recovery >= 0) {
+        e.flags |= H264_INDEX_RECOVERY;
+        e.recovery_frame_cnt = recovery > 255 ? 255 : recovery;
+      }
+      if (e.flags)
+        add_entry(idx, &alloced, &e);
+      recovery = -1;
+    }
+    prev_nal = nal;
+    prev = sh;
+    have_prev = 1;
+    au_start = -1;
+  }
+}
+
+int h264_index_save(const char *path, const struct h264_index *idx) {
+  struct index_header hdr = {
+    .source_size = idx->source_size,
+    .source_mtime = idx->source_mtime,
+    .log2_max_frame_num = idx->log2_max_frame_num,
+    .log2_max_poc_lsb = idx->log2_max_poc_lsb,
+    .pictures = idx->pictures,
+    .count = idx->count,
+  };
+  FILE *f = fopen(path, "wb");
+  int ret = 0;
+
+  if (!f)
+    return -1;
+  memcpy(hdr.magic, magic, sizeof(magic));
+  if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+      fwrite(idx->entries, sizeof(idx->entries[0]), idx->count, f) != idx->count)
+    ret = -1;
+  if (fclose(f))
+    ret = -1;
+  return ret;
+}
+
+int h264_index_load(const char *path, struct h264_index *idx) {
+  struct index_header hdr;
+  struct stat st;
+  FILE *f = fopen(path, "rb");
+
+  memset(idx, 0, sizeof(*idx));
+  if (!f)
+    return -1;
+  if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+      memcmp(hdr.magic, magic, sizeof(magic)))
+    goto fail;
+
+  /* A truncated or corrupt file gets rebuilt, not trusted: the entries
+   * have to be exactly what's left of it. */
+  if (fstat(fileno(f), &st) || st.st_size < (off_t)sizeof(hdr) ||
+      (uint64_t)(st.st_size - sizeof(hdr)) != (uint64_t)hdr.count * sizeof(idx->entries[0]))
+    goto fail;
+
+  idx->entries = malloc(hdr.count * sizeof(idx->entries[0]) + 1);
+  if (!idx->entries ||
+      fread(idx->entries, sizeof(idx->entries[0]), hdr.count, f) != hdr.count)
+    goto fail;
+  fclose(f);
+
+  idx->source_size = hdr.source_size;
+  idx->source_mtime = hdr.source_mtime;
+  idx->log2_max_frame_num = hdr.log2_max_frame_num;
+  idx->log2_max_poc_lsb = hdr.log2_max_poc_lsb;
+  idx->pictures = hdr.pictures;
+  idx->count = hdr.count;
+  return 0;
+
+fail:
+  fclose(f);
+  h264_index_free(idx);
+  return -1;
+}
+
+int h264_index_stale(const struct h264_index *idx,
+                     uint64_t source_size, int64_t source_mtime,
+                     int log2_max_frame_num, int log2_max_poc_lsb) {
+  return idx->source_size != source_size ||
+    idx->source_mtime != source_mtime ||
+    idx->log2_max_frame_num != log2_max_frame_num ||
+    idx->log2_max_poc_lsb != log2_max_poc_lsb;
+}
+
+const struct h264_index_entry *
+h264_index_lookup(const struct h264_index *idx, uint32_t picture) {
+  uint32_t lo = 0, hi = idx->count;
+
+  /* First entry past the picture, the one before it is the answer. */
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (idx->entries[mid].picture <= picture)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo ? &idx->entries[lo - 1] : NULL;
+}
+
+void h264_index_free(struct h264_index *idx) {
+  free(idx->entries);
+  memset(idx, 0, sizeof(*idx));
+}
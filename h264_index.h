@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2013 Ilia Mirkin <imirkin@alum.mit.edu>
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef H264_INDEX_H
+#define H264_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Keyframe index of a dump file, kept next to it as <file>.idx so that
+ * playback can start at any IDR or recovery point without scanning. */
+
+#define H264_INDEX_IDR      0x1
+#define H264_INDEX_RECOVERY 0x2
+
+struct h264_index_entry {
+  uint64_t offset;     /* first NAL of the access unit */
+  uint32_t picture;    /* in decode order, from the start of the file */
+  int32_t poc_lsb;
+  uint16_t frame_num;
+  uint8_t flags;
+  uint8_t recovery_frame_cnt;
+};
+
+struct h264_index {
+  uint64_t source_size;
+  int64_t source_mtime;
+  uint8_t log2_max_frame_num;
+  uint8_t log2_max_poc_lsb;
+  uint32_t pictures;
+  uint32_t count;
+  struct h264_index_entry *entries;
+};
+
+void h264_index_build(const uint8_t *base, size_t len,
+                      int log2_max_frame_num, int log2_max_poc_lsb,
+                      struct h264_index *idx);
+
+/* Both return 0 on success, -1 (with errno set where it makes sense) on
+ * failure. A loaded index has to be checked against the source by the
+ * caller with h264_index_stale(). */
+int h264_index_save(const char *path, const struct h264_index *idx);
+int h264_index_load(const char *path, struct h264_index *idx);
+
+int h264_index_stale(const struct h264_index *idx,
+                     uint64_t source_size, int64_t source_mtime,
+                     int log2_max_frame_num, int log2_max_poc_lsb);
+
+/* Last keyframe at or before the given picture, NULL if there is none. */
+const struct h264_index_entry *
+h264_index_lookup(const struct h264_index *idx, uint32_t picture);
+
+void h264_index_free(struct h264_index *idx);
+
+#endif
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2013 Ilia Mirkin <imirkin@alum.mit.edu>
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/* Converts an mplayer dump (or Annex B stream) into a NAL pack, see
+ * nal_pack.h, or lists one. */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "h264_parse.h"
+#include "nal_pack.h"
+
+#undef NDEBUG
+#include <assert.h>
+
+/* The stream h264_player is hardcoded for, until an SPS comes along */
+#define LOG2_MAX_FRAME_NUM 9
+#define LOG2_MAX_POC_LSB 10
+
+static int
+list(const char *path) {
+  struct nal_pack pack;
+  uint64_t payload = 0;
+  unsigned i;
+
+  if (nal_pack_open(&pack, path)) {
+    fprintf(stderr, "%s: not a valid pack\n", path);
+    return 1;
+  }
+  printf("%u entries, %u byte alignment\n", pack.count, pack.alignment);
+  for (i = 0; i < pack.count; i++) {
+    const struct nal_pack_entry *e = &pack.entries[i];
+
+    printf("%6u  offset %10llx  size %7u  type %2u  slices %2u%s%s\n", i,
+           (unsigned long long)e->offset, e->size, e->type, e->slices,
+           e->flags & NAL_PACK_IDR ? "  idr" : "",
+           e->flags & NAL_PACK_REF ? "  ref" : "");
+    payload += e->size;
+  }
+  printf("%llu payload bytes in %zu\n", (unsigned long long)payload, pack.size);
+  nal_pack_close(&pack);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  struct h264_sps sps = {
+    .log2_max_frame_num_minus4 = LOG2_MAX_FRAME_NUM - 4,
+    .log2_max_pic_order_cnt_lsb_minus4 = LOG2_MAX_POC_LSB - 4,
+    .frame_mbs_only_flag = 1,
+  };
+  struct h264_pps pps = { 0 };
+  struct h264_slice_params params;
+  h264_slice_header_fn parse_slice_header;
+  struct h264_nal nal, first_nal;
+  struct h264_slice_header sh, first;
+  struct nal_pack_writer w;
+  unsigned long pictures = 0, dropped = 0;
+  uint32_t alignment = 256;
+  const uint8_t *addr;
+  struct stat st;
+  size_t pos = 0;
+  int annexb = 0, listing = 0, in_picture = 0, fd, opt;
+
+  while ((opt = getopt(argc, argv, "aA:l")) != -1) {
+    switch (opt) {
+    case 'a':
+      annexb = 1;
+      break;
+    case 'A':
+      alignment = atoi(optarg);
+      assert(alignment >= 256 && !(alignment & (alignment - 1)));
+      break;
+    case 'l':
+      listing = 1;
+      break;
+    default:
+      goto usage;
+    }
+  }
+  if (listing && optind + 1 == argc)
+    return list(argv[optind]);
+  if (listing || optind + 2 != argc)
+    goto usage;
+
+  assert((fd = open(argv[optind], O_RDONLY)) >= 0);
+  assert(fstat(fd, &st) == 0);
+  assert((addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) != MAP_FAILED);
+  close(fd);
+  if (nal_pack_writer_open(&w, argv[optind + 1], alignment)) {
+    perror(argv[optind + 1]);
+    return 1;
+  }
+
+  h264_slice_params_init(&params, &sps, &pps);
+  parse_slice_header = h264_slice_header_parser(&params);
+
+  while (!(annexb ? h264_next_nal_annexb(addr, st.st_size, &pos, &nal)
+                  : h264_next_nal(addr, st.st_size, &pos, &nal))) {
+    if (!h264_nal_is_slice(nal.type)) {
+      if (in_picture && h264_nal_starts_au(nal.type)) {
+        nal_pack_end(&w);
+        in_picture = 0;
+      }
+      /* Parameter sets get entries of their own, since the decoder
+       * needs them; nothing else is kept. */
+      if (nal.type == 7 || nal.type == 8) {
+        if (nal.type == 7 ? !h264_parse_sps(&nal, &sps) : !h264_parse_pps(&nal, &pps)) {
+          h264_slice_params_init(&params, &sps, &pps);
+          parse_slice_header = h264_slice_header_parser(&params);
+        }
+        if (in_picture) {
+          nal_pack_end(&w);
+          in_picture = 0;
+        }
+        nal_pack_begin(&w);
+        nal_pack_append(&w, &nal);
+        nal_pack_end(&w);
+      } else {
+        dropped++;
+      }
+      continue;
+    }
+
+    parse_slice_header(&nal, &params, &sh);
+    if (in_picture && h264_new_picture(&first_nal, &first, &nal, &sh)) {
+      nal_pack_end(&w);
+      in_picture = 0;
+    }
+    if (!in_picture) {
+      nal_pack_begin(&w);
+      first_nal = nal;
+      first = sh;
+      in_picture = 1;
+      pictures++;
+    }
+    nal_pack_append(&w, &nal);
+  }
+  if (in_picture)
+    nal_pack_end(&w);
+  if (nal_pack_writer_close(&w)) {
+    perror(argv[optind + 1]);
+    return 1;
+  }
+  fprintf(stderr, "%lu pictures, %lu other NALs dropped\n", pictures, dropped);
+  return 0;
+
+usage:
+  fprintf(stderr, "Usage: %s [-a] [-A alignment] in.dump out.pack\n"
+          "       %s -l in.pack\n", argv[0], argv[0]);
+  return 1;
+}
@@ -0,0 +1,453 @@
+/*
+ * Copyright (C) 2013 Ilia Mirkin <imirkin@alum.mit.edu>
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <arpa/inet.h>
+#include <string.h>
+
+#include "h264_parse.h"
+
+int read_bit(const void *addr, int *bit_offset) {
+  int offt = *bit_offset;
+  const uint8_t *p = (const uint8_t *)addr + offt / 8;
+  offt %= 8;
+  *bit_offset = *bit_offset + 1;
+  return (*p >> (7 - offt)) & 1;
+}
+
+uint64_t read_bits(const void *addr, int *bit_offset, int n) {
+  int i;
+  uint64_t ret = 0;
+  for (i = 0; i < n; i++) {
+    ret <<= 1;
+    ret |= read_bit(addr, bit_offset);
+  }
+  return ret;
+}
+
+/* Valid codes have at most 31 leading zeros. Stopping at 32 means a
+ * run of zeros, such as the padding past the end of a truncated NAL,
+ * takes no more than 65 bits. */
+uint64_t ue(const void *addr, int *bit_offset) {
+  int leadingZeroBits = -1;
+  int b;
+  for (b = 0; !b && leadingZeroBits < 32; leadingZeroBits++) {
+    b = read_bit(addr, bit_offset);
+  }
+  uint64_t ret = (1ULL << leadingZeroBits) - 1 + read_bits(addr, bit_offset, leadingZeroBits);
+  return ret;
+}
+
+int64_t se(const void *addr, int *bit_offset) {
+  int codeNum = ue(addr, bit_offset);
+  return ((codeNum % 2 == 1) ? 1 : -1) * (codeNum / 2 + codeNum % 2);
+}
+
+int h264_next_nal(const uint8_t *base, size_t len, size_t *pos,
+                  struct h264_nal *nal) {
+  uint32_t size;
+
+  if (*pos + 5 > len)
+    return -1;
+  memcpy(&size, base + *pos, 4);
+  size = ntohl(size);
+  if (size == 0 || *pos + 4 + size > len)
+    return -1;
+
+  nal->offset = *pos;
+  nal->data = base + *pos + 4;
+  nal->size = size;
+  nal->type = nal->data[0] & 0x1f;
+  nal->ref_idc = (nal->data[0] >> 5) & 3;
+
+  *pos += 4 + size;
+  return 0;
+}
+
+/* The 01 of a start code is found with memchr and checked backwards.
+ * When that fails, the next start code can't end before p + 3. */
+static const uint8_t *
+find_start_code(const uint8_t *p, const uint8_t *end) {
+  for (p += 2; p < end && (p = memchr(p, 1, end - p)); p += 3) {
+    if (!p[-1] && !p[-2])
+      return p - 2;
+  }
+  return NULL;
+}
+
+int h264_next_nal_annexb(const uint8_t *base, size_t len, size_t *pos,
+                         struct h264_nal *nal) {
+  const uint8_t *end = base + len, *sc, *data, *next;
+  size_t size;
+
+  do {
+    if (*pos >= len || !(sc = find_start_code(base + *pos, end)))
+      return -1;
+    data = sc + 3;
+    next = data < end ? find_start_code(data, end) : NULL;
+    size = (next ? next : end) - data;
+    /* trailing_zero_8bits, and the zero_byte of a 4-byte start code */
+    while (size && !data[size - 1])
+      size--;
+    *pos = next ? (size_t)(next - base) : len;
+  } while (!size);
+
+  nal->offset = sc - base;
+  nal->data = data;
+  nal->size = size;
+  nal->type = nal->data[0] & 0x1f;
+  nal->ref_idc = (nal->data[0] >> 5) & 3;
+  return 0;
+}
+
+size_t h264_unescape(uint8_t *dst, const uint8_t *src, size_t len) {
+  size_t i, n = 0;
+  int zeros = 0;
+
+  for (i = 0; i < len; i++) {
+    if (zeros >= 2 && src[i] == 3) {
+      zeros = 0;
+      continue;
+    }
+    zeros = src[i] ? 0 : zeros + 1;
+    dst[n++] = src[i];
+  }
+  return n;
+}
+
+/* Parameter sets are small, anything past this is VUI we don't read. */
+#define PARAM_SET_MAX 512
+/* Zeros after the RBSP, enough for every read of a parameter set that
+ * runs past its end: those are a fixed number of capped ue()s, the
+ * loops stop at the end. The parsers then fail on bit_offset. */
+#define PARAM_SET_PAD 256
+
+static int
+more_rbsp_data(const uint8_t *rbsp, size_t len, int bit_offset) {
+  int last;
+
+  /* Position of the rbsp_stop_one_bit */
+  while (len && !rbsp[len - 1])
+    len--;
+  if (!len)
+    return 0;
+  last = len * 8 - 1 - __builtin_ctz(rbsp[len - 1]);
+  return bit_offset < last;
+}
+
+static void
+skip_scaling_list(const uint8_t *rbsp, int *bit_offset, int size, int end) {
+  int last = 8, next = 8, j;
+
+  for (j = 0; j < size && *bit_offset < end; j++) {
+    if (next != 0)
+      next = (last + se(rbsp, bit_offset) + 256) % 256;
+    last = next ? next : last;
+  }
+}
+
+static void
+skip_scaling_lists(const uint8_t *rbsp, int *bit_offset, int count, int end) {
+  int i;
+
+  for (i = 0; i < count && *bit_offset < end; i++)
+    if (read_bit(rbsp, bit_offset))
+      skip_scaling_list(rbsp, bit_offset, i < 6 ? 16 : 64, end);
+}
+
+int h264_parse_sps(const struct h264_nal *nal, struct h264_sps *sps) {
+  uint8_t rbsp[PARAM_SET_MAX + PARAM_SET_PAD] = {0};
+  size_t len = nal->size - 1 > PARAM_SET_MAX ? PARAM_SET_MAX : nal->size - 1;
+  int bit_offset = 0, i;
+
+  len = h264_unescape(rbsp, nal->data + 1, len);
+  if (len < 4)
+    return -1;
+
+  memset(sps, 0, sizeof(*sps));
+  sps->profile_idc = read_bits(rbsp, &bit_offset, 8);
+  read_bits(rbsp, &bit_offset, 8); /* constraint_set flags */
+  sps->level_idc = read_bits(rbsp, &bit_offset, 8);
+  sps->seq_parameter_set_id = ue(rbsp, &bit_offset);
+  sps->chroma_format_idc = 1;
+
+  switch (sps->profile_idc) {
+  case 100: case 110: case 122: case 244: case 44:
+  case 83: case 86: case 118: case 128: case 138: case 139: case 134: case 135:
+    sps->chroma_format_idc = ue(rbsp, &bit_offset);
+    if (sps->chroma_format_idc == 3)
+      read_bit(rbsp, &bit_offset); /* separate_colour_plane_flag */
+    ue(rbsp, &bit_offset); /* bit_depth_luma_minus8 */
+    ue(rbsp, &bit_offset); /* bit_depth_chroma_minus8 */
+    read_bit(rbsp, &bit_offset); /* qpprime_y_zero_transform_bypass_flag */
+    sps->seq_scaling_matrix_present_flag = read_bit(rbsp, &bit_offset);
+    if (sps->seq_scaling_matrix_present_flag)
+      skip_scaling_lists(rbsp, &bit_offset,
+                         sps->chroma_format_idc != 3 ? 8 : 12, len * 8);
+    break;
+  }
+
+  sps->log2_max_frame_num_minus4 = ue(rbsp, &bit_offset);
+  sps->pic_order_cnt_type = ue(rbsp, &bit_offset);
+  if (sps->pic_order_cnt_type == 0) {
+    sps->log2_max_pic_order_cnt_lsb_minus4 = ue(rbsp, &bit_offset);
+  } else if (sps->pic_order_cnt_type == 1) {
+    int cycle;
+
+    sps->delta_pic_order_always_zero_flag = read_bit(rbsp, &bit_offset);
+    se(rbsp, &bit_offset); /* offset_for_non_ref_pic */
+    se(rbsp, &bit_offset); /* offset_for_top_to_bottom_field */
+    cycle = ue(rbsp, &bit_offset);
+    for (i = 0; i < cycle && bit_offset < (int)len * 8; i++)
+      se(rbsp, &bit_offset); /* offset_for_ref_frame[i] */
+  }
+  sps->num_ref_frames = ue(rbsp, &bit_offset);
+  sps->gaps_in_frame_num_value_allowed_flag = read_bit(rbsp, &bit_offset);
+  sps->pic_width_in_mbs_minus1 = ue(rbsp, &bit_offset);
+  sps->pic_height_in_map_units_minus1 = ue(rbsp, &bit_offset);
+  sps->frame_mbs_only_flag = read_bit(rbsp, &bit_offset);
+  if (!sps->frame_mbs_only_flag)
+    sps->mb_adaptive_frame_field_flag = read_bit(rbsp, &bit_offset);
+  sps->direct_8x8_inference_flag = read_bit(rbsp, &bit_offset);
+  sps->frame_cropping_flag = read_bit(rbsp, &bit_offset);
+  if (sps->frame_cropping_flag)
+    for (i = 0; i < 4; i++)
+      sps->frame_crop_offset[i] = ue(rbsp, &bit_offset);
+
+  return bit_offset <= (int)len * 8 ? 0 : -1;
+}
+
+int h264_parse_pps(const struct h264_nal *nal, struct h264_pps *pps) {
+  uint8_t rbsp[PARAM_SET_MAX + PARAM_SET_PAD] = {0};
+  size_t len = nal->size - 1 > PARAM_SET_MAX ? PARAM_SET_MAX : nal->size - 1;
+  int bit_offset = 0;
+
+  len = h264_unescape(rbsp, nal->data + 1, len);
+  if (len < 1)
+    return -1;
+
+  memset(pps, 0, sizeof(*pps));
+  pps->pic_parameter_set_id = ue(rbsp, &bit_offset);
+  pps->seq_parameter_set_id = ue(rbsp, &bit_offset);
+  pps->entropy_coding_mode_flag = read_bit(rbsp, &bit_offset);
+  pps->pic_order_present_flag = read_bit(rbsp, &bit_offset);
+  pps->num_slice_groups_minus1 = ue(rbsp, &bit_offset);
+  if (pps->num_slice_groups_minus1)
+    return -1; /* FMO is baseline-only, and VP2 doesn't do it anyway */
+  pps->num_ref_idx_l0_default_active_minus1 = ue(rbsp, &bit_offset);
+  pps->num_ref_idx_l1_default_active_minus1 = ue(rbsp, &bit_offset);
+  pps->weighted_pred_flag = read_bit(rbsp, &bit_offset);
+  pps->weighted_bipred_idc = read_bits(rbsp, &bit_offset, 2);
+  pps->pic_init_qp_minus26 = se(rbsp, &bit_offset);
+  pps->pic_init_qs_minus26 = se(rbsp, &bit_offset);
+  pps->chroma_qp_index_offset = se(rbsp, &bit_offset);
+  pps->deblocking_filter_control_present_flag = read_bit(rbsp, &bit_offset);
+  pps->constrained_intra_pred_flag = read_bit(rbsp, &bit_offset);
+  pps->redundant_pic_cnt_present_flag = read_bit(rbsp, &bit_offset);
+  pps->second_chroma_qp_index_offset = pps->chroma_qp_index_offset;
+
+  if (more_rbsp_data(rbsp, len, bit_offset)) {
+    pps->transform_8x8_mode_flag = read_bit(rbsp, &bit_offset);
+    pps->pic_scaling_matrix_present_flag = read_bit(rbsp, &bit_offset);
+    if (pps->pic_scaling_matrix_present_flag)
+      /* Assumes 4:2:0, which is all VP2 does. */
+      skip_scaling_lists(rbsp, &bit_offset,
+                         6 + 2 * pps->transform_8x8_mode_flag, len * 8);
+    pps->second_chroma_qp_index_offset = se(rbsp, &bit_offset);
+  }
+
+  return bit_offset <= (int)len * 8 ? 0 : -1;
+}
+
+/* Every slice header parser is this, with the arguments after params
+ * constant in all but the generic one. */
+static inline __attribute__((always_inline)) void
+slice_header(const struct h264_nal *nal, const struct h264_slice_params *params,
+             int log2_max_frame_num, int poc_type, int frame_mbs_only,
+             int pic_order_present, int redundant_pic_cnt_present,
+             struct h264_slice_header *sh) {
+  const uint8_t *data = nal->data;
+  int bit_offset = 8;
+
+  sh->first_mb_in_slice = ue(data, &bit_offset);
+  sh->slice_type = ue(data, &bit_offset);
+  sh->pic_parameter_set_id = ue(data, &bit_offset);
+  sh->frame_num = read_bits(data, &bit_offset, log2_max_frame_num);
+  sh->field_pic_flag = 0;
+  sh->bottom_field_flag = 0;
+  if (!frame_mbs_only) {
+    sh->field_pic_flag = read_bit(data, &bit_offset);
+    if (sh->field_pic_flag)
+      sh->bottom_field_flag = read_bit(data, &bit_offset);
+  }
+  sh->idr_pic_id = nal->type == 5 ? ue(data, &bit_offset) : -1;
+  sh->pic_order_cnt_lsb = 0;
+  sh->delta_pic_order_cnt_bottom = 0;
+  sh->delta_pic_order_cnt[0] = 0;
+  sh->delta_pic_order_cnt[1] = 0;
+  if (poc_type == 0) {
+    sh->pic_order_cnt_lsb = read_bits(data, &bit_offset, params->log2_max_poc_lsb);
+    if (pic_order_present && !sh->field_pic_flag)
+      sh->delta_pic_order_cnt_bottom = se(data, &bit_offset);
+  } else if (poc_type == 1 && !params->delta_pic_order_always_zero_flag) {
+    sh->delta_pic_order_cnt[0] = se(data, &bit_offset);
+    if (pic_order_present && !sh->field_pic_flag)
+      sh->delta_pic_order_cnt[1] = se(data, &bit_offset);
+  }
+  sh->redundant_pic_cnt = redundant_pic_cnt_present ? ue(data, &bit_offset) : 0;
+  sh->header_bits = bit_offset;
+}
+
+void h264_parse_slice_header(const struct h264_nal *nal,
+                             int log2_max_frame_num,
+                             int log2_max_poc_lsb,
+                             struct h264_slice_header *sh) {
+  const struct h264_slice_params params = {
+    .log2_max_frame_num = log2_max_frame_num,
+    .log2_max_poc_lsb = log2_max_poc_lsb,
+  };
+
+  slice_header(nal, &params, log2_max_frame_num, 0, 1, 0, 0, sh);
+}
+
+void h264_slice_params_init(struct h264_slice_params *params,
+                            const struct h264_sps *sps,
+                            const struct h264_pps *pps) {
+  params->log2_max_frame_num = sps->log2_max_frame_num_minus4 + 4;
+  params->log2_max_poc_lsb = sps->log2_max_pic_order_cnt_lsb_minus4 + 4;
+  params->pic_order_cnt_type = sps->pic_order_cnt_type;
+  params->frame_mbs_only_flag = sps->frame_mbs_only_flag;
+  params->delta_pic_order_always_zero_flag = sps->delta_pic_order_always_zero_flag;
+  params->pic_order_present_flag = pps->pic_order_present_flag;
+  params->redundant_pic_cnt_present_flag = pps->redundant_pic_cnt_present_flag;
+}
+
+static void
+slice_header_generic(const struct h264_nal *nal,
+                     const struct h264_slice_params *params,
+                     struct h264_slice_header *sh) {
+  slice_header(nal, params, params->log2_max_frame_num,
+               params->pic_order_cnt_type, params->frame_mbs_only_flag,
+               params->pic_order_present_flag,
+               params->redundant_pic_cnt_present_flag, sh);
+}
+
+#define SLICE_HEADER_FN(name, bits, poc_type, pic_order_present)          \
+  static void                                                             \
+  name(const struct h264_nal *nal, const struct h264_slice_params *params, \
+       struct h264_slice_header *sh) {                                    \
+    slice_header(nal, params, bits, poc_type, 1, pic_order_present, 0, sh); \
+  }
+
+/* log2_max_frame_num is 4..16 */
+#define SLICE_HEADER_FNS(bits)                                 \
+  SLICE_HEADER_FN(slice_header_poc0_##bits, bits, 0, 0)        \
+  SLICE_HEADER_FN(slice_header_poc0_bottom_##bits, bits, 0, 1) \
+  SLICE_HEADER_FN(slice_header_poc2_##bits, bits, 2, 0)
+
+SLICE_HEADER_FNS(4)
+SLICE_HEADER_FNS(5)
+SLICE_HEADER_FNS(6)
+SLICE_HEADER_FNS(7)
+SLICE_HEADER_FNS(8)
+SLICE_HEADER_FNS(9)
+SLICE_HEADER_FNS(10)
+SLICE_HEADER_FNS(11)
+SLICE_HEADER_FNS(12)
+SLICE_HEADER_FNS(13)
+SLICE_HEADER_FNS(14)
+SLICE_HEADER_FNS(15)
+SLICE_HEADER_FNS(16)
+
+#define SLICE_HEADER_ROW(prefix)                                  \
+  { prefix##4, prefix##5, prefix##6, prefix##7, prefix##8,        \
+    prefix##9, prefix##10, prefix##11, prefix##12, prefix##13,    \
+    prefix##14, prefix##15, prefix##16 }
+
+/* [POC type 0, with delta_pic_order_cnt_bottom, POC type 2][log2 - 4] */
+static const h264_slice_header_fn slice_header_fns[3][13] = {
+  SLICE_HEADER_ROW(slice_header_poc0_),
+  SLICE_HEADER_ROW(slice_header_poc0_bottom_),
+  SLICE_HEADER_ROW(slice_header_poc2_),
+};
+
+h264_slice_header_fn h264_slice_header_parser(const struct h264_slice_params *params) {
+  int bits = params->log2_max_frame_num;
+  int row;
+
+  if (!params->frame_mbs_only_flag || params->redundant_pic_cnt_present_flag ||
+      bits < 4 || bits > 16)
+    return slice_header_generic;
+  if (params->pic_order_cnt_type == 0)
+    row = params->pic_order_present_flag;
+  else if (params->pic_order_cnt_type == 2)
+    row = 2;
+  else
+    return slice_header_generic;
+  return slice_header_fns[row][bits - 4];
+}
+
+int h264_new_picture(const struct h264_nal *prev_nal,
+                     const struct h264_slice_header *prev,
+                     const struct h264_nal *nal,
+                     const struct h264_slice_header *sh) {
+  return sh->first_mb_in_slice == 0 ||
+    sh->frame_num != prev->frame_num ||
+    sh->pic_parameter_set_id != prev->pic_parameter_set_id ||
+    sh->field_pic_flag != prev->field_pic_flag ||
+    sh->bottom_field_flag != prev->bottom_field_flag ||
+    (nal->ref_idc == 0) != (prev_nal->ref_idc == 0) ||
+    sh->pic_order_cnt_lsb != prev->pic_order_cnt_lsb ||
+    sh->delta_pic_order_cnt_bottom != prev->delta_pic_order_cnt_bottom ||
+    sh->delta_pic_order_cnt[0] != prev->delta_pic_order_cnt[0] ||
+    sh->delta_pic_order_cnt[1] != prev->delta_pic_order_cnt[1] ||
+    (nal->type == 5) != (prev_nal->type == 5) ||
+    sh->idr_pic_id != prev->idr_pic_id;
+}
+
+int h264_sei_recovery_point(const struct h264_nal *nal) {
+  uint32_t i = 1;
+
+  /* sei_message()s until rbsp_trailing_bits */
+  while (i < nal->size && nal->data[i] != 0x80) {
+    int type = 0, size = 0;
+
+    while (i < nal->size && nal->data[i] == 0xff)
+      type += nal->data[i++];
+    if (i >= nal->size)
+      break;
+    type += nal->data[i++];
+    while (i < nal->size && nal->data[i] == 0xff)
+      size += nal->data[i++];
+    if (i >= nal->size)
+      break;
+    size += nal->data[i++];
+
+    if (type == 6 && i < nal->size) {
+      int bit_offset = 0;
+      return ue(nal->data + i, &bit_offset);
+    }
+    i += size;
+  }
+  return -1;
+}
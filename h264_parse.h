@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2013 Ilia Mirkin <imirkin@alum.mit.edu>
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef H264_PARSE_H
+#define H264_PARSE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Bit-level readers, offsets are in bits from addr. */
+int read_bit(const void *addr, int *bit_offset);
+uint64_t read_bits(const void *addr, int *bit_offset, int n);
+uint64_t ue(const void *addr, int *bit_offset);
+int64_t se(const void *addr, int *bit_offset);
+
+/* One NAL out of an mplayer -dumpvideo file: 4-byte big-endian length,
+ * followed by the NAL itself (header byte first). */
+struct h264_nal {
+  const uint8_t *data;
+  uint32_t size;
+  size_t offset; /* of the length prefix, from the start of the file */
+  int type;
+  int ref_idc;
+};
+
+/* Returns 0 and advances *pos on success, -1 at the end of the stream or
+ * on a truncated NAL. */
+int h264_next_nal(const uint8_t *base, size_t len, size_t *pos,
+                  struct h264_nal *nal);
+
+/* The same for an Annex B byte stream, NALs behind 00 00 01 start
+ * codes; offset is that of the start code. Zero bytes in front of a
+ * start code are not part of the NAL before it. */
+int h264_next_nal_annexb(const uint8_t *base, size_t len, size_t *pos,
+                         struct h264_nal *nal);
+
+static inline int h264_nal_is_slice(int type) {
+  return type == 1 || type == 5;
+}
+
+/* SEI, SPS, PPS, AUD and the reserved 14..18 can only come before the
+ * first slice of an access unit, so they end the current picture. */
+static inline int h264_nal_starts_au(int type) {
+  return (type >= 6 && type <= 9) || (type >= 14 && type <= 18);
+}
+
+/* Removes emulation prevention bytes, returns the RBSP length. dst needs
+ * to be able to hold len bytes. */
+size_t h264_unescape(uint8_t *dst, const uint8_t *src, size_t len);
+
+/* The parts of the SPS and PPS that the decoder setup cares about.
+ * Scaling matrices are parsed past, but not kept. */
+struct h264_sps {
+  int profile_idc;
+  int level_idc;
+  int seq_parameter_set_id;
+  int chroma_format_idc;
+  int seq_scaling_matrix_present_flag;
+  int log2_max_frame_num_minus4;
+  int pic_order_cnt_type;
+  int log2_max_pic_order_cnt_lsb_minus4;
+  int delta_pic_order_always_zero_flag;
+  int num_ref_frames;
+  int gaps_in_frame_num_value_allowed_flag;
+  int pic_width_in_mbs_minus1;
+  int pic_height_in_map_units_minus1;
+  int frame_mbs_only_flag;
+  int mb_adaptive_frame_field_flag;
+  int direct_8x8_inference_flag;
+  int frame_cropping_flag;
+  int frame_crop_offset[4]; /* left, right, top, bottom */
+};
+
+struct h264_pps {
+  int pic_parameter_set_id;
+  int seq_parameter_set_id;
+  int entropy_coding_mode_flag;
+  int pic_order_present_flag;
+  int num_slice_groups_minus1;
+  int num_ref_idx_l0_default_active_minus1;
+  int num_ref_idx_l1_default_active_minus1;
+  int weighted_pred_flag;
+  int weighted_bipred_idc;
+  int pic_init_qp_minus26;
+  int pic_init_qs_minus26;
+  int chroma_qp_index_offset;
+  int deblocking_filter_control_present_flag;
+  int constrained_intra_pred_flag;
+  int redundant_pic_cnt_present_flag;
+  int transform_8x8_mode_flag;
+  int pic_scaling_matrix_present_flag;
+  int second_chroma_qp_index_offset;
+};
+
+/* nal->data is the NAL header byte followed by the escaped payload.
+ * Return 0 on success, -1 for streams that can't be handled (slice
+ * groups, truncated data). */
+int h264_parse_sps(const struct h264_nal *nal, struct h264_sps *sps);
+int h264_parse_pps(const struct h264_nal *nal, struct h264_pps *pps);
+
+/* Everything up to and including redundant_pic_cnt. Fields that aren't
+ * present in a stream are left at 0 (idr_pic_id at -1). */
+struct h264_slice_header {
+  int first_mb_in_slice;
+  int slice_type;
+  int pic_parameter_set_id;
+  int frame_num;
+  int field_pic_flag;
+  int bottom_field_flag;
+  int idr_pic_id;
+  int pic_order_cnt_lsb;
+  int delta_pic_order_cnt_bottom;
+  int delta_pic_order_cnt[2];
+  int redundant_pic_cnt;
+  int header_bits; /* read, counting the NAL header byte */
+};
+
+/* POC type 0, progressive, no bottom field POC delta: the streams the
+ * player has always assumed. */
+void h264_parse_slice_header(const struct h264_nal *nal,
+                             int log2_max_frame_num,
+                             int log2_max_poc_lsb,
+                             struct h264_slice_header *sh);
+
+/* The SPS and PPS fields that decide what a slice header looks like */
+struct h264_slice_params {
+  int log2_max_frame_num;
+  int log2_max_poc_lsb;
+  int pic_order_cnt_type;
+  int frame_mbs_only_flag;
+  int delta_pic_order_always_zero_flag;
+  int pic_order_present_flag;
+  int redundant_pic_cnt_present_flag;
+};
+
+void h264_slice_params_init(struct h264_slice_params *params,
+                            const struct h264_sps *sps,
+                            const struct h264_pps *pps);
+
+typedef void (*h264_slice_header_fn)(const struct h264_nal *nal,
+                                     const struct h264_slice_params *params,
+                                     struct h264_slice_header *sh);
+
+/* Picks a slice header parser for params, to be called once per SPS/PPS
+ * activation. Progressive POC type 0 and 2 streams without
+ * redundant_pic_cnt get one built for their log2_max_frame_num, the
+ * rest a generic one. */
+h264_slice_header_fn h264_slice_header_parser(const struct h264_slice_params *params);
+
+/* Whether the slice in nal/sh belongs to a different picture than the
+ * one in prev_nal/prev, per 7.4.1.2.4. Arbitrary slice order isn't
+ * allowed in Main/High, so first_mb_in_slice == 0 also starts one. */
+int h264_new_picture(const struct h264_nal *prev_nal,
+                     const struct h264_slice_header *prev,
+                     const struct h264_nal *nal,
+                     const struct h264_slice_header *sh);
+
+/* Looks for a recovery point SEI message in a type 6 NAL. Returns its
+ * recovery_frame_cnt, or -1 if there is none. */
+int h264_sei_recovery_point(const struct h264_nal *nal);
+
+#endif
@@ -33,11 +33,17 @@
 #include <string.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 #include <X11/Xlib.h>
 #include <vdpau/vdpau.h>
 #include <vdpau/vdpau_x11.h>
 
+#include "frame_hash.h"
+#include "h264_index.h"
+#include "h264_parse.h"
+#include "spsc.h"
+
 VdpGetProcAddress *vdp_get_proc_address;
 
 VdpDecoderCreate *vdp_decoder_create;
@@ -63,39 +69,6 @@ VdpPresentationQueueBlockUntilSurfaceIdle *vdp_presentation_queue_block_until_su
 VdpPresentationQueueGetTime *vdp_presentation_queue_get_time;
 VdpPresentationQueueTargetCreateX11 *vdp_presentation_queue_target_create_x11;
 
-int read_bit(void *addr, int *bit_offset) {
-  int offt = *bit_offset;
-  addr += offt / 8;
-  offt %= 8;
-  *bit_offset = *bit_offset + 1;
-  return ((*(char *)addr) >> (7 - offt)) & 1;
-}
-
-uint64_t read_bits(void *addr, int *bit_offset, int n) {
-  int i;
-  uint64_t ret = 0;
-  for (i = 0; i < n; i++) {
-    ret <<= 1;
-    ret |= read_bit(addr, bit_offset);
-  }
-  return ret;
-}
-
-uint64_t ue(void *addr, int *bit_offset) {
-  int leadingZeroBits = -1;
-  int b;
-  for (b = 0; !b; leadingZeroBits++) {
-    b = read_bit(addr, bit_offset);
-  }
-  int ret = (1 << leadingZeroBits) - 1 + read_bits(addr, bit_offset, leadingZeroBits);
-  return ret;
-}
-
-int64_t se(void *addr, int *bit_offset) {
-  int codeNum = ue(addr, bit_offset);
-  return ((codeNum % 2 == 1) ? 1 : -1) * (codeNum / 2 + codeNum % 2);
-}
-
 void mark(const char *fmt, ...) __attribute__ ((format (printf, 1, 2)));
 void mark(const char *fmt, ...) {
   va_list ap;
@@ -111,8 +84,322 @@ void mark(const char *fmt, ...) {
   close(fd);
 }
 
+/* These are what the picinfo below is hardcoded to. */
+#define LOG2_MAX_FRAME_NUM 9
+#define LOG2_MAX_POC_LSB 10
+
+static void
+load_index(const char *file, const struct stat *statbuf,
+           const uint8_t *addr, struct h264_index *idx) {
+  char path[4096];
+
+  snprintf(path, sizeof(path), "%s.idx", file);
+  if (!h264_index_load(path, idx) &&
+      !h264_index_stale(idx, statbuf->st_size, statbuf->st_mtime,
+                        LOG2_MAX_FRAME_NUM, LOG2_MAX_POC_LSB))
+    return;
+
+  h264_index_free(idx);
+  h264_index_build(addr, statbuf->st_size,
+                   LOG2_MAX_FRAME_NUM, LOG2_MAX_POC_LSB, idx);
+  idx->source_mtime = statbuf->st_mtime;
+  fprintf(stderr, "Indexed %u keyframes in %u pictures\n",
+          idx->count, idx->pictures);
+  if (h264_index_save(path, idx))
+    perror(path);
+}
+
+#define QUEUE_MAX 64
+#define MAX_SLICES 64
+
+/* Everything vdp_decoder_render needs for one picture. The bitstream
+ * buffers point straight into the mmap'd dump. */
+struct decode_job {
+  VdpPictureInfoH264 info;
+  VdpVideoSurface surface;
+  uint32_t buffer_count;
+  VdpBitstreamBuffer buffer[2 * MAX_SLICES];
+};
+
+/* The parser thread owns the running picinfo (frame_num, POC, reference
+ * list) and hands finished jobs to the render thread through the ring. */
+struct parser {
+  const uint8_t *addr;
+  size_t size;
+  size_t pos;
+  VdpPictureInfoH264 info;
+  const VdpVideoSurface *video;
+  struct h264_slice_params slice_params; /* from info */
+  h264_slice_header_fn parse_slice_header;
+  int keyframes; /* 1: IDR pictures only, 2: intra recovery points too */
+  unsigned long skipped;
+  struct spsc_ring ring;
+  struct decode_job jobs[QUEUE_MAX];
+};
+
+/* Hands the picture over to the renderer and adds it to the reference
+ * list the following pictures will be decoded with. */
+static void
+finish_picture(struct parser *p, int *vframe) {
+  VdpPictureInfoH264 *info = &p->info;
+  int j;
+
+  spsc_produce_end(&p->ring);
+
+  if (info->is_reference) {
+    for (j = 5; j > 0; --j)
+      memcpy(&info->referenceFrames[j], &info->referenceFrames[j-1], sizeof(info->referenceFrames[0]));
+    info->referenceFrames[0].surface = p->video[*vframe];
+    memcpy(info->referenceFrames[0].field_order_cnt, info->field_order_cnt, 2 * sizeof(uint32_t));
+    info->referenceFrames[0].frame_idx = info->frame_num;
+    info->referenceFrames[0].top_is_reference = 1;
+    info->referenceFrames[0].bottom_is_reference = 1;
+  }
+  *vframe = (*vframe + 1) % 16;
+}
+
+static void *
+parse_thread(void *arg) {
+  static const char header[3] = {0, 0, 1};
+  struct parser *p = arg;
+  VdpPictureInfoH264 *info = &p->info;
+  struct decode_job *job = NULL;
+  struct h264_nal nal, first_nal;
+  struct h264_slice_header sh, first;
+  int vframe = 0, recovery = 0, j;
+
+  while (!h264_next_nal(p->addr, p->size, &p->pos, &nal)) {
+    if (!h264_nal_is_slice(nal.type)) {
+      //fprintf(stderr, "Skipping NAL type %d, size: %d\n", nal.type, nal.size);
+      if (job && h264_nal_starts_au(nal.type)) {
+        finish_picture(p, &vframe);
+        job = NULL;
+      }
+      if (p->keyframes > 1 && nal.type == 6 && h264_sei_recovery_point(&nal) >= 0)
+        recovery = 1;
+      continue;
+    }
+
+    /* In keyframe mode, non-IDR slices are dropped on the NAL type
+     * alone, unless they may belong to a recovery point picture: then
+     * the header is needed to tell where that picture ends. */
+    if (p->keyframes && nal.type == 1 && !recovery && !(job && first_nal.type == 1)) {
+      if (job) {
+        finish_picture(p, &vframe);
+        job = NULL;
+      }
+      p->skipped++;
+      continue;
+    }
+    //fprintf(stderr, "Processing NAL type %d, ref_idc: %d, size: %d\n", nal.type, nal.ref_idc, nal.size);
+
+    p->parse_slice_header(&nal, &p->slice_params, &sh);
+    mark("nal_type: %d, ref_idc: %d, size: %d, slice_type: %d, first_mb: %d\n", nal.type, nal.ref_idc, nal.size, sh.slice_type, sh.first_mb_in_slice);
+    //fprintf(stderr, "Slice type: %d\n", sh.slice_type);
+
+    if (job && h264_new_picture(&first_nal, &first, &nal, &sh)) {
+      finish_picture(p, &vframe);
+      job = NULL;
+    }
+
+    if (!job && p->keyframes && nal.type == 1) {
+      /* Only an intra picture decodes without its references */
+      int intra = sh.slice_type % 5 == 2 || sh.slice_type % 5 == 4;
+
+      if (!recovery || !intra) {
+        recovery = 0;
+        p->skipped++;
+        continue;
+      }
+      recovery = 0;
+      for (j = 0; j < 16; ++j)
+        info->referenceFrames[j].surface = VDP_INVALID_HANDLE;
+    }
+
+    if (!job) {
+      first_nal = nal;
+      first = sh;
+
+      info->frame_num = sh.frame_num;
+      if (nal.type == 5) {
+        info->frame_num = 0;
+        for (j = 0; j < 16; ++j)
+          info->referenceFrames[j].surface = VDP_INVALID_HANDLE;
+      }
+
+      info->field_order_cnt[0] = (1 << 16) + sh.pic_order_cnt_lsb;
+      info->field_order_cnt[1] = (1 << 16) + sh.pic_order_cnt_lsb;
+
+      info->is_reference = nal.ref_idc != 0;
+
+      job = &p->jobs[spsc_produce_begin(&p->ring)];
+      job->surface = p->video[vframe];
+      job->buffer_count = 0;
+    }
+
+    /* All the slices of a picture go into a single render call, each
+     * one behind its own start code. */
+    assert(job->buffer_count + 2 <= 2 * MAX_SLICES);
+    job->buffer[job->buffer_count].struct_version = VDP_BITSTREAM_BUFFER_VERSION;
+    job->buffer[job->buffer_count].bitstream = header;
+    job->buffer[job->buffer_count].bitstream_bytes = sizeof(header);
+    job->buffer_count++;
+    job->buffer[job->buffer_count].struct_version = VDP_BITSTREAM_BUFFER_VERSION;
+    job->buffer[job->buffer_count].bitstream = nal.data;
+    job->buffer[job->buffer_count].bitstream_bytes = nal.size;
+    job->buffer_count++;
+
+    info->slice_count = job->buffer_count / 2;
+    job->info = *info;
+  }
+
+  if (job)
+    finish_picture(p, &vframe);
+
+  spsc_close(&p->ring);
+  return NULL;
+}
+
+#define DUMP_QUEUE 8
+
+/* Decoded frames on their way to the dump file. The render loop reads
+ * each surface into a free slot's NV12 planes; the writer thread turns
+ * them into planar YUV 4:2:0 and writes a whole plane at a time. When
+ * the writer falls behind, the render loop blocks on a full ring. */
+struct dumper {
+  int fd;
+  int width, height;
+  struct spsc_ring ring;
+  uint8_t *planes[DUMP_QUEUE][2];
+  uint8_t *u, *v; /* writer-owned */
+  uint64_t bytes;
+};
+
+static void
+write_all(int fd, const uint8_t *buf, size_t len) {
+  while (len) {
+    ssize_t ret = write(fd, buf, len);
+    assert(ret > 0);
+    buf += ret;
+    len -= ret;
+  }
+}
+
+static void *
+dump_thread(void *arg) {
+  struct dumper *d = arg;
+  size_t luma = d->width * d->height, chroma = luma / 4, i;
+  uint32_t slot;
+
+  while (spsc_consume_begin(&d->ring, &slot)) {
+    const uint8_t *uv = d->planes[slot][1];
+
+    for (i = 0; i < chroma; i++) {
+      d->u[i] = uv[2 * i];
+      d->v[i] = uv[2 * i + 1];
+    }
+    write_all(d->fd, d->planes[slot][0], luma);
+    write_all(d->fd, d->u, chroma);
+    write_all(d->fd, d->v, chroma);
+    d->bytes += luma + 2 * chroma;
+    spsc_consume_end(&d->ring);
+  }
+  return NULL;
+}
+
+static void
+dumper_init(struct dumper *d, const char *path, int width, int height) {
+  int i;
+
+  d->fd = strcmp(path, "-") ? open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : 1;
+  assert(d->fd >= 0);
+  d->width = width;
+  d->height = height;
+  spsc_init(&d->ring, DUMP_QUEUE);
+  for (i = 0; i < DUMP_QUEUE; i++) {
+    d->planes[i][0] = malloc(width * height);
+    d->planes[i][1] = malloc(width * height / 2);
+    assert(d->planes[i][0] && d->planes[i][1]);
+  }
+  d->u = malloc(width * height / 4);
+  d->v = malloc(width * height / 4);
+  assert(d->u && d->v);
+}
+
+static void
+usage(const char *name) {
+  fprintf(stderr, "Usage: %s [-i] [-k|-K] [-s seconds] [-r fps] [-q depth] [-g|-v manifest] [-o out.yuv] stream.dump\n"
+          "  -i  only build the keyframe index (stream.dump.idx) and exit\n"
+          "  -k  only decode and show IDR pictures\n"
+          "  -K  same, plus intra pictures at recovery point SEIs\n"
+          "  -s  start at the last keyframe before this time\n"
+          "  -r  frame rate used to turn -s into a picture, default 24\n"
+          "  -q  parser to renderer queue depth, power of 2 up to %d, default 8\n"
+          "  -g  record per-plane CRC32C hashes of every decoded frame\n"
+          "  -v  check decoded frames against hashes recorded with -g\n"
+          "  -o  write decoded frames to a planar YUV 4:2:0 file, - for stdout\n",
+          name, QUEUE_MAX);
+  exit(1);
+}
+
 int main(int argc, char **argv) {
   int width = 1280, height = 544;
+  int index_only = 0, keyframes = 0;
+  double seek = -1, fps = 24;
+  unsigned depth = 8;
+  const char *manifest = NULL, *dump_path = NULL;
+  int generate = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "ikKs:r:q:g:v:o:")) != -1) {
+    switch (opt) {
+    case 'i': index_only = 1; break;
+    case 'k': keyframes = 1; break;
+    case 'K': keyframes = 2; break;
+    case 's': seek = atof(optarg); break;
+    case 'r': fps = atof(optarg); break;
+    case 'q': depth = atoi(optarg); break;
+    case 'g': manifest = optarg; generate = 1; break;
+    case 'v': manifest = optarg; generate = 0; break;
+    case 'o': dump_path = optarg; break;
+    default: usage(argv[0]);
+    }
+  }
+  if (optind >= argc || fps <= 0 ||
+      !depth || depth > QUEUE_MAX || (depth & (depth - 1)))
+    usage(argv[0]);
+
+  int fd = open(argv[optind], O_RDONLY);
+  assert(fd >= 0);
+  struct stat statbuf;
+  assert(fstat(fd, &statbuf) == 0);
+  const uint8_t *addr = mmap(NULL, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  assert(addr != MAP_FAILED);
+
+  struct frame_check *check = NULL;
+  if (manifest) {
+    check = frame_check_open(manifest, generate);
+    assert(check);
+  }
+
+  size_t pos = 0;
+  if (index_only || seek >= 0) {
+    struct h264_index idx;
+    load_index(argv[optind], &statbuf, addr, &idx);
+    if (index_only)
+      return 0;
+
+    const struct h264_index_entry *e = h264_index_lookup(&idx, seek * fps);
+    if (e) {
+      fprintf(stderr, "Starting at picture %u (%s, frame_num %d, poc_lsb %d) "
+              "at offset 0x%lx\n", e->picture,
+              (e->flags & H264_INDEX_IDR) ? "IDR" : "recovery point",
+              e->frame_num, e->poc_lsb, (long)e->offset);
+      pos = e->offset;
+    }
+    h264_index_free(&idx);
+  }
+
   Display *display = XOpenDisplay(NULL);
 
   Window root = XDefaultRootWindow(display);
@@ -207,18 +494,11 @@ int main(int argc, char **argv) {
   ret = vdp_video_mixer_create(dev, sizeof(mixer_features)/sizeof(mixer_features[0]), mixer_features, sizeof(mixer_params)/sizeof(mixer_params[0]), mixer_params, mixer_param_vals, &mixer);
   assert(ret == VDP_STATUS_OK);
 
-
-  assert(argc > 1);
-  int fd = open(argv[1], O_RDONLY);
-  struct stat statbuf;
-  assert(fstat(fd, &statbuf) == 0);
-  void *addr = mmap(NULL, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
-  void *orig_addr = addr;
-
   mark("mmap file addr: 0x%p size: 0x%lx\n", addr, statbuf.st_size);
 
   //printf("mmap'd file of size: %ld\n", statbuf.st_size);
 
+  static struct parser parser;
   VdpPictureInfoH264 info = {
     .slice_count = 1,
     .field_order_cnt = { 65536, 65536 },
@@ -238,9 +518,9 @@ int main(int argc, char **argv) {
     .pic_init_qp_minus26 = 0,
     .num_ref_idx_l0_active_minus1 = 0,
     .num_ref_idx_l1_active_minus1 = 0,
-    .log2_max_frame_num_minus4 = 5,
+    .log2_max_frame_num_minus4 = LOG2_MAX_FRAME_NUM - 4,
     .pic_order_cnt_type = 0,
-    .log2_max_pic_order_cnt_lsb_minus4 = 6,
+    .log2_max_pic_order_cnt_lsb_minus4 = LOG2_MAX_POC_LSB - 4,
     .delta_pic_order_always_zero_flag = 0,
     .direct_8x8_inference_flag = 1,
     .entropy_coding_mode_flag = 1,
@@ -274,50 +554,48 @@ int main(int argc, char **argv) {
 
   fprintf(stderr, "Start time: %ld\n", t);
 
-  int vframe = 0;
+  parser.addr = addr;
+  parser.size = statbuf.st_size;
+  parser.pos = pos;
+  parser.info = info;
+  parser.slice_params = (struct h264_slice_params){
+    .log2_max_frame_num = info.log2_max_frame_num_minus4 + 4,
+    .log2_max_poc_lsb = info.log2_max_pic_order_cnt_lsb_minus4 + 4,
+    .pic_order_cnt_type = info.pic_order_cnt_type,
+    .frame_mbs_only_flag = info.frame_mbs_only_flag,
+    .delta_pic_order_always_zero_flag = info.delta_pic_order_always_zero_flag,
+    .pic_order_present_flag = info.pic_order_present_flag,
+    .redundant_pic_cnt_present_flag = info.redundant_pic_cnt_present_flag,
+  };
+  parser.parse_slice_header = h264_slice_header_parser(&parser.slice_params);
+  parser.video = video;
+  parser.keyframes = keyframes;
+  spsc_init(&parser.ring, depth);
+
+  uint8_t *planes[2] = {
+    malloc(width * height),
+    malloc(width * height / 2),
+  };
+  uint32_t pitches[2] = {width, width};
+  unsigned frame = 0;
+  assert(planes[0] && planes[1]);
+
+  static struct dumper dumper;
+  pthread_t dump_tid;
+  if (dump_path) {
+    dumper_init(&dumper, dump_path, width, height);
+    assert(!pthread_create(&dump_tid, NULL, dump_thread, &dumper));
+  }
 
-  while ((addr - orig_addr) < statbuf.st_size) {
-    int size = ntohl(*(int *)addr);
-    addr += 4;
-    int nal_type = (*(char *)addr) & 0x1F;
-    int nal_ref_idc = (*(char *)addr) >> 5;
-    if (nal_type != 1 && nal_type != 5) {
-      //fprintf(stderr, "Skipping NAL type %d, size: %d\n", nal_type, size);
-      addr += size;
-      continue;
-    }
-    //fprintf(stderr, "Processing NAL type %d, ref_idc: %d, size: %d\n", nal_type, nal_ref_idc, size);
-
-    int bit_offset = 8;
-    ue(addr, &bit_offset);
-    int slice_type = ue(addr, &bit_offset);
-    mark("nal_type: %d, ref_idc: %d, size: %d, slice_type: %d\n", nal_type, nal_ref_idc, size, slice_type);
-    //fprintf(stderr, "Slice type: %d\n", slice_type);
-    ue(addr, &bit_offset);
-    info.frame_num = read_bits(addr, &bit_offset, info.log2_max_frame_num_minus4 + 4);
-    if (nal_type == 5) {
-      ue(addr, &bit_offset);
-      info.frame_num = 0;
-      for (j = 0; j < 16; ++j)
-        info.referenceFrames[j].surface = VDP_INVALID_HANDLE;
-    }
+  pthread_t parse_tid;
+  assert(!pthread_create(&parse_tid, NULL, parse_thread, &parser));
 
-    uint32_t poc_lsb = read_bits(addr, &bit_offset, info.log2_max_pic_order_cnt_lsb_minus4 + 4);
-    info.field_order_cnt[0] = (1 << 16) + poc_lsb;
-    info.field_order_cnt[1] = (1 << 16) + poc_lsb;
-
-    info.is_reference = nal_ref_idc != 0;
-
-    VdpBitstreamBuffer buffer[2];
-    static const char header[3] = {0, 0, 1};
-    buffer[0].struct_version = VDP_BITSTREAM_BUFFER_VERSION;
-    buffer[0].bitstream = header;
-    buffer[0].bitstream_bytes = sizeof(header);
-    buffer[1].struct_version = VDP_BITSTREAM_BUFFER_VERSION;
-    buffer[1].bitstream = addr;
-    buffer[1].bitstream_bytes = size;
-    mark("vdp_decoder_render: %d\n", video[vframe]);
-    ret = vdp_decoder_render(dec, video[vframe], (void*)&info, 2, buffer);
+  uint32_t slot;
+  while (spsc_consume_begin(&parser.ring, &slot)) {
+    struct decode_job *job = &parser.jobs[slot];
+
+    mark("vdp_decoder_render: %d, slices: %d\n", job->surface, job->info.slice_count);
+    ret = vdp_decoder_render(dec, job->surface, (void*)&job->info, job->buffer_count, job->buffer);
     assert(ret == VDP_STATUS_OK);
 
     mark("vdp_video_mixer_render\n");
@@ -326,7 +604,7 @@ int main(int argc, char **argv) {
         VDP_INVALID_HANDLE, NULL,
         VDP_VIDEO_MIXER_PICTURE_STRUCTURE_FRAME,
         0, NULL,
-        video[vframe],
+        job->surface,
         0, NULL,
         NULL,
         output,
@@ -340,37 +618,56 @@ int main(int argc, char **argv) {
     ret = vdp_presentation_queue_display(queue, output, 1280, 544, t);
     assert(ret == VDP_STATUS_OK);
 
-    addr += size;
-
-    /*
-    uint32_t pitches[2] = {1280, 640 * 2};
-    uint8_t *data[2];
-    for (i = 0; i < 2; i++) {
-      data[i] = malloc(1280 * 544 / (i ? 2 : 1));
-      assert(data[i]);
+    if (check || dump_path) {
+      /* Straight into a dump slot if there is a dump, the hashes don't
+       * care where the planes are */
+      uint8_t **dst = planes;
+      uint32_t dump_slot = 0;
+
+      if (dump_path) {
+        dump_slot = spsc_produce_begin(&dumper.ring);
+        dst = dumper.planes[dump_slot];
+      }
+      ret = vdp_video_surface_get_bits_ycbcr(job->surface, VDP_YCBCR_FORMAT_NV12, (void **)dst, pitches);
+      assert(ret == VDP_STATUS_OK);
+      if (check) {
+        frame_check_plane(check, frame, 0, dst[0], width, height, width);
+        frame_check_plane(check, frame, 1, dst[1], width, height / 2, width);
+      }
+      if (dump_path)
+        spsc_produce_end(&dumper.ring);
     }
-    ret = vdp_video_surface_get_bits_ycbcr(video[vframe], VDP_YCBCR_FORMAT_NV12, (void **)data, pitches);
-    assert(ret == VDP_STATUS_OK);
+    frame++;
 
-    write(1, data[0], 1280 * 544);
-    for (i = 0; i < 1280 * 544 / 2; i+=2)
-      write(1, data[1] + i, 1);
-    for (i = 0; i < 1280 * 544 / 2; i+=2)
-      write(1, data[1] + i + 1, 1);
-    */
-
-    if (info.is_reference) {
-      for (j = 5; j > 0; --j)
-        memcpy(&info.referenceFrames[j], &info.referenceFrames[j-1], sizeof(info.referenceFrames[0]));
-      info.referenceFrames[0].surface = video[vframe];
-      memcpy(info.referenceFrames[0].field_order_cnt, info.field_order_cnt, 2 * sizeof(uint32_t));
-      info.referenceFrames[0].frame_idx = info.frame_num;
-      info.referenceFrames[0].top_is_reference = 1;
-      info.referenceFrames[0].bottom_is_reference = 1;
-    }
-    vframe = (vframe + 1) % 16;
-    //if (vframe > 10) break;
+    spsc_consume_end(&parser.ring);
+  }
+
+  assert(!pthread_join(parse_tid, NULL));
+
+  fprintf(stderr, "Parser queue: %lu jobs, depth %u, avg occupancy %.2f, max %u, "
+          "parser stalls (full) %lu, render stalls (empty) %lu\n",
+          (unsigned long)parser.ring.produced, depth,
+          parser.ring.produced ? (double)parser.ring.depth_sum / parser.ring.produced : 0,
+          parser.ring.depth_max,
+          (unsigned long)parser.ring.producer_stalls,
+          (unsigned long)parser.ring.consumer_stalls);
+
+  if (dump_path) {
+    spsc_close(&dumper.ring);
+    assert(!pthread_join(dump_tid, NULL));
+    fprintf(stderr, "Dump: %lu frames, %.1f MB, avg queue occupancy %.2f, "
+            "decoder stalls (full) %lu\n",
+            (unsigned long)dumper.ring.produced, dumper.bytes / 1e6,
+            dumper.ring.produced ? (double)dumper.ring.depth_sum / dumper.ring.produced : 0,
+            (unsigned long)dumper.ring.producer_stalls);
   }
 
+  if (keyframes)
+    fprintf(stderr, "Keyframe mode: %u pictures decoded, %lu slices skipped\n",
+            frame, parser.skipped);
+
+  if (check && frame_check_close(check))
+    return 1;
+
   return 0;
 }
@@ -0,0 +1,1530 @@
+/*
+ * Copyright (C) 2013 Ilia Mirkin <imirkin@alum.mit.edu>
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "h264_recon.h"
+
+static inline uint8_t clip1(int x) {
+  return x < 0 ? 0 : x > 255 ? 255 : x;
+}
+
+static inline int clip3(int lo, int hi, int x) {
+  return x < lo ? lo : x > hi ? hi : x;
+}
+
+/* 8.5.12.2 */
+static void
+idct4_add_c(uint8_t *dst, int stride, int16_t *block) {
+  int tmp[16], i;
+
+  for (i = 0; i < 4; i++) {
+    const int16_t *d = block + 4 * i;
+    int e = d[0] + d[2], f = d[0] - d[2];
+    int g = (d[1] >> 1) - d[3], h = d[1] + (d[3] >> 1);
+
+    tmp[4 * i + 0] = e + h;
+    tmp[4 * i + 1] = f + g;
+    tmp[4 * i + 2] = f - g;
+    tmp[4 * i + 3] = e - h;
+  }
+  for (i = 0; i < 4; i++) {
+    int e = tmp[i] + tmp[8 + i], f = tmp[i] - tmp[8 + i];
+    int g = (tmp[4 + i] >> 1) - tmp[12 + i], h = tmp[4 + i] + (tmp[12 + i] >> 1);
+
+    dst[0 * stride + i] = clip1(dst[0 * stride + i] + ((e + h + 32) >> 6));
+    dst[1 * stride + i] = clip1(dst[1 * stride + i] + ((f + g + 32) >> 6));
+    dst[2 * stride + i] = clip1(dst[2 * stride + i] + ((f - g + 32) >> 6));
+    dst[3 * stride + i] = clip1(dst[3 * stride + i] + ((e - h + 32) >> 6));
+  }
+  memset(block, 0, 16 * sizeof(*block));
+}
+
+/* 8.5.13.2, one row or column */
+#define IDCT8_1D(d0, d1, d2, d3, d4, d5, d6, d7, OUT) do {         \
+    int a0 = d0 + d4, a4 = d0 - d4;                                  \
+    int a2 = (d2 >> 1) - d6, a6 = d2 + (d6 >> 1);                    \
+    int b0 = a0 + a6, b2 = a4 + a2, b4 = a4 - a2, b6 = a0 - a6;      \
+    int a1 = -d3 + d5 - d7 - (d7 >> 1);                              \
+    int a3 = d1 + d7 - d3 - (d3 >> 1);                               \
+    int a5 = -d1 + d7 + d5 + (d5 >> 1);                              \
+    int a7 = d3 + d5 + d1 + (d1 >> 1);                               \
+    int b1 = a1 + (a7 >> 2), b7 = a7 - (a1 >> 2);                    \
+    int b3 = a3 + (a5 >> 2), b5 = (a3 >> 2) - a5;                    \
+    OUT(0, b0 + b7); OUT(1, b2 + b5); OUT(2, b4 + b3); OUT(3, b6 + b1); \
+    OUT(4, b6 - b1); OUT(5, b4 - b3); OUT(6, b2 - b5); OUT(7, b0 - b7); \
+  } while (0)
+
+static void
+idct8_add_c(uint8_t *dst, int stride, int16_t *block) {
+  int tmp[64], i;
+
+  for (i = 0; i < 8; i++) {
+    const int16_t *d = block + 8 * i;
+#define ROW_OUT(k, v) tmp[8 * i + k] = (v)
+    IDCT8_1D(d[0], d[1], d[2], d[3], d[4], d[5], d[6], d[7], ROW_OUT);
+#undef ROW_OUT
+  }
+  for (i = 0; i < 8; i++) {
+    const int *d = tmp + i;
+#define COL_OUT(k, v) dst[k * stride + i] = clip1(dst[k * stride + i] + (((v) + 32) >> 6))
+    IDCT8_1D(d[0], d[8], d[16], d[24], d[32], d[40], d[48], d[56], COL_OUT);
+#undef COL_OUT
+  }
+  memset(block, 0, 64 * sizeof(*block));
+}
+
+/* 8.3.3 */
+static void
+pred16x16_c(uint8_t *dst, int stride, int mode, int avail) {
+  const uint8_t *top = dst - stride;
+  int x, y, dc, sum;
+
+  switch (mode) {
+  case H264_PRED16_V:
+    for (y = 0; y < 16; y++)
+      memcpy(dst + y * stride, top, 16);
+    break;
+  case H264_PRED16_H:
+    for (y = 0; y < 16; y++)
+      memset(dst + y * stride, dst[y * stride - 1], 16);
+    break;
+  case H264_PRED16_DC:
+    sum = 0;
+    if (avail & H264_AVAIL_TOP)
+      for (x = 0; x < 16; x++)
+        sum += top[x];
+    if (avail & H264_AVAIL_LEFT)
+      for (y = 0; y < 16; y++)
+        sum += dst[y * stride - 1];
+    switch (avail & (H264_AVAIL_TOP | H264_AVAIL_LEFT)) {
+    case H264_AVAIL_TOP | H264_AVAIL_LEFT: dc = (sum + 16) >> 5; break;
+    case H264_AVAIL_TOP: case H264_AVAIL_LEFT: dc = (sum + 8) >> 4; break;
+    default: dc = 128; break;
+    }
+    for (y = 0; y < 16; y++)
+      memset(dst + y * stride, dc, 16);
+    break;
+  case H264_PRED16_PLANE: {
+    int H = 0, V = 0, a, b, c;
+
+    for (x = 0; x < 8; x++) {
+      H += (x + 1) * (top[8 + x] - top[6 - x]);
+      V += (x + 1) * (dst[(8 + x) * stride - 1] - dst[(6 - x) * stride - 1]);
+    }
+    a = 16 * (dst[15 * stride - 1] + top[15]);
+    b = (5 * H + 32) >> 6;
+    c = (5 * V + 32) >> 6;
+    for (y = 0; y < 16; y++)
+      for (x = 0; x < 16; x++)
+        dst[y * stride + x] = clip1((a + b * (x - 7) + c * (y - 7) + 16) >> 5);
+    break;
+  }
+  }
+}
+
+void h264_pred_chroma_dc_nv12(uint8_t *dst, int stride, int avail) {
+  int top = avail & H264_AVAIL_TOP, left = avail & H264_AVAIL_LEFT;
+  int bx, by, c, i;
+
+  for (by = 0; by < 2; by++) {
+    for (bx = 0; bx < 2; bx++) {
+      uint8_t *blk = dst + 4 * by * stride + 8 * bx;
+
+      for (c = 0; c < 2; c++) {
+        int st = 0, sl = 0, dc;
+
+        for (i = 0; i < 4; i++) {
+          if (top)
+            st += blk[-stride + 2 * i + c];
+          if (left)
+            sl += blk[i * stride - 2 + c];
+        }
+        /* The top right block prefers the top, the bottom left one the
+         * left, the other two use both. */
+        if (bx != by && bx && top)
+          dc = (st + 2) >> 2;
+        else if (bx != by && by && left)
+          dc = (sl + 2) >> 2;
+        else if (top && left)
+          dc = (st + sl + 4) >> 3;
+        else if (left)
+          dc = (sl + 2) >> 2;
+        else if (top)
+          dc = (st + 2) >> 2;
+        else
+          dc = 128;
+
+        for (i = 0; i < 16; i++)
+          blk[(i / 4) * stride + 2 * (i % 4) + c] = dc;
+      }
+    }
+  }
+}
+
+/* 8.3.1.2 and 8.3.2.2: the intra 4x4 and 8x8 modes share their rules,
+ * only the block size changes. top[] holds p[x, -1] for x = -1..2n-1,
+ * left[] p[-1, y] for y = -1..n-1, both starting at p[-1, -1]. */
+static void
+pred_nxn(uint8_t *dst, int stride, int n, int mode, int avail,
+         const int *top, const int *left) {
+#define T(x) top[(x) + 1]
+#define L(y) left[(y) + 1]
+#define F2(a, b) (((a) + (b) + 1) >> 1)
+#define F3(a, b, c) (((a) + 2 * (b) + (c) + 2) >> 2)
+  int x, y, v, z, sum, shift = n == 4 ? 2 : 3;
+
+  for (y = 0; y < n; y++) {
+    for (x = 0; x < n; x++) {
+      switch (mode) {
+      case H264_PRED_V:
+        v = T(x);
+        break;
+      case H264_PRED_H:
+        v = L(y);
+        break;
+      case H264_PRED_DC:
+        sum = 0;
+        for (z = 0; z < n; z++) {
+          if (avail & H264_AVAIL_TOP)
+            sum += T(z);
+          if (avail & H264_AVAIL_LEFT)
+            sum += L(z);
+        }
+        switch (avail & (H264_AVAIL_TOP | H264_AVAIL_LEFT)) {
+        case H264_AVAIL_TOP | H264_AVAIL_LEFT: v = (sum + n) >> (shift + 1); break;
+        case H264_AVAIL_TOP: case H264_AVAIL_LEFT: v = (sum + n / 2) >> shift; break;
+        default: v = 128; break;
+        }
+        break;
+      case H264_PRED_DDL:
+        if (x == n - 1 && y == n - 1)
+          v = (T(2 * n - 2) + 3 * T(2 * n - 1) + 2) >> 2;
+        else
+          v = F3(T(x + y), T(x + y + 1), T(x + y + 2));
+        break;
+      case H264_PRED_DDR:
+        if (x > y)
+          v = F3(T(x - y - 2), T(x - y - 1), T(x - y));
+        else if (x < y)
+          v = F3(L(y - x - 2), L(y - x - 1), L(y - x));
+        else
+          v = F3(T(0), T(-1), L(0));
+        break;
+      case H264_PRED_VR:
+        z = 2 * x - y;
+        if (z >= 0 && !(z & 1))
+          v = F2(T(x - (y >> 1) - 1), T(x - (y >> 1)));
+        else if (z >= 0)
+          v = F3(T(x - (y >> 1) - 2), T(x - (y >> 1) - 1), T(x - (y >> 1)));
+        else if (z == -1)
+          v = F3(L(0), L(-1), T(0));
+        else
+          v = F3(L(y - 2 * x - 1), L(y - 2 * x - 2), L(y - 2 * x - 3));
+        break;
+      case H264_PRED_HD:
+        z = 2 * y - x;
+        if (z >= 0 && !(z & 1))
+          v = F2(L(y - (x >> 1) - 1), L(y - (x >> 1)));
+        else if (z >= 0)
+          v = F3(L(y - (x >> 1) - 2), L(y - (x >> 1) - 1), L(y - (x >> 1)));
+        else if (z == -1)
+          v = F3(L(0), L(-1), T(0));
+        else
+          v = F3(T(x - 2 * y - 1), T(x - 2 * y - 2), T(x - 2 * y - 3));
+        break;
+      case H264_PRED_VL:
+        if (!(y & 1))
+          v = F2(T(x + (y >> 1)), T(x + (y >> 1) + 1));
+        else
+          v = F3(T(x + (y >> 1)), T(x + (y >> 1) + 1), T(x + (y >> 1) + 2));
+        break;
+      default: /* H264_PRED_HU */
+        z = x + 2 * y;
+        if (z < 2 * n - 3 && !(z & 1))
+          v = F2(L(y + (x >> 1)), L(y + (x >> 1) + 1));
+        else if (z < 2 * n - 3)
+          v = F3(L(y + (x >> 1)), L(y + (x >> 1) + 1), L(y + (x >> 1) + 2));
+        else if (z == 2 * n - 3)
+          v = (L(n - 2) + 3 * L(n - 1) + 2) >> 2;
+        else
+          v = L(n - 1);
+        break;
+      }
+      dst[y * stride + x] = v;
+    }
+  }
+#undef F3
+#undef F2
+#undef L
+#undef T
+}
+
+/* Gathers the neighbours that are there; the rest stay 0 and no
+ * allowed mode reads them. A missing top right repeats p[n-1, -1]. */
+static void
+pred_nxn_refs(const uint8_t *dst, int stride, int n, int avail,
+              int *top, int *left) {
+  int i;
+
+  memset(top, 0, (2 * n + 1) * sizeof(*top));
+  memset(left, 0, (n + 1) * sizeof(*left));
+  if (avail & H264_AVAIL_TOP_LEFT)
+    top[0] = left[0] = dst[-stride - 1];
+  if (avail & H264_AVAIL_TOP)
+    for (i = 0; i < 2 * n; i++)
+      top[1 + i] = dst[-stride + (i < n || (avail & H264_AVAIL_TOP_RIGHT) ? i : n - 1)];
+  if (avail & H264_AVAIL_LEFT)
+    for (i = 0; i < n; i++)
+      left[1 + i] = dst[i * stride - 1];
+}
+
+static void
+pred4x4_c(uint8_t *dst, int stride, int mode, int avail) {
+  int top[9], left[5];
+
+  pred_nxn_refs(dst, stride, 4, avail, top, left);
+  pred_nxn(dst, stride, 4, mode, avail, top, left);
+}
+
+/* 8.3.2.2.1, the reference sample filtering */
+static void
+pred8x8l_refs(const uint8_t *dst, int stride, int avail, int *ft, int *fl) {
+  int top[17], left[9], i;
+  int tl = avail & H264_AVAIL_TOP_LEFT;
+
+  pred_nxn_refs(dst, stride, 8, avail, top, left);
+  memcpy(ft, top, sizeof(top));
+  memcpy(fl, left, sizeof(left));
+
+  if (avail & H264_AVAIL_TOP) {
+    ft[1] = tl ? (top[0] + 2 * top[1] + top[2] + 2) >> 2 : (3 * top[1] + top[2] + 2) >> 2;
+    for (i = 2; i < 16; i++)
+      ft[i] = (top[i - 1] + 2 * top[i] + top[i + 1] + 2) >> 2;
+    ft[16] = (top[15] + 3 * top[16] + 2) >> 2;
+  }
+  if (tl) {
+    switch (avail & (H264_AVAIL_TOP | H264_AVAIL_LEFT)) {
+    case H264_AVAIL_TOP | H264_AVAIL_LEFT: ft[0] = (top[1] + 2 * top[0] + left[1] + 2) >> 2; break;
+    case H264_AVAIL_TOP: ft[0] = (3 * top[0] + top[1] + 2) >> 2; break;
+    case H264_AVAIL_LEFT: ft[0] = (3 * top[0] + left[1] + 2) >> 2; break;
+    }
+    fl[0] = ft[0];
+  }
+  if (avail & H264_AVAIL_LEFT) {
+    fl[1] = tl ? (left[0] + 2 * left[1] + left[2] + 2) >> 2 : (3 * left[1] + left[2] + 2) >> 2;
+    for (i = 2; i < 8; i++)
+      fl[i] = (left[i - 1] + 2 * left[i] + left[i + 1] + 2) >> 2;
+    fl[8] = (left[7] + 3 * left[8] + 2) >> 2;
+  }
+}
+
+/* 8.3.2.2.2-10 */
+static void
+pred8x8l_c(uint8_t *dst, int stride, int mode, int avail) {
+  int ft[17], fl[9];
+
+  pred8x8l_refs(dst, stride, avail, ft, fl);
+  pred_nxn(dst, stride, 8, mode, avail, ft, fl);
+}
+
+/* 8.3.4, on interleaved UV */
+static void
+pred_chroma_c(uint8_t *dst, int stride, int mode, int avail) {
+  const uint8_t *top = dst - stride;
+  int x, y, c;
+
+  switch (mode) {
+  case H264_PREDC_DC:
+    h264_pred_chroma_dc_nv12(dst, stride, avail);
+    break;
+  case H264_PREDC_H:
+    for (y = 0; y < 8; y++)
+      for (x = 0; x < 16; x++)
+        dst[y * stride + x] = dst[y * stride - 2 + (x & 1)];
+    break;
+  case H264_PREDC_V:
+    for (y = 0; y < 8; y++)
+      memcpy(dst + y * stride, top, 16);
+    break;
+  case H264_PREDC_PLANE:
+    for (c = 0; c < 2; c++) {
+      int H = 0, V = 0, a, b, cc;
+
+      for (x = 0; x < 4; x++) {
+        H += (x + 1) * (top[2 * (4 + x) + c] - top[2 * (2 - x) + c]);
+        V += (x + 1) * (dst[(4 + x) * stride - 2 + c] - dst[(2 - x) * stride - 2 + c]);
+      }
+      a = 16 * (dst[7 * stride - 2 + c] + top[14 + c]);
+      b = (34 * H + 32) >> 6;
+      cc = (34 * V + 32) >> 6;
+      for (y = 0; y < 8; y++)
+        for (x = 0; x < 8; x++)
+          dst[y * stride + 2 * x + c] = clip1((a + b * (x - 3) + cc * (y - 3) + 16) >> 5);
+    }
+    break;
+  }
+}
+
+/* 8.4.2.2.1: the three half-sample planes, b (horizontal), h (vertical)
+ * and j (centre). The quarter positions average two of them, or one of
+ * them and a full sample. */
+#define TAP(p, s) ((p)[-2 * (s)] - 5 * (p)[-(s)] + 20 * (p)[0] + \
+                   20 * (p)[s] - 5 * (p)[2 * (s)] + (p)[3 * (s)])
+
+typedef void (*hpel_func)(uint8_t *dst, int dst_stride, const uint8_t *src,
+                          int src_stride, int w, int h);
+
+static void
+hpel_h_c(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride,
+         int w, int h) {
+  int x, y;
+
+  for (y = 0; y < h; y++)
+    for (x = 0; x < w; x++)
+      dst[y * dst_stride + x] = clip1((TAP(src + y * src_stride + x, 1) + 16) >> 5);
+}
+
+static void
+hpel_v_c(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride,
+         int w, int h) {
+  int x, y;
+
+  for (y = 0; y < h; y++)
+    for (x = 0; x < w; x++)
+      dst[y * dst_stride + x] = clip1((TAP(src + y * src_stride + x, src_stride) + 16) >> 5);
+}
+
+static void
+hpel_hv_c(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride,
+          int w, int h) {
+  int tmp[21 * 16], x, y;
+
+  /* Vertical first, unclipped, for the 5 extra columns */
+  for (y = 0; y < h; y++)
+    for (x = 0; x < w + 5; x++)
+      tmp[y * 21 + x] = TAP(src + y * src_stride + x - 2, src_stride);
+  for (y = 0; y < h; y++)
+    for (x = 0; x < w; x++)
+      dst[y * dst_stride + x] = clip1((TAP(tmp + y * 21 + x + 2, 1) + 512) >> 10);
+}
+
+static void
+avg_c(uint8_t *dst, int dst_stride, const uint8_t *a, int a_stride,
+      const uint8_t *b, int b_stride, int w, int h) {
+  int x, y;
+
+  for (y = 0; y < h; y++)
+    for (x = 0; x < w; x++)
+      dst[y * dst_stride + x] = (a[y * a_stride + x] + b[y * b_stride + x] + 1) >> 1;
+}
+
+struct mc_funcs {
+  hpel_func hpel_h, hpel_v, hpel_hv;
+  void (*avg)(uint8_t *dst, int dst_stride, const uint8_t *a, int a_stride,
+              const uint8_t *b, int b_stride, int w, int h);
+};
+
+static void
+mc_luma(const struct mc_funcs *f, uint8_t *dst, int dst_stride,
+        const uint8_t *src, int src_stride, int w, int h, int mx, int my) {
+  /* One extra row of b and column of h, for s and m */
+  uint8_t b[17 * 16], v[16 * 17], j[16 * 16];
+  const int bs = 16, vs = 17;
+  const uint8_t *s = b + bs, *m = v + 1;
+  int y;
+
+  if (mx == 0 && my == 0) {
+    for (y = 0; y < h; y++)
+      memcpy(dst + y * dst_stride, src + y * src_stride, w);
+    return;
+  }
+
+  if (mx && my != 2)
+    f->hpel_h(b, bs, src, src_stride, w, h + (my == 3));
+  if (my && mx != 2)
+    f->hpel_v(v, vs, src, src_stride, w + (mx == 3), h);
+  if ((mx == 2 && my) || (my == 2 && mx))
+    f->hpel_hv(j, 16, src, src_stride, w, h);
+
+  switch (my << 2 | mx) {
+  case 0 << 2 | 1: f->avg(dst, dst_stride, src, src_stride, b, bs, w, h); break;        /* a */
+  case 0 << 2 | 2: f->avg(dst, dst_stride, b, bs, b, bs, w, h); break;                  /* b */
+  case 0 << 2 | 3: f->avg(dst, dst_stride, src + 1, src_stride, b, bs, w, h); break;    /* c */
+  case 1 << 2 | 0: f->avg(dst, dst_stride, src, src_stride, v, vs, w, h); break;        /* d */
+  case 1 << 2 | 1: f->avg(dst, dst_stride, b, bs, v, vs, w, h); break;                  /* e */
+  case 1 << 2 | 2: f->avg(dst, dst_stride, b, bs, j, 16, w, h); break;                  /* f */
+  case 1 << 2 | 3: f->avg(dst, dst_stride, b, bs, m, vs, w, h); break;                  /* g */
+  case 2 << 2 | 0: f->avg(dst, dst_stride, v, vs, v, vs, w, h); break;                  /* h */
+  case 2 << 2 | 1: f->avg(dst, dst_stride, v, vs, j, 16, w, h); break;                  /* i */
+  case 2 << 2 | 2: f->avg(dst, dst_stride, j, 16, j, 16, w, h); break;                  /* j */
+  case 2 << 2 | 3: f->avg(dst, dst_stride, m, vs, j, 16, w, h); break;                  /* k */
+  case 3 << 2 | 0: f->avg(dst, dst_stride, src + src_stride, src_stride, v, vs, w, h); break; /* n */
+  case 3 << 2 | 1: f->avg(dst, dst_stride, s, bs, v, vs, w, h); break;                  /* p */
+  case 3 << 2 | 2: f->avg(dst, dst_stride, s, bs, j, 16, w, h); break;                  /* q */
+  case 3 << 2 | 3: f->avg(dst, dst_stride, s, bs, m, vs, w, h); break;                  /* r */
+  }
+}
+
+static const struct mc_funcs mc_c = { hpel_h_c, hpel_v_c, hpel_hv_c, avg_c };
+
+static void
+mc_luma_c(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride,
+          int w, int h, int mx, int my) {
+  mc_luma(&mc_c, dst, dst_stride, src, src_stride, w, h, mx, my);
+}
+
+/* 8.4.2.2.2, on interleaved UV: the horizontal neighbour is 2 bytes on */
+static void
+mc_chroma_c(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride,
+            int w, int h, int mx, int my) {
+  int A = (8 - mx) * (8 - my), B = mx * (8 - my), C = (8 - mx) * my, D = mx * my;
+  int x, y;
+
+  for (y = 0; y < h; y++) {
+    const uint8_t *s = src + y * src_stride;
+    for (x = 0; x < 2 * w; x++)
+      dst[y * dst_stride + x] = (A * s[x] + B * s[x + 2] + C * s[x + src_stride] +
+                                 D * s[x + src_stride + 2] + 32) >> 6;
+  }
+}
+
+/* 8.7.2.3 and 8.7.2.4 on one line of samples across the edge, step
+ * being the distance between neighbouring samples on that line */
+static void
+deblock_luma_line_c(uint8_t *pix, int step, int alpha, int beta, int tc0) {
+  int p0 = pix[-step], p1 = pix[-2 * step], p2 = pix[-3 * step];
+  int q0 = pix[0], q1 = pix[step], q2 = pix[2 * step];
+  int ap, aq, tc, delta;
+
+  if (abs(p0 - q0) >= alpha || abs(p1 - p0) >= beta || abs(q1 - q0) >= beta)
+    return;
+  ap = abs(p2 - p0) < beta;
+  aq = abs(q2 - q0) < beta;
+
+  tc = tc0 + ap + aq;
+  delta = clip3(-tc, tc, (((q0 - p0) << 2) + (p1 - q1) + 4) >> 3);
+  pix[-step] = clip1(p0 + delta);
+  pix[0] = clip1(q0 - delta);
+  if (ap)
+    pix[-2 * step] = p1 + clip3(-tc0, tc0, (p2 + ((p0 + q0 + 1) >> 1) - (p1 << 1)) >> 1);
+  if (aq)
+    pix[step] = q1 + clip3(-tc0, tc0, (q2 + ((p0 + q0 + 1) >> 1) - (q1 << 1)) >> 1);
+}
+
+static void
+deblock_luma_line_intra_c(uint8_t *pix, int step, int alpha, int beta) {
+  int p0 = pix[-step], p1 = pix[-2 * step], p2 = pix[-3 * step], p3 = pix[-4 * step];
+  int q0 = pix[0], q1 = pix[step], q2 = pix[2 * step], q3 = pix[3 * step];
+  int strong;
+
+  if (abs(p0 - q0) >= alpha || abs(p1 - p0) >= beta || abs(q1 - q0) >= beta)
+    return;
+  strong = abs(p0 - q0) < ((alpha >> 2) + 2);
+
+  if (strong && abs(p2 - p0) < beta) {
+    pix[-step] = (p2 + 2 * p1 + 2 * p0 + 2 * q0 + q1 + 4) >> 3;
+    pix[-2 * step] = (p2 + p1 + p0 + q0 + 2) >> 2;
+    pix[-3 * step] = (2 * p3 + 3 * p2 + p1 + p0 + q0 + 4) >> 3;
+  } else {
+    pix[-step] = (2 * p1 + p0 + q1 + 2) >> 2;
+  }
+  if (strong && abs(q2 - q0) < beta) {
+    pix[0] = (p1 + 2 * p0 + 2 * q0 + 2 * q1 + q2 + 4) >> 3;
+    pix[step] = (p0 + q0 + q1 + q2 + 2) >> 2;
+    pix[2 * step] = (2 * q3 + 3 * q2 + q1 + q0 + p0 + 4) >> 3;
+  } else {
+    pix[0] = (2 * q1 + q0 + p1 + 2) >> 2;
+  }
+}
+
+static void
+deblock_luma_h_c(uint8_t *pix, int stride, int alpha, int beta, const int8_t *tc0) {
+  int i;
+
+  for (i = 0; i < 16; i++)
+    if (tc0[i / 4] >= 0)
+      deblock_luma_line_c(pix + i, stride, alpha, beta, tc0[i / 4]);
+}
+
+static void
+deblock_luma_v_c(uint8_t *pix, int stride, int alpha, int beta, const int8_t *tc0) {
+  int i;
+
+  for (i = 0; i < 16; i++)
+    if (tc0[i / 4] >= 0)
+      deblock_luma_line_c(pix + i * stride, 1, alpha, beta, tc0[i / 4]);
+}
+
+static void
+deblock_luma_h_intra_c(uint8_t *pix, int stride, int alpha, int beta) {
+  int i;
+
+  for (i = 0; i < 16; i++)
+    deblock_luma_line_intra_c(pix + i, stride, alpha, beta);
+}
+
+static void
+deblock_luma_v_intra_c(uint8_t *pix, int stride, int alpha, int beta) {
+  int i;
+
+  for (i = 0; i < 16; i++)
+    deblock_luma_line_intra_c(pix + i * stride, 1, alpha, beta);
+}
+
+/* 8.7.2.3 and 8.7.2.4 for chroma: only p0 and q0 change, tc is tc0 + 1 */
+static void
+deblock_chroma_line_c(uint8_t *pix, int step, int alpha, int beta, int tc0) {
+  int p0 = pix[-step], p1 = pix[-2 * step];
+  int q0 = pix[0], q1 = pix[step];
+  int delta;
+
+  if (abs(p0 - q0) >= alpha || abs(p1 - p0) >= beta || abs(q1 - q0) >= beta)
+    return;
+  delta = clip3(-tc0 - 1, tc0 + 1, (((q0 - p0) << 2) + (p1 - q1) + 4) >> 3);
+  pix[-step] = clip1(p0 + delta);
+  pix[0] = clip1(q0 - delta);
+}
+
+static void
+deblock_chroma_line_intra_c(uint8_t *pix, int step, int alpha, int beta) {
+  int p0 = pix[-step], p1 = pix[-2 * step];
+  int q0 = pix[0], q1 = pix[step];
+
+  if (abs(p0 - q0) >= alpha || abs(p1 - p0) >= beta || abs(q1 - q0) >= beta)
+    return;
+  pix[-step] = (2 * p1 + p0 + q1 + 2) >> 2;
+  pix[0] = (2 * q1 + q0 + p1 + 2) >> 2;
+}
+
+/* Byte i of a UV row is component i & 1 of pair i / 2 */
+static void
+deblock_chroma_h_c(uint8_t *pix, int stride, const int *alpha, const int *beta,
+                   const int8_t *tc0) {
+  int i, c, t;
+
+  for (i = 0; i < 16; i++) {
+    c = i & 1;
+    t = tc0[4 * c + i / 4];
+    if (t >= 0)
+      deblock_chroma_line_c(pix + i, stride, alpha[c], beta[c], t);
+  }
+}
+
+static void
+deblock_chroma_v_c(uint8_t *pix, int stride, const int *alpha, const int *beta,
+                   const int8_t *tc0) {
+  int i, c, t;
+
+  for (i = 0; i < 8; i++) {
+    for (c = 0; c < 2; c++) {
+      t = tc0[4 * c + i / 2];
+      if (t >= 0)
+        deblock_chroma_line_c(pix + i * stride + c, 2, alpha[c], beta[c], t);
+    }
+  }
+}
+
+static void
+deblock_chroma_h_intra_c(uint8_t *pix, int stride, const int *alpha, const int *beta) {
+  int i;
+
+  for (i = 0; i < 16; i++)
+    deblock_chroma_line_intra_c(pix + i, stride, alpha[i & 1], beta[i & 1]);
+}
+
+static void
+deblock_chroma_v_intra_c(uint8_t *pix, int stride, const int *alpha, const int *beta) {
+  int i, c;
+
+  for (i = 0; i < 8; i++)
+    for (c = 0; c < 2; c++)
+      deblock_chroma_line_intra_c(pix + i * stride + c, 2, alpha[c], beta[c]);
+}
+
+const struct h264_recon_funcs h264_recon_c = {
+  .idct4_add = idct4_add_c,
+  .idct8_add = idct8_add_c,
+  .pred4x4 = pred4x4_c,
+  .pred8x8l = pred8x8l_c,
+  .pred16x16 = pred16x16_c,
+  .pred_chroma = pred_chroma_c,
+  .mc_luma = mc_luma_c,
+  .mc_chroma = mc_chroma_c,
+  .deblock_luma_h = deblock_luma_h_c,
+  .deblock_luma_v = deblock_luma_v_c,
+  .deblock_luma_h_intra = deblock_luma_h_intra_c,
+  .deblock_luma_v_intra = deblock_luma_v_intra_c,
+  .deblock_chroma_h = deblock_chroma_h_c,
+  .deblock_chroma_v = deblock_chroma_v_c,
+  .deblock_chroma_h_intra = deblock_chroma_h_intra_c,
+  .deblock_chroma_v_intra = deblock_chroma_v_intra_c,
+};
+
+#ifdef __SSE2__
+
+/* Rows of 4 int16 in the low halves in, columns out */
+static inline void
+transpose4x4_epi16(__m128i *r0, __m128i *r1, __m128i *r2, __m128i *r3) {
+  __m128i a = _mm_unpacklo_epi16(*r0, *r1); /* 00 10 01 11 02 12 03 13 */
+  __m128i b = _mm_unpacklo_epi16(*r2, *r3); /* 20 30 21 31 22 32 23 33 */
+  __m128i lo = _mm_unpacklo_epi32(a, b);    /* 00 10 20 30 01 11 21 31 */
+  __m128i hi = _mm_unpackhi_epi32(a, b);    /* 02 12 22 32 03 13 23 33 */
+
+  *r0 = lo;
+  *r1 = _mm_srli_si128(lo, 8);
+  *r2 = hi;
+  *r3 = _mm_srli_si128(hi, 8);
+}
+
+static inline void
+transpose8x8_epi16(__m128i *r) {
+  __m128i a0 = _mm_unpacklo_epi16(r[0], r[1]), a1 = _mm_unpackhi_epi16(r[0], r[1]);
+  __m128i a2 = _mm_unpacklo_epi16(r[2], r[3]), a3 = _mm_unpackhi_epi16(r[2], r[3]);
+  __m128i a4 = _mm_unpacklo_epi16(r[4], r[5]), a5 = _mm_unpackhi_epi16(r[4], r[5]);
+  __m128i a6 = _mm_unpacklo_epi16(r[6], r[7]), a7 = _mm_unpackhi_epi16(r[6], r[7]);
+  __m128i b0 = _mm_unpacklo_epi32(a0, a2), b1 = _mm_unpackhi_epi32(a0, a2);
+  __m128i b2 = _mm_unpacklo_epi32(a1, a3), b3 = _mm_unpackhi_epi32(a1, a3);
+  __m128i b4 = _mm_unpacklo_epi32(a4, a6), b5 = _mm_unpackhi_epi32(a4, a6);
+  __m128i b6 = _mm_unpacklo_epi32(a5, a7), b7 = _mm_unpackhi_epi32(a5, a7);
+
+  r[0] = _mm_unpacklo_epi64(b0, b4);
+  r[1] = _mm_unpackhi_epi64(b0, b4);
+  r[2] = _mm_unpacklo_epi64(b1, b5);
+  r[3] = _mm_unpackhi_epi64(b1, b5);
+  r[4] = _mm_unpacklo_epi64(b2, b6);
+  r[5] = _mm_unpackhi_epi64(b2, b6);
+  r[6] = _mm_unpacklo_epi64(b3, b7);
+  r[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+static void
+idct4_add_sse2(uint8_t *dst, int stride, int16_t *block) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i d0 = _mm_loadl_epi64((const __m128i *)(block + 0));
+  __m128i d1 = _mm_loadl_epi64((const __m128i *)(block + 4));
+  __m128i d2 = _mm_loadl_epi64((const __m128i *)(block + 8));
+  __m128i d3 = _mm_loadl_epi64((const __m128i *)(block + 12));
+  __m128i e, f, g, h;
+  int pass, i;
+
+  /* Transposing first makes each register one coefficient position of
+   * all four rows, so the butterflies transform the rows; transposing
+   * back then lines the rows up for the columns. */
+  for (pass = 0; pass < 2; pass++) {
+    transpose4x4_epi16(&d0, &d1, &d2, &d3);
+    e = _mm_add_epi16(d0, d2);
+    f = _mm_sub_epi16(d0, d2);
+    g = _mm_sub_epi16(_mm_srai_epi16(d1, 1), d3);
+    h = _mm_add_epi16(d1, _mm_srai_epi16(d3, 1));
+    d0 = _mm_add_epi16(e, h);
+    d1 = _mm_add_epi16(f, g);
+    d2 = _mm_sub_epi16(f, g);
+    d3 = _mm_sub_epi16(e, h);
+  }
+
+  {
+    __m128i r[4] = { d0, d1, d2, d3 };
+    const __m128i round = _mm_set1_epi16(32);
+
+    for (i = 0; i < 4; i++) {
+      __m128i px = _mm_cvtsi32_si128(*(const int32_t *)(dst + i * stride));
+      __m128i res = _mm_srai_epi16(_mm_add_epi16(r[i], round), 6);
+      res = _mm_add_epi16(res, _mm_unpacklo_epi8(px, zero));
+      *(int32_t *)(dst + i * stride) = _mm_cvtsi128_si32(_mm_packus_epi16(res, res));
+    }
+  }
+  memset(block, 0, 16 * sizeof(*block));
+}
+
+static inline void
+idct8_1d_sse2(__m128i *d) {
+  __m128i a0 = _mm_add_epi16(d[0], d[4]), a4 = _mm_sub_epi16(d[0], d[4]);
+  __m128i a2 = _mm_sub_epi16(_mm_srai_epi16(d[2], 1), d[6]);
+  __m128i a6 = _mm_add_epi16(d[2], _mm_srai_epi16(d[6], 1));
+  __m128i b0 = _mm_add_epi16(a0, a6), b2 = _mm_add_epi16(a4, a2);
+  __m128i b4 = _mm_sub_epi16(a4, a2), b6 = _mm_sub_epi16(a0, a6);
+  __m128i a1 = _mm_sub_epi16(_mm_sub_epi16(_mm_sub_epi16(d[5], d[3]), d[7]),
+                             _mm_srai_epi16(d[7], 1));
+  __m128i a3 = _mm_sub_epi16(_mm_sub_epi16(_mm_add_epi16(d[1], d[7]), d[3]),
+                             _mm_srai_epi16(d[3], 1));
+  __m128i a5 = _mm_add_epi16(_mm_add_epi16(_mm_sub_epi16(d[7], d[1]), d[5]),
+                             _mm_srai_epi16(d[5], 1));
+  __m128i a7 = _mm_add_epi16(_mm_add_epi16(_mm_add_epi16(d[3], d[5]), d[1]),
+                             _mm_srai_epi16(d[1], 1));
+  __m128i b1 = _mm_add_epi16(a1, _mm_srai_epi16(a7, 2));
+  __m128i b7 = _mm_sub_epi16(a7, _mm_srai_epi16(a1, 2));
+  __m128i b3 = _mm_add_epi16(a3, _mm_srai_epi16(a5, 2));
+  __m128i b5 = _mm_sub_epi16(_mm_srai_epi16(a3, 2), a5);
+
+  d[0] = _mm_add_epi16(b0, b7);
+  d[1] = _mm_add_epi16(b2, b5);
+  d[2] = _mm_add_epi16(b4, b3);
+  d[3] = _mm_add_epi16(b6, b1);
+  d[4] = _mm_sub_epi16(b6, b1);
+  d[5] = _mm_sub_epi16(b4, b3);
+  d[6] = _mm_sub_epi16(b2, b5);
+  d[7] = _mm_sub_epi16(b0, b7);
+}
+
+static void
+idct8_add_sse2(uint8_t *dst, int stride, int16_t *block) {
+  const __m128i zero = _mm_setzero_si128(), round = _mm_set1_epi16(32);
+  __m128i d[8];
+  int i;
+
+  for (i = 0; i < 8; i++)
+    d[i] = _mm_loadu_si128((const __m128i *)(block + 8 * i));
+  transpose8x8_epi16(d);
+  idct8_1d_sse2(d);
+  transpose8x8_epi16(d);
+  idct8_1d_sse2(d);
+
+  for (i = 0; i < 8; i++) {
+    __m128i px = _mm_loadl_epi64((const __m128i *)(dst + i * stride));
+    __m128i res = _mm_srai_epi16(_mm_add_epi16(d[i], round), 6);
+    res = _mm_add_epi16(res, _mm_unpacklo_epi8(px, zero));
+    _mm_storel_epi64((__m128i *)(dst + i * stride), _mm_packus_epi16(res, res));
+  }
+  memset(block, 0, 64 * sizeof(*block));
+}
+
+static void
+pred16x16_sse2(uint8_t *dst, int stride, int mode, int avail) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i row;
+  int y;
+
+  switch (mode) {
+  case H264_PRED16_V:
+    row = _mm_loadu_si128((const __m128i *)(dst - stride));
+    for (y = 0; y < 16; y++)
+      _mm_storeu_si128((__m128i *)(dst + y * stride), row);
+    break;
+  case H264_PRED16_H:
+    for (y = 0; y < 16; y++)
+      _mm_storeu_si128((__m128i *)(dst + y * stride), _mm_set1_epi8(dst[y * stride - 1]));
+    break;
+  case H264_PRED16_DC:
+    if (!(avail & H264_AVAIL_LEFT)) {
+      int dc = 128;
+      if (avail & H264_AVAIL_TOP) {
+        __m128i sad = _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(dst - stride)), zero);
+        dc = (_mm_cvtsi128_si32(sad) + _mm_extract_epi16(sad, 4) + 8) >> 4;
+      }
+      row = _mm_set1_epi8(dc);
+      for (y = 0; y < 16; y++)
+        _mm_storeu_si128((__m128i *)(dst + y * stride), row);
+      break;
+    }
+    /* Left is a column, no faster than C */
+    pred16x16_c(dst, stride, mode, avail);
+    break;
+  case H264_PRED16_PLANE: {
+    const uint8_t *top = dst - stride;
+    int H = 0, V = 0, a, b, c, x;
+    __m128i lo, hi, step;
+
+    for (x = 0; x < 8; x++) {
+      H += (x + 1) * (top[8 + x] - top[6 - x]);
+      V += (x + 1) * (dst[(8 + x) * stride - 1] - dst[(6 - x) * stride - 1]);
+    }
+    a = 16 * (dst[15 * stride - 1] + top[15]);
+    b = (5 * H + 32) >> 6;
+    c = (5 * V + 32) >> 6;
+
+    /* a + b * (x - 7) - 7c + 16 for the first row, then + c per row */
+    lo = _mm_add_epi16(_mm_set1_epi16(a - 7 * b - 7 * c + 16),
+                       _mm_mullo_epi16(_mm_set1_epi16(b),
+                                       _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7)));
+    hi = _mm_add_epi16(lo, _mm_set1_epi16(8 * b));
+    step = _mm_set1_epi16(c);
+    for (y = 0; y < 16; y++) {
+      _mm_storeu_si128((__m128i *)(dst + y * stride),
+                       _mm_packus_epi16(_mm_srai_epi16(lo, 5), _mm_srai_epi16(hi, 5)));
+      lo = _mm_add_epi16(lo, step);
+      hi = _mm_add_epi16(hi, step);
+    }
+    break;
+  }
+  }
+}
+
+/* The intra 4x4 and 8x8 modes as rows cut out of lines of filtered
+ * edge samples. e[] runs from p[-1, n-1] up the left edge, through
+ * p[-1, -1], along the top to p[2n-1, -1] and then repeats that; f2[i]
+ * is the 2-tap filter of e[i] and e[i+1], f3[i] the 3-tap one centred
+ * on e[i+1]. DDL, DDR and VL rows are windows of those; VR, HD and HU
+ * ones are windows of a line indexed by zVR, zHD or zHU. */
+static void
+pred_nxn_sse2(uint8_t *dst, int stride, int n, int mode, int avail,
+              const int *top, const int *left) {
+  uint8_t e[48], f2[32], f3[32], line[2][32];
+  const uint8_t *row;
+  int lanes = n == 4 ? 16 : 32, i, k, y, z, dc, sum;
+
+  for (i = 0; i < n; i++)
+    e[i] = left[n - i];
+  for (i = 0; i <= 2 * n; i++)
+    e[n + i] = top[i];
+  memset(e + 3 * n + 1, top[2 * n], lanes + 1 - 3 * n);
+  for (i = 0; i < lanes; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(e + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(e + i + 1));
+    __m128i c = _mm_loadu_si128((const __m128i *)(e + i + 2));
+    /* (a + 2b + c + 2) >> 2 == avg(b, floor((a + c) / 2)) */
+    __m128i ac = _mm_sub_epi8(_mm_avg_epu8(a, c),
+                              _mm_and_si128(_mm_xor_si128(a, c), _mm_set1_epi8(1)));
+
+    _mm_storeu_si128((__m128i *)(f2 + i), _mm_avg_epu8(a, b));
+    _mm_storeu_si128((__m128i *)(f3 + i), _mm_avg_epu8(b, ac));
+  }
+
+  switch (mode) {
+  case H264_PRED_V:
+    for (y = 0; y < n; y++)
+      memcpy(dst + y * stride, e + n + 1, n);
+    return;
+  case H264_PRED_H:
+    for (y = 0; y < n; y++)
+      memset(dst + y * stride, e[n - 1 - y], n);
+    return;
+  case H264_PRED_DC:
+    sum = 0;
+    for (i = 0; i < n; i++) {
+      if (avail & H264_AVAIL_TOP)
+        sum += e[n + 1 + i];
+      if (avail & H264_AVAIL_LEFT)
+        sum += e[i];
+    }
+    switch (avail & (H264_AVAIL_TOP | H264_AVAIL_LEFT)) {
+    case H264_AVAIL_TOP | H264_AVAIL_LEFT: dc = (sum + n) >> (n == 4 ? 3 : 4); break;
+    case H264_AVAIL_TOP: case H264_AVAIL_LEFT: dc = (sum + n / 2) >> (n == 4 ? 2 : 3); break;
+    default: dc = 128; break;
+    }
+    for (y = 0; y < n; y++)
+      memset(dst + y * stride, dc, n);
+    return;
+  case H264_PRED_VR:
+    /* Even rows take even zVR, odd rows odd ones, line[y & 1][n + x - y / 2] */
+    for (k = 1 - n / 2; k < n; k++) {
+      line[0][n + k] = k >= 0 ? f2[n + k] : f3[n + 2 * k];
+      line[1][n + k] = k >= 1 ? f3[n - 1 + k] : f3[n + 2 * k - 1];
+    }
+    break;
+  case H264_PRED_HD:
+    /* line[0][2n - 2 - zHD] */
+    for (i = 0; i < 3 * n - 2; i++) {
+      z = 2 * n - 2 - i;
+      if (z >= 0 && !(z & 1))
+        line[0][i] = f2[n - 1 - z / 2];
+      else if (z > 0)
+        line[0][i] = f3[n - 2 - (z - 1) / 2];
+      else
+        line[0][i] = f3[n - 2 - z];
+    }
+    break;
+  case H264_PRED_HU:
+    /* line[0][zHU] */
+    for (z = 0; z < 3 * n - 2; z++) {
+      if (z < 2 * n - 3 && !(z & 1))
+        line[0][z] = f2[n - 2 - z / 2];
+      else if (z < 2 * n - 3)
+        line[0][z] = f3[n - 2 - (z + 1) / 2];
+      else if (z == 2 * n - 3)
+        line[0][z] = (e[1] + 3 * e[0] + 2) >> 2;
+      else
+        line[0][z] = e[0];
+    }
+    break;
+  }
+
+  for (y = 0; y < n; y++) {
+    switch (mode) {
+    case H264_PRED_DDL: row = f3 + n + 1 + y; break;
+    case H264_PRED_DDR: row = f3 + n - 1 - y; break;
+    case H264_PRED_VR: row = line[y & 1] + n - y / 2; break;
+    case H264_PRED_HD: row = line[0] + 2 * n - 2 - 2 * y; break;
+    case H264_PRED_VL: row = (y & 1 ? f3 : f2) + n + 1 + y / 2; break;
+    default: row = line[0] + 2 * y; break; /* H264_PRED_HU */
+    }
+    memcpy(dst + y * stride, row, n);
+  }
+}
+
+static void
+pred4x4_sse2(uint8_t *dst, int stride, int mode, int avail) {
+  int top[9], left[5];
+
+  pred_nxn_refs(dst, stride, 4, avail, top, left);
+  pred_nxn_sse2(dst, stride, 4, mode, avail, top, left);
+}
+
+static void
+pred8x8l_sse2(uint8_t *dst, int stride, int mode, int avail) {
+  int ft[17], fl[9];
+
+  pred8x8l_refs(dst, stride, avail, ft, fl);
+  pred_nxn_sse2(dst, stride, 8, mode, avail, ft, fl);
+}
+
+/* 8.3.4 on interleaved UV: the plane lanes alternate U and V */
+static void
+pred_chroma_sse2(uint8_t *dst, int stride, int mode, int avail) {
+  __m128i row;
+  int y;
+
+  switch (mode) {
+  case H264_PREDC_H:
+    for (y = 0; y < 8; y++)
+      _mm_storeu_si128((__m128i *)(dst + y * stride),
+                       _mm_set1_epi16(dst[y * stride - 2] | dst[y * stride - 1] << 8));
+    break;
+  case H264_PREDC_V:
+    row = _mm_loadu_si128((const __m128i *)(dst - stride));
+    for (y = 0; y < 8; y++)
+      _mm_storeu_si128((__m128i *)(dst + y * stride), row);
+    break;
+  case H264_PREDC_PLANE: {
+    const uint8_t *top = dst - stride;
+    int a[2], b[2], c[2], i, x;
+    __m128i lo, hi, step;
+
+    for (i = 0; i < 2; i++) {
+      int H = 0, V = 0;
+
+      for (x = 0; x < 4; x++) {
+        H += (x + 1) * (top[2 * (4 + x) + i] - top[2 * (2 - x) + i]);
+        V += (x + 1) * (dst[(4 + x) * stride - 2 + i] - dst[(2 - x) * stride - 2 + i]);
+      }
+      b[i] = (34 * H + 32) >> 6;
+      c[i] = (34 * V + 32) >> 6;
+      /* a + b * (x - 3) + c * (y - 3) + 16 at x = 0, y = 0 */
+      a[i] = 16 * (dst[7 * stride - 2 + i] + top[14 + i]) - 3 * b[i] - 3 * c[i] + 16;
+    }
+    lo = _mm_setr_epi16(a[0], a[1], a[0] + b[0], a[1] + b[1],
+                        a[0] + 2 * b[0], a[1] + 2 * b[1], a[0] + 3 * b[0], a[1] + 3 * b[1]);
+    hi = _mm_add_epi16(lo, _mm_setr_epi16(4 * b[0], 4 * b[1], 4 * b[0], 4 * b[1],
+                                          4 * b[0], 4 * b[1], 4 * b[0], 4 * b[1]));
+    step = _mm_setr_epi16(c[0], c[1], c[0], c[1], c[0], c[1], c[0], c[1]);
+    for (y = 0; y < 8; y++) {
+      _mm_storeu_si128((__m128i *)(dst + y * stride),
+                       _mm_packus_epi16(_mm_srai_epi16(lo, 5), _mm_srai_epi16(hi, 5)));
+      lo = _mm_add_epi16(lo, step);
+      hi = _mm_add_epi16(hi, step);
+    }
+    break;
+  }
+  default:
+    h264_pred_chroma_dc_nv12(dst, stride, avail);
+    break;
+  }
+}
+
+/* 8 lanes of the 6-tap filter on 16-bit inputs: (p0 + p5) - 5 (p1 + p4) +
+ * 20 (p2 + p3) */
+static inline __m128i
+tap_epi16(__m128i p0, __m128i p1, __m128i p2, __m128i p3, __m128i p4, __m128i p5) {
+  __m128i s05 = _mm_add_epi16(p0, p5);
+  __m128i s14 = _mm_add_epi16(p1, p4);
+  __m128i s23 = _mm_add_epi16(p2, p3);
+
+  return _mm_add_epi16(s05, _mm_mullo_epi16(_mm_sub_epi16(_mm_slli_epi16(s23, 2), s14),
+                                            _mm_set1_epi16(5)));
+}
+
+/* Loads w (4 or 8+) bytes, so that 4-wide blocks stay inside the margin */
+static inline __m128i
+loadw(const uint8_t *p, int w) {
+  if (w >= 8)
+    return _mm_loadl_epi64((const __m128i *)p);
+  return _mm_cvtsi32_si128(*(const int32_t *)p);
+}
+
+static inline __m128i
+load8(const uint8_t *p, int w) {
+  return _mm_unpacklo_epi8(loadw(p, w), _mm_setzero_si128());
+}
+
+static inline void
+store_w(uint8_t *dst, __m128i v8, int w) {
+  if (w >= 8)
+    _mm_storel_epi64((__m128i *)dst, v8);
+  else
+    *(int32_t *)dst = _mm_cvtsi128_si32(v8);
+}
+
+static void
+hpel_h_sse2(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride,
+            int w, int h) {
+  const __m128i round = _mm_set1_epi16(16);
+  int x, y;
+
+  for (y = 0; y < h; y++) {
+    const uint8_t *s = src + y * src_stride;
+    for (x = 0; x < w; x += 8) {
+      int n = w - x;
+      __m128i t = tap_epi16(load8(s + x - 2, n), load8(s + x - 1, n), load8(s + x, n),
+                            load8(s + x + 1, n), load8(s + x + 2, n), load8(s + x + 3, n));
+      t = _mm_srai_epi16(_mm_add_epi16(t, round), 5);
+      store_w(dst + y * dst_stride + x, _mm_packus_epi16(t, t), w - x);
+    }
+  }
+}
+
+static void
+hpel_v_sse2(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride,
+            int w, int h) {
+  const __m128i round = _mm_set1_epi16(16);
+  int x, y;
+
+  for (y = 0; y < h; y++) {
+    const uint8_t *s = src + y * src_stride;
+    /* w can be 17 here (for m), the odd column goes through C */
+    for (x = 0; x + 4 <= w; x += 8) {
+      int n = w - x;
+      __m128i t = tap_epi16(load8(s + x - 2 * src_stride, n), load8(s + x - src_stride, n),
+                            load8(s + x, n), load8(s + x + src_stride, n),
+                            load8(s + x + 2 * src_stride, n), load8(s + x + 3 * src_stride, n));
+      t = _mm_srai_epi16(_mm_add_epi16(t, round), 5);
+      store_w(dst + y * dst_stride + x, _mm_packus_epi16(t, t), n);
+    }
+    for (x = w & ~3; x < w; x++)
+      dst[y * dst_stride + x] = clip1((TAP(s + x, src_stride) + 16) >> 5);
+  }
+}
+
+static void
+hpel_hv_sse2(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride,
+             int w, int h) {
+  /* The vertical pass, unclipped; 24 columns covers x - 2 .. x + w + 2 */
+  int16_t tmp[16 * 24] __attribute__((aligned(16)));
+  const __m128i coef = _mm_set1_epi32(20 | (-5 << 16)), round = _mm_set1_epi32(512);
+  int x, y;
+
+  for (y = 0; y < h; y++) {
+    const uint8_t *s = src + y * src_stride - 2;
+    /* The last group overlaps the previous one rather than read past
+     * x + w + 2 */
+    for (x = 0; x < w + 5; x += 8) {
+      int c = x + 8 > w + 5 ? w - 3 : x;
+      _mm_storeu_si128((__m128i *)(tmp + y * 24 + c),
+                       tap_epi16(load8(s + c - 2 * src_stride, 8), load8(s + c - src_stride, 8),
+                                 load8(s + c, 8), load8(s + c + src_stride, 8),
+                                 load8(s + c + 2 * src_stride, 8), load8(s + c + 3 * src_stride, 8)));
+    }
+  }
+
+  /* The horizontal pass needs 32 bits: 20 (b + c) - 5 (a + d) via
+   * pmaddwd, the outer pair added separately */
+  for (y = 0; y < h; y++) {
+    const int16_t *t = tmp + y * 24;
+    for (x = 0; x < w; x += 8) {
+      __m128i p0 = _mm_loadu_si128((const __m128i *)(t + x));
+      __m128i p1 = _mm_loadu_si128((const __m128i *)(t + x + 1));
+      __m128i p2 = _mm_loadu_si128((const __m128i *)(t + x + 2));
+      __m128i p3 = _mm_loadu_si128((const __m128i *)(t + x + 3));
+      __m128i p4 = _mm_loadu_si128((const __m128i *)(t + x + 4));
+      __m128i p5 = _mm_loadu_si128((const __m128i *)(t + x + 5));
+      __m128i s05 = _mm_add_epi16(p0, p5);
+      __m128i s14 = _mm_add_epi16(p1, p4);
+      __m128i s23 = _mm_add_epi16(p2, p3);
+      __m128i sign = _mm_srai_epi16(s05, 15);
+      __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(s23, s14), coef);
+      __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(s23, s14), coef);
+
+      lo = _mm_add_epi32(lo, _mm_unpacklo_epi16(s05, sign));
+      hi = _mm_add_epi32(hi, _mm_unpackhi_epi16(s05, sign));
+      lo = _mm_srai_epi32(_mm_add_epi32(lo, round), 10);
+      hi = _mm_srai_epi32(_mm_add_epi32(hi, round), 10);
+      lo = _mm_packs_epi32(lo, hi);
+      store_w(dst + y * dst_stride + x, _mm_packus_epi16(lo, lo), w - x);
+    }
+  }
+}
+
+static void
+avg_sse2(uint8_t *dst, int dst_stride, const uint8_t *a, int a_stride,
+         const uint8_t *b, int b_stride, int w, int h) {
+  int y;
+
+  for (y = 0; y < h; y++) {
+    const uint8_t *pa = a + y * a_stride, *pb = b + y * b_stride;
+    uint8_t *d = dst + y * dst_stride;
+
+    if (w == 16) {
+      _mm_storeu_si128((__m128i *)d,
+                       _mm_avg_epu8(_mm_loadu_si128((const __m128i *)pa),
+                                    _mm_loadu_si128((const __m128i *)pb)));
+    } else {
+      __m128i v = _mm_avg_epu8(loadw(pa, w), loadw(pb, w));
+      store_w(d, v, w);
+    }
+  }
+}
+
+static const struct mc_funcs mc_sse2 = { hpel_h_sse2, hpel_v_sse2, hpel_hv_sse2, avg_sse2 };
+
+static void
+mc_luma_sse2(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride,
+             int w, int h, int mx, int my) {
+  mc_luma(&mc_sse2, dst, dst_stride, src, src_stride, w, h, mx, my);
+}
+
+static void
+mc_chroma_sse2(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride,
+               int w, int h, int mx, int my) {
+  const __m128i A = _mm_set1_epi16((8 - mx) * (8 - my)), B = _mm_set1_epi16(mx * (8 - my));
+  const __m128i C = _mm_set1_epi16((8 - mx) * my), D = _mm_set1_epi16(mx * my);
+  const __m128i round = _mm_set1_epi16(32);
+  int x, y;
+
+  for (y = 0; y < h; y++) {
+    const uint8_t *s = src + y * src_stride;
+    for (x = 0; x < 2 * w; x += 8) {
+      int n = 2 * w - x;
+      __m128i t = _mm_add_epi16(_mm_mullo_epi16(A, load8(s + x, n)),
+                                _mm_mullo_epi16(B, load8(s + x + 2, n)));
+      t = _mm_add_epi16(t, _mm_mullo_epi16(C, load8(s + x + src_stride, n)));
+      t = _mm_add_epi16(t, _mm_mullo_epi16(D, load8(s + x + src_stride + 2, n)));
+      t = _mm_srli_epi16(_mm_add_epi16(t, round), 6);
+      store_w(dst + y * dst_stride + x, _mm_packus_epi16(t, t), n);
+    }
+  }
+}
+
+static inline __m128i
+abs_diff_epi16(__m128i a, __m128i b) {
+  __m128i d = _mm_sub_epi16(a, b);
+  return _mm_max_epi16(d, _mm_sub_epi16(_mm_setzero_si128(), d));
+}
+
+static inline __m128i
+select_epi16(__m128i mask, __m128i a, __m128i b) {
+  return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static inline __m128i
+clamp_epi16(__m128i x, __m128i lo, __m128i hi) {
+  return _mm_min_epi16(_mm_max_epi16(x, lo), hi);
+}
+
+/* The deblocking filters on 8 lines at once, 16-bit lanes, r[0..7] being
+ * p3 p2 p1 p0 q0 q1 q2 q3. tc0 is per lane, negative to skip. */
+static inline __m128i
+deblock_mask(const __m128i *r, __m128i alpha, __m128i beta) {
+  return _mm_and_si128(_mm_cmplt_epi16(abs_diff_epi16(r[3], r[4]), alpha),
+                       _mm_and_si128(_mm_cmplt_epi16(abs_diff_epi16(r[2], r[3]), beta),
+                                     _mm_cmplt_epi16(abs_diff_epi16(r[5], r[4]), beta)));
+}
+
+static void
+deblock8_sse2(__m128i *r, __m128i alpha, __m128i beta, __m128i tc0) {
+  const __m128i zero = _mm_setzero_si128(), one = _mm_set1_epi16(1);
+  __m128i p2 = r[1], p1 = r[2], p0 = r[3], q0 = r[4], q1 = r[5], q2 = r[6];
+  __m128i mask = _mm_and_si128(deblock_mask(r, alpha, beta),
+                               _mm_cmpgt_epi16(tc0, _mm_set1_epi16(-1)));
+  __m128i ap = _mm_cmplt_epi16(abs_diff_epi16(p2, p0), beta);
+  __m128i aq = _mm_cmplt_epi16(abs_diff_epi16(q2, q0), beta);
+  __m128i tc = _mm_sub_epi16(_mm_sub_epi16(tc0, ap), aq);
+  __m128i ntc = _mm_sub_epi16(zero, tc), ntc0 = _mm_sub_epi16(zero, tc0);
+  __m128i delta, avg, d;
+
+  delta = _mm_add_epi16(_mm_slli_epi16(_mm_sub_epi16(q0, p0), 2), _mm_sub_epi16(p1, q1));
+  delta = _mm_srai_epi16(_mm_add_epi16(delta, _mm_set1_epi16(4)), 3);
+  delta = _mm_and_si128(clamp_epi16(delta, ntc, tc), mask);
+
+  avg = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(p0, q0), one), 1);
+  d = _mm_srai_epi16(_mm_sub_epi16(_mm_add_epi16(p2, avg), _mm_slli_epi16(p1, 1)), 1);
+  r[2] = _mm_add_epi16(p1, _mm_and_si128(clamp_epi16(d, ntc0, tc0), _mm_and_si128(mask, ap)));
+  d = _mm_srai_epi16(_mm_sub_epi16(_mm_add_epi16(q2, avg), _mm_slli_epi16(q1, 1)), 1);
+  r[5] = _mm_add_epi16(q1, _mm_and_si128(clamp_epi16(d, ntc0, tc0), _mm_and_si128(mask, aq)));
+
+  r[3] = _mm_add_epi16(p0, delta);
+  r[4] = _mm_sub_epi16(q0, delta);
+}
+
+static void
+deblock8_intra_sse2(__m128i *r, __m128i alpha, __m128i beta) {
+  const __m128i two = _mm_set1_epi16(2), four = _mm_set1_epi16(4);
+  __m128i p3 = r[0], p2 = r[1], p1 = r[2], p0 = r[3];
+  __m128i q0 = r[4], q1 = r[5], q2 = r[6], q3 = r[7];
+  __m128i mask = deblock_mask(r, alpha, beta);
+  __m128i strong = _mm_cmplt_epi16(abs_diff_epi16(p0, q0),
+                                   _mm_add_epi16(_mm_srai_epi16(alpha, 2), two));
+  __m128i sp = _mm_and_si128(_mm_and_si128(strong, mask),
+                             _mm_cmplt_epi16(abs_diff_epi16(p2, p0), beta));
+  __m128i sq = _mm_and_si128(_mm_and_si128(strong, mask),
+                             _mm_cmplt_epi16(abs_diff_epi16(q2, q0), beta));
+  __m128i pq = _mm_add_epi16(p0, q0);
+  __m128i s, w;
+
+  /* p side */
+  s = _mm_add_epi16(_mm_add_epi16(p2, q1), _mm_slli_epi16(_mm_add_epi16(p1, pq), 1));
+  s = _mm_srli_epi16(_mm_add_epi16(s, four), 3);
+  w = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_slli_epi16(p1, 1), p0),
+                                   _mm_add_epi16(q1, two)), 2);
+  r[3] = select_epi16(mask, select_epi16(sp, s, w), p0);
+  s = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(p2, p1), _mm_add_epi16(pq, two)), 2);
+  r[2] = select_epi16(sp, s, p1);
+  s = _mm_add_epi16(_mm_slli_epi16(p3, 1), _mm_add_epi16(_mm_slli_epi16(p2, 1), p2));
+  s = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(s, p1), _mm_add_epi16(pq, four)), 3);
+  r[1] = select_epi16(sp, s, p2);
+
+  /* q side */
+  s = _mm_add_epi16(_mm_add_epi16(q2, p1), _mm_slli_epi16(_mm_add_epi16(q1, pq), 1));
+  s = _mm_srli_epi16(_mm_add_epi16(s, four), 3);
+  w = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_slli_epi16(q1, 1), q0),
+                                   _mm_add_epi16(p1, two)), 2);
+  r[4] = select_epi16(mask, select_epi16(sq, s, w), q0);
+  s = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(q2, q1), _mm_add_epi16(pq, two)), 2);
+  r[5] = select_epi16(sq, s, q1);
+  s = _mm_add_epi16(_mm_slli_epi16(q3, 1), _mm_add_epi16(_mm_slli_epi16(q2, 1), q2));
+  s = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(s, q1), _mm_add_epi16(pq, four)), 3);
+  r[6] = select_epi16(sq, s, q2);
+}
+
+/* tc0 for lanes 0-7 of an 8-line half */
+static inline __m128i
+tc0_lanes(const int8_t *tc0) {
+  return _mm_setr_epi16(tc0[0], tc0[0], tc0[0], tc0[0], tc0[1], tc0[1], tc0[1], tc0[1]);
+}
+
+static void
+deblock_luma_h_common(uint8_t *pix, int stride, int alpha, int beta,
+                      const int8_t *tc0, int intra) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i va = _mm_set1_epi16(alpha), vb = _mm_set1_epi16(beta);
+  __m128i raw[8], lo[8], hi[8];
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    raw[i] = _mm_loadu_si128((const __m128i *)(pix + (i - 4) * stride));
+    lo[i] = _mm_unpacklo_epi8(raw[i], zero);
+    hi[i] = _mm_unpackhi_epi8(raw[i], zero);
+  }
+  if (intra) {
+    deblock8_intra_sse2(lo, va, vb);
+    deblock8_intra_sse2(hi, va, vb);
+  } else {
+    deblock8_sse2(lo, va, vb, tc0_lanes(tc0));
+    deblock8_sse2(hi, va, vb, tc0_lanes(tc0 + 2));
+  }
+  for (i = 1; i < 7; i++)
+    _mm_storeu_si128((__m128i *)(pix + (i - 4) * stride), _mm_packus_epi16(lo[i], hi[i]));
+}
+
+static void
+deblock_luma_v_common(uint8_t *pix, int stride, int alpha, int beta,
+                      const int8_t *tc0, int intra) {
+  const __m128i va = _mm_set1_epi16(alpha), vb = _mm_set1_epi16(beta);
+  __m128i r[8];
+  int half, i;
+
+  /* 8 rows of p3..q3 at a time, transposed so that each register is one
+   * position across the edge */
+  for (half = 0; half < 2; half++) {
+    uint8_t *p = pix + 8 * half * stride - 4;
+
+    for (i = 0; i < 8; i++)
+      r[i] = load8(p + i * stride, 8);
+    transpose8x8_epi16(r);
+    if (intra)
+      deblock8_intra_sse2(r, va, vb);
+    else
+      deblock8_sse2(r, va, vb, tc0_lanes(tc0 + 2 * half));
+    transpose8x8_epi16(r);
+    for (i = 0; i < 8; i++)
+      _mm_storel_epi64((__m128i *)(p + i * stride), _mm_packus_epi16(r[i], r[i]));
+  }
+}
+
+static void
+deblock_luma_h_sse2(uint8_t *pix, int stride, int alpha, int beta, const int8_t *tc0) {
+  deblock_luma_h_common(pix, stride, alpha, beta, tc0, 0);
+}
+
+static void
+deblock_luma_v_sse2(uint8_t *pix, int stride, int alpha, int beta, const int8_t *tc0) {
+  deblock_luma_v_common(pix, stride, alpha, beta, tc0, 0);
+}
+
+static void
+deblock_luma_h_intra_sse2(uint8_t *pix, int stride, int alpha, int beta) {
+  deblock_luma_h_common(pix, stride, alpha, beta, NULL, 1);
+}
+
+static void
+deblock_luma_v_intra_sse2(uint8_t *pix, int stride, int alpha, int beta) {
+  deblock_luma_v_common(pix, stride, alpha, beta, NULL, 1);
+}
+
+/* Chroma on 8 lanes, r[2..5] being p1 p0 q0 q1 as above */
+static void
+deblock8_chroma_sse2(__m128i *r, __m128i alpha, __m128i beta, __m128i tc0, int intra) {
+  const __m128i two = _mm_set1_epi16(2);
+  __m128i p1 = r[2], p0 = r[3], q0 = r[4], q1 = r[5];
+  __m128i mask = deblock_mask(r, alpha, beta);
+  __m128i tc, delta;
+
+  if (intra) {
+    r[3] = select_epi16(mask, _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_slli_epi16(p1, 1), p0),
+                                                           _mm_add_epi16(q1, two)), 2), p0);
+    r[4] = select_epi16(mask, _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_slli_epi16(q1, 1), q0),
+                                                           _mm_add_epi16(p1, two)), 2), q0);
+    return;
+  }
+  mask = _mm_and_si128(mask, _mm_cmpgt_epi16(tc0, _mm_set1_epi16(-1)));
+  tc = _mm_add_epi16(tc0, _mm_set1_epi16(1));
+  delta = _mm_add_epi16(_mm_slli_epi16(_mm_sub_epi16(q0, p0), 2), _mm_sub_epi16(p1, q1));
+  delta = _mm_srai_epi16(_mm_add_epi16(delta, _mm_set1_epi16(4)), 3);
+  delta = _mm_and_si128(clamp_epi16(delta, _mm_sub_epi16(_mm_setzero_si128(), tc), tc), mask);
+  r[3] = _mm_add_epi16(p0, delta);
+  r[4] = _mm_sub_epi16(q0, delta);
+}
+
+/* The lanes of a horizontal edge alternate U and V, 2 lanes per pair */
+static void
+deblock_chroma_h_common(uint8_t *pix, int stride, const int *alpha, const int *beta,
+                        const int8_t *tc0, int intra) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i va = _mm_setr_epi16(alpha[0], alpha[1], alpha[0], alpha[1],
+                                    alpha[0], alpha[1], alpha[0], alpha[1]);
+  const __m128i vb = _mm_setr_epi16(beta[0], beta[1], beta[0], beta[1],
+                                    beta[0], beta[1], beta[0], beta[1]);
+  __m128i lo[8], hi[8], t[2] = { zero, zero };
+  int i;
+
+  for (i = 2; i < 6; i++) {
+    __m128i raw = _mm_loadu_si128((const __m128i *)(pix + (i - 4) * stride));
+    lo[i] = _mm_unpacklo_epi8(raw, zero);
+    hi[i] = _mm_unpackhi_epi8(raw, zero);
+  }
+  if (!intra)
+    for (i = 0; i < 2; i++)
+      t[i] = _mm_setr_epi16(tc0[2 * i], tc0[4 + 2 * i], tc0[2 * i], tc0[4 + 2 * i],
+                            tc0[2 * i + 1], tc0[5 + 2 * i], tc0[2 * i + 1], tc0[5 + 2 * i]);
+  deblock8_chroma_sse2(lo, va, vb, t[0], intra);
+  deblock8_chroma_sse2(hi, va, vb, t[1], intra);
+  for (i = 3; i < 5; i++)
+    _mm_storeu_si128((__m128i *)(pix + (i - 4) * stride), _mm_packus_epi16(lo[i], hi[i]));
+}
+
+/* 8 rows of p1 p0 q0 q1 UV pairs transpose to p1U p1V p0U .. q1V; each
+ * component then filters with the rows as lanes. */
+static void
+deblock_chroma_v_common(uint8_t *pix, int stride, const int *alpha, const int *beta,
+                        const int8_t *tc0, int intra) {
+  __m128i r[8], c8[8];
+  uint8_t *p = pix - 4;
+  int c, i;
+
+  for (i = 0; i < 8; i++)
+    r[i] = load8(p + i * stride, 8);
+  transpose8x8_epi16(r);
+  for (c = 0; c < 2; c++) {
+    const int8_t *t = tc0 + 4 * c;
+    __m128i vt = intra ? _mm_setzero_si128() :
+      _mm_setr_epi16(t[0], t[0], t[1], t[1], t[2], t[2], t[3], t[3]);
+
+    for (i = 0; i < 4; i++)
+      c8[2 + i] = r[2 * i + c];
+    deblock8_chroma_sse2(c8, _mm_set1_epi16(alpha[c]), _mm_set1_epi16(beta[c]), vt, intra);
+    r[2 + c] = c8[3];
+    r[4 + c] = c8[4];
+  }
+  transpose8x8_epi16(r);
+  for (i = 0; i < 8; i++)
+    _mm_storel_epi64((__m128i *)(p + i * stride), _mm_packus_epi16(r[i], r[i]));
+}
+
+static void
+deblock_chroma_h_sse2(uint8_t *pix, int stride, const int *alpha, const int *beta,
+                      const int8_t *tc0) {
+  deblock_chroma_h_common(pix, stride, alpha, beta, tc0, 0);
+}
+
+static void
+deblock_chroma_v_sse2(uint8_t *pix, int stride, const int *alpha, const int *beta,
+                      const int8_t *tc0) {
+  deblock_chroma_v_common(pix, stride, alpha, beta, tc0, 0);
+}
+
+static void
+deblock_chroma_h_intra_sse2(uint8_t *pix, int stride, const int *alpha, const int *beta) {
+  deblock_chroma_h_common(pix, stride, alpha, beta, NULL, 1);
+}
+
+static void
+deblock_chroma_v_intra_sse2(uint8_t *pix, int stride, const int *alpha, const int *beta) {
+  deblock_chroma_v_common(pix, stride, alpha, beta, NULL, 1);
+}
+
+const struct h264_recon_funcs h264_recon_simd = {
+  .idct4_add = idct4_add_sse2,
+  .idct8_add = idct8_add_sse2,
+  .pred4x4 = pred4x4_sse2,
+  .pred8x8l = pred8x8l_sse2,
+  .pred16x16 = pred16x16_sse2,
+  .pred_chroma = pred_chroma_sse2,
+  .mc_luma = mc_luma_sse2,
+  .mc_chroma = mc_chroma_sse2,
+  .deblock_luma_h = deblock_luma_h_sse2,
+  .deblock_luma_v = deblock_luma_v_sse2,
+  .deblock_luma_h_intra = deblock_luma_h_intra_sse2,
+  .deblock_luma_v_intra = deblock_luma_v_intra_sse2,
+  .deblock_chroma_h = deblock_chroma_h_sse2,
+  .deblock_chroma_v = deblock_chroma_v_sse2,
+  .deblock_chroma_h_intra = deblock_chroma_h_intra_sse2,
+  .deblock_chroma_v_intra = deblock_chroma_v_intra_sse2,
+};
+
+#else
+
+const struct h264_recon_funcs h264_recon_simd = {
+  .idct4_add = idct4_add_c,
+  .idct8_add = idct8_add_c,
+  .pred4x4 = pred4x4_c,
+  .pred8x8l = pred8x8l_c,
+  .pred16x16 = pred16x16_c,
+  .pred_chroma = pred_chroma_c,
+  .mc_luma = mc_luma_c,
+  .mc_chroma = mc_chroma_c,
+  .deblock_luma_h = deblock_luma_h_c,
+  .deblock_luma_v = deblock_luma_v_c,
+  .deblock_luma_h_intra = deblock_luma_h_intra_c,
+  .deblock_luma_v_intra = deblock_luma_v_intra_c,
+  .deblock_chroma_h = deblock_chroma_h_c,
+  .deblock_chroma_v = deblock_chroma_v_c,
+  .deblock_chroma_h_intra = deblock_chroma_h_intra_c,
+  .deblock_chroma_v_intra = deblock_chroma_v_intra_c,
+};
+
+#endif
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2013 Ilia Mirkin <imirkin@alum.mit.edu>
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef H264_RECON_H
+#define H264_RECON_H
+
+#include <stdint.h>
+
+/* CPU pixel reconstruction, into the same linear NV12 layout that
+ * decoder.c's copy_buffer() leaves in the output buffer: the luma
+ * plane, then the interleaved UV plane at decoder_layout's chroma offset.
+ * That's past the luma plane's 16-line aligned fields, not directly
+ * after height lines, so the caller passes it in. */
+struct h264_recon_frame {
+  uint8_t *luma, *chroma;
+  int width, height, pitch;
+};
+
+static inline void
+h264_recon_frame_init(struct h264_recon_frame *f, uint8_t *buf,
+                      int width, int height, int pitch, uint32_t chroma) {
+  f->luma = buf;
+  f->chroma = buf + chroma;
+  f->width = width;
+  f->height = height;
+  f->pitch = pitch;
+}
+
+enum {
+  H264_PRED16_V,
+  H264_PRED16_H,
+  H264_PRED16_DC,
+  H264_PRED16_PLANE,
+};
+
+/* Intra 4x4 and 8x8, Table 8-2 and 8-3 */
+enum {
+  H264_PRED_V,
+  H264_PRED_H,
+  H264_PRED_DC,
+  H264_PRED_DDL,
+  H264_PRED_DDR,
+  H264_PRED_VR,
+  H264_PRED_HD,
+  H264_PRED_VL,
+  H264_PRED_HU,
+};
+
+/* Chroma, Table 8-5 (intra_chroma_pred_mode) */
+enum {
+  H264_PREDC_DC,
+  H264_PREDC_H,
+  H264_PREDC_V,
+  H264_PREDC_PLANE,
+};
+
+/* Neighbour availability. The DC predictions look at TOP and LEFT. The
+ * 4x4 and 8x8 ones replicate the last top pixel when TOP_RIGHT is
+ * missing, and 8x8 filters its references differently without
+ * TOP_LEFT. Modes that read a missing neighbour aren't allowed by the
+ * bitstream, so the functions don't check. */
+#define H264_AVAIL_TOP       1
+#define H264_AVAIL_LEFT      2
+#define H264_AVAIL_TOP_LEFT  4
+#define H264_AVAIL_TOP_RIGHT 8
+
+/* Coefficients are in raster order and already dequantized. The
+ * motion compensation sources need 3 pixels (luma) or 1 pixel pair
+ * (chroma) of readable margin on each side. Luma blocks are 4, 8 or 16
+ * wide; chroma ones 2, 4 or 8 UV pairs. pred_chroma covers one MB's
+ * 8x8 UV pairs. The deblocking functions take the first pixel past the
+ * edge (q0); tc0 holds one value per 4 pixels along the edge, negative
+ * for bS == 0. A chroma edge is 8 UV pairs long, and U and V can have
+ * different QPs: alpha and beta are { U, V }, tc0 is 4 values for U
+ * then 4 for V, one per 2 pairs. */
+struct h264_recon_funcs {
+  void (*idct4_add)(uint8_t *dst, int stride, int16_t *block);
+  void (*idct8_add)(uint8_t *dst, int stride, int16_t *block);
+  void (*pred4x4)(uint8_t *dst, int stride, int mode, int avail);
+  void (*pred8x8l)(uint8_t *dst, int stride, int mode, int avail);
+  void (*pred16x16)(uint8_t *dst, int stride, int mode, int avail);
+  void (*pred_chroma)(uint8_t *dst, int stride, int mode, int avail);
+  void (*mc_luma)(uint8_t *dst, int dst_stride, const uint8_t *src,
+                  int src_stride, int w, int h, int mx, int my);
+  void (*mc_chroma)(uint8_t *dst, int dst_stride, const uint8_t *src,
+                    int src_stride, int w, int h, int mx, int my);
+  void (*deblock_luma_h)(uint8_t *pix, int stride, int alpha, int beta,
+                         const int8_t *tc0);
+  void (*deblock_luma_v)(uint8_t *pix, int stride, int alpha, int beta,
+                         const int8_t *tc0);
+  void (*deblock_luma_h_intra)(uint8_t *pix, int stride, int alpha, int beta);
+  void (*deblock_luma_v_intra)(uint8_t *pix, int stride, int alpha, int beta);
+  void (*deblock_chroma_h)(uint8_t *pix, int stride, const int *alpha,
+                           const int *beta, const int8_t *tc0);
+  void (*deblock_chroma_v)(uint8_t *pix, int stride, const int *alpha,
+                           const int *beta, const int8_t *tc0);
+  void (*deblock_chroma_h_intra)(uint8_t *pix, int stride, const int *alpha,
+                                 const int *beta);
+  void (*deblock_chroma_v_intra)(uint8_t *pix, int stride, const int *alpha,
+                                 const int *beta);
+};
+
+/* The plain C versions, as a reference */
+extern const struct h264_recon_funcs h264_recon_c;
+/* SSE2 where available, C otherwise */
+extern const struct h264_recon_funcs h264_recon_simd;
+
+/* Chroma 8x8 (8 UV pairs x 8 rows) DC prediction, 8.3.4.1-3. Both
+ * tables' pred_chroma use it for DC: it's 64 bytes per MB, with a
+ * different rule per 4x4 block. */
+void h264_pred_chroma_dc_nv12(uint8_t *dst, int stride, int avail);
+
+#endif
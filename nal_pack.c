@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2013 Ilia Mirkin <imirkin@alum.mit.edu>
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "nal_pack.h"
+
+static const uint8_t start_code[3] = { 0, 0, 1 };
+/* Two of what load_bitstream() writes as 0x0b010000, 0 */
+static const uint8_t end_markers[NAL_PACK_END_MARKERS] = {
+  0, 0, 1, 0x0b, 0, 0, 0, 0,
+  0, 0, 1, 0x0b, 0, 0, 0, 0,
+};
+
+int nal_pack_is_pack(const void *data, size_t size) {
+  return size >= sizeof(struct nal_pack_header) &&
+    !memcmp(data, NAL_PACK_MAGIC, 8);
+}
+
+int nal_pack_open(struct nal_pack *pack, const char *path) {
+  struct nal_pack_header hdr;
+  struct stat st;
+  void *addr;
+  uint32_t i;
+  int fd;
+
+  memset(pack, 0, sizeof(*pack));
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return -1;
+  if (fstat(fd, &st) || (size_t)st.st_size < sizeof(hdr)) {
+    close(fd);
+    return -1;
+  }
+  addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED)
+    return -1;
+  pack->base = addr;
+  pack->size = st.st_size;
+
+  memcpy(&hdr, addr, sizeof(hdr));
+  if (!nal_pack_is_pack(addr, st.st_size) || hdr.alignment < 256 ||
+      (hdr.alignment & (hdr.alignment - 1)) ||
+      hdr.table_offset % 8 || hdr.table_offset > pack->size ||
+      (pack->size - hdr.table_offset) / sizeof(struct nal_pack_entry) < hdr.count)
+    goto fail;
+  pack->alignment = hdr.alignment;
+  pack->count = hdr.count;
+  pack->entries = (const void *)(pack->base + hdr.table_offset);
+
+  for (i = 0; i < pack->count; i++) {
+    const struct nal_pack_entry *e = &pack->entries[i];
+    uint64_t padded = (e->size + (uint64_t)hdr.alignment - 1) & ~(uint64_t)(hdr.alignment - 1);
+
+    if (e->offset % hdr.alignment || e->offset < sizeof(hdr) ||
+        e->offset > hdr.table_offset || padded > hdr.table_offset - e->offset ||
+        e->nal_size == 0 || (uint64_t)e->nal_size + 3 > e->size)
+      goto fail;
+  }
+  return 0;
+
+fail:
+  nal_pack_close(pack);
+  return -1;
+}
+
+void nal_pack_close(struct nal_pack *pack) {
+  if (pack->base)
+    munmap((void *)pack->base, pack->size);
+  memset(pack, 0, sizeof(*pack));
+}
+
+void nal_pack_nal(const struct nal_pack *pack, unsigned i, struct h264_nal *nal) {
+  const struct nal_pack_entry *e = &pack->entries[i];
+
+  nal->data = pack->base + e->offset + 3;
+  nal->size = e->nal_size;
+  nal->offset = e->offset;
+  nal->type = nal->data[0] & 0x1f;
+  nal->ref_idc = (nal->data[0] >> 5) & 3;
+}
+
+static void
+write_padding(struct nal_pack_writer *w) {
+  static const uint8_t zeros[4096];
+
+  while (w->pos % w->alignment) {
+    size_t n = w->alignment - w->pos % w->alignment;
+    if (n > sizeof(zeros))
+      n = sizeof(zeros);
+    fwrite(zeros, 1, n, w->f);
+    w->pos += n;
+  }
+}
+
+int nal_pack_writer_open(struct nal_pack_writer *w, const char *path,
+                         uint32_t alignment) {
+  struct nal_pack_header hdr = { .alignment = alignment };
+
+  assert(alignment >= 256 && !(alignment & (alignment - 1)));
+  memset(w, 0, sizeof(*w));
+  if (!(w->f = fopen(path, "wb")))
+    return -1;
+  w->alignment = alignment;
+
+  /* Filled in for real on close */
+  fwrite(&hdr, sizeof(hdr), 1, w->f);
+  w->pos = sizeof(hdr);
+  write_padding(w);
+  return 0;
+}
+
+void nal_pack_begin(struct nal_pack_writer *w) {
+  struct nal_pack_entry *e;
+
+  assert(!w->open);
+  if (w->count == w->alloced) {
+    w->alloced = w->alloced ? w->alloced * 2 : 256;
+    w->entries = realloc(w->entries, w->alloced * sizeof(*w->entries));
+    assert(w->entries);
+  }
+  e = &w->entries[w->count];
+  memset(e, 0, sizeof(*e));
+  e->offset = w->pos;
+  w->open = 1;
+}
+
+void nal_pack_append(struct nal_pack_writer *w, const struct h264_nal *nal) {
+  struct nal_pack_entry *e = &w->entries[w->count];
+
+  assert(w->open);
+  if (!e->size) {
+    e->nal_size = nal->size;
+    e->type = nal->type;
+    if (nal->type == 5)
+      e->flags |= NAL_PACK_IDR;
+    if (nal->ref_idc)
+      e->flags |= NAL_PACK_REF;
+  }
+  fwrite(start_code, 1, sizeof(start_code), w->f);
+  fwrite(nal->data, 1, nal->size, w->f);
+  e->size += sizeof(start_code) + nal->size;
+  if (h264_nal_is_slice(nal->type))
+    e->slices++;
+}
+
+void nal_pack_end(struct nal_pack_writer *w) {
+  struct nal_pack_entry *e = &w->entries[w->count];
+
+  assert(w->open && e->size);
+  if (e->slices) {
+    fwrite(end_markers, 1, sizeof(end_markers), w->f);
+    e->size += sizeof(end_markers);
+  }
+  w->pos += e->size;
+  write_padding(w);
+  w->count++;
+  w->open = 0;
+}
+
+int nal_pack_writer_close(struct nal_pack_writer *w) {
+  struct nal_pack_header hdr = {
+    .alignment = w->alignment,
+    .count = w->count,
+    .table_offset = w->pos,
+  };
+  int ret;
+
+  assert(!w->open);
+  memcpy(hdr.magic, NAL_PACK_MAGIC, 8);
+  fwrite(w->entries, sizeof(*w->entries), w->count, w->f);
+  fseek(w->f, 0, SEEK_SET);
+  fwrite(&hdr, sizeof(hdr), 1, w->f);
+  ret = ferror(w->f) ? -1 : 0;
+  if (fclose(w->f))
+    ret = -1;
+  free(w->entries);
+  memset(w, 0, sizeof(*w));
+  return ret;
+}
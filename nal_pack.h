@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2013 Ilia Mirkin <imirkin@alum.mit.edu>
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef NAL_PACK_H
+#define NAL_PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "h264_parse.h"
+
+/* A stream stored the way the BSP reads it, so that a picture goes into
+ * the bitstream buffer with one aligned copy. Each entry's payload
+ * starts on an alignment boundary (at least 256, the BSP takes
+ * addresses >> 8). A picture's payload is every slice behind a
+ * 00 00 01 start code, then the two 00 00 01 0b end markers. SPS and
+ * PPS entries are just the start code and the NAL. Payloads are
+ * zero-padded to the alignment, so copying whole aligned blocks never
+ * runs off the end of the file.
+ *
+ * Layout: the header, payloads from the first alignment boundary past
+ * it, then the entry table. Everything is little-endian. */
+
+#define NAL_PACK_MAGIC "VP2PACK\1"
+#define NAL_PACK_END_MARKERS 16
+
+struct nal_pack_header {
+  char magic[8];
+  uint32_t alignment;
+  uint32_t count;
+  uint64_t table_offset;
+};
+
+enum {
+  NAL_PACK_IDR = 1 << 0,
+  NAL_PACK_REF = 1 << 1,
+};
+
+struct nal_pack_entry {
+  uint64_t offset;     /* of the payload in the file */
+  uint32_t size;       /* of the payload, without padding */
+  uint32_t nal_size;   /* of the first NAL, which starts 3 bytes in */
+  uint16_t slices;     /* 0 for SPS/PPS */
+  uint8_t type;        /* of the first NAL */
+  uint8_t flags;
+  uint32_t pad;
+};
+
+struct nal_pack {
+  const uint8_t *base;
+  size_t size;
+  uint32_t alignment;
+  uint32_t count;
+  const struct nal_pack_entry *entries;
+};
+
+/* Maps a pack and checks every entry against the file. Returns 0, or
+ * -1 if path isn't a valid pack. */
+int nal_pack_open(struct nal_pack *pack, const char *path);
+void nal_pack_close(struct nal_pack *pack);
+
+/* Whether the file starts with the pack magic */
+int nal_pack_is_pack(const void *data, size_t size);
+
+static inline const uint8_t *
+nal_pack_payload(const struct nal_pack *pack, unsigned i) {
+  return pack->base + pack->entries[i].offset;
+}
+
+/* The first NAL of entry i, as h264_next_nal() would return it */
+void nal_pack_nal(const struct nal_pack *pack, unsigned i, struct h264_nal *nal);
+
+/* Writing: entries are started, filled with NALs and finished in
+ * order. Payloads are written as they're finished, the table on
+ * close. */
+struct nal_pack_writer {
+  FILE *f;
+  uint32_t alignment;
+  uint64_t pos;
+  struct nal_pack_entry *entries;
+  uint32_t count, alloced;
+  int open; /* an entry has been begun */
+};
+
+int nal_pack_writer_open(struct nal_pack_writer *w, const char *path,
+                         uint32_t alignment);
+void nal_pack_begin(struct nal_pack_writer *w);
+void nal_pack_append(struct nal_pack_writer *w, const struct h264_nal *nal);
+void nal_pack_end(struct nal_pack_writer *w);
+int nal_pack_writer_close(struct nal_pack_writer *w);
+
+#endif
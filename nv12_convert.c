@@ -0,0 +1,522 @@
+/*
+ * Copyright (C) 2013 Ilia Mirkin <imirkin@alum.mit.edu>
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <immintrin.h>
+
+#include "nv12_convert.h"
+
+/* Filter weights are 8-bit and sum to 256 for every output sample, so a
+ * vertically filtered line fits in 16 bits (8.8) and the horizontal pass
+ * in 32 bits (16.16). */
+#define WEIGHT_ONE 256
+
+struct taps {
+  int *start;     /* first source sample of each output sample */
+  uint16_t *w;    /* max weights per output sample, unused ones 0 */
+  int max;
+};
+
+struct line_buf {
+  uint16_t *luma, *chroma;
+  uint8_t *y, *u, *v;
+};
+
+struct band;
+
+/* Bands 1 to threads - 1 go to workers started with the scaler, which
+ * wait on start for generation to move and count pending down when
+ * they're done with it. */
+struct nv12_scaler {
+  struct nv12_scaler_params p;
+  struct taps luma_x, luma_y, chroma_x, chroma_y;
+  int cy, crv, cgu, cgv, cbu;
+  int threads, simd;
+  struct line_buf *lines;
+
+  struct band *bands;
+  pthread_t *workers;
+  pthread_mutex_t lock;
+  pthread_cond_t start, done;
+  unsigned generation;
+  int pending, quit;
+};
+
+struct band {
+  struct nv12_scaler *s;
+  const uint8_t *luma, *chroma;
+  int pitch;
+  uint8_t *dst;
+  int dst_pitch;
+  int first, last;
+  struct line_buf *line;
+};
+
+static int have_avx2;
+
+__attribute__((constructor)) static void
+nv12_convert_init(void) {
+  have_avx2 = __builtin_cpu_supports("avx2");
+}
+
+/* Rounds the real-valued weights in f[0..n) to integers summing to
+ * WEIGHT_ONE, handing the rounding error to the largest one. */
+static void
+quantize(const double *f, int n, uint16_t *w) {
+  int i, sum = 0, big = 0;
+
+  for (i = 0; i < n; i++) {
+    w[i] = f[i] * WEIGHT_ONE + 0.5;
+    sum += w[i];
+    if (f[i] > f[big])
+      big = i;
+  }
+  w[big] += WEIGHT_ONE - sum;
+}
+
+static void
+taps_compute(struct taps *t, int src, int dst, int filter) {
+  double scale = (double)src / dst, *f;
+  int i, k;
+
+  t->max = filter == NV12_SCALE_AREA ? (int)scale + 2 : 2;
+  if (t->max > src)
+    t->max = src;
+  t->start = calloc(dst, sizeof(*t->start));
+  t->w = calloc(dst * t->max, sizeof(*t->w));
+  f = malloc(t->max * sizeof(*f));
+  assert(t->start && t->w && f);
+
+  for (i = 0; i < dst; i++) {
+    uint16_t *w = t->w + i * t->max;
+    int n;
+
+    if (filter == NV12_SCALE_AREA) {
+      /* The source samples overlapping [i, i + 1) * scale, by coverage */
+      double lo = i * scale, hi = (i + 1) * scale;
+      int first = lo, last = hi < src ? (int)(hi - 1e-9) : src - 1;
+
+      n = last - first + 1;
+      assert(n <= t->max);
+      for (k = 0; k < n; k++) {
+        double a = first + k > lo ? first + k : lo;
+        double b = first + k + 1 < hi ? first + k + 1 : hi;
+        f[k] = (b - a) / scale;
+      }
+      t->start[i] = first;
+    } else {
+      double c = (i + 0.5) * scale - 0.5;
+      int x0 = c < 0 ? 0 : (int)c;
+
+      if (x0 > src - 2)
+        x0 = src > 1 ? src - 2 : 0;
+      c -= x0;
+      c = c < 0 ? 0 : c > 1 ? 1 : c;
+      n = src > 1 ? 2 : 1;
+      f[0] = n == 2 ? 1 - c : 1;
+      if (n == 2)
+        f[1] = c;
+      t->start[i] = x0;
+    }
+    quantize(f, n, w);
+  }
+  free(f);
+}
+
+static void
+taps_free(struct taps *t) {
+  free(t->start);
+  free(t->w);
+}
+
+/* Sum of w[k] * row k, over width bytes starting at src + start * pitch.
+ * The sum of the weights being 256, nothing overflows 16 bits. */
+static void
+vfilter_c(uint16_t *dst, const uint8_t *src, int pitch, int width,
+          const uint16_t *w, int n) {
+  int x, k;
+
+  memset(dst, 0, width * sizeof(*dst));
+  for (k = 0; k < n; k++) {
+    const uint8_t *row = src + k * pitch;
+    if (!w[k])
+      continue;
+    for (x = 0; x < width; x++)
+      dst[x] += row[x] * w[k];
+  }
+}
+
+__attribute__((target("avx2"))) static void
+vfilter_avx2(uint16_t *dst, const uint8_t *src, int pitch, int width,
+             const uint16_t *w, int n) {
+  int x = 0, k;
+
+  for (; x + 32 <= width; x += 32) {
+    __m256i a0 = _mm256_setzero_si256(), a1 = _mm256_setzero_si256();
+
+    for (k = 0; k < n; k++) {
+      const uint8_t *row = src + k * pitch + x;
+      __m256i wk = _mm256_set1_epi16(w[k]);
+
+      a0 = _mm256_add_epi16(a0, _mm256_mullo_epi16(
+                              _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)row)), wk));
+      a1 = _mm256_add_epi16(a1, _mm256_mullo_epi16(
+                              _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(row + 16))), wk));
+    }
+    _mm256_storeu_si256((__m256i *)(dst + x), a0);
+    _mm256_storeu_si256((__m256i *)(dst + x + 16), a1);
+  }
+  if (x < width)
+    vfilter_c(dst + x, src + x, pitch, width - x, w, n);
+}
+
+/* Horizontal pass over a filtered line; step is 2 for interleaved UV */
+static void
+hfilter(uint8_t *dst, const uint16_t *line, int step, const struct taps *t,
+        int count) {
+  int i, k;
+
+  for (i = 0; i < count; i++) {
+    const uint16_t *w = t->w + i * t->max, *l = line + t->start[i] * step;
+    uint32_t acc = 1 << 15;
+
+    for (k = 0; k < t->max; k++)
+      acc += l[k * step] * w[k];
+    dst[i] = acc >> 16;
+  }
+}
+
+/* 6-bit coefficients, with 255/219 and 255/224 for the range expansion.
+ * Everything stays within 16 bits, bar B (and only for results that get
+ * clamped to 255 anyway), which is why the AVX2 version can saturate. */
+static void
+yuv_coef(struct nv12_scaler *s) {
+  s->cy = 75;
+  if (s->p.matrix == NV12_BT709) {
+    s->crv = 115;
+    s->cgu = 14;
+    s->cgv = 34;
+    s->cbu = 135;
+  } else {
+    s->crv = 102;
+    s->cgu = 25;
+    s->cgv = 52;
+    s->cbu = 129;
+  }
+}
+
+static inline uint8_t
+clamp8(int x) {
+  return x < 0 ? 0 : x > 255 ? 255 : x;
+}
+
+static void
+yuv_to_rgba_c(const struct nv12_scaler *s, uint8_t *dst, const uint8_t *y,
+              const uint8_t *u, const uint8_t *v, int width) {
+  int x;
+
+  for (x = 0; x < width; x++) {
+    int l = (y[x] - 16) * s->cy + 32, cb = u[x] - 128, cr = v[x] - 128;
+
+    dst[4 * x + 0] = clamp8((l + s->crv * cr) >> 6);
+    dst[4 * x + 1] = clamp8((l - s->cgu * cb - s->cgv * cr) >> 6);
+    dst[4 * x + 2] = clamp8((l + s->cbu * cb) >> 6);
+    dst[4 * x + 3] = 0xff;
+  }
+}
+
+__attribute__((target("avx2"))) static void
+yuv_to_rgba_avx2(const struct nv12_scaler *s, uint8_t *dst, const uint8_t *y,
+                 const uint8_t *u, const uint8_t *v, int width) {
+  const __m256i c16 = _mm256_set1_epi16(16), c128 = _mm256_set1_epi16(128);
+  const __m256i round = _mm256_set1_epi16(32), cy = _mm256_set1_epi16(s->cy);
+  const __m256i crv = _mm256_set1_epi16(s->crv), cgu = _mm256_set1_epi16(s->cgu);
+  const __m256i cgv = _mm256_set1_epi16(s->cgv), cbu = _mm256_set1_epi16(s->cbu);
+  const __m128i alpha = _mm_set1_epi8(-1);
+  int x = 0;
+
+  for (; x + 16 <= width; x += 16) {
+    __m256i l = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(y + x)));
+    __m256i cb = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(u + x)));
+    __m256i cr = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(v + x)));
+    __m256i r, g, b;
+    __m128i r8, g8, b8, rg, ba;
+
+    l = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(l, c16), cy), round);
+    cb = _mm256_sub_epi16(cb, c128);
+    cr = _mm256_sub_epi16(cr, c128);
+    r = _mm256_srai_epi16(_mm256_adds_epi16(l, _mm256_mullo_epi16(cr, crv)), 6);
+    g = _mm256_sub_epi16(l, _mm256_add_epi16(_mm256_mullo_epi16(cb, cgu),
+                                             _mm256_mullo_epi16(cr, cgv)));
+    g = _mm256_srai_epi16(g, 6);
+    b = _mm256_srai_epi16(_mm256_adds_epi16(l, _mm256_mullo_epi16(cb, cbu)), 6);
+
+    /* Back to bytes per 128-bit half, which keeps them in order */
+    r8 = _mm_packus_epi16(_mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1));
+    g8 = _mm_packus_epi16(_mm256_castsi256_si128(g), _mm256_extracti128_si256(g, 1));
+    b8 = _mm_packus_epi16(_mm256_castsi256_si128(b), _mm256_extracti128_si256(b, 1));
+
+    rg = _mm_unpacklo_epi8(r8, g8);
+    ba = _mm_unpacklo_epi8(b8, alpha);
+    _mm_storeu_si128((__m128i *)(dst + 4 * x), _mm_unpacklo_epi16(rg, ba));
+    _mm_storeu_si128((__m128i *)(dst + 4 * x + 16), _mm_unpackhi_epi16(rg, ba));
+    rg = _mm_unpackhi_epi8(r8, g8);
+    ba = _mm_unpackhi_epi8(b8, alpha);
+    _mm_storeu_si128((__m128i *)(dst + 4 * x + 32), _mm_unpacklo_epi16(rg, ba));
+    _mm_storeu_si128((__m128i *)(dst + 4 * x + 48), _mm_unpackhi_epi16(rg, ba));
+  }
+  if (x < width)
+    yuv_to_rgba_c(s, dst + 4 * x, y + x, u + x, v + x, width - x);
+}
+
+static void *
+run_band(void *arg) {
+  struct band *b = arg;
+  struct nv12_scaler *s = b->s;
+  struct line_buf *line = b->line;
+  int sw = s->p.src_width, dw = s->p.dst_width, cw = sw / 2 * 2;
+  int i;
+
+  for (i = b->first; i < b->last; i++) {
+    const struct taps *ty = &s->luma_y, *tc = &s->chroma_y;
+    const uint16_t *wy = ty->w + i * ty->max, *wc = tc->w + i * tc->max;
+    const uint8_t *ly = b->luma + ty->start[i] * b->pitch;
+    const uint8_t *lc = b->chroma + tc->start[i] * b->pitch;
+    uint8_t *out = b->dst + i * b->dst_pitch;
+
+    if (s->simd) {
+      vfilter_avx2(line->luma, ly, b->pitch, sw, wy, ty->max);
+      vfilter_avx2(line->chroma, lc, b->pitch, cw, wc, tc->max);
+    } else {
+      vfilter_c(line->luma, ly, b->pitch, sw, wy, ty->max);
+      vfilter_c(line->chroma, lc, b->pitch, cw, wc, tc->max);
+    }
+
+    hfilter(line->y, line->luma, 1, &s->luma_x, dw);
+    hfilter(line->u, line->chroma, 2, &s->chroma_x, dw);
+    hfilter(line->v, line->chroma + 1, 2, &s->chroma_x, dw);
+
+    if (s->simd)
+      yuv_to_rgba_avx2(s, out, line->y, line->u, line->v, dw);
+    else
+      yuv_to_rgba_c(s, out, line->y, line->u, line->v, dw);
+  }
+  return NULL;
+}
+
+static void *
+worker(void *arg) {
+  struct band *b = arg;
+  struct nv12_scaler *s = b->s;
+  unsigned seen = 0;
+
+  pthread_mutex_lock(&s->lock);
+  for (;;) {
+    while (s->generation == seen && !s->quit)
+      pthread_cond_wait(&s->start, &s->lock);
+    if (s->quit)
+      break;
+    seen = s->generation;
+    pthread_mutex_unlock(&s->lock);
+    run_band(b);
+    pthread_mutex_lock(&s->lock);
+    if (!--s->pending)
+      pthread_cond_signal(&s->done);
+  }
+  pthread_mutex_unlock(&s->lock);
+  return NULL;
+}
+
+/* The taps never reach past the last sample, but vfilter reads n rows
+ * from the first one, with zero weights for the unused ones. Clamping
+ * the start keeps those rows inside the picture. */
+static void
+taps_clamp(struct taps *t, int src, int dst) {
+  int i, k;
+
+  for (i = 0; i < dst; i++) {
+    uint16_t *w = t->w + i * t->max;
+    int shift = t->start[i] + t->max - src;
+
+    if (shift <= 0)
+      continue;
+    assert(shift <= t->start[i]);
+    for (k = t->max - 1; k >= shift; k--)
+      w[k] = w[k - shift];
+    for (; k >= 0; k--)
+      w[k] = 0;
+    t->start[i] -= shift;
+  }
+}
+
+struct nv12_scaler *nv12_scaler_new(const struct nv12_scaler_params *p) {
+  struct nv12_scaler *s = calloc(1, sizeof(*s));
+  int cw = p->src_width / 2, ch = p->src_height / 2, threads, i;
+
+  assert(s);
+  assert(p->src_width >= 2 && p->src_height >= 2);
+  assert(p->dst_width > 0 && p->dst_height > 0);
+  s->p = *p;
+
+  taps_compute(&s->luma_x, p->src_width, p->dst_width, p->filter);
+  taps_compute(&s->luma_y, p->src_height, p->dst_height, p->filter);
+  taps_compute(&s->chroma_x, cw, p->dst_width, p->filter);
+  taps_compute(&s->chroma_y, ch, p->dst_height, p->filter);
+  taps_clamp(&s->luma_x, p->src_width, p->dst_width);
+  taps_clamp(&s->luma_y, p->src_height, p->dst_height);
+  taps_clamp(&s->chroma_x, cw, p->dst_width);
+  taps_clamp(&s->chroma_y, ch, p->dst_height);
+  yuv_coef(s);
+
+  s->simd = have_avx2 && !p->no_simd;
+  threads = p->threads > 0 ? p->threads : sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads < 1)
+    threads = 1;
+  if (threads > p->dst_height)
+    threads = p->dst_height;
+
+  s->bands = calloc(threads, sizeof(*s->bands));
+  s->workers = calloc(threads, sizeof(*s->workers));
+  assert(s->bands && s->workers);
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->start, NULL);
+  pthread_cond_init(&s->done, NULL);
+  /* With fewer workers than asked for, the bands just get bigger */
+  for (i = 0; i < threads; i++) {
+    s->bands[i].s = s;
+    if (i && pthread_create(&s->workers[i], NULL, worker, &s->bands[i])) {
+      threads = i;
+      break;
+    }
+  }
+  s->threads = threads;
+
+  s->lines = calloc(threads, sizeof(*s->lines));
+  assert(s->lines);
+  for (i = 0; i < threads; i++) {
+    struct line_buf *l = &s->lines[i];
+    l->luma = malloc(p->src_width * sizeof(*l->luma));
+    l->chroma = malloc(cw * 2 * sizeof(*l->chroma));
+    l->y = malloc(p->dst_width * 3);
+    assert(l->luma && l->chroma && l->y);
+    l->u = l->y + p->dst_width;
+    l->v = l->u + p->dst_width;
+
+    s->bands[i].first = p->dst_height * i / threads;
+    s->bands[i].last = p->dst_height * (i + 1) / threads;
+    s->bands[i].line = l;
+  }
+  return s;
+}
+
+void nv12_scaler_free(struct nv12_scaler *s) {
+  int i;
+
+  pthread_mutex_lock(&s->lock);
+  s->quit = 1;
+  pthread_cond_broadcast(&s->start);
+  pthread_mutex_unlock(&s->lock);
+  for (i = 1; i < s->threads; i++)
+    pthread_join(s->workers[i], NULL);
+  pthread_mutex_destroy(&s->lock);
+  pthread_cond_destroy(&s->start);
+  pthread_cond_destroy(&s->done);
+  free(s->workers);
+  free(s->bands);
+
+  for (i = 0; i < s->threads; i++) {
+    free(s->lines[i].luma);
+    free(s->lines[i].chroma);
+    free(s->lines[i].y);
+  }
+  free(s->lines);
+  taps_free(&s->luma_x);
+  taps_free(&s->luma_y);
+  taps_free(&s->chroma_x);
+  taps_free(&s->chroma_y);
+  free(s);
+}
+
+int nv12_scaler_simd(const struct nv12_scaler *s) {
+  return s->simd;
+}
+
+void nv12_scaler_run(struct nv12_scaler *s, const uint8_t *luma,
+                     const uint8_t *chroma, int pitch,
+                     uint8_t *dst, int dst_pitch) {
+  int i;
+
+  /* The rest of each band is set up by nv12_scaler_new */
+  for (i = 0; i < s->threads; i++) {
+    struct band *b = &s->bands[i];
+
+    b->luma = luma;
+    b->chroma = chroma;
+    b->pitch = pitch;
+    b->dst = dst;
+    b->dst_pitch = dst_pitch;
+  }
+  if (s->threads == 1) {
+    run_band(&s->bands[0]);
+    return;
+  }
+
+  /* The calling thread takes the first band */
+  pthread_mutex_lock(&s->lock);
+  s->pending = s->threads - 1;
+  s->generation++;
+  pthread_cond_broadcast(&s->start);
+  pthread_mutex_unlock(&s->lock);
+  run_band(&s->bands[0]);
+  pthread_mutex_lock(&s->lock);
+  while (s->pending)
+    pthread_cond_wait(&s->done, &s->lock);
+  pthread_mutex_unlock(&s->lock);
+}
+
+int nv12_write_ppm(FILE *f, const uint8_t *rgba, int width, int height,
+                   int pitch) {
+  uint8_t *row = malloc(width * 3);
+  int x, y;
+
+  assert(row);
+  fprintf(f, "P6\n%d %d\n255\n", width, height);
+  for (y = 0; y < height; y++) {
+    const uint8_t *p = rgba + y * pitch;
+    for (x = 0; x < width; x++) {
+      row[3 * x + 0] = p[4 * x + 0];
+      row[3 * x + 1] = p[4 * x + 1];
+      row[3 * x + 2] = p[4 * x + 2];
+    }
+    if (fwrite(row, 3, width, f) != (size_t)width)
+      break;
+  }
+  free(row);
+  return y == height ? 0 : -1;
+}
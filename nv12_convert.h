@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2013 Ilia Mirkin <imirkin@alum.mit.edu>
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef NV12_CONVERT_H
+#define NV12_CONVERT_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Limited range YCbCr to full range RGB */
+enum {
+  NV12_BT601,
+  NV12_BT709,
+};
+
+enum {
+  NV12_SCALE_AREA,     /* box filter, for large reductions */
+  NV12_SCALE_BILINEAR,
+};
+
+struct nv12_scaler_params {
+  int src_width, src_height;
+  int dst_width, dst_height;
+  int filter, matrix;
+  int threads;   /* 0 for one per CPU */
+  int no_simd;   /* use the C paths even with AVX2 around */
+};
+
+/* Converts a linear NV12 picture (as decode_frame's output buffer holds
+ * it) to RGBA at a different size, in one pass: each thread takes a band
+ * of output rows, filters the source rows that make up each one down to
+ * a single line, and converts that line after scaling it horizontally.
+ * There is never a full size RGB frame. The threads are started by
+ * nv12_scaler_new() and kept until nv12_scaler_free(). */
+struct nv12_scaler;
+
+struct nv12_scaler *nv12_scaler_new(const struct nv12_scaler_params *p);
+void nv12_scaler_free(struct nv12_scaler *s);
+
+/* dst gets dst_width RGBA pixels per row, alpha 0xff */
+void nv12_scaler_run(struct nv12_scaler *s, const uint8_t *luma,
+                     const uint8_t *chroma, int pitch,
+                     uint8_t *dst, int dst_pitch);
+
+/* Whether nv12_scaler_run uses AVX2 */
+int nv12_scaler_simd(const struct nv12_scaler *s);
+
+/* A binary (P6) PPM of an RGBA buffer, alpha dropped */
+int nv12_write_ppm(FILE *f, const uint8_t *rgba, int width, int height,
+                   int pitch);
+
+#endif
@@ -0,0 +1,649 @@
+/*
+ * Copyright (C) 2013 Ilia Mirkin <imirkin@alum.mit.edu>
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/* Times the CPU-side parsing paths (NAL splitting in both stream formats,
+ * emulation prevention removal, ue/se, slice headers and per-picture
+ * picinfo setup) on generated streams and frame_nal, and compares the
+ * results against a saved baseline. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "h264_parse.h"
+
+#undef NDEBUG
+#include <assert.h>
+
+/* Same as the stream h264_player and decode_frame default to */
+#define LOG2_MAX_FRAME_NUM 9
+#define LOG2_MAX_POC_LSB 10
+#define GOP 30
+#define STREAM_BYTES (8 << 20)
+#define CODES (1 << 20)
+
+struct bitwriter {
+  uint8_t *buf;
+  size_t size, bits;
+};
+
+static void
+put_bits(struct bitwriter *w, uint32_t v, int n) {
+  while (n--) {
+    size_t byte = w->bits / 8;
+    assert(byte < w->size);
+    if (w->bits % 8 == 0)
+      w->buf[byte] = 0;
+    w->buf[byte] |= ((v >> n) & 1) << (7 - w->bits % 8);
+    w->bits++;
+  }
+}
+
+static void
+put_ue(struct bitwriter *w, uint32_t v) {
+  int len = 32 - __builtin_clz(v + 1);
+  put_bits(w, 0, len - 1);
+  put_bits(w, v + 1, len);
+}
+
+struct stream_cfg {
+  const char *name;
+  int slices;    /* per picture */
+  int nal_size;  /* payload bytes per slice */
+  int ep_every;  /* force an emulation prevention byte every ~n bytes, 0: never */
+  int annexb;
+};
+
+struct stream {
+  const struct stream_cfg *cfg;
+  uint8_t *buf;
+  size_t len;
+  unsigned nals;
+  struct h264_nal *index; /* every NAL, for the stages after splitting */
+};
+
+/* Escapes rbsp into dst, returns the NAL length */
+static size_t
+escape(uint8_t *dst, const uint8_t *rbsp, size_t len) {
+  size_t i, n = 0;
+  int zeros = 0;
+
+  for (i = 0; i < len; i++) {
+    if (zeros >= 2 && rbsp[i] <= 3) {
+      dst[n++] = 3;
+      zeros = 0;
+    }
+    zeros = rbsp[i] ? 0 : zeros + 1;
+    dst[n++] = rbsp[i];
+  }
+  return n;
+}
+
+static void
+stream_generate(struct stream *s, const struct stream_cfg *cfg) {
+  size_t cap = STREAM_BYTES + (size_t)cfg->slices * (cfg->nal_size * 3 / 2 + 4);
+  uint8_t *rbsp = malloc(cfg->nal_size + 64);
+  unsigned pic = 0, k;
+  size_t pos;
+
+  s->cfg = cfg;
+  s->buf = malloc(cap);
+  assert(s->buf && rbsp);
+  s->len = 0;
+  s->nals = 0;
+
+  while (s->len < STREAM_BYTES) {
+    int idr = pic % GOP == 0, i;
+
+    for (i = 0; i < cfg->slices; i++) {
+      struct bitwriter w = { rbsp, cfg->nal_size + 64, 0 };
+      size_t n;
+
+      put_bits(&w, idr ? 0x65 : 0x41, 8);
+      put_ue(&w, i * 8160 / cfg->slices / 16);
+      put_ue(&w, idr ? 7 : 5);
+      put_ue(&w, 0);
+      put_bits(&w, pic % GOP, LOG2_MAX_FRAME_NUM);
+      if (idr)
+        put_ue(&w, pic / GOP);
+      put_bits(&w, 2 * (pic % GOP), LOG2_MAX_POC_LSB);
+
+      /* Payload: random bytes without accidental zero runs, then
+       * forced ones */
+      pos = (w.bits + 7) / 8;
+      for (k = pos; k < cfg->nal_size - 1u; k++) {
+        rbsp[k] = rand() | 0x10;
+        if (cfg->ep_every && rand() % cfg->ep_every == 0 && k + 3 < cfg->nal_size - 1u) {
+          rbsp[k++] = 0;
+          rbsp[k++] = 0;
+          rbsp[k] = rand() & 3;
+        }
+      }
+      rbsp[cfg->nal_size - 1] = 0x80;
+
+      if (cfg->annexb) {
+        memcpy(s->buf + s->len, "\0\0\0\1", 4);
+        s->len += 4;
+        s->len += escape(s->buf + s->len, rbsp, cfg->nal_size);
+      } else {
+        n = escape(s->buf + s->len + 4, rbsp, cfg->nal_size);
+        s->buf[s->len] = n >> 24;
+        s->buf[s->len + 1] = n >> 16;
+        s->buf[s->len + 2] = n >> 8;
+        s->buf[s->len + 3] = n;
+        s->len += 4 + n;
+      }
+      s->nals++;
+    }
+    pic++;
+  }
+  free(rbsp);
+
+  /* The index doubles as a check of both splitters */
+  s->index = malloc(s->nals * sizeof(*s->index));
+  assert(s->index);
+  pos = 0;
+  for (k = 0; k < s->nals; k++) {
+    if (cfg->annexb)
+      assert(!h264_next_nal_annexb(s->buf, s->len, &pos, &s->index[k]));
+    else
+      assert(!h264_next_nal(s->buf, s->len, &pos, &s->index[k]));
+    assert(h264_nal_is_slice(s->index[k].type));
+  }
+  assert(pos == s->len);
+}
+
+/* What h264_player's parser thread keeps per picture, in a
+ * VdpPictureInfoH264-sized shape: frame_num, POC, and the reference
+ * list that gets shifted for every reference picture. */
+struct picinfo {
+  int32_t field_order_cnt[2];
+  int is_reference;
+  uint16_t frame_num;
+  uint32_t slice_count;
+  struct {
+    uint32_t surface;
+    int top_is_reference, bottom_is_reference;
+    int32_t field_order_cnt[2];
+    uint16_t frame_idx;
+  } ref[16];
+};
+
+/* Each stage runs over a whole stream and returns how many items (NALs,
+ * codes) it went through. sink keeps the compiler honest. */
+static volatile uint64_t sink;
+
+static unsigned
+stage_split(struct stream *s) {
+  struct h264_nal nal;
+  size_t pos = 0;
+  unsigned n = 0;
+  uint64_t sum = 0;
+
+  if (s->cfg->annexb) {
+    while (!h264_next_nal_annexb(s->buf, s->len, &pos, &nal)) {
+      sum += nal.size;
+      n++;
+    }
+  } else {
+    while (!h264_next_nal(s->buf, s->len, &pos, &nal)) {
+      sum += nal.size;
+      n++;
+    }
+  }
+  sink = sum;
+  return n;
+}
+
+static uint8_t *scratch;
+
+static unsigned
+stage_unescape(struct stream *s) {
+  uint64_t sum = 0;
+  unsigned i;
+
+  for (i = 0; i < s->nals; i++)
+    sum += h264_unescape(scratch, s->index[i].data, s->index[i].size);
+  sink = sum;
+  return s->nals;
+}
+
+static unsigned
+stage_slice_header(struct stream *s) {
+  struct h264_slice_header sh;
+  uint64_t sum = 0;
+  unsigned i;
+
+  for (i = 0; i < s->nals; i++) {
+    h264_parse_slice_header(&s->index[i], LOG2_MAX_FRAME_NUM, LOG2_MAX_POC_LSB, &sh);
+    sum += sh.first_mb_in_slice + sh.pic_order_cnt_lsb;
+  }
+  sink = sum;
+  return s->nals;
+}
+
+/* The same through the parser h264_slice_header_parser() picks for the
+ * generated streams */
+static unsigned
+stage_slice_header_fn(struct stream *s) {
+  const struct h264_slice_params params = {
+    .log2_max_frame_num = LOG2_MAX_FRAME_NUM,
+    .log2_max_poc_lsb = LOG2_MAX_POC_LSB,
+    .frame_mbs_only_flag = 1,
+  };
+  h264_slice_header_fn parse = h264_slice_header_parser(&params);
+  struct h264_slice_header sh;
+  uint64_t sum = 0;
+  unsigned i;
+
+  for (i = 0; i < s->nals; i++) {
+    parse(&s->index[i], &params, &sh);
+    sum += sh.first_mb_in_slice + sh.pic_order_cnt_lsb;
+  }
+  sink = sum;
+  return s->nals;
+}
+
+/* Slice headers, picture boundaries and picinfo updates, the way
+ * h264_player's parse_thread does them */
+static unsigned
+stage_picinfo(struct stream *s) {
+  struct picinfo info = { .frame_num = 0 };
+  struct h264_slice_header sh, first = { .first_mb_in_slice = -1 };
+  const struct h264_nal *first_nal = NULL;
+  unsigned i, pictures = 0;
+  int j;
+
+  for (i = 0; i < s->nals; i++) {
+    const struct h264_nal *nal = &s->index[i];
+
+    h264_parse_slice_header(nal, LOG2_MAX_FRAME_NUM, LOG2_MAX_POC_LSB, &sh);
+    if (first_nal && !h264_new_picture(first_nal, &first, nal, &sh)) {
+      info.slice_count++;
+      continue;
+    }
+
+    if (first_nal && info.is_reference) {
+      memmove(&info.ref[1], &info.ref[0], 5 * sizeof(info.ref[0]));
+      info.ref[0].surface = pictures;
+      memcpy(info.ref[0].field_order_cnt, info.field_order_cnt, sizeof(info.field_order_cnt));
+      info.ref[0].frame_idx = info.frame_num;
+      info.ref[0].top_is_reference = info.ref[0].bottom_is_reference = 1;
+    }
+    first_nal = nal;
+    first = sh;
+    pictures++;
+
+    info.frame_num = sh.frame_num;
+    if (nal->type == 5) {
+      info.frame_num = 0;
+      for (j = 0; j < 16; j++)
+        info.ref[j].surface = ~0u;
+    }
+    info.field_order_cnt[0] = info.field_order_cnt[1] = (1 << 16) + sh.pic_order_cnt_lsb;
+    info.is_reference = nal->ref_idc != 0;
+    info.slice_count = 1;
+  }
+  sink = pictures + info.ref[0].surface;
+  return s->nals;
+}
+
+static uint8_t *codes;
+static size_t codes_len;
+
+static void
+codes_generate(void) {
+  struct bitwriter w;
+  int i;
+
+  /* Mostly small values, like real syntax elements, with a tail */
+  codes_len = CODES * 8 + 16;
+  codes = calloc(codes_len, 1);
+  assert(codes);
+  w = (struct bitwriter){ codes, codes_len, 0 };
+  for (i = 0; i < CODES; i++) {
+    int bits = rand() % 16 < 12 ? rand() % 3 : rand() % 16;
+    put_ue(&w, rand() & ((1u << bits) - 1));
+  }
+}
+
+static unsigned
+stage_ue(struct stream *s) {
+  uint64_t sum = 0;
+  int bit_offset = 0, i;
+
+  for (i = 0; i < CODES; i++)
+    sum += ue(codes, &bit_offset);
+  sink = sum;
+  return CODES;
+}
+
+static unsigned
+stage_se(struct stream *s) {
+  int64_t sum = 0;
+  int bit_offset = 0, i;
+
+  for (i = 0; i < CODES; i++)
+    sum += se(codes, &bit_offset);
+  sink = sum;
+  return CODES;
+}
+
+static struct stream frame_nal;
+
+/* frame_nal is a single IDR slice, so it's gone through many times */
+#define FRAME_NAL_REPEAT 256
+
+static unsigned
+stage_frame_nal(struct stream *s) {
+  struct h264_slice_header sh;
+  uint64_t sum = 0;
+  int i;
+
+  for (i = 0; i < FRAME_NAL_REPEAT; i++) {
+    sum += h264_unescape(scratch, s->index[0].data, s->index[0].size);
+    h264_parse_slice_header(&s->index[0], LOG2_MAX_FRAME_NUM, LOG2_MAX_POC_LSB, &sh);
+    sum += sh.pic_order_cnt_lsb;
+  }
+  sink = sum;
+  return FRAME_NAL_REPEAT;
+}
+
+static uint64_t
+now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int
+cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+/* Baselines keep the fastest run, which moves much less between runs
+ * of unchanged code than the median does, and how far the median was
+ * from it, as a measure of the noise. */
+struct result {
+  char name[64];
+  double ns;    /* per item, fastest run */
+  double noise; /* median over fastest, percent */
+  int retries;
+};
+
+#define MAX_RESULTS 64
+
+static struct result results[MAX_RESULTS], baseline[MAX_RESULTS];
+static int result_count, baseline_count;
+static double threshold = 5;
+
+/* A result that's slower than its baseline allows is measured again up
+ * to this many times, and the fastest run of all of them counts: a
+ * regression has to show up every time, noise usually doesn't. */
+#define RETRIES 2
+
+static const struct result *
+baseline_find(const char *name) {
+  int i;
+
+  for (i = 0; i < baseline_count; i++)
+    if (!strcmp(baseline[i].name, name))
+      return &baseline[i];
+  return NULL;
+}
+
+/* Percent slower than the baseline the fastest run may be: -t, plus
+ * the noise of the noisier of the two */
+static double
+limit(const struct result *r, const struct result *base) {
+  return threshold + (base->noise > r->noise ? base->noise : r->noise);
+}
+
+static int
+slower(const struct result *r, const struct result *base) {
+  return (r->ns - base->ns) / base->ns * 100 > limit(r, base);
+}
+
+/* Two untimed runs, then reps timed ones, sorted into t */
+static unsigned
+run_stage(unsigned (*stage)(struct stream *), struct stream *s, int reps,
+          uint64_t *t) {
+  uint64_t start;
+  unsigned items = 0;
+  int i;
+
+  stage(s);
+  stage(s);
+  for (i = 0; i < reps; i++) {
+    start = now_ns();
+    items = stage(s);
+    t[i] = now_ns() - start;
+  }
+  qsort(t, reps, sizeof(t[0]), cmp_u64);
+  return items;
+}
+
+/* Prints the median of reps and the fastest run. bytes is 0 for stages
+ * that don't have a meaningful throughput. */
+static void
+measure(const char *name, const char *unit, unsigned (*stage)(struct stream *),
+        struct stream *s, size_t bytes, int reps) {
+  const struct result *base = baseline_find(name);
+  struct result *r;
+  uint64_t t[reps];
+  unsigned items = run_stage(stage, s, reps, t);
+  double ns = (double)t[reps / 2] / items;
+
+  printf("%-34s %10.1f ns/%-5s min %8.1f", name, ns, unit, (double)t[0] / items);
+  if (bytes)
+    printf("  %7.2f GB/s", (double)bytes / t[reps / 2]);
+  printf("\n");
+
+  assert(result_count < MAX_RESULTS);
+  r = &results[result_count++];
+  snprintf(r->name, sizeof(r->name), "%s", name);
+  r->ns = (double)t[0] / items;
+  r->noise = (double)(t[reps / 2] - t[0]) / t[0] * 100;
+  r->retries = 0;
+  while (base && slower(r, base) && r->retries < RETRIES) {
+    items = run_stage(stage, s, reps, t);
+    if ((double)t[0] / items < r->ns)
+      r->ns = (double)t[0] / items;
+    r->retries++;
+  }
+}
+
+static void
+baseline_write(const char *path) {
+  FILE *f = fopen(path, "w");
+  int i;
+
+  assert(f);
+  for (i = 0; i < result_count; i++)
+    fprintf(f, "%s %.3f %.2f\n", results[i].name, results[i].ns, results[i].noise);
+  fclose(f);
+}
+
+/* Baselines without a noise column count as noiseless */
+static int
+baseline_read(const char *path) {
+  FILE *f = fopen(path, "r");
+  char line[128];
+
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+  while (baseline_count < MAX_RESULTS && fgets(line, sizeof(line), f)) {
+    struct result *b = &baseline[baseline_count];
+
+    b->noise = 0;
+    if (sscanf(line, "%63s %lf %lf", b->name, &b->ns, &b->noise) >= 2)
+      baseline_count++;
+  }
+  fclose(f);
+  return 0;
+}
+
+/* Returns the number of results that are slower than their limit */
+static int
+baseline_compare(const char *path) {
+  int i, regressions = 0;
+
+  printf("\nagainst %s (fastest runs):\n", path);
+  for (i = 0; i < result_count; i++) {
+    const struct result *r = &results[i], *base = baseline_find(r->name);
+    double delta;
+    int slow;
+
+    if (!base)
+      continue;
+    delta = (r->ns - base->ns) / base->ns * 100;
+    slow = slower(r, base);
+    printf("%-34s %10.1f -> %10.1f  %+6.1f%% (limit %.1f%%)%s", r->name,
+           base->ns, r->ns, delta, limit(r, base),
+           slow ? "  REGRESSION" : delta < -limit(r, base) ? "  faster" : "");
+    if (r->retries)
+      printf(", %d retr%s", r->retries, r->retries > 1 ? "ies" : "y");
+    printf("\n");
+    regressions += slow;
+  }
+  return regressions;
+}
+
+static const struct stream_cfg configs[] = {
+  { "1x16k",      1, 16384,  0, 0 },
+  { "1x16k-ep",   1, 16384, 64, 0 },
+  { "8x2k",       8,  2048,  0, 0 },
+  { "8x2k-ep",    8,  2048, 64, 0 },
+  { "32x256",    32,   256,  0, 0 },
+  { "32x256-ep", 32,   256, 64, 0 },
+  { "1x16k",      1, 16384,  0, 1 },
+  { "1x16k-ep",   1, 16384, 64, 1 },
+  { "8x2k",       8,  2048,  0, 1 },
+  { "8x2k-ep",    8,  2048, 64, 1 },
+  { "32x256",    32,   256,  0, 1 },
+  { "32x256-ep", 32,   256, 64, 1 },
+};
+
+int main(int argc, char **argv) {
+  const char *write_path = NULL, *compare_path = NULL, *nal_path = "frame_nal";
+  int reps = 15, opt, regressions = 0;
+  unsigned i;
+  char name[64];
+
+  while ((opt = getopt(argc, argv, "n:w:c:t:f:")) != -1) {
+    switch (opt) {
+    case 'n':
+      reps = atoi(optarg);
+      break;
+    case 'w':
+      write_path = optarg;
+      break;
+    case 'c':
+      compare_path = optarg;
+      break;
+    case 't':
+      threshold = atof(optarg);
+      break;
+    case 'f':
+      nal_path = optarg;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-n reps] [-w baseline] [-c baseline] [-t percent] [-f nal file]\n", argv[0]);
+      return 1;
+    }
+  }
+  assert(reps > 0);
+  if (compare_path && baseline_read(compare_path))
+    return 1;
+
+  srand(1);
+  scratch = malloc(65536);
+  assert(scratch);
+
+  for (i = 0; i < sizeof(configs) / sizeof(configs[0]); i++) {
+    const struct stream_cfg *cfg = &configs[i];
+    struct stream s;
+
+    stream_generate(&s, cfg);
+    snprintf(name, sizeof(name), "split/%s/%s", cfg->annexb ? "annexb" : "dump", cfg->name);
+    /* The dump splitter never touches the payload, so no GB/s for it */
+    measure(name, "NAL", stage_split, &s, cfg->annexb ? s.len : 0, reps);
+    if (!cfg->annexb) {
+      snprintf(name, sizeof(name), "unescape/%s", cfg->name);
+      measure(name, "NAL", stage_unescape, &s, s.len, reps);
+      snprintf(name, sizeof(name), "slice_header/%s", cfg->name);
+      measure(name, "NAL", stage_slice_header, &s, 0, reps);
+      snprintf(name, sizeof(name), "slice_header_fn/%s", cfg->name);
+      measure(name, "NAL", stage_slice_header_fn, &s, 0, reps);
+      snprintf(name, sizeof(name), "picinfo/%s", cfg->name);
+      measure(name, "NAL", stage_picinfo, &s, 0, reps);
+    }
+    free(s.index);
+    free(s.buf);
+  }
+
+  codes_generate();
+  measure("ue", "code", stage_ue, NULL, 0, reps);
+  measure("se", "code", stage_se, NULL, 0, reps);
+
+  {
+    int fd = open(nal_path, O_RDONLY);
+    struct stat st;
+
+    if (fd >= 0 && !fstat(fd, &st) && st.st_size > 0 && st.st_size <= 65536) {
+      static struct h264_nal nal;
+      nal.data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      assert(nal.data != MAP_FAILED);
+      nal.size = st.st_size;
+      nal.type = nal.data[0] & 0x1f;
+      nal.ref_idc = (nal.data[0] >> 5) & 3;
+      frame_nal.index = &nal;
+      frame_nal.nals = 1;
+      measure("frame_nal", "NAL", stage_frame_nal, &frame_nal,
+              (size_t)st.st_size * FRAME_NAL_REPEAT, reps);
+    } else {
+      fprintf(stderr, "%s not found (or over 64k), skipped\n", nal_path);
+    }
+    if (fd >= 0)
+      close(fd);
+  }
+
+  if (write_path)
+    baseline_write(write_path);
+  if (compare_path) {
+    regressions = baseline_compare(compare_path);
+    if (regressions > 0)
+      printf("%d results more than %.0f%% plus noise slower\n", regressions, threshold);
+  }
+  return regressions != 0;
+}
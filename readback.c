@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2013 Ilia Mirkin <imirkin@alum.mit.edu>
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdint.h>
+#include <string.h>
+#include <smmintrin.h>
+
+#include "readback.h"
+
+static int have_sse41;
+
+__attribute__((constructor)) static void
+readback_init(void) {
+  have_sse41 = __builtin_cpu_supports("sse4.1");
+}
+
+/* 4 loads per 64-byte line, so that each line's fill buffer is used up
+ * in one go, then plain stores into the cached destination. */
+__attribute__((target("sse4.1"))) static void
+readback_stream(uint8_t *dst, const uint8_t *src, size_t len) {
+  size_t i;
+
+  for (i = 0; i + 64 <= len; i += 64) {
+    __m128i a = _mm_stream_load_si128((__m128i *)(src + i));
+    __m128i b = _mm_stream_load_si128((__m128i *)(src + i + 16));
+    __m128i c = _mm_stream_load_si128((__m128i *)(src + i + 32));
+    __m128i d = _mm_stream_load_si128((__m128i *)(src + i + 48));
+
+    _mm_storeu_si128((__m128i *)(dst + i), a);
+    _mm_storeu_si128((__m128i *)(dst + i + 16), b);
+    _mm_storeu_si128((__m128i *)(dst + i + 32), c);
+    _mm_storeu_si128((__m128i *)(dst + i + 48), d);
+  }
+  if (i < len)
+    memcpy(dst + i, src + i, len - i);
+}
+
+void readback_copy(void *dst, const void *src, size_t len) {
+  const uint8_t *s = src;
+  uint8_t *d = dst;
+  size_t head;
+
+  if (!have_sse41) {
+    memcpy(dst, src, len);
+    return;
+  }
+
+  /* movntdqa wants 16-byte aligned sources */
+  head = -(uintptr_t)s & 15;
+  if (head > len)
+    head = len;
+  memcpy(d, s, head);
+  readback_stream(d + head, s + head, len - head);
+}
+
+int readback_streaming(void) {
+  return have_sse41;
+}
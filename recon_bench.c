@@ -0,0 +1,372 @@
+/*
+ * Copyright (C) 2013 Ilia Mirkin <imirkin@alum.mit.edu>
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/* Checks h264_recon_simd against the C reference on random input, then
+ * times both, kernel by kernel. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "h264_recon.h"
+
+#undef NDEBUG
+#include <assert.h>
+
+/* Source pictures get a margin on every side, for MC and deblocking */
+#define PIC_STRIDE 64
+#define PIC_SIZE (PIC_STRIDE * 48)
+#define PIC_ORIGIN (PIC_STRIDE * 16 + 16)
+
+struct args {
+  int16_t block[64];
+  uint8_t pic[PIC_SIZE];
+  int w, h, mx, my, mode, avail;
+  /* Luma uses the first of each; chroma alpha and beta are { U, V },
+   * tc0 4 values for U then 4 for V */
+  int alpha[2], beta[2];
+  int8_t tc0[8];
+};
+
+/* run() works on pic, a copy of a->pic, in place; except for MC, which
+ * reads a->pic and writes pic. */
+struct kernel {
+  const char *name;
+  void (*gen)(struct args *a);
+  void (*run)(const struct h264_recon_funcs *f, struct args *a, uint8_t *pic);
+  int in_place;
+};
+
+static void
+fill(uint8_t *p, size_t len) {
+  size_t i;
+  for (i = 0; i < len; i++)
+    p[i] = rand();
+}
+
+/* A gentle gradient plus noise, so that most edges get filtered */
+static void
+fill_smooth(uint8_t *p, int spread) {
+  int base = rand() % 200, x, y;
+
+  for (y = 0; y < PIC_SIZE / PIC_STRIDE; y++)
+    for (x = 0; x < PIC_STRIDE; x++)
+      p[y * PIC_STRIDE + x] = base + (x + y) / 4 + rand() % spread;
+}
+
+static void
+gen_idct4(struct args *a) {
+  int i;
+
+  fill(a->pic, PIC_SIZE);
+  for (i = 0; i < 16; i++)
+    a->block[i] = rand() % 1024 - 512;
+}
+
+static void
+gen_idct8(struct args *a) {
+  int i;
+
+  fill(a->pic, PIC_SIZE);
+  for (i = 0; i < 64; i++)
+    a->block[i] = rand() % 512 - 256;
+}
+
+static void
+gen_pred(struct args *a) {
+  fill(a->pic, PIC_SIZE);
+  a->mode = rand() % 4;
+  a->avail = a->mode == H264_PRED16_DC ? rand() % 4 : H264_AVAIL_TOP | H264_AVAIL_LEFT;
+}
+
+/* Each mode with the neighbours it reads, plus random others */
+static void
+gen_pred_nxn(struct args *a) {
+  static const int needs[] = {
+    [H264_PRED_V] = H264_AVAIL_TOP,
+    [H264_PRED_H] = H264_AVAIL_LEFT,
+    [H264_PRED_DC] = 0,
+    [H264_PRED_DDL] = H264_AVAIL_TOP,
+    [H264_PRED_DDR] = H264_AVAIL_TOP | H264_AVAIL_LEFT | H264_AVAIL_TOP_LEFT,
+    [H264_PRED_VR] = H264_AVAIL_TOP | H264_AVAIL_LEFT | H264_AVAIL_TOP_LEFT,
+    [H264_PRED_HD] = H264_AVAIL_TOP | H264_AVAIL_LEFT | H264_AVAIL_TOP_LEFT,
+    [H264_PRED_VL] = H264_AVAIL_TOP,
+    [H264_PRED_HU] = H264_AVAIL_LEFT,
+  };
+
+  fill(a->pic, PIC_SIZE);
+  a->mode = rand() % 9;
+  a->avail = needs[a->mode] | (rand() % 16);
+  /* Top left, and a top right with no top, can't happen */
+  if ((a->avail & H264_AVAIL_TOP_LEFT) &&
+      !(a->avail & (H264_AVAIL_TOP | H264_AVAIL_LEFT)))
+    a->avail &= ~H264_AVAIL_TOP_LEFT;
+  if (!(a->avail & H264_AVAIL_TOP))
+    a->avail &= ~H264_AVAIL_TOP_RIGHT;
+}
+
+static void
+gen_pred_chroma(struct args *a) {
+  fill(a->pic, PIC_SIZE);
+  a->mode = rand() % 4;
+  a->avail = a->mode == H264_PREDC_DC ? rand() % 4 : H264_AVAIL_TOP | H264_AVAIL_LEFT;
+}
+
+static void
+gen_mc(struct args *a) {
+  static const int sizes[] = { 4, 8, 16 };
+
+  fill(a->pic, PIC_SIZE);
+  a->w = sizes[rand() % 3];
+  a->h = sizes[rand() % 3];
+  a->mx = rand() % 4;
+  a->my = rand() % 4;
+}
+
+static void
+gen_mc_chroma(struct args *a) {
+  static const int sizes[] = { 2, 4, 8 };
+
+  fill(a->pic, PIC_SIZE);
+  a->w = sizes[rand() % 3];
+  a->h = sizes[rand() % 3];
+  a->mx = rand() % 8;
+  a->my = rand() % 8;
+}
+
+static void
+gen_deblock(struct args *a) {
+  int i;
+
+  fill_smooth(a->pic, 1 + rand() % 24);
+  for (i = 0; i < 2; i++) {
+    a->alpha[i] = 4 + rand() % 252;
+    a->beta[i] = 2 + rand() % 17;
+  }
+  for (i = 0; i < 8; i++)
+    a->tc0[i] = rand() % 27 - 1;
+}
+
+static void
+run_idct4(const struct h264_recon_funcs *f, struct args *a, uint8_t *pic) {
+  int16_t block[16];
+
+  memcpy(block, a->block, sizeof(block));
+  f->idct4_add(pic + PIC_ORIGIN, PIC_STRIDE, block);
+  assert(!block[0] && !block[15]);
+}
+
+static void
+run_idct8(const struct h264_recon_funcs *f, struct args *a, uint8_t *pic) {
+  int16_t block[64];
+
+  memcpy(block, a->block, sizeof(block));
+  f->idct8_add(pic + PIC_ORIGIN, PIC_STRIDE, block);
+  assert(!block[0] && !block[63]);
+}
+
+static void
+run_pred4(const struct h264_recon_funcs *f, struct args *a, uint8_t *pic) {
+  f->pred4x4(pic + PIC_ORIGIN, PIC_STRIDE, a->mode, a->avail);
+}
+
+static void
+run_pred8(const struct h264_recon_funcs *f, struct args *a, uint8_t *pic) {
+  f->pred8x8l(pic + PIC_ORIGIN, PIC_STRIDE, a->mode, a->avail);
+}
+
+static void
+run_pred(const struct h264_recon_funcs *f, struct args *a, uint8_t *pic) {
+  f->pred16x16(pic + PIC_ORIGIN, PIC_STRIDE, a->mode, a->avail);
+}
+
+static void
+run_pred_chroma(const struct h264_recon_funcs *f, struct args *a, uint8_t *pic) {
+  f->pred_chroma(pic + PIC_ORIGIN, PIC_STRIDE, a->mode, a->avail);
+}
+
+static void
+run_mc(const struct h264_recon_funcs *f, struct args *a, uint8_t *pic) {
+  f->mc_luma(pic, PIC_STRIDE, a->pic + PIC_ORIGIN, PIC_STRIDE, a->w, a->h, a->mx, a->my);
+}
+
+static void
+run_mc_chroma(const struct h264_recon_funcs *f, struct args *a, uint8_t *pic) {
+  f->mc_chroma(pic, PIC_STRIDE, a->pic + PIC_ORIGIN, PIC_STRIDE, a->w, a->h, a->mx, a->my);
+}
+
+static void
+run_deblock_h(const struct h264_recon_funcs *f, struct args *a, uint8_t *pic) {
+  f->deblock_luma_h(pic + PIC_ORIGIN, PIC_STRIDE, a->alpha[0], a->beta[0], a->tc0);
+}
+
+static void
+run_deblock_v(const struct h264_recon_funcs *f, struct args *a, uint8_t *pic) {
+  f->deblock_luma_v(pic + PIC_ORIGIN, PIC_STRIDE, a->alpha[0], a->beta[0], a->tc0);
+}
+
+static void
+run_deblock_h_intra(const struct h264_recon_funcs *f, struct args *a, uint8_t *pic) {
+  f->deblock_luma_h_intra(pic + PIC_ORIGIN, PIC_STRIDE, a->alpha[0], a->beta[0]);
+}
+
+static void
+run_deblock_v_intra(const struct h264_recon_funcs *f, struct args *a, uint8_t *pic) {
+  f->deblock_luma_v_intra(pic + PIC_ORIGIN, PIC_STRIDE, a->alpha[0], a->beta[0]);
+}
+
+static void
+run_deblock_chroma_h(const struct h264_recon_funcs *f, struct args *a, uint8_t *pic) {
+  f->deblock_chroma_h(pic + PIC_ORIGIN, PIC_STRIDE, a->alpha, a->beta, a->tc0);
+}
+
+static void
+run_deblock_chroma_v(const struct h264_recon_funcs *f, struct args *a, uint8_t *pic) {
+  f->deblock_chroma_v(pic + PIC_ORIGIN, PIC_STRIDE, a->alpha, a->beta, a->tc0);
+}
+
+static void
+run_deblock_chroma_h_intra(const struct h264_recon_funcs *f, struct args *a, uint8_t *pic) {
+  f->deblock_chroma_h_intra(pic + PIC_ORIGIN, PIC_STRIDE, a->alpha, a->beta);
+}
+
+static void
+run_deblock_chroma_v_intra(const struct h264_recon_funcs *f, struct args *a, uint8_t *pic) {
+  f->deblock_chroma_v_intra(pic + PIC_ORIGIN, PIC_STRIDE, a->alpha, a->beta);
+}
+
+static const struct kernel kernels[] = {
+  { "idct4_add", gen_idct4, run_idct4, 1 },
+  { "idct8_add", gen_idct8, run_idct8, 1 },
+  { "pred4x4", gen_pred_nxn, run_pred4, 1 },
+  { "pred8x8l", gen_pred_nxn, run_pred8, 1 },
+  { "pred16x16", gen_pred, run_pred, 1 },
+  { "pred_chroma", gen_pred_chroma, run_pred_chroma, 1 },
+  { "mc_luma", gen_mc, run_mc, 0 },
+  { "mc_chroma", gen_mc_chroma, run_mc_chroma, 0 },
+  { "deblock_luma_h", gen_deblock, run_deblock_h, 1 },
+  { "deblock_luma_v", gen_deblock, run_deblock_v, 1 },
+  { "deblock_luma_h_intra", gen_deblock, run_deblock_h_intra, 1 },
+  { "deblock_luma_v_intra", gen_deblock, run_deblock_v_intra, 1 },
+  { "deblock_chroma_h", gen_deblock, run_deblock_chroma_h, 1 },
+  { "deblock_chroma_v", gen_deblock, run_deblock_chroma_v, 1 },
+  { "deblock_chroma_h_intra", gen_deblock, run_deblock_chroma_h_intra, 1 },
+  { "deblock_chroma_v_intra", gen_deblock, run_deblock_chroma_v_intra, 1 },
+};
+
+static uint64_t
+now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Cycles through the first TIME_SET inputs, so that they stay in cache.
+ * In-place kernels keep working on (and changing) their own input, which
+ * doesn't change the amount of work. */
+#define TIME_SET 256
+
+static double
+time_kernel(const struct kernel *k, const struct h264_recon_funcs *f,
+            struct args *a, int set, int count, uint8_t *out) {
+  uint64_t start;
+  int i;
+
+  start = now_ns();
+  for (i = 0; i < count; i++) {
+    struct args *ai = &a[i % set];
+    k->run(f, ai, k->in_place ? ai->pic : out);
+  }
+  return (double)(now_ns() - start) / count;
+}
+
+int main(int argc, char **argv) {
+  unsigned seed = 1, k;
+  int trials = 5000, iters = 20, opt, i, j;
+  struct args *a;
+  uint8_t *ref, *out;
+
+  while ((opt = getopt(argc, argv, "t:i:r:")) != -1) {
+    switch (opt) {
+    case 't':
+      trials = atoi(optarg);
+      break;
+    case 'i':
+      iters = atoi(optarg);
+      break;
+    case 'r':
+      seed = strtoul(optarg, NULL, 0);
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-t trials] [-i timing passes] [-r seed]\n", argv[0]);
+      return 1;
+    }
+  }
+  assert(trials > 0 && iters > 0);
+
+  a = malloc(trials * sizeof(*a));
+  ref = malloc(PIC_SIZE);
+  out = malloc(PIC_SIZE);
+  assert(a && ref && out);
+  srand(seed);
+
+  printf("%-24s %10s %10s %8s\n", "kernel", "C ns", "SIMD ns", "speedup");
+  for (k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+    const struct kernel *kn = &kernels[k];
+    double c = 0, simd = 0;
+
+    for (i = 0; i < trials; i++) {
+      kn->gen(&a[i]);
+      memcpy(ref, a[i].pic, PIC_SIZE);
+      memcpy(out, a[i].pic, PIC_SIZE);
+      kn->run(&h264_recon_c, &a[i], ref);
+      kn->run(&h264_recon_simd, &a[i], out);
+      if (memcmp(ref, out, PIC_SIZE)) {
+        for (j = 0; ref[j] == out[j]; j++)
+          ;
+        fprintf(stderr, "%s, trial %d: mismatch at %d,%d (w %d h %d mx %d my %d mode %d): "
+                "%d, expected %d\n", kn->name, i,
+                j % PIC_STRIDE - PIC_ORIGIN % PIC_STRIDE, j / PIC_STRIDE - PIC_ORIGIN / PIC_STRIDE,
+                a[i].w, a[i].h, a[i].mx, a[i].my, a[i].mode, out[j], ref[j]);
+        return 1;
+      }
+    }
+
+    for (i = 0; i < iters; i++) {
+      int set = trials < TIME_SET ? trials : TIME_SET;
+      c += time_kernel(kn, &h264_recon_c, a, set, trials, out);
+      simd += time_kernel(kn, &h264_recon_simd, a, set, trials, out);
+    }
+    printf("%-24s %10.1f %10.1f %7.2fx\n", kn->name, c / iters, simd / iters, c / simd);
+  }
+  printf("all kernels match over %d trials each\n", trials);
+
+  free(out);
+  free(ref);
+  free(a);
+  return 0;
+}
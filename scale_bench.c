@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2013 Ilia Mirkin <imirkin@alum.mit.edu>
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/* Checks the AVX2 paths of nv12_convert.c against the C ones on a
+ * synthetic NV12 picture, then times thumbnail generation per frame
+ * with one thread and with all of them. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nv12_convert.h"
+
+#undef NDEBUG
+#include <assert.h>
+
+static uint64_t
+now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Gradients with some noise and the full range of chroma, so that the
+ * conversion gets clamped both ways */
+static void
+make_picture(uint8_t *buf, int width, int height, int pitch) {
+  uint8_t *chroma = buf + pitch * height;
+  int x, y;
+
+  for (y = 0; y < height; y++)
+    for (x = 0; x < width; x++)
+      buf[y * pitch + x] = (x * 255 / width + y) % 256 ^ (rand() & 7);
+  for (y = 0; y < height / 2; y++)
+    for (x = 0; x < width / 2; x++) {
+      chroma[y * pitch + 2 * x] = x * 511 / width;
+      chroma[y * pitch + 2 * x + 1] = (y * 511 / height) ^ (rand() & 3);
+    }
+}
+
+static double
+time_run(struct nv12_scaler *s, const uint8_t *buf, int height, int pitch,
+         uint8_t *dst, int dst_pitch, int iters) {
+  uint64_t start = now_ns();
+  int i;
+
+  for (i = 0; i < iters; i++)
+    nv12_scaler_run(s, buf, buf + pitch * height, pitch, dst, dst_pitch);
+  return (now_ns() - start) / 1e6 / iters;
+}
+
+static int
+parse_size(const char *arg, int *w, int *h) {
+  return sscanf(arg, "%dx%d", w, h) == 2 && *w > 0 && *h > 0;
+}
+
+int main(int argc, char **argv) {
+  struct nv12_scaler_params p = {
+    .src_width = 1280, .src_height = 544,
+    .dst_width = 160, .dst_height = 68,
+    .filter = NV12_SCALE_AREA, .matrix = NV12_BT601,
+  };
+  const char *ppm = NULL;
+  int iters = 100, pitch, dst_pitch, filter, matrix, opt;
+  uint8_t *buf, *ref, *out;
+
+  while ((opt = getopt(argc, argv, "s:d:i:bmo:")) != -1) {
+    switch (opt) {
+    case 's':
+      assert(parse_size(optarg, &p.src_width, &p.src_height));
+      break;
+    case 'd':
+      assert(parse_size(optarg, &p.dst_width, &p.dst_height));
+      break;
+    case 'i':
+      iters = atoi(optarg);
+      break;
+    case 'b':
+      p.filter = NV12_SCALE_BILINEAR;
+      break;
+    case 'm':
+      p.matrix = NV12_BT709;
+      break;
+    case 'o':
+      ppm = optarg;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-s WxH source] [-d WxH thumbnail] [-i iterations] "
+              "[-b(ilinear)] [-m (BT.709)] [-o out.ppm]\n", argv[0]);
+      return 1;
+    }
+  }
+  assert(iters > 0);
+
+  pitch = (p.src_width + 63) & ~63;
+  dst_pitch = p.dst_width * 4;
+  buf = malloc(pitch * p.src_height * 3 / 2);
+  ref = malloc(dst_pitch * p.dst_height);
+  out = malloc(dst_pitch * p.dst_height);
+  assert(buf && ref && out);
+  make_picture(buf, p.src_width, p.src_height, pitch);
+
+  /* Every filter and matrix, not just the one being timed */
+  for (filter = 0; filter < 2; filter++) {
+    for (matrix = 0; matrix < 2; matrix++) {
+      struct nv12_scaler_params q = p;
+      struct nv12_scaler *c, *simd;
+
+      q.filter = filter;
+      q.matrix = matrix;
+      q.no_simd = 1;
+      c = nv12_scaler_new(&q);
+      q.no_simd = 0;
+      simd = nv12_scaler_new(&q);
+      nv12_scaler_run(c, buf, buf + pitch * p.src_height, pitch, ref, dst_pitch);
+      nv12_scaler_run(simd, buf, buf + pitch * p.src_height, pitch, out, dst_pitch);
+      if (memcmp(ref, out, dst_pitch * p.dst_height)) {
+        fprintf(stderr, "filter %d matrix %d: AVX2 and C outputs differ\n", filter, matrix);
+        return 1;
+      }
+      if (!nv12_scaler_simd(simd))
+        printf("no AVX2, only the C paths are checked\n");
+      nv12_scaler_free(c);
+      nv12_scaler_free(simd);
+    }
+  }
+
+  printf("%dx%d -> %dx%d, %s, %s\n", p.src_width, p.src_height,
+         p.dst_width, p.dst_height,
+         p.filter == NV12_SCALE_AREA ? "area" : "bilinear",
+         p.matrix == NV12_BT709 ? "BT.709" : "BT.601");
+  {
+    static const char *names[] = { "C, 1 thread", "AVX2, 1 thread", "C, all threads", "AVX2, all threads" };
+    int k;
+
+    for (k = 0; k < 4; k++) {
+      struct nv12_scaler_params q = p;
+      struct nv12_scaler *s;
+
+      q.no_simd = !(k & 1);
+      q.threads = k < 2 ? 1 : 0;
+      s = nv12_scaler_new(&q);
+      printf("  %-18s %8.3f ms/frame\n", names[k],
+             time_run(s, buf, p.src_height, pitch, out, dst_pitch, iters));
+      nv12_scaler_free(s);
+    }
+  }
+
+  if (ppm) {
+    FILE *f = fopen(ppm, "wb");
+    assert(f);
+    assert(!nv12_write_ppm(f, out, p.dst_width, p.dst_height, dst_pitch));
+    fclose(f);
+  }
+
+  free(out);
+  free(ref);
+  free(buf);
+  return 0;
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2013 Ilia Mirkin <imirkin@alum.mit.edu>
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+/* Bounded single-producer/single-consumer ring. The ring only hands out
+ * slot indices; the slots themselves live in an array of the same
+ * (power of two) size owned by the user. A slot belongs to the producer
+ * between produce_begin/produce_end and to the consumer between
+ * consume_begin/consume_end, so nothing is copied and nothing is locked.
+ *
+ * Each side only writes its own index and its own statistics. */
+
+struct spsc_ring {
+  _Atomic uint32_t head; /* next slot to fill, producer-owned */
+  char pad0[60];
+  _Atomic uint32_t tail; /* next slot to drain, consumer-owned */
+  char pad1[60];
+  _Atomic int closed;
+  uint32_t size;
+
+  /* producer side */
+  uint64_t produced;
+  uint64_t producer_stalls; /* times the ring was full */
+  /* consumer side */
+  uint64_t consumer_stalls; /* times the ring was empty */
+  uint64_t depth_sum;       /* ring depth seen at each consume */
+  uint32_t depth_max;
+};
+
+static inline void
+spsc_init(struct spsc_ring *r, uint32_t size) {
+  memset(r, 0, sizeof(*r));
+  /* Callers index their slot arrays with & (size - 1). */
+  r->size = size;
+}
+
+static inline void
+spsc_wait(unsigned *spins) {
+  if (++*spins < 64)
+    return;
+  if (*spins < 128) {
+    sched_yield();
+    return;
+  }
+  nanosleep(&(struct timespec){ .tv_nsec = 50000 }, NULL);
+}
+
+static inline uint32_t
+spsc_produce_begin(struct spsc_ring *r) {
+  uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  unsigned spins = 0;
+
+  if (head - atomic_load_explicit(&r->tail, memory_order_acquire) == r->size) {
+    r->producer_stalls++;
+    while (head - atomic_load_explicit(&r->tail, memory_order_acquire) == r->size)
+      spsc_wait(&spins);
+  }
+  return head & (r->size - 1);
+}
+
+static inline void
+spsc_produce_end(struct spsc_ring *r) {
+  uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  r->produced++;
+  atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+/* No more slots will be produced; the consumer drains what's left. */
+static inline void
+spsc_close(struct spsc_ring *r) {
+  atomic_store_explicit(&r->closed, 1, memory_order_release);
+}
+
+/* Returns 0 once the ring is closed and empty. */
+static inline int
+spsc_consume_begin(struct spsc_ring *r, uint32_t *slot) {
+  uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  uint32_t depth = atomic_load_explicit(&r->head, memory_order_acquire) - tail;
+  unsigned spins = 0;
+
+  if (!depth) {
+    r->consumer_stalls++;
+    while (!(depth = atomic_load_explicit(&r->head, memory_order_acquire) - tail)) {
+      if (atomic_load_explicit(&r->closed, memory_order_acquire)) {
+        /* Re-check, the last slot may have landed right before close. */
+        if (atomic_load_explicit(&r->head, memory_order_acquire) == tail)
+          return 0;
+        continue;
+      }
+      spsc_wait(&spins);
+    }
+  }
+
+  r->depth_sum += depth;
+  if (depth > r->depth_max)
+    r->depth_max = depth;
+  *slot = tail & (r->size - 1);
+  return 1;
+}
+
+static inline void
+spsc_consume_end(struct spsc_ring *r) {
+  uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+}
+
+#endif
@@ -0,0 +1,597 @@
+/*
+ * Copyright (C) 2013 Ilia Mirkin <imirkin@alum.mit.edu>
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/* Decode daemon: owns the decoder and takes jobs from local clients over
+ * VP2D_SOCKET, see vp2d.h for the protocol. */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#ifndef VP2D_STAND_IN_ONLY
+#include "decoder.h"
+#endif
+#include "h264_parse.h"
+#include "vp2d.h"
+
+#undef NDEBUG
+#include <assert.h>
+
+#define CLIENTS_MAX 64
+#define QUEUE_MAX 64
+/* Slice headers are parsed from a zero-padded copy of the NAL's start,
+ * so one that runs past the end of the job reads zeros instead of the
+ * rest of the client's buffer, or past it. The longest header, with
+ * ue() capped, is about 60 bytes. */
+#define SLICE_HEADER_MAX 128
+
+/* What the daemon needs from a decoder. Stream state (SPS, PPS, slice
+ * header) is kept per client by the daemon; the device only turns one
+ * slice into an NV12 picture at out. client is the serial of the
+ * client the slice is from. Returns a vp2d_status. report, if set,
+ * prints the device's statistics at exit. */
+struct vp2d_device {
+  int (*decode)(struct vp2d_device *dev, unsigned client,
+                const struct h264_sps *sps, const struct h264_pps *pps,
+                const struct h264_slice_header *sh, const struct h264_nal *nal,
+                uint8_t *out);
+  void (*report)(struct vp2d_device *dev);
+};
+
+#ifndef VP2D_STAND_IN_ONLY
+/* The card, through decoder.c. Jobs run one at a time, so the output
+ * ring has a single buffer and each picture is read back before decode
+ * returns, straight into the client's buffer.
+ *
+ * The decoder has one set of reference frames, so they belong to the
+ * client whose IDR went last: another client's non-IDR slices would be
+ * predicted from them, and get VP2D_REFS instead. */
+struct card_device {
+  struct vp2d_device base;
+  struct decoder *dec;
+  uint8_t *out; /* of the job being decoded */
+  unsigned owner;
+  int owned;
+};
+
+/* The decoder's output is pitch wide with the chroma plane at
+ * l->chroma; the protocol's has pitch == width, chroma after luma. */
+static void
+card_output(void *arg, unsigned frame, const uint8_t *pic,
+            const struct decoder_layout *l) {
+  struct card_device *card = arg;
+  uint32_t y;
+
+  for (y = 0; y < l->height; y++)
+    memcpy(card->out + y * l->width, pic + y * l->pitch, l->width);
+  for (y = 0; y < l->height / 2; y++)
+    memcpy(card->out + (l->height + y) * l->width, pic + l->chroma + y * l->pitch,
+           l->width);
+}
+
+static int
+card_decode(struct vp2d_device *dev, unsigned client,
+            const struct h264_sps *sps, const struct h264_pps *pps,
+            const struct h264_slice_header *sh, const struct h264_nal *nal,
+            uint8_t *out) {
+  struct card_device *card = (struct card_device *)dev;
+
+  /* The buffers were allocated for one layout at startup */
+  if (!decoder_fits(card->dec, sps))
+    return VP2D_DEVICE;
+  if (!decoder_bitstream_fits(card->dec, nal->size))
+    return VP2D_INVALID;
+  if (nal->type == 5) {
+    card->owner = client;
+    card->owned = 1;
+  } else if (!card->owned || card->owner != client) {
+    return VP2D_REFS;
+  }
+  card->out = out;
+  decoder_picture(card->dec, sps, pps, sh, nal, NULL);
+  decoder_finish(card->dec);
+  return VP2D_OK;
+}
+
+static void
+card_report(struct vp2d_device *dev) {
+  decoder_report(((struct card_device *)dev)->dec);
+}
+
+/* The VP writes every macroblock, so there's no clearing between
+ * pictures */
+static struct vp2d_device *
+card_device_new(const struct h264_sps *sps) {
+  struct card_device *card = calloc(1, sizeof(*card));
+  struct decoder_config cfg = {
+    .ring_depth = 1, .clear = CLEAR_NONE, .output = card_output,
+  };
+
+  assert(card);
+  cfg.output_arg = card;
+  card->dec = decoder_new(sps, &cfg);
+  card->base.decode = card_decode;
+  card->base.report = card_report;
+  return &card->base;
+}
+#endif
+
+/* Stand-in device (-n) for checking the daemon and its clients without a
+ * card: the picture is a pattern made from the slice header and the
+ * NAL's contents, so it's deterministic and changes with the input.
+ * -l adds a fixed decode time. */
+struct null_device {
+  struct vp2d_device base;
+  long latency_us;
+};
+
+static int
+null_decode(struct vp2d_device *dev, unsigned client,
+            const struct h264_sps *sps, const struct h264_pps *pps,
+            const struct h264_slice_header *sh, const struct h264_nal *nal,
+            uint8_t *out) {
+  struct null_device *null = (struct null_device *)dev;
+  uint32_t width = (sps->pic_width_in_mbs_minus1 + 1) * 16;
+  uint32_t height = (sps->pic_height_in_map_units_minus1 + 1) * 16 *
+    (2 - sps->frame_mbs_only_flag);
+  uint32_t sum = 0, x, y;
+
+  for (x = 0; x < nal->size; x++)
+    sum = sum * 31 + nal->data[x];
+  for (y = 0; y < height; y++)
+    for (x = 0; x < width; x++)
+      out[y * width + x] = x + y + sh->pic_order_cnt_lsb + sum;
+  memset(out + width * height, 0x80, width * height / 2);
+
+  if (null->latency_us)
+    nanosleep(&(struct timespec){ .tv_sec = null->latency_us / 1000000,
+                                  .tv_nsec = null->latency_us % 1000000 * 1000 },
+              NULL);
+  return VP2D_OK;
+}
+
+static struct vp2d_device *
+null_device_new(long latency_us) {
+  struct null_device *null = calloc(1, sizeof(*null));
+
+  assert(null);
+  null->base.decode = null_decode;
+  null->latency_us = latency_us;
+  return &null->base;
+}
+
+struct job {
+  uint32_t id, offset, size, out_offset;
+};
+
+struct client {
+  int fd;
+  unsigned serial; /* for the log */
+  const uint8_t *bitstream;
+  size_t bitstream_size;
+  uint8_t *output;
+  size_t output_size;
+
+  struct h264_sps sps;
+  struct h264_pps pps;
+  struct h264_slice_params slice_params;
+  h264_slice_header_fn parse_slice_header;
+
+  struct job queue[QUEUE_MAX];
+  unsigned head, count;
+
+  unsigned long jobs, busy;
+  uint64_t decode_ns;
+};
+
+/* Until a client sends its own. -g and -L change the picture size and
+ * level, and so what the card's buffers are allocated for. */
+static struct h264_sps default_sps = {
+  .profile_idc = 77,
+  .level_idc = 40,
+  .chroma_format_idc = 1,
+  .log2_max_frame_num_minus4 = 5,
+  .log2_max_pic_order_cnt_lsb_minus4 = 6,
+  .num_ref_frames = 6,
+  .pic_width_in_mbs_minus1 = 1280 / 16 - 1,
+  .pic_height_in_map_units_minus1 = 544 / 16 - 1,
+  .frame_mbs_only_flag = 1,
+  .direct_8x8_inference_flag = 1,
+};
+
+static const struct h264_pps default_pps = {
+  .entropy_coding_mode_flag = 1,
+  .deblocking_filter_control_present_flag = 1,
+};
+
+static struct client *clients[CLIENTS_MAX];
+static unsigned client_count, client_serial;
+static unsigned queue_limit = 4, client_limit = 16;
+static struct vp2d_device *device;
+static volatile sig_atomic_t quit;
+
+static uint64_t
+now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+slice_parser_select(struct client *c) {
+  h264_slice_params_init(&c->slice_params, &c->sps, &c->pps);
+  c->parse_slice_header = h264_slice_header_parser(&c->slice_params);
+}
+
+static void
+unmap_buffers(struct client *c) {
+  if (c->bitstream)
+    munmap((void *)c->bitstream, c->bitstream_size);
+  if (c->output)
+    munmap(c->output, c->output_size);
+  c->bitstream = c->output = NULL;
+}
+
+static void
+client_drop(unsigned i) {
+  struct client *c = clients[i];
+
+  fprintf(stderr, "client %u: gone, %lu jobs, %lu busy, %.3f ms decoding\n",
+          c->serial, c->jobs, c->busy, c->decode_ns / 1e6);
+  unmap_buffers(c);
+  close(c->fd);
+  free(c);
+  clients[i] = clients[--client_count];
+}
+
+/* Replies never block: a client that doesn't read them gets dropped
+ * instead of stalling everyone else. Returns -1 in that case. */
+static int
+reply(struct client *c, const struct vp2d_msg *msg) {
+  return send(c->fd, msg, sizeof(*msg), MSG_DONTWAIT | MSG_NOSIGNAL) ==
+    sizeof(*msg) ? 0 : -1;
+}
+
+static void *
+map_sealed(int fd, size_t *size, int prot) {
+  struct stat st;
+  void *map;
+  int seals;
+
+  if (fd < 0 || fstat(fd, &st) || st.st_size <= 0)
+    return NULL;
+  /* -1 for anything that isn't a memfd, which has every bit set */
+  seals = fcntl(fd, F_GET_SEALS);
+  if (seals < 0 || !(seals & F_SEAL_SHRINK))
+    return NULL;
+  map = mmap(NULL, st.st_size, prot, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+    return NULL;
+  *size = st.st_size;
+  return map;
+}
+
+static int
+attach(struct client *c, struct msghdr *mh) {
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(mh);
+  int fds[2] = { -1, -1 }, status = VP2D_INVALID;
+
+  if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+      cmsg->cmsg_len == CMSG_LEN(sizeof(fds)))
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+  if (c->count) {
+    status = VP2D_NO_BUFFER;
+  } else if (fds[0] >= 0 && fds[1] >= 0) {
+    unmap_buffers(c);
+    c->bitstream = map_sealed(fds[0], &c->bitstream_size, PROT_READ);
+    c->output = map_sealed(fds[1], &c->output_size, PROT_READ | PROT_WRITE);
+    if (c->bitstream && c->output)
+      status = VP2D_OK;
+    else
+      unmap_buffers(c);
+  }
+  if (fds[0] >= 0)
+    close(fds[0]);
+  if (fds[1] >= 0)
+    close(fds[1]);
+  return status;
+}
+
+/* Handles one message. Returns 1 when there are none left, -1 when the
+ * client has to go. */
+static int
+client_read(struct client *c) {
+  struct vp2d_msg msg, ack = { .type = VP2D_DONE };
+  union {
+    char buf[CMSG_SPACE(2 * sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct iovec iov = { &msg, sizeof(msg) };
+  struct msghdr mh = {
+    .msg_iov = &iov, .msg_iovlen = 1,
+    .msg_control = control.buf, .msg_controllen = sizeof(control.buf),
+  };
+  ssize_t n = recvmsg(c->fd, &mh, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+
+  if (n < 0 && (errno == EAGAIN || errno == EINTR))
+    return 1;
+  if (n != sizeof(msg) || (mh.msg_flags & (MSG_TRUNC | MSG_CTRUNC)))
+    return -1;
+
+  switch (msg.type) {
+  case VP2D_ATTACH:
+    ack.type = VP2D_ATTACH;
+    ack.status = attach(c, &mh);
+    return reply(c, &ack);
+  case VP2D_DECODE:
+    ack.id = msg.id;
+    ack.out_offset = msg.out_offset;
+    if (!c->bitstream) {
+      ack.status = VP2D_NO_BUFFER;
+    } else if (msg.size == 0 || msg.offset > c->bitstream_size ||
+               msg.size > c->bitstream_size - msg.offset) {
+      ack.status = VP2D_INVALID;
+    } else if (c->count >= queue_limit) {
+      /* Admission control: the job is turned away instead of queued */
+      ack.status = VP2D_BUSY;
+      c->busy++;
+    } else {
+      c->queue[(c->head + c->count++) % QUEUE_MAX] = (struct job){
+        msg.id, msg.offset, msg.size, msg.out_offset,
+      };
+      return 0;
+    }
+    return reply(c, &ack);
+  default:
+    return -1;
+  }
+}
+
+static int
+run_job(struct client *c) {
+  struct job *job = &c->queue[c->head];
+  struct vp2d_msg done = {
+    .type = VP2D_DONE, .id = job->id, .out_offset = job->out_offset,
+  };
+  struct h264_nal nal = {
+    .data = c->bitstream + job->offset,
+    .size = job->size,
+  };
+  struct h264_nal head_nal;
+  uint8_t head[SLICE_HEADER_MAX] = {0};
+  struct h264_slice_header sh;
+  uint64_t start;
+
+  c->head = (c->head + 1) % QUEUE_MAX;
+  c->count--;
+  c->jobs++;
+  nal.type = nal.data[0] & 0x1f;
+  nal.ref_idc = (nal.data[0] >> 5) & 3;
+
+  if (nal.type == 7 || nal.type == 8) {
+    struct h264_sps sps = c->sps;
+    struct h264_pps pps = c->pps;
+
+    if (nal.type == 7 ? h264_parse_sps(&nal, &sps) : h264_parse_pps(&nal, &pps)) {
+      done.status = VP2D_INVALID;
+    } else {
+      c->sps = sps;
+      c->pps = pps;
+      slice_parser_select(c);
+    }
+    return reply(c, &done);
+  }
+
+  done.width = (c->sps.pic_width_in_mbs_minus1 + 1) * 16;
+  done.height = (c->sps.pic_height_in_map_units_minus1 + 1) * 16 *
+    (2 - c->sps.frame_mbs_only_flag);
+  if (!h264_nal_is_slice(nal.type) || nal.size < 4 ||
+      job->out_offset > c->output_size ||
+      (uint64_t)done.width * done.height * 3 / 2 > c->output_size - job->out_offset) {
+    done.status = VP2D_INVALID;
+    return reply(c, &done);
+  }
+
+  head_nal = nal;
+  head_nal.data = head;
+  memcpy(head, nal.data, nal.size < sizeof(head) ? nal.size : sizeof(head));
+  c->parse_slice_header(&head_nal, &c->slice_params, &sh);
+  if (sh.header_bits > (uint64_t)nal.size * 8) {
+    done.status = VP2D_INVALID;
+    return reply(c, &done);
+  }
+
+  start = now_ns();
+  done.status = device->decode(device, c->serial, &c->sps, &c->pps, &sh, &nal,
+                               c->output + job->out_offset);
+  done.decode_ns = now_ns() - start;
+  c->decode_ns += done.decode_ns;
+  return reply(c, &done);
+}
+
+static void
+accept_client(int listen_fd) {
+  struct vp2d_msg hello = {
+    .type = VP2D_HELLO, .version = VP2D_VERSION, .queue = queue_limit,
+  };
+  struct client *c;
+  int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+
+  if (fd < 0)
+    return;
+  if (client_count == client_limit) {
+    hello.status = VP2D_TOO_MANY;
+    send(fd, &hello, sizeof(hello), MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(fd);
+    return;
+  }
+
+  assert((c = calloc(1, sizeof(*c))));
+  c->fd = fd;
+  c->serial = client_serial++;
+  c->sps = default_sps;
+  c->pps = default_pps;
+  slice_parser_select(c);
+  clients[client_count++] = c;
+  if (reply(c, &hello))
+    client_drop(client_count - 1);
+}
+
+static void
+on_signal(int sig) {
+  quit = 1;
+}
+
+int main(int argc, char **argv) {
+  const char *path = VP2D_SOCKET;
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  struct pollfd pfd[CLIENTS_MAX + 1];
+  long latency_us = 0;
+  unsigned i, next = 0, width, height;
+  int listen_fd, opt, ret, stand_in = 0;
+
+  while ((opt = getopt(argc, argv, "s:c:q:nl:g:L:")) != -1) {
+    switch (opt) {
+    case 's':
+      path = optarg;
+      break;
+    case 'c':
+      client_limit = atoi(optarg);
+      assert(client_limit >= 1 && client_limit <= CLIENTS_MAX);
+      break;
+    case 'q':
+      queue_limit = atoi(optarg);
+      assert(queue_limit >= 1 && queue_limit <= QUEUE_MAX);
+      break;
+    case 'n':
+      stand_in = 1;
+      break;
+    case 'l':
+      latency_us = atol(optarg);
+      break;
+    case 'g':
+      assert(sscanf(optarg, "%ux%u", &width, &height) == 2);
+      assert(width >= 16 && width <= 2048 && width % 16 == 0);
+      assert(height >= 16 && height <= 2048 && height % 16 == 0);
+      default_sps.pic_width_in_mbs_minus1 = width / 16 - 1;
+      default_sps.pic_height_in_map_units_minus1 = height / 16 - 1;
+      break;
+    case 'L':
+      default_sps.level_idc = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-s socket] [-c clients] [-q queue per client] [-g WIDTHxHEIGHT] [-L level_idc] [-n [-l stand-in latency us]]\n", argv[0]);
+      return 1;
+    }
+  }
+
+#ifdef VP2D_STAND_IN_ONLY
+  if (!stand_in) {
+    fprintf(stderr, "Built without the card, only -n works\n");
+    return 1;
+  }
+#endif
+  if (stand_in)
+    device = null_device_new(latency_us);
+#ifndef VP2D_STAND_IN_ONLY
+  else
+    device = card_device_new(&default_sps);
+#endif
+
+  assert(strlen(path) < sizeof(addr.sun_path));
+  strcpy(addr.sun_path, path);
+  unlink(path);
+  listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  assert(listen_fd >= 0);
+  assert(!bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)));
+  assert(!listen(listen_fd, 16));
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  fprintf(stderr, "Listening on %s, %u clients, %u queued jobs each\n",
+          path, client_limit, queue_limit);
+
+  while (!quit) {
+    int pending = 0;
+
+    pfd[0] = (struct pollfd){ .fd = listen_fd, .events = POLLIN };
+    for (i = 0; i < client_count; i++) {
+      pfd[i + 1] = (struct pollfd){ .fd = clients[i]->fd, .events = POLLIN };
+      pending |= clients[i]->count != 0;
+    }
+    /* Jobs waiting: just look for new messages, don't sleep */
+    if (poll(pfd, client_count + 1, pending ? 0 : -1) < 0)
+      continue;
+
+    /* Backwards, since dropping a client moves the last one into its
+     * place */
+    for (i = client_count; i-- > 0; ) {
+      if (pfd[i + 1].revents & (POLLERR | POLLHUP | POLLNVAL) &&
+          !(pfd[i + 1].revents & POLLIN)) {
+        client_drop(i);
+      } else if (pfd[i + 1].revents & POLLIN) {
+        /* All of it, so that the queue limit applies to what the
+         * client has sent rather than to the socket buffer */
+        while (!(ret = client_read(clients[i])))
+          ;
+        if (ret < 0)
+          client_drop(i);
+      }
+    }
+    if (pfd[0].revents & POLLIN)
+      accept_client(listen_fd);
+
+    /* One job per round, taking turns between clients with work */
+    for (i = 0; i < client_count; i++) {
+      unsigned k = (next + i) % client_count;
+
+      if (clients[k]->count) {
+        if (run_job(clients[k]))
+          client_drop(k);
+        next = k + 1;
+        break;
+      }
+    }
+  }
+
+  while (client_count)
+    client_drop(client_count - 1);
+  if (device->report)
+    device->report(device);
+  unlink(path);
+  return 0;
+}
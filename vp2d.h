@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2013 Ilia Mirkin <imirkin@alum.mit.edu>
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef VP2D_H
+#define VP2D_H
+
+#include <stdint.h>
+
+/* The vp2d protocol. Clients talk to the daemon over a SOCK_SEQPACKET
+ * Unix socket, one struct vp2d_msg per packet. Bitstreams and decoded
+ * pictures don't go through the socket: the client hands the daemon two
+ * memfds with VP2D_ATTACH, writes NALs into the first one and gets
+ * pictures back in the second. Both have to be sealed against
+ * shrinking, so that the daemon can't be made to fault on them.
+ *
+ * Each DECODE names one NAL (header byte first, still escaped, as in
+ * decode_frame's input files) and where its picture goes, and gets one
+ * DONE back with the same id. Queued jobs complete in order; a job
+ * turned away (BUSY, INVALID) is answered right away. SPS and PPS NALs set the
+ * parameters for the client's later slices and produce no picture.
+ * Pictures are NV12 with pitch == width, chroma right after luma. A
+ * region of either buffer belongs to the daemon from DECODE until its
+ * DONE. */
+
+#define VP2D_SOCKET "/tmp/vp2d.sock"
+#define VP2D_VERSION 2
+
+enum vp2d_msg_type {
+  VP2D_HELLO = 1, /* daemon: status, version, queue */
+  VP2D_ATTACH,    /* client: SCM_RIGHTS bitstream and output memfds */
+  VP2D_DECODE,    /* client: id, offset, size, out_offset */
+  VP2D_DONE,      /* daemon: id, status, out_offset, width, height, decode_ns */
+};
+
+enum vp2d_status {
+  VP2D_OK = 0,
+  VP2D_BUSY,      /* the client already has queue jobs waiting, try again later */
+  VP2D_INVALID,   /* bad message, range or NAL */
+  VP2D_NO_BUFFER, /* DECODE before ATTACH, or ATTACH with jobs queued */
+  VP2D_TOO_MANY,  /* HELLO: the daemon is at its client limit */
+  VP2D_DEVICE,    /* the decode itself failed */
+  VP2D_REFS,      /* non-IDR slice, but another client's IDR has been decoded
+                   * since this client's: resend from an IDR */
+};
+
+struct vp2d_msg {
+  uint32_t type;
+  uint32_t status;
+  uint32_t id;
+  uint32_t version;
+  uint32_t queue;      /* HELLO: jobs a client may have waiting */
+  uint32_t offset;     /* of the NAL in the bitstream buffer */
+  uint32_t size;
+  uint32_t out_offset; /* of the picture in the output buffer */
+  uint32_t width, height;
+  uint64_t decode_ns;
+};
+
+#endif
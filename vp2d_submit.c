@@ -0,0 +1,276 @@
+/*
+ * Copyright (C) 2013 Ilia Mirkin <imirkin@alum.mit.edu>
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/* Sends NAL files to vp2d and collects the pictures, keeping up to -d
+ * jobs in flight. */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "h264_parse.h"
+#include "vp2d.h"
+
+#undef NDEBUG
+#include <assert.h>
+
+#define DEPTH_MAX 16
+
+struct input {
+  uint32_t offset, size;
+  int type;
+};
+
+static uint64_t
+now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int
+sealed_memfd(const char *name, size_t size) {
+  int fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+  assert(fd >= 0);
+  assert(!ftruncate(fd, size));
+  assert(!fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW));
+  return fd;
+}
+
+static void
+send_msg(int sock, const struct vp2d_msg *msg) {
+  assert(send(sock, msg, sizeof(*msg), MSG_NOSIGNAL) == sizeof(*msg));
+}
+
+static void
+recv_msg(int sock, struct vp2d_msg *msg) {
+  assert(recv(sock, msg, sizeof(*msg), 0) == sizeof(*msg));
+}
+
+static void
+attach(int sock, int bitstream_fd, int output_fd) {
+  struct vp2d_msg msg = { .type = VP2D_ATTACH };
+  union {
+    char buf[CMSG_SPACE(2 * sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct iovec iov = { &msg, sizeof(msg) };
+  struct msghdr mh = {
+    .msg_iov = &iov, .msg_iovlen = 1,
+    .msg_control = control.buf, .msg_controllen = sizeof(control.buf),
+  };
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+  int fds[2] = { bitstream_fd, output_fd };
+
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+  assert(sendmsg(sock, &mh, MSG_NOSIGNAL) == sizeof(msg));
+
+  recv_msg(sock, &msg);
+  assert(msg.type == VP2D_ATTACH && msg.status == VP2D_OK);
+}
+
+/* I420, like decode_frame */
+static void
+write_picture(int fd, const uint8_t *nv12, uint32_t width, uint32_t height) {
+  const uint8_t *uv = nv12 + width * height;
+  uint8_t *plane = malloc(width * height / 4);
+  uint32_t i, c;
+
+  assert(plane);
+  assert(write(fd, nv12, width * height) == width * height);
+  for (c = 0; c < 2; c++) {
+    for (i = 0; i < width * height / 4; i++)
+      plane[i] = uv[2 * i + c];
+    assert(write(fd, plane, width * height / 4) == width * height / 4);
+  }
+  free(plane);
+}
+
+int main(int argc, char **argv) {
+  const char *path = VP2D_SOCKET, *out_path = NULL;
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  struct vp2d_msg msg;
+  struct input *inputs;
+  uint64_t submitted_at[DEPTH_MAX], start, latency_sum = 0, latency_max = 0;
+  uint32_t frame_max = 0;
+  size_t bitstream_size = 0;
+  uint8_t *bitstream, *output;
+  unsigned depth = 4, repeat = 1, count, sent = 0, done = 0, pictures = 0;
+  unsigned long busy = 0;
+  int backoff = 0;
+  int sock, bitstream_fd, output_fd, out_fd = -1, opt, i;
+
+  while ((opt = getopt(argc, argv, "s:o:d:r:")) != -1) {
+    switch (opt) {
+    case 's':
+      path = optarg;
+      break;
+    case 'o':
+      out_path = optarg;
+      break;
+    case 'd':
+      depth = atoi(optarg);
+      assert(depth >= 1 && depth <= DEPTH_MAX);
+      break;
+    case 'r':
+      repeat = atoi(optarg);
+      assert(repeat >= 1);
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-s socket] [-o out.yuv] [-d jobs in flight] [-r repeat] [nal files...]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (optind == argc) {
+    static char *frame_nal[] = { "frame_nal" };
+    argv = frame_nal;
+    argc = 1;
+    optind = 0;
+  }
+  count = argc - optind;
+  inputs = calloc(count, sizeof(*inputs));
+  assert(inputs);
+
+  /* Every file goes into the bitstream buffer once; the output buffer
+   * has a picture slot per job in flight, sized for the largest SPS. */
+  for (i = 0; i < (int)count; i++) {
+    struct stat st;
+    assert(!stat(argv[optind + i], &st) && st.st_size > 0);
+    inputs[i].offset = bitstream_size;
+    inputs[i].size = st.st_size;
+    bitstream_size += (st.st_size + 63) & ~63;
+  }
+  bitstream_fd = sealed_memfd("vp2d-bitstream", bitstream_size);
+  bitstream = mmap(NULL, bitstream_size, PROT_READ | PROT_WRITE, MAP_SHARED, bitstream_fd, 0);
+  assert(bitstream != MAP_FAILED);
+  for (i = 0; i < (int)count; i++) {
+    int fd = open(argv[optind + i], O_RDONLY);
+    struct h264_nal nal;
+    struct h264_sps sps;
+
+    assert(fd >= 0);
+    assert(read(fd, bitstream + inputs[i].offset, inputs[i].size) == inputs[i].size);
+    close(fd);
+    inputs[i].type = bitstream[inputs[i].offset] & 0x1f;
+    nal = (struct h264_nal){ .data = bitstream + inputs[i].offset, .size = inputs[i].size,
+                             .type = inputs[i].type };
+    if (nal.type == 7 && !h264_parse_sps(&nal, &sps)) {
+      uint32_t size = (sps.pic_width_in_mbs_minus1 + 1) * 16 *
+        (sps.pic_height_in_map_units_minus1 + 1) * 16 * (2 - sps.frame_mbs_only_flag) * 3 / 2;
+      if (size > frame_max)
+        frame_max = size;
+    }
+  }
+  /* The daemon's default stream */
+  if (!frame_max)
+    frame_max = 1280 * 544 * 3 / 2;
+  output_fd = sealed_memfd("vp2d-output", (size_t)frame_max * depth);
+  output = mmap(NULL, (size_t)frame_max * depth, PROT_READ, MAP_SHARED, output_fd, 0);
+  assert(output != MAP_FAILED);
+
+  if (out_path) {
+    out_fd = strcmp(out_path, "-") ? open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : 1;
+    assert(out_fd >= 0);
+  }
+
+  assert(strlen(path) < sizeof(addr.sun_path));
+  strcpy(addr.sun_path, path);
+  sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  assert(sock >= 0);
+  if (connect(sock, (struct sockaddr *)&addr, sizeof(addr))) {
+    perror(path);
+    return 1;
+  }
+  recv_msg(sock, &msg);
+  assert(msg.type == VP2D_HELLO);
+  if (msg.status != VP2D_OK || msg.version != VP2D_VERSION) {
+    fprintf(stderr, "vp2d refused: status %u, version %u\n", msg.status, msg.version);
+    return 1;
+  }
+  if (depth > msg.queue)
+    fprintf(stderr, "Daemon queues %u jobs per client, expect BUSY replies\n", msg.queue);
+  attach(sock, bitstream_fd, output_fd);
+
+  /* Job n always uses picture slot n % depth, and DONEs for queued jobs
+   * come back in order, so a slot is free again once its DONE is in.
+   * After a BUSY, that job and the ones after it are sent again once
+   * something else has completed. */
+  start = now_ns();
+  while (done < count * repeat) {
+    while (!backoff && sent < count * repeat && sent - done < depth) {
+      struct input *in = &inputs[sent % count];
+      msg = (struct vp2d_msg){
+        .type = VP2D_DECODE, .id = sent,
+        .offset = in->offset, .size = in->size,
+        .out_offset = sent % depth * frame_max,
+      };
+      submitted_at[sent % depth] = now_ns();
+      send_msg(sock, &msg);
+      sent++;
+    }
+
+    recv_msg(sock, &msg);
+    assert(msg.type == VP2D_DONE);
+    if (msg.status == VP2D_BUSY) {
+      busy++;
+      if (msg.id < sent)
+        sent = msg.id;
+      backoff = 1;
+      continue;
+    }
+    backoff = 0;
+    if (msg.id != done)
+      continue; /* BUSY'd jobs after the one we rewound to */
+    assert(msg.status == VP2D_OK);
+
+    uint64_t latency = now_ns() - submitted_at[done % depth];
+    latency_sum += latency;
+    if (latency > latency_max)
+      latency_max = latency;
+    if (msg.width) {
+      if (out_fd >= 0)
+        write_picture(out_fd, output + msg.out_offset, msg.width, msg.height);
+      pictures++;
+    }
+    done++;
+  }
+
+  double secs = (now_ns() - start) / 1e9;
+  fprintf(stderr, "%u jobs, %u pictures in %.3f s (%.1f/s), latency avg %.3f ms max %.3f ms, %lu busy\n",
+          done, pictures, secs, done / secs, latency_sum / 1e6 / done, latency_max / 1e6, busy);
+  return 0;
+}